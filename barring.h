@@ -0,0 +1,108 @@
+#ifndef BARRING_H
+#define BARRING_H
+
+#include <QVector>
+#include <QtGlobal>
+
+#include <algorithm>
+
+// Fixed capacity column of bar values. Appending to a full ring drops the
+// oldest value, dropping from either end is O(1). Every value is kept
+// twice, at its slot and capacity slots after it, so the live values are
+// always one contiguous span starting at constData() whatever the head.
+template <typename T>
+class BarRing
+{
+public:
+    explicit BarRing(int capacity)
+        : m_capacity(qMax(1, capacity))
+        , m_data(new T[2 * m_capacity])
+        , m_head(0)
+        , m_size(0)
+    {
+    }
+
+    ~BarRing() { delete [] m_data; }
+
+    int  capacity() const { return m_capacity; }
+    int  size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    void clear() { m_head = m_size = 0; }
+
+    // the m_size values, oldest first
+    const T* constData() const { return m_data + m_head; }
+
+    const T& at(int i) const { Q_ASSERT(i >= 0 && i < m_size); return m_data[m_head + i]; }
+    const T& operator[](int i) const { return at(i); }
+    const T& first() const { return at(0); }
+    const T& last() const { return at(m_size - 1); }
+
+    void replace(int i, const T & value)
+    {
+        Q_ASSERT(i >= 0 && i < m_size);
+        const int slot = (m_head + i) % m_capacity;
+        m_data[slot] = m_data[slot + m_capacity] = value;
+    }
+
+    void append(const T & value)
+    {
+        if (m_size == m_capacity)
+            removeFirst();
+        const int slot = (m_head + m_size) % m_capacity;
+        m_data[slot] = m_data[slot + m_capacity] = value;
+        ++m_size;
+    }
+
+    void append(const T* values, int n)
+    {
+        // only the last capacity of them can stay
+        if (n > m_capacity) {
+            values += n - m_capacity;
+            n = m_capacity;
+        }
+        for (int i = 0; i < n; ++i)
+            append(values[i]);
+    }
+
+    void removeFirst(int n = 1)
+    {
+        n = qMin(n, m_size);
+        m_head = (m_head + n) % m_capacity;
+        m_size -= n;
+    }
+
+    void removeLast(int n = 1) { m_size -= qMin(n, m_size); }
+
+    T takeLast()
+    {
+        const T value = last();
+        removeLast();
+        return value;
+    }
+
+    QVector<T> mid(int pos, int length = -1) const
+    {
+        pos = qBound(0, pos, m_size);
+        if (length < 0 || pos + length > m_size)
+            length = m_size - pos;
+        QVector<T> v(length);
+        std::copy(constData() + pos, constData() + pos + length, v.begin());
+        return v;
+    }
+
+    // a copy, constData() reads the values in place
+    QVector<T> toVector() const { return mid(0); }
+
+    BarRing & operator+=(const T & value) { append(value); return *this; }
+    BarRing & operator+=(const QVector<T> & values) { append(values.constData(), values.size()); return *this; }
+
+private:
+    Q_DISABLE_COPY(BarRing)
+
+    int m_capacity;
+    T*  m_data;
+    int m_head;     // slot of the oldest value, < m_capacity
+    int m_size;
+};
+
+#endif // BARRING_H
@@ -0,0 +1,207 @@
+#include "barstore.h"
+
+#include <QHash>
+
+#include <cstring>
+
+static const char    STORE_MAGIC[4] = { 'N', 'K', 'B', 'S' };
+static const quint32 STORE_VERSION = 1;
+static const int     INITIAL_CAPACITY = 4096;
+
+static const int COLUMN_WIDTH[] = {
+    sizeof(double), sizeof(double), sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+    sizeof(quint32), sizeof(quint32), sizeof(quint8)
+};
+
+struct BarStore::Header
+{
+    char    magic[4];
+    quint32 version;
+    quint32 barSecs;
+    qint32  capacity;
+    qint32  count;
+    quint32 reserved[3];
+};
+
+// stores acquired in this process, by path
+static QHash<QString, BarStore*> & openStores()
+{
+    static QHash<QString, BarStore*> stores;
+    return stores;
+}
+
+BarStore::BarStore()
+    : m_map(NULL)
+    , m_refs(0)
+{
+}
+
+BarStore::~BarStore()
+{
+    close();
+}
+
+BarStore *BarStore::acquire(const QString &path, uint barSecs)
+{
+    BarStore* store = openStores().value(path);
+    if (store) {
+        if (store->barSecs() != barSecs)
+            return NULL;
+    }
+    else {
+        store = new BarStore;
+        if (!store->open(path, barSecs)) {
+            delete store;
+            return NULL;
+        }
+        openStores().insert(path, store);
+    }
+    ++store->m_refs;
+    return store;
+}
+
+void BarStore::release(BarStore *store)
+{
+    if (!store || --store->m_refs > 0)
+        return;
+    openStores().remove(store->m_file.fileName());
+    delete store;
+}
+
+qint64 BarStore::columnOffset(Column c, int capacity)
+{
+    qint64 offset = sizeof(Header);
+    for (int i = 0; i < c; ++i)
+        offset += (qint64)COLUMN_WIDTH[i] * capacity;
+    return offset;
+}
+
+qint64 BarStore::fileSize(int capacity)
+{
+    return columnOffset(NUM_COLUMNS, capacity);
+}
+
+uchar *BarStore::column(Column c) const
+{
+    return m_map ? m_map + columnOffset(c, header()->capacity) : NULL;
+}
+
+int BarStore::size() const
+{
+    return m_map ? header()->count : 0;
+}
+
+uint BarStore::barSecs() const
+{
+    return m_map ? header()->barSecs : 0;
+}
+
+double BarStore::lastTimeStamp() const
+{
+    const int n = size();
+    return n ? timeStamps()[n - 1] : 0;
+}
+
+bool BarStore::open(const QString &path, uint barSecs)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    if (m_file.size() == 0) {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, STORE_MAGIC, 4);
+        h.version = STORE_VERSION;
+        h.barSecs = barSecs;
+        h.capacity = INITIAL_CAPACITY;
+        if (!m_file.resize(fileSize(INITIAL_CAPACITY))
+                || m_file.write((const char*)&h, sizeof(h)) != sizeof(h)
+                || !m_file.flush()) {
+            m_file.close();
+            return false;
+        }
+    }
+
+    if (!map()) {
+        m_file.close();
+        return false;
+    }
+
+    const Header* h = header();
+    if (memcmp(h->magic, STORE_MAGIC, 4) || h->version != STORE_VERSION || h->barSecs != barSecs
+            || h->capacity <= 0 || h->count < 0 || h->count > h->capacity
+            || m_file.size() < fileSize(h->capacity)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void BarStore::close()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = NULL;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+bool BarStore::map()
+{
+    if (m_file.size() < (qint64)sizeof(Header))
+        return false;
+    m_map = m_file.map(0, m_file.size());
+    return m_map != NULL;
+}
+
+bool BarStore::grow()
+{
+    const int count = header()->count;
+    const int oldCapacity = header()->capacity;
+    const int newCapacity = oldCapacity * 2;
+
+    m_file.unmap(m_map);
+    m_map = NULL;
+    if (!m_file.resize(fileSize(newCapacity)) || !map())
+        return false;
+
+    // every column moves up, the last one the most
+    for (int c = NUM_COLUMNS - 1; c > 0; --c) {
+        memmove(m_map + columnOffset((Column)c, newCapacity),
+                m_map + columnOffset((Column)c, oldCapacity),
+                (size_t)count * COLUMN_WIDTH[c]);
+    }
+    header()->capacity = newCapacity;
+    return true;
+}
+
+bool BarStore::append(double timeStamp, double open, double high, double low, double close,
+                      uint volume, uint barCount, double wap, bool hasGaps)
+{
+    if (!m_map)
+        return false;
+
+    const int n = header()->count;
+    if (n && timeStamp <= timeStamps()[n - 1])
+        return false;
+    if (n == header()->capacity && !grow())
+        return false;
+
+    ((double*)column(TIMESTAMP))[n] = timeStamp;
+    ((double*)column(OPEN))[n] = open;
+    ((double*)column(HIGH))[n] = high;
+    ((double*)column(LOW))[n] = low;
+    ((double*)column(CLOSE))[n] = close;
+    ((double*)column(WAP))[n] = wap;
+    ((quint32*)column(VOLUME))[n] = volume;
+    ((quint32*)column(BARCOUNT))[n] = barCount;
+    ((quint8*)column(HASGAPS))[n] = hasGaps;
+
+    // readers only see the bar once it is complete
+    header()->count = n + 1;
+    return true;
+}
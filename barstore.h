@@ -0,0 +1,73 @@
+#ifndef BARSTORE_H
+#define BARSTORE_H
+
+#include <QFile>
+#include <QString>
+
+// Closed bars of one contract and time frame on disk, memory-mapped. The
+// file is a header and one region per column, each room for capacity bars,
+// so a column is read straight out of the mapping. Appending writes the
+// bar into the columns and then bumps the count in the header; when the
+// file is full it doubles and the columns are moved to their new offsets
+// back to front.
+//
+// A file is mapped once per process: users of the same path share one
+// store through acquire() and release(), so one of them growing it can't
+// pull the mapping out from under another.
+class BarStore
+{
+public:
+    BarStore();
+    ~BarStore();
+
+    // the store of path, opened on first use; NULL if it can't be used
+    static BarStore* acquire(const QString & path, uint barSecs);
+    // closes the store once its last user released it
+    static void release(BarStore* store);
+
+    // maps path, creating it for bars of barSecs if it doesn't exist;
+    // fails for a file of another bar size or layout
+    bool open(const QString & path, uint barSecs);
+    void close();
+    bool isOpen() const { return m_map != NULL; }
+
+    int    size() const;
+    uint   barSecs() const;
+    double lastTimeStamp() const;
+
+    const double* timeStamps() const { return (const double*)column(TIMESTAMP); }
+    const double* opens() const { return (const double*)column(OPEN); }
+    const double* highs() const { return (const double*)column(HIGH); }
+    const double* lows() const { return (const double*)column(LOW); }
+    const double* closes() const { return (const double*)column(CLOSE); }
+    const double* waps() const { return (const double*)column(WAP); }
+    const quint32* volumes() const { return (const quint32*)column(VOLUME); }
+    const quint32* barCounts() const { return (const quint32*)column(BARCOUNT); }
+    const quint8* hasGaps() const { return (const quint8*)column(HASGAPS); }
+
+    // bars at or before the last stored one are ignored
+    bool append(double timeStamp, double open, double high, double low, double close,
+                uint volume, uint barCount, double wap, bool hasGaps);
+
+private:
+    Q_DISABLE_COPY(BarStore)
+
+    // 8 byte columns first so every column stays aligned
+    enum Column { TIMESTAMP, OPEN, HIGH, LOW, CLOSE, WAP, VOLUME, BARCOUNT, HASGAPS, NUM_COLUMNS };
+
+    struct Header;
+
+    Header* header() const { return (Header*)m_map; }
+    uchar*  column(Column c) const;
+    bool    map();
+    bool    grow();
+
+    static qint64 fileSize(int capacity);
+    static qint64 columnOffset(Column c, int capacity);
+
+    QFile   m_file;
+    uchar*  m_map;
+    int     m_refs;
+};
+
+#endif // BARSTORE_H
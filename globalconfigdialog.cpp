@@ -119,6 +119,8 @@ void GlobalConfigDialog::keyPressEvent(QKeyEvent *evt)
 void GlobalConfigDialog::setMangagedAccounts(const QStringList &managedAccounts)
 {
     m_managedAccounts = managedAccounts;
+    // TWS sends them again on every reconnect
+    ui->managedAccountsComboBox_2->clear();
     for (int i=0;i<m_managedAccounts.size();++i) {
         ui->managedAccountsComboBox_2->addItem(m_managedAccounts.at(i));
     }
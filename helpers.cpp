@@ -31,12 +31,17 @@ double getMax(const QVector<double> & vec)
 }
 
 double getMean(const QVector<double> & vec)
+{
+    return getMean(vec.constData(), vec.size());
+}
+
+double getMean(const double* vec, int n)
 {
     double sum = 0;
-    for (int i = 0; i < vec.size(); ++i) {
-        sum += vec.at(i);
+    for (int i = 0; i < n; ++i) {
+        sum += vec[i];
     }
-    return sum / vec.size();
+    return sum / n;
 }
 
 QVector<double> getMA(const QVector<double> & vec, int period)
@@ -84,6 +89,11 @@ QVector<double> getStdDevVector(const QVector<double> & vec, int period)
 
 
 QVector<double> getRSI(const QVector<double> & vec, int period)
+{
+    return getRSI(vec.constData(), vec.size(), period);
+}
+
+QVector<double> getRSI(const double* vec, int n, int period)
 {
     // http://stockcharts.com/school/doku.php?id=chart_school:technical_indicators:relative_strength_index_rsi
     double gainSum = 0;
@@ -96,9 +106,9 @@ QVector<double> getRSI(const QVector<double> & vec, int period)
     double rsi = 0;
     QVector<double> ret;
 
-    for (int i=1;i<vec.size();++i) {
-        double lval = vec.at(i-1);
-        double val  = vec.at(i);
+    for (int i=1;i<n;++i) {
+        double lval = vec[i-1];
+        double val  = vec[i];
         double diff = val - lval;
         if (diff > 0) {
             if (val < 1 && lval < 1) {
@@ -138,23 +148,18 @@ QVector<double> getRSI(const QVector<double> & vec, int period)
 
 QVector<double> getCorrelation(const QVector<double> & pair1, const QVector<double> & pair2)
 {
-    double pMean1 = getMean(pair1);
-    double pMean2 = getMean(pair2);
+    return getCorrelation(pair1.constData(), pair1.size(), pair2.constData(), pair2.size());
+}
 
-    QVector<double> pair11;
-    QVector<double> pair22;
+QVector<double> getCorrelation(const double* pair1, int n1, const double* pair2, int n2)
+{
+    double pMean1 = getMean(pair1, n1);
+    double pMean2 = getMean(pair2, n2);
 
-    int size = 0;
-    if (pair1.size() <= pair2.size()) {
-        size = pair1.size();
-        pair11 = pair1;
-        pair22 = pair2.mid(pair2.size() - pair1.size());
-    }
-    else {
-        size = pair2.size();
-        pair11 = pair1.mid(pair1.size() - pair2.size());
-        pair22 = pair2;
-    }
+    // the last size values of each
+    int size = qMin(n1, n2);
+    const double* pair11 = pair1 + n1 - size;
+    const double* pair22 = pair2 + n2 - size;
 
     double absum=0;
     double aasum=0;
@@ -163,8 +168,8 @@ QVector<double> getCorrelation(const QVector<double> & pair1, const QVector<doub
     QVector<double> ret;
 
     for (int i=0;i<size;++i) {
-        double a = pair11.at(i) - pMean1;
-        double b = pair22.at(i) - pMean2;
+        double a = pair11[i] - pMean1;
+        double b = pair22[i] - pMean2;
         double ab = a * b;
         absum += ab;
         double aa = a * a;
@@ -180,31 +185,24 @@ QVector<double> getCorrelation(const QVector<double> & pair1, const QVector<doub
 
 QVector<double> getRatio(const QVector<double> & vec1, const QVector<double> & vec2)
 {
-    int size = 0;
-
-    QVector<double> vec11;
-    QVector<double> vec22;
+    return getRatio(vec1.constData(), vec1.size(), vec2.constData(), vec2.size());
+}
 
-    if (vec1.size() < vec2.size()) {
-        size = vec1.size();
-        vec11 = vec1;
-        vec22 = vec2.mid(vec2.size()-size);
-    }
-    else {
-        size = vec2.size();
-        vec11 = vec1.mid(vec1.size()-size);
-        vec22 = vec2;
-    }
+QVector<double> getRatio(const double* vec1, int n1, const double* vec2, int n2)
+{
+    int size = qMin(n1, n2);
+    const double* vec11 = vec1 + n1 - size;
+    const double* vec22 = vec2 + n2 - size;
 
     QVector<double> ret;
 
 
     for (int i=0; i<size;++i) {
-        if (vec22.at(i) == 0) {
+        if (vec22[i] == 0) {
             ret.append(DBL_MIN);
             continue;
         }
-        ret.append(vec11.at(i) / vec22.at(i));
+        ret.append(vec11[i] / vec22[i]);
     }
 
     return ret;
@@ -329,32 +327,19 @@ void delay(int milliSecondsToWait)
 
 QVector<double> getDiff(const QVector<double> &vec1, const QVector<double> &vec2)
 {
-    int mid = 0;
-    int size = 0;
+    return getDiff(vec1.constData(), vec1.size(), vec2.constData(), vec2.size());
+}
+
+QVector<double> getDiff(const double* vec1, int n1, const double* vec2, int n2)
+{
     QVector<double> ret;
-    QVector<double> vec11;
-    QVector<double> vec22;
+    int size = qMin(n1, n2);
+    const double* vec11 = vec1 + n1 - size;
+    const double* vec22 = vec2 + n2 - size;
 
-    if (vec1.size() == vec2.size()) {
-        vec11 = vec1;
-        vec22 = vec2;
-        size = vec1.size();
-    }
-    else if (vec1.size() < vec2.size()) {
-        mid = vec2.size() - vec1.size();
-        vec11 = vec1;
-        vec22 = vec2.mid(mid);
-        size = vec1.size();
-    }
-    else {
-        mid = vec1.size() - vec2.size();
-        vec11 = vec1.mid(mid);
-        vec22 = vec2;
-        size = vec2.size();
-    }
     for (int i=0;i<size;++i) {
-//        qDebug() << vec11.at(i) << vec22.at(i) << vec11.at(i) - vec22.at(i);
-        ret.append(vec11.at(i) - vec22.at(i));
+//        qDebug() << vec11[i] << vec22[i] << vec11[i] - vec22[i];
+        ret.append(vec11[i] - vec22[i]);
     }
     return ret;
 }
@@ -13,16 +13,23 @@ void delay(int milliSecondsToWait);
 double getMin(const QVector<double> & vec);
 double getMax(const QVector<double> & vec);
 double getMean(const QVector<double> & vec);
+double getMean(const double* vec, int n);
 QVector<double> getMA(const QVector<double> & vec, int period);
 QVector<double> getExpMA(const QVector<double> & vec, int period);
 double getStdDev(const QVector<double> & vec);
 QVector<double> getStdDevVector(const QVector<double> & vec, int period);
 QVector<double> getRSI(const QVector<double> & vec, int period=14);
+QVector<double> getRSI(const double* vec, int n, int period=14);
+// the pointer ones take the last values of the longer one, as many as
+// the shorter one has
 QVector<double> getCorrelation(const QVector<double> & pair1, const QVector<double> & pair2);
+QVector<double> getCorrelation(const double* pair1, int n1, const double* pair2, int n2);
 QVector<double> getRatio(const QVector<double> & vec1, const QVector<double> & vec2);
+QVector<double> getRatio(const double* vec1, int n1, const double* vec2, int n2);
 QVector<double> getDiff(const QVector<double> & vec);
 QVector<double> getAbsDiff(const QVector<double> & vec);
 QVector<double> getDiff(const QVector<double> & vec1, const QVector<double> & vec2);
+QVector<double> getDiff(const double* vec1, int n1, const double* vec2, int n2);
 QVector<double> getRatioVolatility(const QVector<double> & vec, int period);
 //QVector<double> getRatioVolatility(const QVector<double> & ratioOfHighs, const QVector<double> &ratioOfLows, int period);
 QVector<double> getPercentFromMA(const QVector<double> & vec, int period);
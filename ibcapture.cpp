@@ -0,0 +1,105 @@
+#include "ibcapture.h"
+
+#include <QDateTime>
+#include <QtEndian>
+
+#include <climits>
+#include <cstring>
+
+static const char   CAPTURE_MAGIC[4] = { 'N', 'K', 'C', 'P' };
+static const quint32 CAPTURE_VERSION = 1;
+static const int    HEADER_SIZE = 16;
+static const int    RECORD_HEADER_SIZE = 12;
+
+IBCaptureWriter::IBCaptureWriter()
+{
+}
+
+IBCaptureWriter::~IBCaptureWriter()
+{
+    close();
+}
+
+bool IBCaptureWriter::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    uchar header[HEADER_SIZE];
+    memcpy(header, CAPTURE_MAGIC, 4);
+    qToLittleEndian<quint32>(CAPTURE_VERSION, header + 4);
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), header + 8);
+    m_file.write((const char*)header, HEADER_SIZE);
+
+    m_clock.start();
+    return true;
+}
+
+void IBCaptureWriter::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+void IBCaptureWriter::write(const char *data, int len)
+{
+    if (!m_file.isOpen() || len <= 0)
+        return;
+
+    uchar rec[RECORD_HEADER_SIZE];
+    qToLittleEndian<qint64>(m_clock.nsecsElapsed(), rec);
+    qToLittleEndian<quint32>(len, rec + 8);
+    m_file.write((const char*)rec, RECORD_HEADER_SIZE);
+    m_file.write(data, len);
+}
+
+
+IBCaptureReader::IBCaptureReader()
+    : m_startMSecs(0)
+{
+}
+
+bool IBCaptureReader::open(const QString &path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    uchar header[HEADER_SIZE];
+    if (m_file.read((char*)header, HEADER_SIZE) != HEADER_SIZE
+            || memcmp(header, CAPTURE_MAGIC, 4) != 0
+            || qFromLittleEndian<quint32>(header + 4) != CAPTURE_VERSION) {
+        m_file.close();
+        return false;
+    }
+    m_startMSecs = qFromLittleEndian<qint64>(header + 8);
+    return true;
+}
+
+void IBCaptureReader::close()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+bool IBCaptureReader::next(qint64 &nsecs, QByteArray &data)
+{
+    uchar rec[RECORD_HEADER_SIZE];
+    if (m_file.read((char*)rec, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE)
+        return false;
+
+    nsecs = qFromLittleEndian<qint64>(rec);
+    quint32 len = qFromLittleEndian<quint32>(rec + 8);
+
+    // a cut short or corrupt file, not worth allocating for
+    if ((qint64)len > m_file.size() - m_file.pos() || len > (quint32)INT_MAX)
+        return false;
+
+    data.resize(len);
+    return m_file.read(data.data(), len) == (qint64)len;
+}
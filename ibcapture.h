@@ -0,0 +1,49 @@
+#ifndef IBCAPTURE_H
+#define IBCAPTURE_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+// Raw inbound TWS stream capture. The file starts with a 16 byte header
+// (magic "NKCP", version, wall clock msecs at start) followed by one record
+// per socket read: qint64 monotonic nsecs since start, quint32 length and
+// the bytes as received. All integers are little endian.
+class IBCaptureWriter
+{
+public:
+    IBCaptureWriter();
+    ~IBCaptureWriter();
+
+    bool open(const QString & path);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    void write(const char* data, int len);
+
+private:
+    QFile           m_file;
+    QElapsedTimer   m_clock;
+};
+
+class IBCaptureReader
+{
+public:
+    IBCaptureReader();
+
+    bool open(const QString & path);
+    void close();
+
+    qint64 startMSecsSinceEpoch() const { return m_startMSecs; }
+
+    // next record, false at the end of the file or on a truncated record
+    // or one whose length runs past the end of the file
+    bool next(qint64 & nsecs, QByteArray & data);
+
+private:
+    QFile   m_file;
+    qint64  m_startMSecs;
+};
+
+#endif // IBCAPTURE_H
@@ -9,51 +9,220 @@
 #include "ibcommissionreport.h"
 #include "ibsocketerrors.h"
 #include "ibtagvalue.h"
+#include "ibclientworker.h"
 #include "helpers.h"
 
 #include <QDebug>
+#include <QThread>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QDateTime>
 #include <QByteArray>
 #include <QList>
 #include <QVariant>
 
 #include <cfloat>
+#include <cstring>
 #include <cassert>
 
 
 //static const qint64 BUFFER_SIZE_HIGH_MARK = 1 * 1024 * 1024; // 1 MB
 
+struct IBClient::MktDataSubscription
+{
+    Contract    contract;
+    QByteArray  genericTicks;
+};
+
+struct IBClient::MktDepthSubscription
+{
+    Contract    contract;
+    int         numRows;
+    IBOrderBook book;
+};
 
-IBClient::IBClient(QObject *parent)
+struct IBClient::RealTimeBarsSubscription
+{
+    Contract    contract;
+    int         barSize;
+    QByteArray  whatToShow;
+    bool        useRTH;
+    IBResponseHandler* handler;
+};
+
+// Emits a decoded event. In worker-thread mode the decoder runs on the
+// network thread, so the signal is queued and emitted on the GUI thread.
+#define IB_EMIT(signal) \
+    do { \
+        if (m_thread) \
+            postEvent([=]() { emit signal; }); \
+        else \
+            emit signal; \
+    } while (0)
+
+// Runs a call that touches GUI side state (the encoder, m_clientId) from
+// the decoder.
+#define IB_POST(call) \
+    do { \
+        if (m_thread) \
+            postEvent([=]() { call; }); \
+        else \
+            call; \
+    } while (0)
+
+
+IBClient::IBClient(QObject *parent, bool networkThread)
     : QObject(parent)
     , m_socket(NULL)
     , m_clientId(0)
     , m_outBuffer(QByteArray())
-    , m_inBuffer(QByteArray())
+    , m_msgFieldsNeeded(0)
+    , m_msgFieldsFound(0)
+    , m_msgBytesScanned(0)
     , m_connected(false)
     , m_serverVersion(0)
     , m_twsTime(QByteArray())
-    , m_begIdx(0)
-    , m_endIdx(0)
     , m_extraAuth(0)
+    , m_ready(false)
+    , m_traceMessages(false)
+    , m_disconnecting(false)
+    , m_dataRouting(RouteRoundRobin)
+    , m_nextDataConnection(0)
     , m_tickerId(1)
     , m_orderId(0)
+    , m_thread(NULL)
+    , m_worker(NULL)
+    , m_drainPending(false)
+    , m_batchDepth(0)
+    , m_pacerTimer(NULL)
+    , m_replay(false)
+    , m_msgHandlers(new MsgHandler[MAX_INCOMING_MSG_ID + 1])
 {
-    m_socket = new QTcpSocket(this);
+    // in worker-thread mode the socket has no parent so it can be moved
+    m_socket = new QTcpSocket(networkThread ? NULL : this);
+    m_outBuffer.reserve(1024);
 
 
 //    m_socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, var);
 //    m_socket->setSocketOption(QAbstractSocket::KeepAliveOption, QVariant(1));
 
-
+    // direct connections: the slots run on whichever thread owns the socket
     connect(m_socket, SIGNAL(connected()),
-            this, SLOT(onConnected()));
+            this, SLOT(onConnected()), Qt::DirectConnection);
+    connect(m_socket, SIGNAL(disconnected()),
+            this, SLOT(onDisconnected()), Qt::DirectConnection);
     connect(m_socket, SIGNAL(readyRead()),
-            this, SLOT(onReadyRead()));
+            this, SLOT(onReadyRead()), Qt::DirectConnection);
     connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SLOT(onSocketError(QAbstractSocket::SocketError)));
+            this, SLOT(onSocketError(QAbstractSocket::SocketError)), Qt::DirectConnection);
+
+    m_pacerTimer = new QTimer(this);
+    m_pacerTimer->setSingleShot(true);
+    connect(m_pacerTimer, SIGNAL(timeout()),
+            this, SLOT(pumpRequests()));
+
+    // incoming messages are dispatched through m_msgHandlers by msgId
+    registerHandler(TICK_PRICE, "TICK_PRICE", &IBClient::decodeTickPrice);
+    registerHandler(TICK_SIZE, "TICK_SIZE", &IBClient::decodeTickSize);
+    registerHandler(TICK_OPTION_COMPUTATION, "TICK_OPTION_COMPUTATION", &IBClient::decodeTickOptionComputation);
+    registerHandler(TICK_GENERIC, "TICK_GENERIC", &IBClient::decodeTickGeneric);
+    registerHandler(TICK_STRING, "TICK_STRING", &IBClient::decodeTickString);
+    registerHandler(TICK_EFP, "TICK_EFP", &IBClient::decodeTickEfp);
+    registerHandler(ORDER_STATUS, "ORDER_STATUS", &IBClient::decodeOrderStatus);
+    registerHandler(ERR_MSG, "ERR_MSG", &IBClient::decodeErrMsg);
+    registerHandler(OPEN_ORDER, "OPEN_ORDER", &IBClient::decodeOpenOrder);
+    registerHandler(ACCT_VALUE, "ACCT_VALUE", &IBClient::decodeAcctValue);
+    registerHandler(PORTFOLIO_VALUE, "PORTFOLIO_VALUE", &IBClient::decodePortfolioValue);
+    registerHandler(ACCT_UPDATE_TIME, "ACCT_UPDATE_TIME", &IBClient::decodeAcctUpdateTime);
+    registerHandler(NEXT_VALID_ID, "NEXT_VALID_ID", &IBClient::decodeNextValidId);
+    registerHandler(CONTRACT_DATA, "CONTRACT_DATA", &IBClient::decodeContractData);
+    registerHandler(BOND_CONTRACT_DATA, "BOND_CONTRACT_DATA", &IBClient::decodeBondContractData);
+    registerHandler(EXECUTION_DATA, "EXECUTION_DATA", &IBClient::decodeExecutionData);
+    registerHandler(MARKET_DEPTH, "MARKET_DEPTH", &IBClient::decodeMarketDepth);
+    registerHandler(MARKET_DEPTH_L2, "MARKET_DEPTH_L2", &IBClient::decodeMarketDepthL2);
+    registerHandler(NEWS_BULLETINS, "NEWS_BULLETINS", &IBClient::decodeNewsBulletins);
+    registerHandler(MANAGED_ACCTS, "MANAGED_ACCTS", &IBClient::decodeManagedAccts);
+    registerHandler(RECEIVE_FA, "RECEIVE_FA", &IBClient::decodeReceiveFa);
+    registerHandler(HISTORICAL_DATA, "HISTORICAL_DATA", &IBClient::decodeHistoricalData);
+    registerHandler(SCANNER_DATA, "SCANNER_DATA", &IBClient::decodeScannerData);
+    registerHandler(SCANNER_PARAMETERS, "SCANNER_PARAMETERS", &IBClient::decodeScannerParameters);
+    registerHandler(CURRENT_TIME, "CURRENT_TIME", &IBClient::decodeCurrentTime);
+    registerHandler(REAL_TIME_BARS, "REAL_TIME_BARS", &IBClient::decodeRealTimeBars);
+    registerHandler(FUNDAMENTAL_DATA, "FUNDAMENTAL_DATA", &IBClient::decodeFundamentalData);
+    registerHandler(CONTRACT_DATA_END, "CONTRACT_DATA_END", &IBClient::decodeContractDataEnd);
+    registerHandler(OPEN_ORDER_END, "OPEN_ORDER_END", &IBClient::decodeOpenOrderEnd);
+    registerHandler(ACCT_DOWNLOAD_END, "ACCT_DOWNLOAD_END", &IBClient::decodeAcctDownloadEnd);
+    registerHandler(EXECUTION_DATA_END, "EXECUTION_DATA_END", &IBClient::decodeExecutionDataEnd);
+    registerHandler(DELTA_NEUTRAL_VALIDATION, "DELTA_NEUTRAL_VALIDATION", &IBClient::decodeDeltaNeutralValidation);
+    registerHandler(TICK_SNAPSHOT_END, "TICK_SNAPSHOT_END", &IBClient::decodeTickSnapshotEnd);
+    registerHandler(MARKET_DATA_TYPE, "MARKET_DATA_TYPE", &IBClient::decodeMarketDataType);
+    registerHandler(COMMISSION_REPORT, "COMMISSION_REPORT", &IBClient::decodeCommissionReport);
+    registerHandler(POSITION_DATA, "POSITION_DATA", &IBClient::decodePositionData);
+    registerHandler(POSITION_END, "POSITION_END", &IBClient::decodePositionEnd);
+    registerHandler(ACCOUNT_SUMMARY, "ACCOUNT_SUMMARY", &IBClient::decodeAccountSummary);
+    registerHandler(ACCOUNT_SUMMARY_END, "ACCOUNT_SUMMARY_END", &IBClient::decodeAccountSummaryEnd);
+    registerHandler(VERIFY_MESSAGE_API, "VERIFY_MESSAGE_API", &IBClient::decodeVerifyMessageApi);
+    registerHandler(VERIFY_COMPLETED, "VERIFY_COMPLETED", &IBClient::decodeVerifyCompleted);
+    registerHandler(DISPLAY_GROUP_LIST, "DISPLAY_GROUP_LIST", &IBClient::decodeDisplayGroupList);
+    registerHandler(DISPLAY_GROUP_UPDATED, "DISPLAY_GROUP_UPDATED", &IBClient::decodeDisplayGroupUpdated);
+
+    if (networkThread) {
+        m_thread = new QThread(this);
+        m_worker = new IBClientWorker(this);
+        m_socket->moveToThread(m_thread);
+        m_worker->moveToThread(m_thread);
+        m_thread->start();
+    }
+}
+
+IBClient::~IBClient()
+{
+    if (m_thread) {
+        m_thread->requestInterruption();
+        QMetaObject::invokeMethod(m_worker, "shutdown", Qt::BlockingQueuedConnection);
+        m_thread->quit();
+        m_thread->wait();
+        delete m_worker;
+    }
+    delete [] m_msgHandlers;
+    qDeleteAll(m_mktDataSubscriptions);
+    qDeleteAll(m_realTimeBarsSubscriptions);
+    qDeleteAll(m_mktDepthSubscriptions);
+}
+
+void IBClient::registerHandler(int msgId, const char *name, MsgDecoder decode)
+{
+    m_msgHandlers[msgId].decode = decode;
+    m_msgHandlers[msgId].name = name;
 }
 
-IBClient::~IBClient() {}
+QList<IBMsgStats> IBClient::msgStats() const
+{
+    QList<IBMsgStats> stats;
+    for (int i = 1; i <= MAX_INCOMING_MSG_ID; ++i) {
+        const MsgHandler & h = m_msgHandlers[i];
+        if (!h.decode)
+            continue;
+        IBMsgStats s;
+        s.msgId = i;
+        s.name = h.name;
+        s.count = h.count.load(std::memory_order_relaxed);
+        s.bytes = h.bytes.load(std::memory_order_relaxed);
+        s.nsecs = h.nsecs.load(std::memory_order_relaxed);
+        stats.append(s);
+    }
+    return stats;
+}
+
+void IBClient::resetMsgStats()
+{
+    for (int i = 1; i <= MAX_INCOMING_MSG_ID; ++i) {
+        m_msgHandlers[i].count = 0;
+        m_msgHandlers[i].bytes = 0;
+        m_msgHandlers[i].nsecs = 0;
+    }
+}
 
 
 
@@ -62,22 +231,273 @@ void IBClient::connectToTWS(const QString &host, quint16 port, int clientId)
     Q_UNUSED(host);
 
     m_clientId = clientId;
-    m_socket->connectToHost(QString("127.0.0.1"), port);
+    m_disconnecting = false;
+    if (m_thread)
+        QMetaObject::invokeMethod(m_worker, "connectToHost", Qt::QueuedConnection,
+                                  Q_ARG(QString, QString("127.0.0.1")), Q_ARG(int, port));
+    else
+        m_socket->connectToHost(QString("127.0.0.1"), port);
     encodeField(CLIENT_VERSION);
     send();
 }
 
 void IBClient::disconnectTWS()
 {
+    m_disconnecting = true;
+    m_clientId = -1;
+    resetSession();
+
+    if (m_thread) {
+        QMetaObject::invokeMethod(m_worker, "disconnectFromHost", Qt::QueuedConnection);
+        return;
+    }
+
     m_twsTime.clear();
+    m_inBuffer.clear();
+    m_msgFieldsNeeded = 0;
+    m_cursor = IBFieldCursor();
+
+    m_socket->disconnectFromHost();
+}
+
+// Drops what belongs to the current session on the GUI side: unsent
+// requests, and fails the requests that wait for an answer.
+void IBClient::resetSession()
+{
     m_serverVersion = 0;
     m_connected = false;
     m_extraAuth = false;
-    m_clientId = -1;
-    m_outBuffer.clear();
-    m_inBuffer.clear();
+    m_ready = false;
+    m_outBuffer.resize(0);
+    m_wireBuffer.clear();
+    m_pacer.clear();
+    m_pacerTimer->stop();
 
-    m_socket->disconnectFromHost();
+    // the books are sent anew by resubscribe(), what they hold now is stale
+    foreach (MktDepthSubscription* sub, m_mktDepthSubscriptions)
+        sub->book.clear();
+
+    // the realtime bar streams are sent again by resubscribe()
+    QHash<TickerId, IBResponseHandler*> lost;
+    QHashIterator<TickerId, IBResponseHandler*> it(m_responseHandlers);
+    while (it.hasNext()) {
+        it.next();
+        if (!m_realTimeBarsSubscriptions.contains(it.key()))
+            lost.insert(it.key(), it.value());
+    }
+    m_responseHandlers.clear();
+
+    if (m_thread) {
+        QMutexLocker locker(&m_txMutex);
+        m_txBuffer.clear();
+    }
+
+    QHashIterator<TickerId, IBResponseHandler*> lostIt(lost);
+    while (lostIt.hasNext()) {
+        lostIt.next();
+        lostIt.value()->onRequestError(lostIt.key(), NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+    }
+}
+
+void IBClient::resubscribe()
+{
+    beginBatch();
+    foreach (TickerId tickerId, m_mktDataSubscriptions.keys()) {
+        const MktDataSubscription* sub = m_mktDataSubscriptions.value(tickerId);
+        reqMktData(tickerId, sub->contract, sub->genericTicks, false);
+    }
+    foreach (TickerId tickerId, m_realTimeBarsSubscriptions.keys()) {
+        const RealTimeBarsSubscription* sub = m_realTimeBarsSubscriptions.value(tickerId);
+        reqRealTimeBars(tickerId, sub->contract, sub->barSize, sub->whatToShow, sub->useRTH,
+                        QList<TagValue*>(), sub->handler);
+    }
+    foreach (TickerId tickerId, m_mktDepthSubscriptions.keys()) {
+        const MktDepthSubscription* sub = m_mktDepthSubscriptions.value(tickerId);
+        reqMktDepth(tickerId, sub->contract, sub->numRows);
+    }
+    endBatch();
+}
+
+void IBClient::addDataConnection(IBClient *client)
+{
+    m_dataConnections.append(client);
+
+    connect(client, SIGNAL(tickPrice(long,TickType,double,int)),
+            this, SIGNAL(tickPrice(long,TickType,double,int)));
+    connect(client, SIGNAL(tickSize(long,TickType,int)),
+            this, SIGNAL(tickSize(long,TickType,int)));
+    connect(client, SIGNAL(tickGeneric(long,TickType,double)),
+            this, SIGNAL(tickGeneric(long,TickType,double)));
+    connect(client, SIGNAL(tickString(long,TickType,QByteArray)),
+            this, SIGNAL(tickString(long,TickType,QByteArray)));
+    connect(client, SIGNAL(tickSnapshotEnd(int)),
+            this, SIGNAL(tickSnapshotEnd(int)));
+    connect(client, SIGNAL(marketDataType(long,int)),
+            this, SIGNAL(marketDataType(long,int)));
+    connect(client, SIGNAL(contractDetails(int,ContractDetails)),
+            this, SIGNAL(contractDetails(int,ContractDetails)));
+    connect(client, SIGNAL(contractDetailsEnd(int)),
+            this, SIGNAL(contractDetailsEnd(int)));
+    connect(client, SIGNAL(historicalData(long,QByteArray,double,double,double,double,int,int,double,int)),
+            this, SIGNAL(historicalData(long,QByteArray,double,double,double,double,int,int,double,int)));
+    connect(client, SIGNAL(realtimeBar(long,long,double,double,double,double,long,double,int)),
+            this, SIGNAL(realtimeBar(long,long,double,double,double,double,long,double,int)));
+    connect(client, SIGNAL(updateMktDepth(long,int,int,int,double,int)),
+            this, SIGNAL(updateMktDepth(long,int,int,int,double,int)));
+    connect(client, SIGNAL(updateMktDepthL2(long,int,QByteArray,int,int,double,int)),
+            this, SIGNAL(updateMktDepthL2(long,int,QByteArray,int,int,double,int)));
+
+    // only request errors, the connection's own state is its supervisor's;
+    // a realtime bar stream the error ends there isn't routed to it anymore
+    connect(client, &IBClient::error, this, [this, client](int id, int errorCode, const QByteArray & errorString) {
+        if (id <= 0)
+            return;
+        if (client->m_realTimeBarsSubscriptions.contains(id) && m_streamConnection.value(id) == client)
+            m_streamConnection.remove(id);
+        emit error(id, errorCode, errorString);
+    });
+}
+
+int IBClient::dataLoad() const
+{
+    return m_mktDataSubscriptions.size() + m_realTimeBarsSubscriptions.size()
+            + m_mktDepthSubscriptions.size() + m_responseHandlers.size();
+}
+
+// round robin over the ready data connections from index first on, NULL
+// if none is
+IBClient *IBClient::nextDataConnection(int first)
+{
+    const int n = m_dataConnections.size() - first;
+    for (int i = 0; i < n; ++i) {
+        IBClient* client = m_dataConnections.at(first + m_nextDataConnection++ % n);
+        if (client->isReady())
+            return client;
+    }
+    return NULL;
+}
+
+// connection for a stream, sticky until the stream is cancelled
+IBClient *IBClient::routeStream(TickerId tickerId)
+{
+    if (m_dataConnections.isEmpty())
+        return NULL;
+
+    IBClient* client = m_streamConnection.value(tickerId);
+    if (client)
+        return client;
+
+    switch (m_dataRouting) {
+    case RouteHistoryApart:
+        client = m_dataConnections.first()->isReady() ? m_dataConnections.first() : NULL;
+        break;
+    case RouteLeastLoaded:
+        client = routeRequest();
+        break;
+    default:
+        client = nextDataConnection(0);
+        break;
+    }
+    if (client)
+        m_streamConnection.insert(tickerId, client);
+    return client;
+}
+
+// connection for a one-off request, NULL for this one
+IBClient *IBClient::routeRequest()
+{
+    if (m_dataConnections.isEmpty())
+        return NULL;
+
+    switch (m_dataRouting) {
+    case RouteHistoryApart:
+        return nextDataConnection(m_dataConnections.size() > 1 ? 1 : 0);
+
+    case RouteLeastLoaded: {
+        IBClient* least = NULL;
+        foreach (IBClient* client, m_dataConnections) {
+            if (client->isReady() && (!least || client->dataLoad() < least->dataLoad()))
+                least = client;
+        }
+        return least;
+    }
+
+    default:
+        return nextDataConnection(0);
+    }
+}
+
+void IBClient::subscribeTicks(TickerId tickerId, IBTickSubscriber *subscriber)
+{
+    if (IBClient* client = m_streamConnection.value(tickerId)) {
+        client->subscribeTicks(tickerId, subscriber);
+        return;
+    }
+
+    if (tickerId < 0)
+        return;
+    if (tickerId >= m_tickSubscribers.size())
+        m_tickSubscribers.resize(tickerId + 1);
+
+    QVector<IBTickSubscriber*> & subscribers = m_tickSubscribers[tickerId];
+    if (!subscribers.contains(subscriber))
+        subscribers.append(subscriber);
+}
+
+void IBClient::unsubscribeTicks(TickerId tickerId, IBTickSubscriber *subscriber)
+{
+    if (IBClient* client = m_streamConnection.value(tickerId))
+        client->unsubscribeTicks(tickerId, subscriber);
+
+    if (tickerId >= 0 && tickerId < m_tickSubscribers.size())
+        m_tickSubscribers[tickerId].removeAll(subscriber);
+}
+
+void IBClient::unsubscribeTicks(IBTickSubscriber *subscriber)
+{
+    foreach (IBClient* client, m_dataConnections)
+        client->unsubscribeTicks(subscriber);
+
+    for (int i = 0; i < m_tickSubscribers.size(); ++i)
+        m_tickSubscribers[i].removeAll(subscriber);
+}
+
+void IBClient::removeResponseHandler(IBResponseHandler *handler)
+{
+    foreach (IBClient* client, m_dataConnections)
+        client->removeResponseHandler(handler);
+
+    QMutableHashIterator<TickerId, IBResponseHandler*> it(m_responseHandlers);
+    while (it.hasNext()) {
+        if (it.next().value() == handler)
+            it.remove();
+    }
+
+    // nor resubscribe its streams for it
+    QMutableHashIterator<TickerId, RealTimeBarsSubscription*> sub(m_realTimeBarsSubscriptions);
+    while (sub.hasNext()) {
+        if (sub.next().value()->handler == handler) {
+            delete sub.value();
+            sub.remove();
+        }
+    }
+}
+
+// the size is re-read each pass since a subscriber may unsubscribe itself
+void IBClient::dispatchTickPrice(TickerId tickerId, TickType field, double price, int canAutoExecute)
+{
+    if (tickerId < 0 || tickerId >= m_tickSubscribers.size())
+        return;
+    for (int i = 0; i < m_tickSubscribers.at(tickerId).size(); ++i)
+        m_tickSubscribers.at(tickerId).at(i)->onTickPrice(tickerId, field, price, canAutoExecute);
+}
+
+void IBClient::dispatchTickSize(TickerId tickerId, TickType field, int size)
+{
+    if (tickerId < 0 || tickerId >= m_tickSubscribers.size())
+        return;
+    for (int i = 0; i < m_tickSubscribers.at(tickerId).size(); ++i)
+        m_tickSubscribers.at(tickerId).at(i)->onTickSize(tickerId, field, size);
 }
 
 OrderId IBClient::getOrderId()
@@ -89,88 +509,200 @@ OrderId IBClient::getOrderId()
 
 void IBClient::send()
 {
-//    qDebug() << "[DEBUG-send] debugBuffer" << m_debugBuffer;
-    m_debugBuffer.clear();
-//    qDebug() << "[DEBUG-send] rawBuffer" << m_outBuffer;
+    if (m_traceMessages) {
+        qDebug() << "[DEBUG-send]" << m_debugBuffer;
+        m_debugBuffer.clear();
+    }
 
-    int sent = m_socket->write(m_outBuffer);
+    if (m_outBuffer.isEmpty())
+        return;
 
-    if (sent == m_outBuffer.size())
-        m_outBuffer.clear();
+    if (!m_connected) {
+        // the handshake is not paced
+        m_wireBuffer.append(m_outBuffer);
+    }
     else {
+        const char* f;
+        int len;
+        IBFieldCursor c(m_outBuffer.constData(), m_outBuffer.constData() + m_outBuffer.size());
+        c.next(f, len);
+        // the pacer keeps an exact size copy, m_outBuffer keeps its capacity
+        QByteArray msg(m_outBuffer.constData(), m_outBuffer.size());
+        m_pacer.enqueue(IBRequestPacer::laneFor(IBFieldCursor::toInt(f, len)), msg);
+    }
+    m_outBuffer.resize(0);
+
+    // inside a batch the message waits in the pacer for endBatch()
+    if (m_batchDepth > 0)
+        return;
+
+    pumpRequests();
+}
+
+void IBClient::endBatch()
+{
+    if (m_batchDepth > 0 && --m_batchDepth == 0)
+        pumpRequests();
+}
+
+void IBClient::pumpRequests()
+{
+    QByteArray msg;
+    while (m_pacer.takeNext(msg))
+        m_wireBuffer.append(msg);
+
+    writeOutBuffer();
+
+    int wait = m_pacer.msecsUntilNext();
+    if (wait >= 0)
+        m_pacerTimer->start(qMax(wait, 1));
+}
+
+void IBClient::writeOutBuffer()
+{
+    if (m_wireBuffer.isEmpty())
+        return;
+
+    // nobody is listening during a replay
+    if (m_replay) {
+        m_wireBuffer.clear();
+        return;
+    }
+
+    if (m_thread) {
+        // the socket belongs to the network thread, which writes as soon as
+        // it picks the bytes up; it never waits for the GUI to paint
+        bool schedule;
+        {
+            QMutexLocker locker(&m_txMutex);
+            schedule = m_txBuffer.isEmpty();
+            m_txBuffer.append(m_wireBuffer);
+        }
+        m_wireBuffer.clear();
+        if (schedule)
+            QMetaObject::invokeMethod(m_worker, "flush", Qt::QueuedConnection);
+        return;
+    }
+
+    qint64 sent = m_socket->write(m_wireBuffer);
+
+    if (sent == m_wireBuffer.size())
+        m_wireBuffer.clear();
+    else if (sent > 0) {
 //qDebug() << "[WARNING !!!] NOT ALL DATA IN THE OUT BUFFER WAS SENT... PREPENDING TO NEXT MESSAGE";
-        m_outBuffer.remove(0, sent + 1);
+        m_wireBuffer.remove(0, sent);
+    }
+
+    // don't wait for the event loop to push the bytes out
+    m_socket->flush();
+}
+
+// network thread
+void IBClient::flushTx()
+{
+    QByteArray tx;
+    {
+        QMutexLocker locker(&m_txMutex);
+        tx.swap(m_txBuffer);
     }
+    if (tx.isEmpty())
+        return;
+
+    m_socket->write(tx);
+    m_socket->flush();
+}
+
+// network thread
+void IBClient::postEvent(const std::function<void()> &event)
+{
+    // the GUI thread is behind, let it catch up rather than drop events
+    while (!m_events.push(event)) {
+        if (m_thread->isInterruptionRequested())
+            return;
+        QThread::yieldCurrentThread();
+    }
+
+    if (!m_drainPending.load(std::memory_order_acquire)
+            && !m_drainPending.exchange(true))
+        QMetaObject::invokeMethod(this, "drainEvents", Qt::QueuedConnection);
 }
 
-void IBClient::reqHistoricalData(long tickerId, const Contract &contract, const QByteArray &endDateTime, const QByteArray &durationStr, const QByteArray &barSizeSetting, const QByteArray &whatToShow, int useRTH, int formatDate, const QList<TagValue*> &chartOptions)
+// GUI thread, once per event loop turn while events are pending
+void IBClient::drainEvents()
 {
+    // cleared before draining so an event pushed meanwhile schedules again
+    m_drainPending = false;
+
+    std::function<void()> event;
+    size_t n = m_events.capacity();
+    while (n-- && m_events.pop(event))
+        event();
+
+    if (!m_events.isEmpty() && !m_drainPending.exchange(true))
+        QMetaObject::invokeMethod(this, "drainEvents", Qt::QueuedConnection);
+}
+
+void IBClient::reqHistoricalData(long tickerId, const Contract &contract, const QByteArray &endDateTime, const QByteArray &durationStr, const QByteArray &barSizeSetting, const QByteArray &whatToShow, int useRTH, int formatDate, const QList<TagValue*> &chartOptions, IBResponseHandler* handler)
+{
+    if (IBClient* client = routeRequest()) {
+        client->reqHistoricalData(tickerId, contract, endDateTime, durationStr, barSizeSetting, whatToShow,
+                                  useRTH, formatDate, chartOptions, handler);
+        return;
+    }
+
     if (!m_connected) {
        emit error(tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
         return;
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_TRADING_CLASS) {
-        if (!contract.tradingClass.isEmpty() || (contract.conId > 0)) {
-            emit error(tickerId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                  "  It does not support conId and tradingClass parameters in reqHistoricalData.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !contract.tradingClass.isEmpty() || (contract.conId > 0), tickerId,
+                            "conId and tradingClass parameters in reqHistoricalData."))
+        return;
 
     const int version = 6;
 
-    encodeField(REQ_HISTORICAL_DATA);
-    encodeField(version);
-    encodeField(tickerId);
+    encodeFields(REQ_HISTORICAL_DATA, version, tickerId);
 
     // send contract fields
     if (m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField(contract.conId);
     }
-    encodeField(contract.symbol);
-    encodeField(contract.secType);
-    encodeField(contract.expiry);
-    encodeField(contract.strike);
-    encodeField(contract.right);
-    encodeField(contract.multiplier);
-    encodeField(contract.exchange);
-    encodeField(contract.primaryExchange);
-    encodeField(contract.currency);
-    encodeField(contract.localSymbol);
+    encodeFields(contract.symbol,
+                 contract.secType,
+                 contract.expiry,
+                 contract.strike,
+                 contract.right,
+                 contract.multiplier,
+                 contract.exchange,
+                 contract.primaryExchange,
+                 contract.currency,
+                 contract.localSymbol);
     if (m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField(contract.tradingClass);
     }
-    encodeField(contract.includeExpired);
-    encodeField(endDateTime);
-    encodeField(barSizeSetting);
-    encodeField(durationStr);
-    encodeField(useRTH);
-    encodeField(whatToShow);
-    encodeField(formatDate);
+    encodeFields(contract.includeExpired,
+                 endDateTime,
+                 barSizeSetting,
+                 durationStr,
+                 useRTH,
+                 whatToShow,
+                 formatDate);
 
     // send combo legs for BAG requests
     if (contract.secType == "BAG") {
         encodeField(contract.comboLegs.size());
         foreach(ComboLeg* leg, contract.comboLegs) {
-            encodeField(leg->conId);
-            encodeField(leg->ratio);
-            encodeField(leg->action);
-            encodeField(leg->exchange);
+            encodeFields(leg->conId, leg->ratio, leg->action, leg->exchange);
         }
     }
 
     // send chart options parameter
     if (m_serverVersion >= MIN_SERVER_VER_LINKING) {
-        QByteArray chartOptionsStr;
-        foreach (TagValue* tv, chartOptions) {
-            chartOptionsStr.append(tv->tag);
-            chartOptionsStr.append("=");
-            chartOptionsStr.append(tv->value);
-            chartOptionsStr.append(";");
-        }
-        encodeField(chartOptionsStr);
+        encodeTagValues(chartOptions);
     }
+
+    if (handler)
+        m_responseHandlers.insert(tickerId, handler);
     send();
 }
 void IBClient::reqCurrentTime()
@@ -182,8 +714,7 @@ void IBClient::reqCurrentTime()
     }
 
     const int version = 1;
-    encodeField(REQ_CURRENT_TIME);
-    encodeField(version);
+    encodeFields(REQ_CURRENT_TIME, version);
     send();
 }
 
@@ -191,59 +722,59 @@ void IBClient::reqCurrentTime()
 void IBClient::reqMktData(TickerId tickerId, const Contract& contract,
                                const QByteArray& genericTicks, bool snapshot, const QList<TagValue*>& mktDataOptions)
 {
-    // not connected?
-    if( !m_connected) {
-        emit error( tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+    if (IBClient* client = snapshot ? routeRequest() : routeStream(tickerId)) {
+        client->reqMktData(tickerId, contract, genericTicks, snapshot, mktDataOptions);
         return;
     }
 
-    if( m_serverVersion < MIN_SERVER_VER_UNDER_COMP) {
-        if( contract.underComp) {
-            emit error( tickerId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support delta-neutral orders.");
-            return;
+    // registered before the connection check, so it goes out on reconnect
+    if (!snapshot) {
+        MktDataSubscription* sub = m_mktDataSubscriptions.value(tickerId);
+        if (!sub) {
+            sub = new MktDataSubscription;
+            m_mktDataSubscriptions.insert(tickerId, sub);
         }
+        sub->contract = contract;
+        sub->genericTicks = genericTicks;
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_REQ_MKT_DATA_CONID) {
-        if( contract.conId > 0) {
-            emit error( tickerId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support conId parameter.");
-            return;
-        }
+    // not connected?
+    if( !m_connected) {
+        emit error( tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+        return;
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_TRADING_CLASS) {
-        if( !contract.tradingClass.isEmpty()) {
-            emit error( tickerId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support tradingClass parameter in reqMktData.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_UNDER_COMP, contract.underComp != NULL, tickerId,
+                            "delta-neutral orders."))
+        return;
+
+    if (!checkServerVersion(MIN_SERVER_VER_REQ_MKT_DATA_CONID, contract.conId > 0, tickerId,
+                            "conId parameter."))
+        return;
+
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !contract.tradingClass.isEmpty(), tickerId,
+                            "tradingClass parameter in reqMktData."))
+        return;
 
     const int VERSION = 11;
 
     // send req mkt data msg
-    encodeField( REQ_MKT_DATA);
-    encodeField( VERSION);
-    encodeField( tickerId);
+    encodeFields( REQ_MKT_DATA, VERSION, tickerId);
 
     // send contract fields
     if( m_serverVersion >= MIN_SERVER_VER_REQ_MKT_DATA_CONID) {
         encodeField( contract.conId);
     }
-    encodeField( contract.symbol);
-    encodeField( contract.secType);
-    encodeField( contract.expiry);
-    encodeField( contract.strike);
-    encodeField( contract.right);
-    encodeField( contract.multiplier); // srv v15 and above
-
-    encodeField( contract.exchange);
-    encodeField( contract.primaryExchange); // srv v14 and above
-    encodeField( contract.currency);
-
-    encodeField( contract.localSymbol); // srv v2 and above
+    encodeFields( contract.symbol,
+                  contract.secType,
+                  contract.expiry,
+                  contract.strike,
+                  contract.right,
+                  contract.multiplier, // srv v15 and above
+                  contract.exchange,
+                  contract.primaryExchange, // srv v14 and above
+                  contract.currency,
+                  contract.localSymbol); // srv v2 and above
 
     if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField( contract.tradingClass);
@@ -254,101 +785,196 @@ void IBClient::reqMktData(TickerId tickerId, const Contract& contract,
         const QList<ComboLeg*> comboLegs = contract.comboLegs;
         encodeField(comboLegs.size());
         foreach (ComboLeg* cl, comboLegs) {
-            encodeField(cl->conId);
-            encodeField(cl->ratio);
-            encodeField(cl->action);
-            encodeField(cl->exchange);
+            encodeFields(cl->conId, cl->ratio, cl->action, cl->exchange);
         }
     }
 
     if( m_serverVersion >= MIN_SERVER_VER_UNDER_COMP) {
         if( contract.underComp) {
-            encodeField( true);
-            encodeField( contract.underComp->conId);
-            encodeField( contract.underComp->delta);
-            encodeField( contract.underComp->price);
+            encodeFields( true, contract.underComp->conId, contract.underComp->delta, contract.underComp->price);
         }
         else {
             encodeField( false);
         }
     }
 
-    encodeField( genericTicks); // srv v31 and above
-    encodeField( snapshot); // srv v35 and above
+    encodeFields( genericTicks, // srv v31 and above
+                  snapshot); // srv v35 and above
 
     // send mktDataOptions parameter
     if( m_serverVersion >= MIN_SERVER_VER_LINKING) {
-        QByteArray mktDataOptionsStr;
-        foreach (TagValue* tv, mktDataOptions) {
-            mktDataOptionsStr.append(tv->tag);
-            mktDataOptionsStr.append("=");
-            mktDataOptionsStr.append(tv->value);
-            mktDataOptionsStr.append(";");
-        }
-        encodeField( mktDataOptionsStr);
+        encodeTagValues( mktDataOptions);
     }
 
     send();
 }
 
-void IBClient::reqRealTimeBars(const long &tickerId, const Contract &contract, const int &barSize, const QByteArray &whatToShow, const bool &useRTH, const QList<TagValue *> &realTimeBarsOptions)
+void IBClient::reqRealTimeBars(const long &tickerId, const Contract &contract, const int &barSize, const QByteArray &whatToShow, const bool &useRTH, const QList<TagValue *> &realTimeBarsOptions, IBResponseHandler *handler)
 {
+    if (IBClient* client = routeStream(tickerId)) {
+        client->reqRealTimeBars(tickerId, contract, barSize, whatToShow, useRTH, realTimeBarsOptions, handler);
+        return;
+    }
+
+    // registered before the connection check, so it goes out on reconnect
+    RealTimeBarsSubscription* sub = m_realTimeBarsSubscriptions.value(tickerId);
+    if (!sub) {
+        sub = new RealTimeBarsSubscription;
+        m_realTimeBarsSubscriptions.insert(tickerId, sub);
+    }
+    sub->contract = contract;
+    sub->barSize = barSize;
+    sub->whatToShow = whatToShow;
+    sub->useRTH = useRTH;
+    sub->handler = handler;
+
     if (!m_connected) {
       emit error(tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
         return;
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_TRADING_CLASS) {
-        if (!contract.tradingClass.isEmpty() || contract.conId > 0) {
-          emit error(tickerId, UPDATE_TWS.code(), UPDATE_TWS.msg()
-                  + "  It does not support conId and tradingClass params in reqRealTimeBars.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !contract.tradingClass.isEmpty() || contract.conId > 0, tickerId,
+                            "conId and tradingClass params in reqRealTimeBars."))
+        return;
 
     const int VERSION = 3;
 
 
-    encodeField(REQ_REAL_TIME_BARS);
-    encodeField(VERSION);
-    encodeField(tickerId);
+    encodeFields(REQ_REAL_TIME_BARS, VERSION, tickerId);
 
     // send contract fields
     if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField(contract.conId);
     }
-    encodeField(contract.symbol);
-    encodeField(contract.secType);
-    encodeField(contract.expiry);
-    encodeField(contract.strike);
-    encodeField(contract.right);
-    encodeField(contract.multiplier);
-    encodeField(contract.exchange);
-    encodeField(contract.primaryExchange);
-    encodeField(contract.currency);
-    encodeField(contract.localSymbol);
+    encodeFields(contract.symbol,
+                 contract.secType,
+                 contract.expiry,
+                 contract.strike,
+                 contract.right,
+                 contract.multiplier,
+                 contract.exchange,
+                 contract.primaryExchange,
+                 contract.currency,
+                 contract.localSymbol);
     if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField(contract.tradingClass);
     }
-    encodeField(barSize);
-    encodeField(whatToShow);
-    encodeField(useRTH);
+    encodeFields(barSize, whatToShow, useRTH);
 
     // send realTimeBarsOptions parameter
     if( m_serverVersion >= MIN_SERVER_VER_LINKING) {
-        QByteArray realTimeBarsOptionsStr;
-        if( realTimeBarsOptions.size() > 0) {
-            for( int i = 0; i < realTimeBarsOptions.size(); ++i) {
-                const TagValue* tagValue = realTimeBarsOptions.at(i);
-                realTimeBarsOptionsStr += tagValue->tag;
-                realTimeBarsOptionsStr += "=";
-                realTimeBarsOptionsStr += tagValue->value;
-                realTimeBarsOptionsStr += ";";
-            }
-        }
-        encodeField(realTimeBarsOptionsStr);
+        encodeTagValues(realTimeBarsOptions);
+    }
+
+    if (handler)
+        m_responseHandlers.insert(tickerId, handler);
+    send();
+}
+
+void IBClient::reqMktDepth(TickerId tickerId, const Contract &contract, int numRows, const QList<TagValue *> &mktDepthOptions)
+{
+    if (IBClient* client = routeStream(tickerId)) {
+        client->reqMktDepth(tickerId, contract, numRows, mktDepthOptions);
+        return;
+    }
+
+    // registered before the connection check, so it goes out on reconnect;
+    // TWS sends the whole book again, so start from an empty one
+    MktDepthSubscription* sub = m_mktDepthSubscriptions.value(tickerId);
+    if (!sub) {
+        sub = new MktDepthSubscription;
+        m_mktDepthSubscriptions.insert(tickerId, sub);
+    }
+    sub->contract = contract;
+    sub->numRows = numRows;
+    sub->book.setDepth(numRows);
+
+    if (!m_connected) {
+        emit error(tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+        return;
+    }
+
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !contract.tradingClass.isEmpty() || contract.conId > 0, tickerId,
+                            "conId and tradingClass parameters in reqMktDepth."))
+        return;
+
+    const int VERSION = 5;
+
+    encodeFields(REQ_MKT_DEPTH, VERSION, tickerId);
+
+    // send contract fields
+    if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
+        encodeField(contract.conId);
+    }
+    encodeFields(contract.symbol,
+                 contract.secType,
+                 contract.expiry,
+                 contract.strike,
+                 contract.right,
+                 contract.multiplier,
+                 contract.exchange,
+                 contract.currency,
+                 contract.localSymbol);
+    if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
+        encodeField(contract.tradingClass);
+    }
+    encodeField(numRows);
+
+    // send mktDepthOptions parameter
+    if( m_serverVersion >= MIN_SERVER_VER_LINKING) {
+        encodeTagValues(mktDepthOptions);
+    }
+
+    send();
+}
+
+void IBClient::cancelMktDepth(TickerId tickerId)
+{
+    if (IBClient* client = m_streamConnection.take(tickerId)) {
+        client->cancelMktDepth(tickerId);
+        return;
+    }
+
+    delete m_mktDepthSubscriptions.take(tickerId);
+
+    if (!m_connected) {
+        emit error(tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+        return;
+    }
+
+    const int VERSION = 1;
+
+    encodeFields(CANCEL_MKT_DEPTH, VERSION, tickerId);
+    send();
+}
+
+const IBOrderBook *IBClient::orderBook(TickerId tickerId) const
+{
+    if (const IBClient* client = m_streamConnection.value(tickerId))
+        return client->orderBook(tickerId);
+
+    const MktDepthSubscription* sub = m_mktDepthSubscriptions.value(tickerId);
+    return sub ? &sub->book : NULL;
+}
+
+void IBClient::cancelRealTimeBars(TickerId tickerId)
+{
+    if (IBClient* client = m_streamConnection.take(tickerId)) {
+        client->cancelRealTimeBars(tickerId);
+        return;
+    }
+
+    delete m_realTimeBarsSubscriptions.take(tickerId);
+    m_responseHandlers.remove(tickerId);
+
+    if (!m_connected) {
+        emit error(tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
+        return;
     }
 
+    const int VERSION = 1;
+
+    encodeFields(CANCEL_REAL_TIME_BARS, VERSION, tickerId);
     send();
 }
 
@@ -400,204 +1026,132 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
     //	}
     //}
 
-    if( m_serverVersion < MIN_SERVER_VER_UNDER_COMP) {
-        if( contract.underComp) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support delta-neutral orders.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_UNDER_COMP, contract.underComp != NULL, id,
+                            "delta-neutral orders."))
+        return;
 
-    if( m_serverVersion < MIN_SERVER_VER_SCALE_ORDERS2) {
-        if( order.scaleSubsLevelSize != UNSET_INTEGER) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support Subsequent Level Size for Scale orders.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SCALE_ORDERS2, order.scaleSubsLevelSize != UNSET_INTEGER, id,
+                            "Subsequent Level Size for Scale orders."))
+        return;
 
-    if( m_serverVersion < MIN_SERVER_VER_ALGO_ORDERS) {
+    if (!checkServerVersion(MIN_SERVER_VER_ALGO_ORDERS, !IsEmpty(order.algoStrategy), id,
+                            "algo orders."))
+        return;
 
-        if( !IsEmpty(order.algoStrategy)) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support algo orders.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_NOT_HELD, order.notHeld, id,
+                            "notHeld parameter."))
+        return;
 
-    if( m_serverVersion < MIN_SERVER_VER_NOT_HELD) {
-        if (order.notHeld) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support notHeld parameter.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SEC_ID_TYPE, !IsEmpty(contract.secIdType) || !IsEmpty(contract.secId), id,
+                            "secIdType and secId parameters."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_SEC_ID_TYPE) {
-        if( !IsEmpty(contract.secIdType) || !IsEmpty(contract.secId)) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support secIdType and secId parameters.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_PLACE_ORDER_CONID, contract.conId > 0, id,
+                            "conId parameter."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_PLACE_ORDER_CONID) {
-        if( contract.conId > 0) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support conId parameter.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SSHORTX, order.exemptCode != -1, id,
+                            "exemptCode parameter."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_SSHORTX) {
-        if( order.exemptCode != -1) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support exemptCode parameter.");
+    for (int i = 0; i < contract.comboLegs.size(); ++i) {
+        const ComboLeg* comboLeg = contract.comboLegs.at(i);
+        assert( comboLeg);
+        if (!checkServerVersion(MIN_SERVER_VER_SSHORTX, comboLeg->exemptCode != -1, id,
+                                "exemptCode parameter."))
             return;
-        }
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_SSHORTX) {
-        for( int i = 0; i < contract.comboLegs.size(); ++i) {
-            const ComboLeg* comboLeg = contract.comboLegs.at(i);
-            assert( comboLeg);
-            if( comboLeg->exemptCode != -1 ){
-              emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                    "  It does not support exemptCode parameter.");
-                return;
-            }
-        }
-    }
-
-    if( m_serverVersion < MIN_SERVER_VER_HEDGE_ORDERS) {
-        if( !IsEmpty(order.hedgeType)) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support hedge orders.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_HEDGE_ORDERS, !IsEmpty(order.hedgeType), id,
+                            "hedge orders."))
+        return;
 
-    if( m_serverVersion < MIN_SERVER_VER_OPT_OUT_SMART_ROUTING) {
-        if (order.optOutSmartRouting) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support optOutSmartRouting parameter.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_OPT_OUT_SMART_ROUTING, order.optOutSmartRouting, id,
+                            "optOutSmartRouting parameter."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_DELTA_NEUTRAL_CONID) {
-        if (order.deltaNeutralConId > 0
-                || !IsEmpty(order.deltaNeutralSettlingFirm)
-                || !IsEmpty(order.deltaNeutralClearingAccount)
-                || !IsEmpty(order.deltaNeutralClearingIntent)
-                ) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support deltaNeutral parameters: ConId, SettlingFirm, ClearingAccount, ClearingIntent.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_DELTA_NEUTRAL_CONID,
+                            order.deltaNeutralConId > 0
+                            || !IsEmpty(order.deltaNeutralSettlingFirm)
+                            || !IsEmpty(order.deltaNeutralClearingAccount)
+                            || !IsEmpty(order.deltaNeutralClearingIntent), id,
+                            "deltaNeutral parameters: ConId, SettlingFirm, ClearingAccount, ClearingIntent."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_DELTA_NEUTRAL_OPEN_CLOSE) {
-        if (!IsEmpty(order.deltaNeutralOpenClose)
-                || order.deltaNeutralShortSale
-                || order.deltaNeutralShortSaleSlot > 0
-                || !IsEmpty(order.deltaNeutralDesignatedLocation)
-                ) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support deltaNeutral parameters: OpenClose, ShortSale, ShortSaleSlot, DesignatedLocation.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_DELTA_NEUTRAL_OPEN_CLOSE,
+                            !IsEmpty(order.deltaNeutralOpenClose)
+                            || order.deltaNeutralShortSale
+                            || order.deltaNeutralShortSaleSlot > 0
+                            || !IsEmpty(order.deltaNeutralDesignatedLocation), id,
+                            "deltaNeutral parameters: OpenClose, ShortSale, ShortSaleSlot, DesignatedLocation."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_SCALE_ORDERS3) {
-        if (order.scalePriceIncrement > 0 && order.scalePriceIncrement != UNSET_DOUBLE) {
-            if (order.scalePriceAdjustValue != UNSET_DOUBLE
-                || order.scalePriceAdjustInterval != UNSET_INTEGER
-                || order.scaleProfitOffset != UNSET_DOUBLE
-                || order.scaleAutoReset
-                || order.scaleInitPosition != UNSET_INTEGER
-                || order.scaleInitFillQty != UNSET_INTEGER
-                || order.scaleRandomPercent) {
-              emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                        "  It does not support Scale order parameters: PriceAdjustValue, PriceAdjustInterval, " +
-                        "ProfitOffset, AutoReset, InitPosition, InitFillQty and RandomPercent");
-                return;
-            }
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SCALE_ORDERS3,
+                            order.scalePriceIncrement > 0 && order.scalePriceIncrement != UNSET_DOUBLE
+                            && (order.scalePriceAdjustValue != UNSET_DOUBLE
+                                || order.scalePriceAdjustInterval != UNSET_INTEGER
+                                || order.scaleProfitOffset != UNSET_DOUBLE
+                                || order.scaleAutoReset
+                                || order.scaleInitPosition != UNSET_INTEGER
+                                || order.scaleInitFillQty != UNSET_INTEGER
+                                || order.scaleRandomPercent), id,
+                            "Scale order parameters: PriceAdjustValue, PriceAdjustInterval, "
+                            "ProfitOffset, AutoReset, InitPosition, InitFillQty and RandomPercent"))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_ORDER_COMBO_LEGS_PRICE && Compare(contract.secType, "BAG") == 0) {
-        for( int i = 0; i < order.orderComboLegs.size(); ++i) {
+    if (Compare(contract.secType, "BAG") == 0) {
+        for (int i = 0; i < order.orderComboLegs.size(); ++i) {
             const OrderComboLeg* orderComboLeg = order.orderComboLegs.at(i);
             assert( orderComboLeg);
-            if( orderComboLeg->price != UNSET_DOUBLE) {
-              emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                    "  It does not support per-leg prices for order combo legs.");
+            if (!checkServerVersion(MIN_SERVER_VER_ORDER_COMBO_LEGS_PRICE, orderComboLeg->price != UNSET_DOUBLE, id,
+                                    "per-leg prices for order combo legs."))
                 return;
-            }
         }
     }
 
-    if (m_serverVersion < MIN_SERVER_VER_TRAILING_PERCENT) {
-        if (order.trailingPercent != UNSET_DOUBLE) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                    "  It does not support trailing percent parameter");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_TRAILING_PERCENT, order.trailingPercent != UNSET_DOUBLE, id,
+                            "trailing percent parameter"))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_TRADING_CLASS) {
-        if( !IsEmpty(contract.tradingClass)) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support tradingClass parameter in placeOrder.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !IsEmpty(contract.tradingClass), id,
+                            "tradingClass parameter in placeOrder."))
+        return;
 
-    if (m_serverVersion < MIN_SERVER_VER_SCALE_TABLE) {
-        if( !IsEmpty(order.scaleTable) || !IsEmpty(order.activeStartTime) || !IsEmpty(order.activeStopTime)) {
-          emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                    "  It does not support scaleTable, activeStartTime and activeStopTime parameters");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SCALE_TABLE,
+                            !IsEmpty(order.scaleTable) || !IsEmpty(order.activeStartTime) || !IsEmpty(order.activeStopTime), id,
+                            "scaleTable, activeStartTime and activeStopTime parameters"))
+        return;
 
+    const bool isBag = (Compare(contract.secType, "BAG") == 0);
     int VERSION = (m_serverVersion < MIN_SERVER_VER_NOT_HELD) ? 27 : 42;
 
     // send place order msg
-    encodeField(PLACE_ORDER);
-    encodeField(VERSION);
-    encodeField(id);
-
-
+    encodeFields(PLACE_ORDER, VERSION, id);
 
     // send contract fields
     if( m_serverVersion >= MIN_SERVER_VER_PLACE_ORDER_CONID) {
         encodeField(contract.conId);
     }
-    encodeField(contract.symbol);
-    encodeField(contract.secType);
-    encodeField(contract.expiry);
-    encodeField(contract.strike);
-    encodeField(contract.right);
-    encodeField(contract.multiplier); // srv v15 and above
-    encodeField(contract.exchange);
-    encodeField(contract.primaryExchange); // srv v14 and above
-    encodeField(contract.currency);
-    encodeField(contract.localSymbol); // srv v2 and above
+    encodeFields(contract.symbol,
+                 contract.secType,
+                 contract.expiry,
+                 contract.strike,
+                 contract.right,
+                 contract.multiplier, // srv v15 and above
+                 contract.exchange,
+                 contract.primaryExchange, // srv v14 and above
+                 contract.currency,
+                 contract.localSymbol); // srv v2 and above
     if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField(contract.tradingClass);
     }
 
     if( m_serverVersion >= MIN_SERVER_VER_SEC_ID_TYPE){
-        encodeField(contract.secIdType);
-        encodeField(contract.secId);
+        encodeFields(contract.secIdType, contract.secId);
     }
 
     // send main order fields
-    encodeField(order.action);
-    encodeField(order.totalQuantity);
-    encodeField(order.orderType);
+    encodeFields(order.action, order.totalQuantity, order.orderType);
     if( m_serverVersion < MIN_SERVER_VER_ORDER_COMBO_LEGS_PRICE) {
         encodeField(order.lmtPrice == UNSET_DOUBLE ? 0 : order.lmtPrice);
     }
@@ -611,89 +1165,59 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
         encodeFieldMax( order.auxPrice);
     }
 
-//    qDebug() << "[[order.auxPrice]]" << order.auxPrice;
-
-
     // send extended order fields
-    encodeField(order.tif);
-//    qDebug() << "[[order.tif]]" << order.tif;
-    encodeField(order.ocaGroup);
-//    qDebug() << "[[order.ocaGroup]]" << order.ocaGroup;
-    encodeField(order.account);
-//    qDebug() << "[[order.acconut]]" << order.account;
-    encodeField(order.openClose);
-//    qDebug() << "[[order.openClose]]" << order.openClose;
-    encodeField(order.origin);
-//    qDebug() << "[[order.origin]]" << order.origin;
-    encodeField(order.orderRef);
-//    qDebug() << "[[order.orderRef]]" << order.orderRef;
-    encodeField(order.transmit);
-//    qDebug() << "[[order.transmit]]" << order.transmit;
-    encodeField(order.parentId); // srv v4 and above
-//    qDebug() << "[[order.parentId]]" << order.parentId;
-
-    encodeField(order.blockOrder); // srv v5 and above
-    encodeField(order.sweepToFill); // srv v5 and above
-    encodeField(order.displaySize); // srv v5 and above
-    encodeField(order.triggerMethod); // srv v5 and above
-
-    //if( m_serverVersion < 38) {
-    // will never happen
-    //	ENCODE_FIELD(/* order.ignoreRth */ false);
-    //}
-    //else {
-        encodeField(order.outsideRth); // srv v5 and above
-    //}
-
-    encodeField(order.hidden); // srv v7 and above
+    encodeFields(order.tif,
+                 order.ocaGroup,
+                 order.account,
+                 order.openClose,
+                 order.origin,
+                 order.orderRef,
+                 order.transmit,
+                 order.parentId, // srv v4 and above
+                 order.blockOrder, // srv v5 and above
+                 order.sweepToFill, // srv v5 and above
+                 order.displaySize, // srv v5 and above
+                 order.triggerMethod, // srv v5 and above
+                 order.outsideRth, // srv v5 and above
+                 order.hidden); // srv v7 and above
 
     // Send combo legs for BAG requests (srv v8 and above)
-    if( Compare(contract.secType, "BAG") == 0)
-    {
+    if (isBag) {
         const int comboLegsCount = contract.comboLegs.size();
         encodeField(comboLegsCount);
-        if( comboLegsCount > 0) {
-            for( int i = 0; i < comboLegsCount; ++i) {
-                const ComboLeg* comboLeg = contract.comboLegs.at(i);
-                assert( comboLeg);
-                encodeField(comboLeg->conId);
-                encodeField(comboLeg->ratio);
-                encodeField(comboLeg->action);
-                encodeField(comboLeg->exchange);
-                encodeField(comboLeg->openClose);
-
-                encodeField(comboLeg->shortSaleSlot); // srv v35 and above
-                encodeField(comboLeg->designatedLocation); // srv v35 and above
-                if (m_serverVersion >= MIN_SERVER_VER_SSHORTX_OLD) {
-                    encodeField(comboLeg->exemptCode);
-                }
+        for( int i = 0; i < comboLegsCount; ++i) {
+            const ComboLeg* comboLeg = contract.comboLegs.at(i);
+            assert( comboLeg);
+            encodeFields(comboLeg->conId,
+                         comboLeg->ratio,
+                         comboLeg->action,
+                         comboLeg->exchange,
+                         comboLeg->openClose,
+                         comboLeg->shortSaleSlot, // srv v35 and above
+                         comboLeg->designatedLocation); // srv v35 and above
+            if (m_serverVersion >= MIN_SERVER_VER_SSHORTX_OLD) {
+                encodeField(comboLeg->exemptCode);
             }
         }
     }
 
     // Send order combo legs for BAG requests
-    if( m_serverVersion >= MIN_SERVER_VER_ORDER_COMBO_LEGS_PRICE && Compare(contract.secType, "BAG") == 0)
-    {
+    if( m_serverVersion >= MIN_SERVER_VER_ORDER_COMBO_LEGS_PRICE && isBag) {
         const int orderComboLegsCount = order.orderComboLegs.size();
         encodeField(orderComboLegsCount);
-        if( orderComboLegsCount > 0) {
-            for( int i = 0; i < orderComboLegsCount; ++i) {
-                const OrderComboLeg* orderComboLeg = order.orderComboLegs.at(i);
-                assert( orderComboLeg);
-                encodeFieldMax( orderComboLeg->price);
-            }
+        for( int i = 0; i < orderComboLegsCount; ++i) {
+            const OrderComboLeg* orderComboLeg = order.orderComboLegs.at(i);
+            assert( orderComboLeg);
+            encodeFieldMax( orderComboLeg->price);
         }
     }
 
-    if( m_serverVersion >= MIN_SERVER_VER_SMART_COMBO_ROUTING_PARAMS && Compare(contract.secType, "BAG") == 0) {
+    if( m_serverVersion >= MIN_SERVER_VER_SMART_COMBO_ROUTING_PARAMS && isBag) {
         const int smartComboRoutingParamsCount = order.smartComboRoutingParams.size();
         encodeField(smartComboRoutingParamsCount);
-        if( smartComboRoutingParamsCount > 0) {
-            for( int i = 0; i < smartComboRoutingParamsCount; ++i) {
-                const TagValue* tagValue = order.smartComboRoutingParams.at(i);
-                encodeField(tagValue->tag);
-                encodeField(tagValue->value);
-            }
+        for( int i = 0; i < smartComboRoutingParamsCount; ++i) {
+            const TagValue* tagValue = order.smartComboRoutingParams.at(i);
+            encodeFields(tagValue->tag, tagValue->value);
         }
     }
 
@@ -709,94 +1233,61 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
     //      residual 80 to account 'U203' enter the following share allocation string:
     //          U101/20,U203/80
     /////////////////////////////////////////////////////////////////////////////
-    {
-        // send deprecated sharesAllocation field
-        QByteArray ba = "";
-        encodeField(ba); // srv v9 and above
-    }
-
-    encodeField(order.discretionaryAmt); // srv v10 and above
-    encodeField(order.goodAfterTime); // srv v11 and above
-    encodeField(order.goodTillDate); // srv v12 and above
-
-    encodeField(order.faGroup); // srv v13 and above
-    encodeField(order.faMethod); // srv v13 and above
-    encodeField(order.faPercentage); // srv v13 and above
-    encodeField(order.faProfile); // srv v13 and above
-
-    // institutional short saleslot data (srv v18 and above)
-    encodeField(order.shortSaleSlot);      // 0 for retail, 1 or 2 for institutions
-    encodeField(order.designatedLocation); // populate only when shortSaleSlot = 2.
+    encodeFields("", // deprecated sharesAllocation field, srv v9 and above
+                 order.discretionaryAmt, // srv v10 and above
+                 order.goodAfterTime, // srv v11 and above
+                 order.goodTillDate, // srv v12 and above
+                 order.faGroup, // srv v13 and above
+                 order.faMethod, // srv v13 and above
+                 order.faPercentage, // srv v13 and above
+                 order.faProfile, // srv v13 and above
+                 // institutional short saleslot data (srv v18 and above)
+                 order.shortSaleSlot, // 0 for retail, 1 or 2 for institutions
+                 order.designatedLocation); // populate only when shortSaleSlot = 2.
     if (m_serverVersion >= MIN_SERVER_VER_SSHORTX_OLD) {
         encodeField(order.exemptCode);
     }
 
-    // not needed anymore
-    //bool isVolOrder = (order.orderType.CompareNoCase("VOL") == 0);
-
     // srv v19 and above fields
-    encodeField(order.ocaType);
-    //if( m_serverVersion < 38) {
-    // will never happen
-    //	send( /* order.rthOnly */ false);
-    //}
-    encodeField(order.rule80A);
-    encodeField(order.settlingFirm);
-    encodeField(order.allOrNone);
-    encodeFieldMax( order.minQty);
-    encodeFieldMax( order.percentOffset);
-    encodeField(order.eTradeOnly);
-    encodeField(order.firmQuoteOnly);
-    encodeFieldMax( order.nbboPriceCap);
-    encodeField(order.auctionStrategy); // AUCTION_MATCH, AUCTION_IMPROVEMENT, AUCTION_TRANSPARENT
-    encodeFieldMax( order.startingPrice);
-    encodeFieldMax( order.stockRefPrice);
-    encodeFieldMax( order.delta);
-    // Volatility orders had specific watermark price attribs in server version 26
-    //double lower = (m_serverVersion == 26 && isVolOrder) ? DBL_MAX : order.stockRangeLower;
-    //double upper = (m_serverVersion == 26 && isVolOrder) ? DBL_MAX : order.stockRangeUpper;
-    encodeFieldMax( order.stockRangeLower);
-    encodeFieldMax( order.stockRangeUpper);
-
-    encodeField(order.overridePercentageConstraints); // srv v22 and above
-
-    // Volatility orders (srv v26 and above)
-    encodeFieldMax( order.volatility);
-    encodeFieldMax( order.volatilityType);
-    // will never happen
-    //if( m_serverVersion < 28) {
-    //	send( order.deltaNeutralOrderType.CompareNoCase("MKT") == 0);
-    //}
-    //else {
-        encodeField(order.deltaNeutralOrderType); // srv v28 and above
-        encodeFieldMax( order.deltaNeutralAuxPrice); // srv v28 and above
-
-        if (m_serverVersion >= MIN_SERVER_VER_DELTA_NEUTRAL_CONID && !IsEmpty(order.deltaNeutralOrderType)){
-            encodeField(order.deltaNeutralConId);
-            encodeField(order.deltaNeutralSettlingFirm);
-            encodeField(order.deltaNeutralClearingAccount);
-            encodeField(order.deltaNeutralClearingIntent);
-        }
-
-        if (m_serverVersion >= MIN_SERVER_VER_DELTA_NEUTRAL_OPEN_CLOSE && !IsEmpty(order.deltaNeutralOrderType)){
-            encodeField(order.deltaNeutralOpenClose);
-            encodeField(order.deltaNeutralShortSale);
-            encodeField(order.deltaNeutralShortSaleSlot);
-            encodeField(order.deltaNeutralDesignatedLocation);
-        }
-
-    //}
-    encodeField(order.continuousUpdate);
-    //if( m_serverVersion == 26) {
-    //	// Volatility orders had specific watermark price attribs in server version 26
-    //	double lower = (isVolOrder ? order.stockRangeLower : DBL_MAX);
-    //	double upper = (isVolOrder ? order.stockRangeUpper : DBL_MAX);
-    //	encodeFieldMax( lower);
-    //	encodeFieldMax( upper);
-    //}
-    encodeFieldMax( order.referencePriceType);
-
-    encodeFieldMax( order.trailStopPrice); // srv v30 and above
+    encodeFields(order.ocaType,
+                 order.rule80A,
+                 order.settlingFirm,
+                 order.allOrNone,
+                 fieldMax(order.minQty),
+                 fieldMax(order.percentOffset),
+                 order.eTradeOnly,
+                 order.firmQuoteOnly,
+                 fieldMax(order.nbboPriceCap),
+                 order.auctionStrategy, // AUCTION_MATCH, AUCTION_IMPROVEMENT, AUCTION_TRANSPARENT
+                 fieldMax(order.startingPrice),
+                 fieldMax(order.stockRefPrice),
+                 fieldMax(order.delta),
+                 fieldMax(order.stockRangeLower),
+                 fieldMax(order.stockRangeUpper),
+                 order.overridePercentageConstraints, // srv v22 and above
+                 // Volatility orders (srv v26 and above)
+                 fieldMax(order.volatility),
+                 fieldMax(order.volatilityType),
+                 order.deltaNeutralOrderType, // srv v28 and above
+                 fieldMax(order.deltaNeutralAuxPrice)); // srv v28 and above
+
+    if (m_serverVersion >= MIN_SERVER_VER_DELTA_NEUTRAL_CONID && !IsEmpty(order.deltaNeutralOrderType)){
+        encodeFields(order.deltaNeutralConId,
+                     order.deltaNeutralSettlingFirm,
+                     order.deltaNeutralClearingAccount,
+                     order.deltaNeutralClearingIntent);
+    }
+
+    if (m_serverVersion >= MIN_SERVER_VER_DELTA_NEUTRAL_OPEN_CLOSE && !IsEmpty(order.deltaNeutralOrderType)){
+        encodeFields(order.deltaNeutralOpenClose,
+                     order.deltaNeutralShortSale,
+                     order.deltaNeutralShortSaleSlot,
+                     order.deltaNeutralDesignatedLocation);
+    }
+
+    encodeFields(order.continuousUpdate,
+                 fieldMax(order.referencePriceType),
+                 fieldMax(order.trailStopPrice)); // srv v30 and above
 
     if( m_serverVersion >= MIN_SERVER_VER_TRAILING_PERCENT) {
         encodeFieldMax( order.trailingPercent);
@@ -804,32 +1295,29 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
 
     // SCALE orders
     if( m_serverVersion >= MIN_SERVER_VER_SCALE_ORDERS2) {
-        encodeFieldMax( order.scaleInitLevelSize);
-        encodeFieldMax( order.scaleSubsLevelSize);
+        encodeFields(fieldMax(order.scaleInitLevelSize), fieldMax(order.scaleSubsLevelSize));
     }
     else {
         // srv v35 and above)
-        encodeField(""); // for not supported scaleNumComponents
-        encodeFieldMax( order.scaleInitLevelSize); // for scaleComponentSize
+        encodeFields("", // for not supported scaleNumComponents
+                     fieldMax(order.scaleInitLevelSize)); // for scaleComponentSize
     }
 
     encodeFieldMax( order.scalePriceIncrement);
 
     if( m_serverVersion >= MIN_SERVER_VER_SCALE_ORDERS3
         && order.scalePriceIncrement > 0.0 && order.scalePriceIncrement != UNSET_DOUBLE) {
-        encodeFieldMax( order.scalePriceAdjustValue);
-        encodeFieldMax( order.scalePriceAdjustInterval);
-        encodeFieldMax( order.scaleProfitOffset);
-        encodeField(order.scaleAutoReset);
-        encodeFieldMax( order.scaleInitPosition);
-        encodeFieldMax( order.scaleInitFillQty);
-        encodeField(order.scaleRandomPercent);
+        encodeFields(fieldMax(order.scalePriceAdjustValue),
+                     fieldMax(order.scalePriceAdjustInterval),
+                     fieldMax(order.scaleProfitOffset),
+                     order.scaleAutoReset,
+                     fieldMax(order.scaleInitPosition),
+                     fieldMax(order.scaleInitFillQty),
+                     order.scaleRandomPercent);
     }
 
     if( m_serverVersion >= MIN_SERVER_VER_SCALE_TABLE) {
-        encodeField(order.scaleTable);
-        encodeField(order.activeStartTime);
-        encodeField(order.activeStopTime);
+        encodeFields(order.scaleTable, order.activeStartTime, order.activeStopTime);
     }
 
     // HEDGE orders
@@ -845,8 +1333,7 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
     }
 
     if( m_serverVersion >= MIN_SERVER_VER_PTA_ORDERS) {
-        encodeField(order.clearingAccount);
-        encodeField(order.clearingIntent);
+        encodeFields(order.clearingAccount, order.clearingIntent);
     }
 
     if( m_serverVersion >= MIN_SERVER_VER_NOT_HELD){
@@ -856,10 +1343,7 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
     if( m_serverVersion >= MIN_SERVER_VER_UNDER_COMP) {
         if( contract.underComp) {
             const UnderComp& underComp = *contract.underComp;
-            encodeField(true);
-            encodeField(underComp.conId);
-            encodeField(underComp.delta);
-            encodeField(underComp.price);
+            encodeFields(true, underComp.conId, underComp.delta, underComp.price);
         }
         else {
             encodeField(false);
@@ -872,12 +1356,9 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
         if( !IsEmpty(order.algoStrategy)) {
             const int algoParamsCount = order.algoParams.size();
             encodeField(algoParamsCount);
-            if( algoParamsCount > 0) {
-                for( int i = 0; i < algoParamsCount; ++i) {
-                    const TagValue* tagValue = order.algoParams.at(i);
-                    encodeField(tagValue->tag);
-                    encodeField(tagValue->value);
-                }
+            for( int i = 0; i < algoParamsCount; ++i) {
+                const TagValue* tagValue = order.algoParams.at(i);
+                encodeFields(tagValue->tag, tagValue->value);
             }
         }
     }
@@ -886,23 +1367,11 @@ void IBClient::placeOrder(long id, const Contract &contract, const Order &order)
 
     // send miscOptions parameter
     if( m_serverVersion >= MIN_SERVER_VER_LINKING) {
-        QByteArray miscOptionsStr("");
-        const int orderMiscOptionsCount = order.orderMiscOptions.size();
-        if( orderMiscOptionsCount > 0) {
-            for( int i = 0; i < orderMiscOptionsCount; ++i) {
-                const TagValue* tagValue = order.orderMiscOptions.at(i);
-                miscOptionsStr += tagValue->tag;
-                miscOptionsStr += "=";
-                miscOptionsStr += tagValue->value;
-                miscOptionsStr += ";";
-            }
-        }
-        encodeField(miscOptionsStr);
+        encodeTagValues(order.orderMiscOptions);
     }
 
     send();
 }
-
 void IBClient::reqAccountUpdates(bool subscribe, const QByteArray &acctCode)
 {
     // not connected?
@@ -915,12 +1384,10 @@ void IBClient::reqAccountUpdates(bool subscribe, const QByteArray &acctCode)
     const int VERSION = 2;
 
     // send req acct msg
-    encodeField( REQ_ACCT_DATA);
-    encodeField( VERSION);
-    encodeField( subscribe);  // TRUE = subscribe, FALSE = unsubscribe.
-
-    // Send the account code. This will only be used for FA clients
-    encodeField( acctCode); // srv v9 and above
+    encodeFields( REQ_ACCT_DATA,
+                  VERSION,
+                  subscribe,  // TRUE = subscribe, FALSE = unsubscribe.
+                  acctCode); // the account code, only used for FA clients, srv v9 and above
 
     send();
 }
@@ -936,8 +1403,7 @@ void IBClient::reqOpenOrders()
     const int VERSION = 1;
 
     // send req open orders msg
-    encodeField( REQ_OPEN_ORDERS);
-    encodeField( VERSION);
+    encodeFields( REQ_OPEN_ORDERS, VERSION);
 
     send();
 }
@@ -953,14 +1419,18 @@ void IBClient::reqAllOpenOrders()
     const int VERSION = 1;
 
     // send req open orders msg
-    encodeField( REQ_ALL_OPEN_ORDERS);
-    encodeField( VERSION);
+    encodeFields( REQ_ALL_OPEN_ORDERS, VERSION);
 
     send();
 }
 
-void IBClient::reqContractDetails(int reqId, const Contract &contract)
+void IBClient::reqContractDetails(int reqId, const Contract &contract, IBResponseHandler *handler)
 {
+    if (IBClient* client = routeRequest()) {
+        client->reqContractDetails(reqId, contract, handler);
+        return;
+    }
+
     // not connected?
     if( !m_connected) {
         emit error( NO_VALID_ID, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
@@ -973,52 +1443,45 @@ void IBClient::reqContractDetails(int reqId, const Contract &contract)
     //	emit error( NO_VALID_ID, UPDATE_TWS.code(), UPDATE_TWS.msg());
     //	return;
     //}
-    if (m_serverVersion < MIN_SERVER_VER_SEC_ID_TYPE) {
-        if( !IsEmpty(contract.secIdType) || !IsEmpty(contract.secId)) {
-            emit error( reqId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support secIdType and secId parameters.");
-            return;
-        }
-    }
-    if (m_serverVersion < MIN_SERVER_VER_TRADING_CLASS) {
-        if( !IsEmpty(contract.tradingClass)) {
-            emit error( reqId, UPDATE_TWS.code(), UPDATE_TWS.msg() +
-                "  It does not support tradingClass parameter in reqContractDetails.");
-            return;
-        }
-    }
+    if (!checkServerVersion(MIN_SERVER_VER_SEC_ID_TYPE, !IsEmpty(contract.secIdType) || !IsEmpty(contract.secId), reqId,
+                            "secIdType and secId parameters."))
+        return;
+
+    if (!checkServerVersion(MIN_SERVER_VER_TRADING_CLASS, !IsEmpty(contract.tradingClass), reqId,
+                            "tradingClass parameter in reqContractDetails."))
+        return;
 
     const int VERSION = 7;
 
     // send req mkt data msg
-    encodeField( REQ_CONTRACT_DATA);
-    encodeField( VERSION);
+    encodeFields( REQ_CONTRACT_DATA, VERSION);
 
     if( m_serverVersion >= MIN_SERVER_VER_CONTRACT_DATA_CHAIN) {
         encodeField( reqId);
     }
 
     // send contract fields
-    encodeField( contract.conId); // srv v37 and above
-    encodeField( contract.symbol);
-    encodeField( contract.secType);
-    encodeField( contract.expiry);
-    encodeField( contract.strike);
-    encodeField( contract.right);
-    encodeField( contract.multiplier); // srv v15 and above
-    encodeField( contract.exchange);
-    encodeField( contract.currency);
-    encodeField( contract.localSymbol);
+    encodeFields( contract.conId, // srv v37 and above
+                  contract.symbol,
+                  contract.secType,
+                  contract.expiry,
+                  contract.strike,
+                  contract.right,
+                  contract.multiplier, // srv v15 and above
+                  contract.exchange,
+                  contract.currency,
+                  contract.localSymbol);
     if( m_serverVersion >= MIN_SERVER_VER_TRADING_CLASS) {
         encodeField( contract.tradingClass);
     }
     encodeField( contract.includeExpired); // srv v31 and above
 
     if( m_serverVersion >= MIN_SERVER_VER_SEC_ID_TYPE){
-        encodeField( contract.secIdType);
-        encodeField( contract.secId);
+        encodeFields( contract.secIdType, contract.secId);
     }
 
+    if (handler)
+        m_responseHandlers.insert(reqId, handler);
     send();
 }
 
@@ -1035,15 +1498,20 @@ void IBClient::reqIds(int numIds)
     const int VERSION = 1;
 
     // send req open orders msg
-    encodeField(REQ_IDS);
-    encodeField(VERSION);
-    encodeField(numIds);
+    encodeFields(REQ_IDS, VERSION, numIds);
 
     send();
 }
 
 void IBClient::cancelMktData(long tickerId)
 {
+    if (IBClient* client = m_streamConnection.take(tickerId)) {
+        client->cancelMktData(tickerId);
+        return;
+    }
+
+    delete m_mktDataSubscriptions.take(tickerId);
+
     // not connected?
     if( !m_connected) {
         emit error( tickerId, NOT_CONNECTED.code(), NOT_CONNECTED.msg());
@@ -1053,62 +1521,192 @@ void IBClient::cancelMktData(long tickerId)
     const int VERSION = 2;
 
     // send cancel mkt data msg
-    encodeField( CANCEL_MKT_DATA);
-    encodeField( VERSION);
-    encodeField( tickerId);
+    encodeFields( CANCEL_MKT_DATA, VERSION, tickerId);
 
     send();
 }
 
+void IBClient::sendClientId()
+{
+    if (m_serverVersion >= 3) {
+        if (m_serverVersion < MIN_SERVER_VER_LINKING) {
+            encodeField(m_clientId);
+            send();
+        }
+        else if (!m_extraAuth) {
+            startApi();
+        }
+    }
+}
+
+void IBClient::startApi()
+{
+    const int VERSION = 1;
+    encodeFields(START_API, VERSION, m_clientId);
+    send();
+}
+
 void IBClient::onConnected()
 {
+    // orders and pair legs must not sit in the Nagle buffer
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
 //qDebug() << "TWS is connected";
 //    m_socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 16384);
 //    /*qDebug*/() << "[DEBUG-onConnected] socketRecvBufferSize:" << m_socket->socketOption(QAbstractSocket::ReceiveBufferSizeSocketOption).toInt();
 //    qDebug() << "[DEBUG-onConnected] readBufferSize:" << m_socket->readBufferSize();
 }
 
+// Runs on the socket's thread. The decoder state belongs to that thread and
+// is reset here, the rest of the session on the GUI thread.
+void IBClient::onDisconnected()
+{
+    m_connected = false;
+    m_twsTime.clear();
+    m_inBuffer.clear();
+    m_msgFieldsNeeded = 0;
+    m_cursor = IBFieldCursor();
+
+    if (m_disconnecting)
+        return;
+
+    IB_POST(resetSession());
+    IB_EMIT(connectionClosed());
+    IB_EMIT(connectionLost());
+}
+
 void IBClient::onReadyRead()
 {
-//    qDebug();
-//    qDebug();
 //    qDebug() << "[DEBUG-onReadyRead] bytesAvailable:" << m_socket->bytesAvailable();
 
+    // read straight into the ring, it grows instead of dropping data
+    while (m_socket->bytesAvailable() > 0) {
+        int space = 0;
+        char* dst = m_inBuffer.writePtr(qMin<qint64>(m_socket->bytesAvailable(), 64 * 1024), space);
+        qint64 got = m_socket->read(dst, space);
+        if (got <= 0)
+            break;
+        if (m_capture.isOpen())
+            m_capture.write(dst, (int)got);
+        m_inBuffer.commit((int)got);
+    }
 
-    m_inBuffer.append(m_socket->readAll());
+//    qDebug() << "[DEBUG-onReadyRead] m_inBuffer.size():" << m_inBuffer.size();
 
-    if (m_socket->bytesAvailable() == 65536)
-        qFatal("[CRITICAL ERROR] Socket Buffer is too small.. increase size in registry.. (is this Windows 7)");
+    processInBuffer();
+}
 
-//    qDebug() << "[DEBUG-onReadyRead] m_inBuffer.size():" << m_inBuffer.size();
-//    qDebug() << "[DEBUG-onReadyRead] raw:" << m_inBuffer;
+void IBClient::feedInbound(const char *data, int len)
+{
+    if (m_thread) {
+        qWarning("IBClient::feedInbound() needs a client without network thread");
+        return;
+    }
 
+    while (len > 0) {
+        int space = 0;
+        char* dst = m_inBuffer.writePtr(len, space);
+        int n = qMin(len, space);
+        memcpy(dst, data, n);
+        m_inBuffer.commit(n);
+        data += n;
+        len -= n;
+    }
+
+    processInBuffer();
+}
+
+bool IBClient::startCapture(const QString &path)
+{
+    return m_capture.open(path);
+}
 
-    while (m_inBuffer.size()) {
+void IBClient::stopCapture()
+{
+    m_capture.close();
+}
 
-//    qDebug() << "[REP]" << m_inBuffer;
+void IBClient::processInBuffer()
+{
+    while (!m_inBuffer.isEmpty()) {
 
-    // I'M GETTING EMPTY MESSAGES.. IS THIS THE CORRECT WAY TO HANDLE THIS ???
+        // WHY ARE MESSAGES FROM TWS SARTING WITH A '\0' ??? ... IS THIS THE CORRECT WAY TO HANDLE IT?
+        if (*m_inBuffer.readPtr() == '\0') {
+            m_inBuffer.consume(1);
+            continue;
+        }
 
-    if (m_inBuffer.isEmpty()) {
-//qDebug() << "Received empty onReadyRead message.. ignoring it..";
-        return;
+        // a message that came short is only decoded again once the fields
+        // it needs are there, counted over the bytes that came since
+        if (m_msgFieldsNeeded && !havePendingFields())
+            break;
+
+        const char* begin = m_inBuffer.readPtr();
+        m_cursor = IBFieldCursor(begin, begin + m_inBuffer.contiguousSize());
+
+        if (!processMsg()) {
+            // the message is incomplete: if it wraps around the end of the
+            // ring make it contiguous and retry, otherwise wait for the rest
+            if (m_inBuffer.isContiguous()) {
+                m_msgFieldsNeeded = m_cursor.fieldsNeeded();
+                m_msgFieldsFound = 0;
+                m_msgBytesScanned = 0;
+                break;
+            }
+            m_inBuffer.linearize();
+            continue;
+        }
+        m_msgFieldsNeeded = 0;
+
+        // nothing left to consume if the message handler disconnected
+        if (m_inBuffer.isEmpty())
+            break;
+        m_inBuffer.consume(m_cursor.pos() - begin);
     }
 
-    // WHY ARE MESSAGES FROM TWS SARTING WITH A '\0' ??? ... IS THIS THE CORRECT WAY TO HANDLE IT?
-    if (m_inBuffer.startsWith('\0')) {
-//qDebug() << "[DEBUG] onReadyRead message started with a \'\0\' ??? wtf, I'm removing it";
-        m_inBuffer.remove(0, 1);
+    m_cursor = IBFieldCursor();
+}
+
+// counts the fields of the short message at the front up to the ones it
+// needs, scanning each byte once
+bool IBClient::havePendingFields()
+{
+    if (!m_inBuffer.isContiguous())
+        m_inBuffer.linearize();
+
+    const char* begin = m_inBuffer.readPtr();
+    const char* end = begin + m_inBuffer.size();
+    const char* p = begin + m_msgBytesScanned;
+    while (m_msgFieldsFound < m_msgFieldsNeeded) {
+        const char* nul = (const char*)memchr(p, '\0', end - p);
+        if (!nul)
+            break;
+        p = nul + 1;
+        ++m_msgFieldsFound;
     }
+    m_msgBytesScanned = (int)(p - begin);
+    return m_msgFieldsFound >= m_msgFieldsNeeded;
+}
 
-    // DEBUG
-    //    qDebug() << "onReadyRead msg:" << m_inBuffer;
+// Decodes one message at the cursor. Returns false without emitting anything
+// if the message is not complete yet; the caller keeps the bytes for later.
+bool IBClient::processMsg()
+{
+    const char* begin = m_cursor.pos();
 
     if (!m_connected) {
-        decodeField(m_serverVersion);
+        int serverVersion;
+        QByteArray twsTime;
+        decodeField(serverVersion);
+
+        if (serverVersion >= 20)
+            decodeField(twsTime);
 
-        if (m_serverVersion >= 20)
-            decodeField(m_twsTime);
+        if (m_cursor.underflow())
+            return false;
+
+        m_serverVersion = serverVersion;
+        m_twsTime = twsTime;
 
         if (m_serverVersion < SERVER_VERSION) {
             m_socket->disconnectFromHost();
@@ -1116,29 +1714,15 @@ void IBClient::onReadyRead()
         }
 
         m_connected = true;
-        emit twsConnected();
-
-        //        cleanInBuffer();
+        IB_EMIT(twsConnected());
 
         // DEBUG
         //        qDebug() << "server version:" << m_serverVersion;
         //        qDebug() << "tws time:" << m_twsTime;
-        //        qDebug() << "left over:" << decodeField(m_inBuffer);
+        //        qDebug() << "left over:" << m_cursor.pos();
 
         // send the clientId
-        if (m_serverVersion >= 3) {
-            if (m_serverVersion < MIN_SERVER_VER_LINKING) {
-                encodeField(m_clientId);
-                send();
-            }
-            else if (!m_extraAuth) {
-                const int VERSION = 1;
-                encodeField(START_API);
-                encodeField(VERSION);
-                encodeField(m_clientId);
-                send();
-            }
-        }
+        IB_POST(sendClientId());
     }
 
     else { // yes we're connected
@@ -1146,1322 +1730,1602 @@ void IBClient::onReadyRead()
         int msgId = 0;
 
         decodeField(msgId);
+        if (m_cursor.underflow())
+            return false;
 
 //        qDebug() << "[DEBUG-onReadyRead] msgId:" << msgId;
 
 
-        switch (msgId) {
-        case TICK_PRICE:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            double price;
-            int size;
-            int canAutoExecute;
-
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(price);
-            decodeField(size);
-            decodeField(canAutoExecute);
-
-            emit tickPrice(tickerId, (TickType)tickTypeInt, price, canAutoExecute);
-
-            // process version 2 fields here
-            {
-                TickType sizeTickType = NOT_SET;
-                switch ((TickType)tickTypeInt) {
-                case BID:
-                    sizeTickType = BID_SIZE;
-                    break;
-                case ASK:
-                    sizeTickType = ASK_SIZE;
-                    break;
-                case LAST:
-                    sizeTickType = LAST_SIZE;
-                    break;
-                default:
-                    break;
-                }
-                if (sizeTickType != NOT_SET)
-                    emit tickSize(tickerId, sizeTickType, size);
-            }
-            break;
+        MsgHandler* handler = (msgId > 0 && msgId <= MAX_INCOMING_MSG_ID) ? &m_msgHandlers[msgId] : NULL;
+
+        if (!handler || !handler->decode) {
+            QString errstr("[CRITICAL] UNKNOWN_ID: msgId:"
+                           + QString::number(msgId)
+                           + "buffer: "
+                           + QByteArray(m_cursor.pos(), m_cursor.end() - m_cursor.pos()));
+            pDebug(errstr);
+    
+            IB_EMIT(error( msgId, UNKNOWN_ID.code(), UNKNOWN_ID.msg()));
+            // stop parsing here, disconnectTWS() may only run later on the GUI thread
+            m_inBuffer.clear();
+            IB_POST(disconnectTWS());
+            IB_EMIT(connectionClosed());
+            return true;
         }
-        case TICK_SIZE:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            int size;
 
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(size);
+        QElapsedTimer timer;
+        timer.start();
+
+        if (!(this->*handler->decode)())
+            return false;
+
+        handler->nsecs.fetch_add(timer.nsecsElapsed(), std::memory_order_relaxed);
+        handler->bytes.fetch_add(m_cursor.pos() - begin, std::memory_order_relaxed);
+        handler->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return true;
+}
 
-            emit tickSize(tickerId, (TickType)tickTypeInt, size);
+bool IBClient::decodeTickPrice()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    double price;
+    int size;
+    int canAutoExecute;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(price);
+    decodeField(size);
+    decodeField(canAutoExecute);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickPrice(tickerId, (TickType)tickTypeInt, price, canAutoExecute));
+    IB_POST(dispatchTickPrice(tickerId, (TickType)tickTypeInt, price, canAutoExecute));
+
+    // process version 2 fields here
+    {
+        TickType sizeTickType = NOT_SET;
+        switch ((TickType)tickTypeInt) {
+        case BID:
+            sizeTickType = BID_SIZE;
             break;
-        }
-        case TICK_OPTION_COMPUTATION:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            double impliedVol;
-            double delta;
-
-            double optPrice = DBL_MAX;
-            double pvDividend = DBL_MAX;
-            double gamma = DBL_MAX;
-            double vega = DBL_MAX;
-            double theta = DBL_MAX;
-            double undPrice = DBL_MAX;
-
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(impliedVol);
-            decodeField(delta);
-
-            if (impliedVol < 0)
-                impliedVol = DBL_MAX;
-            if ((delta > 1) || (delta < -1))
-                delta = DBL_MAX;
-            if ((version >= 6) || tickTypeInt == MODEL_OPTION) {
-                decodeField(optPrice);
-                decodeField(pvDividend);
-
-                if (optPrice < 0)
-                    optPrice = DBL_MAX;
-                if (pvDividend < 0)
-                    pvDividend = DBL_MAX;
-            }
-            if (version >= 6) {
-                decodeField(gamma);
-                decodeField(vega);
-                decodeField(theta);
-                decodeField(undPrice);
-
-                if (gamma > 1 || gamma < -1)
-                    gamma = DBL_MAX;
-                if (vega > 1 || vega < -1)
-                    vega = DBL_MAX;
-                if (theta > 1 || theta < -1)
-                    theta = DBL_MAX;
-                if (undPrice < 0)
-                    undPrice = DBL_MAX;
-            }
-            emit tickOptionComputation(tickerId, (TickType)tickTypeInt, impliedVol, delta, optPrice, pvDividend, gamma, vega, theta, undPrice);
+        case ASK:
+            sizeTickType = ASK_SIZE;
+            break;
+        case LAST:
+            sizeTickType = LAST_SIZE;
+            break;
+        default:
             break;
         }
-        case TICK_GENERIC:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            double value;
+        if (sizeTickType != NOT_SET) {
+            IB_EMIT(tickSize(tickerId, sizeTickType, size));
+            IB_POST(dispatchTickSize(tickerId, sizeTickType, size));
+        }
+    }
+    return true;
+}
 
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(value);
+bool IBClient::decodeTickSize()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    int size;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(size);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickSize(tickerId, (TickType)tickTypeInt, size));
+    IB_POST(dispatchTickSize(tickerId, (TickType)tickTypeInt, size));
+    return true;
+}
 
-            emit tickGeneric(tickerId, (TickType)tickTypeInt, value);
-            break;
+bool IBClient::decodeTickOptionComputation()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    double impliedVol;
+    double delta;
+
+    double optPrice = DBL_MAX;
+    double pvDividend = DBL_MAX;
+    double gamma = DBL_MAX;
+    double vega = DBL_MAX;
+    double theta = DBL_MAX;
+    double undPrice = DBL_MAX;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(impliedVol);
+    decodeField(delta);
+
+    if (impliedVol < 0)
+        impliedVol = DBL_MAX;
+    if ((delta > 1) || (delta < -1))
+        delta = DBL_MAX;
+    if ((version >= 6) || tickTypeInt == MODEL_OPTION) {
+        decodeField(optPrice);
+        decodeField(pvDividend);
+
+        if (optPrice < 0)
+            optPrice = DBL_MAX;
+        if (pvDividend < 0)
+            pvDividend = DBL_MAX;
+    }
+    if (version >= 6) {
+        decodeField(gamma);
+        decodeField(vega);
+        decodeField(theta);
+        decodeField(undPrice);
+
+        if (gamma > 1 || gamma < -1)
+            gamma = DBL_MAX;
+        if (vega > 1 || vega < -1)
+            vega = DBL_MAX;
+        if (theta > 1 || theta < -1)
+            theta = DBL_MAX;
+        if (undPrice < 0)
+            undPrice = DBL_MAX;
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickOptionComputation(tickerId, (TickType)tickTypeInt, impliedVol, delta, optPrice, pvDividend, gamma, vega, theta, undPrice));
+    return true;
+}
+
+bool IBClient::decodeTickGeneric()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    double value;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(value);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickGeneric(tickerId, (TickType)tickTypeInt, value));
+    return true;
+}
+
+bool IBClient::decodeTickString()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    QByteArray value;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(value);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickString(tickerId, (TickType)tickTypeInt, value));
+    return true;
+}
+
+bool IBClient::decodeTickEfp()
+{
+    int version;
+    int tickerId;
+    int tickTypeInt;
+    double basisPoints;
+    QByteArray formattedBasisPoints;
+    double impliedFuturesPrice;
+    int holdDays;
+    QByteArray futureExpiry;
+    double dividendImpact;
+    double dividendsToExpiry;
+
+    decodeField(version);
+    decodeField(tickerId);
+    decodeField(tickTypeInt);
+    decodeField(basisPoints);
+    decodeField(formattedBasisPoints);
+    decodeField(impliedFuturesPrice);
+    decodeField(holdDays);
+    decodeField(futureExpiry);
+    decodeField(dividendImpact);
+    decodeField(dividendsToExpiry);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(tickEFP(tickerId, (TickType)tickTypeInt, basisPoints, formattedBasisPoints, impliedFuturesPrice, holdDays, futureExpiry, dividendImpact, dividendsToExpiry));
+    return true;
+}
+
+bool IBClient::decodeOrderStatus()
+{
+    int version;
+    int orderId;
+    QByteArray status;
+    int filled;
+    int remaining;
+    double avgFillPrice;
+    int permId;
+    int parentId;
+    double lastFillPrice;
+    int clientId;
+    QByteArray whyHeld;
+
+    decodeField(version);
+    decodeField(orderId);
+    decodeField(status);
+    decodeField(filled);
+    decodeField(remaining);
+    decodeField(avgFillPrice);
+    decodeField(permId);
+    decodeField(parentId);
+    decodeField(lastFillPrice);
+    decodeField(clientId);
+    decodeField(whyHeld);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(orderStatus(orderId, status, filled, remaining, avgFillPrice, permId, parentId, lastFillPrice, clientId, whyHeld));
+    return true;
+}
+
+bool IBClient::decodeErrMsg()
+{
+    int version;
+    int id;
+    int errorCode;
+    QByteArray errorMsg;
+
+    decodeField(version);
+    decodeField(id);
+    decodeField(errorCode);
+    decodeField(errorMsg);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(error(id, errorCode, errorMsg));
+    if (id > 0)
+        IB_POST(dispatchRequestError(id, errorCode, errorMsg));
+    return true;
+}
+
+// an error for a request made with a handler ends that request
+void IBClient::dispatchRequestError(long reqId, int errorCode, const QByteArray & errorMsg)
+{
+    delete m_realTimeBarsSubscriptions.take(reqId);
+    IBResponseHandler* handler = m_responseHandlers.take(reqId);
+    if (handler)
+        handler->onRequestError(reqId, errorCode, errorMsg);
+}
+
+bool IBClient::decodeOpenOrder()
+{
+    // read version
+    int version;
+    decodeField(version);
+
+    // read order id
+    Order order;
+    decodeField(order.orderId);
+
+    // read contract fields
+    Contract contract;
+    decodeField(contract.conId); // ver 17 field
+    decodeField(contract.symbol);
+    decodeField(contract.secType);
+    decodeField(contract.expiry);
+    decodeField(contract.strike);
+    decodeField(contract.right);
+    if (version >= 32) {
+        decodeField(contract.multiplier);
+    }
+    decodeField(contract.exchange);
+    decodeField(contract.currency);
+    decodeField(contract.localSymbol); // ver 2 field
+    if (version >= 32) {
+        decodeField(contract.tradingClass);
+    }
+
+    // read order fields
+    decodeField(order.action);
+    decodeField(order.totalQuantity);
+    decodeField(order.orderType);
+    if (version < 29) {
+        decodeField(order.lmtPrice);
+    }
+    else {
+        decodeFieldMax( order.lmtPrice);
+    }
+    if (version < 30) {
+        decodeField(order.auxPrice);
+    }
+    else {
+        decodeFieldMax( order.auxPrice);
+    }
+    decodeField(order.tif);
+    decodeField(order.ocaGroup);
+    decodeField(order.account);
+    decodeField(order.openClose);
+
+    int orderOriginInt;
+    decodeField(orderOriginInt);
+    order.origin = (Origin)orderOriginInt;
+
+    decodeField(order.orderRef);
+    decodeField(order.clientId); // ver 3 field
+    decodeField(order.permId); // ver 4 field
+
+    //if( version < 18) {
+    //	// will never happen
+    //	/* order.ignoreRth = */ readBoolFromInt();
+    //}
+
+    decodeField(order.outsideRth); // ver 18 field
+    decodeField(order.hidden); // ver 4 field
+    decodeField(order.discretionaryAmt); // ver 4 field
+    decodeField(order.goodAfterTime); // ver 5 field
+
+    skipField(); // deprecated ver 6 sharesAllocation field
+
+    decodeField(order.faGroup); // ver 7 field
+    decodeField(order.faMethod); // ver 7 field
+    decodeField(order.faPercentage); // ver 7 field
+    decodeField(order.faProfile); // ver 7 field
+
+    decodeField(order.goodTillDate); // ver 8 field
+
+    decodeField(order.rule80A); // ver 9 field
+    decodeFieldMax( order.percentOffset); // ver 9 field
+    decodeField(order.settlingFirm); // ver 9 field
+    decodeField(order.shortSaleSlot); // ver 9 field
+    decodeField(order.designatedLocation); // ver 9 field
+    if( m_serverVersion == MIN_SERVER_VER_SSHORTX_OLD){
+        skipField(); // exemptCode
+    }
+    else if( version >= 23){
+        decodeField(order.exemptCode);
+    }
+    decodeField(order.auctionStrategy); // ver 9 field
+    decodeFieldMax( order.startingPrice); // ver 9 field
+    decodeFieldMax( order.stockRefPrice); // ver 9 field
+    decodeFieldMax( order.delta); // ver 9 field
+    decodeFieldMax( order.stockRangeLower); // ver 9 field
+    decodeFieldMax( order.stockRangeUpper); // ver 9 field
+    decodeField(order.displaySize); // ver 9 field
+
+    //if( version < 18) {
+    //		// will never happen
+    //		/* order.rthOnly = */ readBoolFromInt();
+    //}
+
+    decodeField(order.blockOrder); // ver 9 field
+    decodeField(order.sweepToFill); // ver 9 field
+    decodeField(order.allOrNone); // ver 9 field
+    decodeFieldMax( order.minQty); // ver 9 field
+    decodeField(order.ocaType); // ver 9 field
+    decodeField(order.eTradeOnly); // ver 9 field
+    decodeField(order.firmQuoteOnly); // ver 9 field
+    decodeFieldMax( order.nbboPriceCap); // ver 9 field
+
+    decodeField(order.parentId); // ver 10 field
+    decodeField(order.triggerMethod); // ver 10 field
+
+    decodeFieldMax( order.volatility); // ver 11 field
+    decodeField(order.volatilityType); // ver 11 field
+    decodeField(order.deltaNeutralOrderType); // ver 11 field (had a hack for ver 11)
+    decodeFieldMax( order.deltaNeutralAuxPrice); // ver 12 field
+
+    if (version >= 27 && !order.deltaNeutralOrderType.isEmpty()) {
+        decodeField(order.deltaNeutralConId);
+        decodeField(order.deltaNeutralSettlingFirm);
+        decodeField(order.deltaNeutralClearingAccount);
+        decodeField(order.deltaNeutralClearingIntent);
+    }
+
+    if (version >= 31 && !order.deltaNeutralOrderType.isEmpty()) {
+        decodeField(order.deltaNeutralOpenClose);
+        decodeField(order.deltaNeutralShortSale);
+        decodeField(order.deltaNeutralShortSaleSlot);
+        decodeField(order.deltaNeutralDesignatedLocation);
+    }
+
+    decodeField(order.continuousUpdate); // ver 11 field
+
+    // will never happen
+    //if( m_serverVersion == 26) {
+    //	order.stockRangeLower = readDouble();
+    //	order.stockRangeUpper = readDouble();
+    //}
+
+    decodeField(order.referencePriceType); // ver 11 field
+
+    decodeFieldMax( order.trailStopPrice); // ver 13 field
+
+    if (version >= 30) {
+        decodeFieldMax( order.trailingPercent);
+    }
+
+    decodeFieldMax( order.basisPoints); // ver 14 field
+    decodeFieldMax( order.basisPointsType); // ver 14 field
+    decodeField(contract.comboLegsDescrip); // ver 14 field
+
+    if (version >= 29) {
+        int comboLegsCount = 0;
+        decodeField(comboLegsCount);
+
+        if (comboLegsCount > 0) {
+            QList<ComboLeg*> comboLegs;
+            for (int i = 0; i < comboLegsCount; ++i) {
+                ComboLeg* comboLeg = new ComboLeg();
+                decodeField(comboLeg->conId);
+                decodeField(comboLeg->ratio);
+                decodeField(comboLeg->action);
+                decodeField(comboLeg->exchange);
+                decodeField(comboLeg->openClose);
+                decodeField(comboLeg->shortSaleSlot);
+                decodeField(comboLeg->designatedLocation);
+                decodeField(comboLeg->exemptCode);
+
+                comboLegs.append(comboLeg);
+            }
+            contract.comboLegs = comboLegs;
         }
-        case TICK_STRING:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            QByteArray value;
 
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(value);
+        int orderComboLegsCount = 0;
+        decodeField(orderComboLegsCount);
+        if (orderComboLegsCount > 0) {
+            QList<OrderComboLeg*> orderComboLegs;
+            for (int i = 0; i < orderComboLegsCount; ++i) {
+                OrderComboLeg* orderComboLeg = new OrderComboLeg();
+                decodeFieldMax( orderComboLeg->price);
 
-            emit tickString(tickerId, (TickType)tickTypeInt, value);
-            break;
+                orderComboLegs.append(orderComboLeg);
+            }
+            order.orderComboLegs = orderComboLegs;
         }
-        case TICK_EFP:
-        {
-            int version;
-            int tickerId;
-            int tickTypeInt;
-            double basisPoints;
-            QByteArray formattedBasisPoints;
-            double impliedFuturesPrice;
-            int holdDays;
-            QByteArray futureExpiry;
-            double dividendImpact;
-            double dividendsToExpiry;
-
-            decodeField(version);
-            decodeField(tickerId);
-            decodeField(tickTypeInt);
-            decodeField(basisPoints);
-            decodeField(formattedBasisPoints);
-            decodeField(impliedFuturesPrice);
-            decodeField(holdDays);
-            decodeField(futureExpiry);
-            decodeField(dividendImpact);
-            decodeField(dividendsToExpiry);
-
-            emit tickEFP(tickerId, (TickType)tickTypeInt, basisPoints, formattedBasisPoints, impliedFuturesPrice, holdDays, futureExpiry, dividendImpact, dividendsToExpiry);
-            break;
+    }
+
+    if (version >= 26) {
+        int smartComboRoutingParamsCount = 0;
+        decodeField(smartComboRoutingParamsCount);
+        if( smartComboRoutingParamsCount > 0) {
+            QList<TagValue*> smartComboRoutingParams;
+            for( int i = 0; i < smartComboRoutingParamsCount; ++i) {
+                TagValue* tagValue = new TagValue();
+                decodeField(tagValue->tag);
+                decodeField(tagValue->value);
+                smartComboRoutingParams.append(tagValue);
+            }
+            order.smartComboRoutingParams = smartComboRoutingParams;
         }
-        case ORDER_STATUS:
-        {
-            int version;
-            int orderId;
-            QByteArray status;
-            int filled;
-            int remaining;
-            double avgFillPrice;
-            int permId;
-            int parentId;
-            double lastFillPrice;
-            int clientId;
-            QByteArray whyHeld;
-
-            decodeField(version);
-            decodeField(orderId);
-            decodeField(status);
-            decodeField(filled);
-            decodeField(remaining);
-            decodeField(avgFillPrice);
-            decodeField(permId);
-            decodeField(parentId);
-            decodeField(lastFillPrice);
-            decodeField(clientId);
-            decodeField(whyHeld);
-
-            emit orderStatus(orderId, status, filled, remaining, avgFillPrice, permId, parentId, lastFillPrice, clientId, whyHeld);
-            break;
+    }
+
+    if( version >= 20) {
+        decodeFieldMax( order.scaleInitLevelSize);
+        decodeFieldMax( order.scaleSubsLevelSize);
+    }
+    else {
+        // ver 15 fields
+        int notSuppScaleNumComponents = 0;
+        decodeFieldMax( notSuppScaleNumComponents);
+        decodeFieldMax( order.scaleInitLevelSize); // scaleComponectSize
+    }
+    decodeFieldMax( order.scalePriceIncrement); // ver 15 field
+
+    if (version >= 28 && order.scalePriceIncrement > 0.0 && order.scalePriceIncrement != UNSET_DOUBLE) {
+        decodeFieldMax( order.scalePriceAdjustValue);
+        decodeFieldMax( order.scalePriceAdjustInterval);
+        decodeFieldMax( order.scaleProfitOffset);
+        decodeField(order.scaleAutoReset);
+        decodeFieldMax( order.scaleInitPosition);
+        decodeFieldMax( order.scaleInitFillQty);
+        decodeField(order.scaleRandomPercent);
+    }
+
+    if( version >= 24) {
+        decodeField(order.hedgeType);
+        if( !order.hedgeType.isEmpty()) {
+            decodeField(order.hedgeParam);
         }
-        case ERR_MSG:
-        {
-            int version;
-            int id;
-            int errorCode;
-            QByteArray errorMsg;
+    }
+
+    if( version >= 25) {
+        decodeField(order.optOutSmartRouting);
+    }
 
-            decodeField(version);
-            decodeField(id);
-            decodeField(errorCode);
-            decodeField(errorMsg);
+    decodeField(order.clearingAccount); // ver 19 field
+    decodeField(order.clearingIntent); // ver 19 field
 
-            emit error(id, errorCode, errorMsg);
-            break;
+    if( version >= 22) {
+        decodeField(order.notHeld);
+    }
+
+    UnderComp underComp;
+    if( version >= 20) {
+        bool underCompPresent = false;
+        decodeField(underCompPresent);
+        if( underCompPresent){
+            decodeField(underComp.conId);
+            decodeField(underComp.delta);
+            decodeField(underComp.price);
+            contract.underComp = &underComp;
         }
-        case OPEN_ORDER:
-        {
-            // read version
-            int version;
-            decodeField(version);
-
-            // read order id
-            Order order;
-            decodeField(order.orderId);
-
-            // read contract fields
-            Contract contract;
-            decodeField(contract.conId); // ver 17 field
-            decodeField(contract.symbol);
-            decodeField(contract.secType);
-            decodeField(contract.expiry);
-            decodeField(contract.strike);
-            decodeField(contract.right);
-            if (version >= 32) {
-                decodeField(contract.multiplier);
-            }
-            decodeField(contract.exchange);
-            decodeField(contract.currency);
-            decodeField(contract.localSymbol); // ver 2 field
-            if (version >= 32) {
-                decodeField(contract.tradingClass);
-            }
+    }
 
-            // read order fields
-            decodeField(order.action);
-            decodeField(order.totalQuantity);
-            decodeField(order.orderType);
-            if (version < 29) {
-                decodeField(order.lmtPrice);
-            }
-            else {
-                decodeFieldMax( order.lmtPrice);
-            }
-            if (version < 30) {
-                decodeField(order.auxPrice);
-            }
-            else {
-                decodeFieldMax( order.auxPrice);
-            }
-            decodeField(order.tif);
-            decodeField(order.ocaGroup);
-            decodeField(order.account);
-            decodeField(order.openClose);
-
-            int orderOriginInt;
-            decodeField(orderOriginInt);
-            order.origin = (Origin)orderOriginInt;
-
-            decodeField(order.orderRef);
-            decodeField(order.clientId); // ver 3 field
-            decodeField(order.permId); // ver 4 field
-
-            //if( version < 18) {
-            //	// will never happen
-            //	/* order.ignoreRth = */ readBoolFromInt();
-            //}
-
-            decodeField(order.outsideRth); // ver 18 field
-            decodeField(order.hidden); // ver 4 field
-            decodeField(order.discretionaryAmt); // ver 4 field
-            decodeField(order.goodAfterTime); // ver 5 field
-
-            {
-                QByteArray sharesAllocation;
-                decodeField(sharesAllocation); // deprecated ver 6 field
-            }
 
-            decodeField(order.faGroup); // ver 7 field
-            decodeField(order.faMethod); // ver 7 field
-            decodeField(order.faPercentage); // ver 7 field
-            decodeField(order.faProfile); // ver 7 field
-
-            decodeField(order.goodTillDate); // ver 8 field
-
-            decodeField(order.rule80A); // ver 9 field
-            decodeFieldMax( order.percentOffset); // ver 9 field
-            decodeField(order.settlingFirm); // ver 9 field
-            decodeField(order.shortSaleSlot); // ver 9 field
-            decodeField(order.designatedLocation); // ver 9 field
-            if( m_serverVersion == MIN_SERVER_VER_SSHORTX_OLD){
-                int exemptCode;
-                decodeField(exemptCode);
-            }
-            else if( version >= 23){
-                decodeField(order.exemptCode);
-            }
-            decodeField(order.auctionStrategy); // ver 9 field
-            decodeFieldMax( order.startingPrice); // ver 9 field
-            decodeFieldMax( order.stockRefPrice); // ver 9 field
-            decodeFieldMax( order.delta); // ver 9 field
-            decodeFieldMax( order.stockRangeLower); // ver 9 field
-            decodeFieldMax( order.stockRangeUpper); // ver 9 field
-            decodeField(order.displaySize); // ver 9 field
-
-            //if( version < 18) {
-            //		// will never happen
-            //		/* order.rthOnly = */ readBoolFromInt();
-            //}
-
-            decodeField(order.blockOrder); // ver 9 field
-            decodeField(order.sweepToFill); // ver 9 field
-            decodeField(order.allOrNone); // ver 9 field
-            decodeFieldMax( order.minQty); // ver 9 field
-            decodeField(order.ocaType); // ver 9 field
-            decodeField(order.eTradeOnly); // ver 9 field
-            decodeField(order.firmQuoteOnly); // ver 9 field
-            decodeFieldMax( order.nbboPriceCap); // ver 9 field
-
-            decodeField(order.parentId); // ver 10 field
-            decodeField(order.triggerMethod); // ver 10 field
-
-            decodeFieldMax( order.volatility); // ver 11 field
-            decodeField(order.volatilityType); // ver 11 field
-            decodeField(order.deltaNeutralOrderType); // ver 11 field (had a hack for ver 11)
-            decodeFieldMax( order.deltaNeutralAuxPrice); // ver 12 field
-
-            if (version >= 27 && !order.deltaNeutralOrderType.isEmpty()) {
-                decodeField(order.deltaNeutralConId);
-                decodeField(order.deltaNeutralSettlingFirm);
-                decodeField(order.deltaNeutralClearingAccount);
-                decodeField(order.deltaNeutralClearingIntent);
+    if( version >= 21) {
+        decodeField(order.algoStrategy);
+        if( !order.algoStrategy.isEmpty()) {
+            int algoParamsCount = 0;
+            decodeField(algoParamsCount);
+            if( algoParamsCount > 0) {
+                for( int i = 0; i < algoParamsCount; ++i) {
+                    TagValue* tagValue = new TagValue();
+                    decodeField(tagValue->tag);
+                    decodeField(tagValue->value);
+                    order.algoParams.append( tagValue);
+                }
             }
+        }
+    }
 
-            if (version >= 31 && !order.deltaNeutralOrderType.isEmpty()) {
-                decodeField(order.deltaNeutralOpenClose);
-                decodeField(order.deltaNeutralShortSale);
-                decodeField(order.deltaNeutralShortSaleSlot);
-                decodeField(order.deltaNeutralDesignatedLocation);
-            }
+    OrderState orderState;
 
-            decodeField(order.continuousUpdate); // ver 11 field
+    decodeField(order.whatIf); // ver 16 field
 
-            // will never happen
-            //if( m_serverVersion == 26) {
-            //	order.stockRangeLower = readDouble();
-            //	order.stockRangeUpper = readDouble();
-            //}
+    decodeField(orderState.status); // ver 16 field
+    decodeField(orderState.initMargin); // ver 16 field
+    decodeField(orderState.maintMargin); // ver 16 field
+    decodeField(orderState.equityWithLoan); // ver 16 field
+    decodeFieldMax( orderState.commission); // ver 16 field
+    decodeFieldMax( orderState.minCommission); // ver 16 field
+    decodeFieldMax( orderState.maxCommission); // ver 16 field
+    decodeField(orderState.commissionCurrency); // ver 16 field
+    decodeField(orderState.warningText); // ver 16 field
 
-            decodeField(order.referencePriceType); // ver 11 field
+    if (m_cursor.underflow())
+        return false;
 
-            decodeFieldMax( order.trailStopPrice); // ver 13 field
+    IB_EMIT(openOrder( (OrderId)order.orderId, contract, order, orderState));
+    return true;
+}
 
-            if (version >= 30) {
-                decodeFieldMax( order.trailingPercent);
-            }
+bool IBClient::decodeAcctValue()
+{
+    int version;
+    QByteArray key;
+    QByteArray val;
+    QByteArray cur;
+    QByteArray accountName;
+
+    decodeField(version);
+    decodeField(key);
+    decodeField(val);
+    decodeField(cur);
+    decodeField(accountName); // ver 2 field
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(updateAccountValue( key, val, cur, accountName));
+    return true;
+}
 
-            decodeFieldMax( order.basisPoints); // ver 14 field
-            decodeFieldMax( order.basisPointsType); // ver 14 field
-            decodeField(contract.comboLegsDescrip); // ver 14 field
-
-            if (version >= 29) {
-                int comboLegsCount = 0;
-                decodeField(comboLegsCount);
-
-                if (comboLegsCount > 0) {
-                    QList<ComboLeg*> comboLegs;
-                    for (int i = 0; i < comboLegsCount; ++i) {
-                        ComboLeg* comboLeg = new ComboLeg();
-                        decodeField(comboLeg->conId);
-                        decodeField(comboLeg->ratio);
-                        decodeField(comboLeg->action);
-                        decodeField(comboLeg->exchange);
-                        decodeField(comboLeg->openClose);
-                        decodeField(comboLeg->shortSaleSlot);
-                        decodeField(comboLeg->designatedLocation);
-                        decodeField(comboLeg->exemptCode);
-
-                        comboLegs.append(comboLeg);
-                    }
-                    contract.comboLegs = comboLegs;
-                }
+bool IBClient::decodePortfolioValue()
+{
+    // decode version
+    int version;
+    decodeField(version);
+
+    // read contract fields
+    Contract contract;
+    decodeField(contract.conId); // ver 6 field
+    decodeField(contract.symbol);
+    decodeField(contract.secType);
+    decodeField(contract.expiry);
+    decodeField(contract.strike);
+    decodeField(contract.right);
+
+    if( version >= 7) {
+        decodeField(contract.multiplier);
+        decodeField(contract.primaryExchange);
+    }
+
+    decodeField(contract.currency);
+    decodeField(contract.localSymbol); // ver 2 field
+    if (version >= 8) {
+        decodeField(contract.tradingClass);
+    }
+
+    int     position;
+    double  marketPrice;
+    double  marketValue;
+    double  averageCost;
+    double  unrealizedPNL;
+    double  realizedPNL;
+
+    decodeField(position);
+    decodeField(marketPrice);
+    decodeField(marketValue);
+    decodeField(averageCost); // ver 3 field
+    decodeField(unrealizedPNL); // ver 3 field
+    decodeField(realizedPNL); // ver 3 field
+
+    QByteArray accountName;
+    decodeField(accountName); // ver 4 field
+    if( version == 6 && m_serverVersion == 39) {
+        decodeField(contract.primaryExchange);
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(updatePortfolio( contract,
+                          position, marketPrice, marketValue, averageCost,
+                          unrealizedPNL, realizedPNL, accountName));
+
+    return true;
+}
 
-                int orderComboLegsCount = 0;
-                decodeField(orderComboLegsCount);
-                if (orderComboLegsCount > 0) {
-                    QList<OrderComboLeg*> orderComboLegs;
-                    for (int i = 0; i < orderComboLegsCount; ++i) {
-                        OrderComboLeg* orderComboLeg = new OrderComboLeg();
-                        decodeFieldMax( orderComboLeg->price);
-
-                        orderComboLegs.append(orderComboLeg);
-                    }
-                    order.orderComboLegs = orderComboLegs;
-                }
-            }
+bool IBClient::decodeAcctUpdateTime()
+{
+    int version;
+    QByteArray accountTime;
 
-            if (version >= 26) {
-                int smartComboRoutingParamsCount = 0;
-                decodeField(smartComboRoutingParamsCount);
-                if( smartComboRoutingParamsCount > 0) {
-                    QList<TagValue*> smartComboRoutingParams;
-                    for( int i = 0; i < smartComboRoutingParamsCount; ++i) {
-                        TagValue* tagValue = new TagValue();
-                        decodeField(tagValue->tag);
-                        decodeField(tagValue->value);
-                        smartComboRoutingParams.append(tagValue);
-                    }
-                    order.smartComboRoutingParams = smartComboRoutingParams;
-                }
-            }
+    decodeField(version);
+    decodeField(accountTime);
 
-            if( version >= 20) {
-                decodeFieldMax( order.scaleInitLevelSize);
-                decodeFieldMax( order.scaleSubsLevelSize);
-            }
-            else {
-                // ver 15 fields
-                int notSuppScaleNumComponents = 0;
-                decodeFieldMax( notSuppScaleNumComponents);
-                decodeFieldMax( order.scaleInitLevelSize); // scaleComponectSize
-            }
-            decodeFieldMax( order.scalePriceIncrement); // ver 15 field
-
-            if (version >= 28 && order.scalePriceIncrement > 0.0 && order.scalePriceIncrement != UNSET_DOUBLE) {
-                decodeFieldMax( order.scalePriceAdjustValue);
-                decodeFieldMax( order.scalePriceAdjustInterval);
-                decodeFieldMax( order.scaleProfitOffset);
-                decodeField(order.scaleAutoReset);
-                decodeFieldMax( order.scaleInitPosition);
-                decodeFieldMax( order.scaleInitFillQty);
-                decodeField(order.scaleRandomPercent);
-            }
+    if (m_cursor.underflow())
+        return false;
 
-            if( version >= 24) {
-                decodeField(order.hedgeType);
-                if( !order.hedgeType.isEmpty()) {
-                    decodeField(order.hedgeParam);
-                }
-            }
+    IB_EMIT(updateAccountTime( accountTime));
+    return true;
+}
 
-            if( version >= 25) {
-                decodeField(order.optOutSmartRouting);
-            }
+bool IBClient::decodeNextValidId()
+{
+    int version;
+    int orderId;
 
-            decodeField(order.clearingAccount); // ver 19 field
-            decodeField(order.clearingIntent); // ver 19 field
+    decodeField(version);
+    decodeField(orderId);
 
-            if( version >= 22) {
-                decodeField(order.notHeld);
-            }
+    if (m_cursor.underflow())
+        return false;
 
-            UnderComp underComp;
-            if( version >= 20) {
-                bool underCompPresent = false;
-                decodeField(underCompPresent);
-                if( underCompPresent){
-                    decodeField(underComp.conId);
-                    decodeField(underComp.delta);
-                    decodeField(underComp.price);
-                    contract.underComp = &underComp;
-                }
+    IB_POST(m_ready = true);
+    IB_EMIT(nextValidId(orderId));
+    return true;
+}
+
+bool IBClient::decodeContractData()
+{
+    int version;
+    decodeField(version);
+
+    int reqId = -1;
+    if( version >= 3) {
+        decodeField(reqId);
+    }
+
+    ContractDetails contract;
+    decodeField(contract.summary.symbol);
+    decodeField(contract.summary.secType);
+    decodeField(contract.summary.expiry);
+    decodeField(contract.summary.strike);
+    decodeField(contract.summary.right);
+    decodeField(contract.summary.exchange);
+    decodeField(contract.summary.currency);
+    decodeField(contract.summary.localSymbol);
+    decodeField(contract.marketName);
+    decodeField(contract.summary.tradingClass);
+    decodeField(contract.summary.conId);
+    decodeField(contract.minTick);
+    decodeField(contract.summary.multiplier);
+    decodeField(contract.orderTypes);
+    decodeField(contract.validExchanges);
+    decodeField(contract.priceMagnifier); // ver 2 field
+    if( version >= 4) {
+        decodeField(contract.underConId);
+    }
+    if( version >= 5) {
+        decodeField(contract.longName);
+        decodeField(contract.summary.primaryExchange);
+    }
+    if( version >= 6) {
+        decodeField(contract.contractMonth);
+        decodeField(contract.industry);
+        decodeField(contract.category);
+        decodeField(contract.subcategory);
+        decodeField(contract.timeZoneId);
+        decodeField(contract.tradingHours);
+        decodeField(contract.liquidHours);
+    }
+    if( version >= 8) {
+        decodeField(contract.evRule);
+        decodeField(contract.evMultiplier);
+    }
+    if( version >= 7) {
+        int secIdListCount = 0;
+        decodeField(secIdListCount);
+        if( secIdListCount > 0) {
+            for( int i = 0; i < secIdListCount; ++i) {
+                TagValue* tagValue = new TagValue();
+                decodeField(tagValue->tag);
+                decodeField(tagValue->value);
+                contract.secIdList.append( tagValue);
             }
+        }
+    }
 
+    if (m_cursor.underflow())
+        return false;
 
-            if( version >= 21) {
-                decodeField(order.algoStrategy);
-                if( !order.algoStrategy.isEmpty()) {
-                    int algoParamsCount = 0;
-                    decodeField(algoParamsCount);
-                    if( algoParamsCount > 0) {
-                        for( int i = 0; i < algoParamsCount; ++i) {
-                            TagValue* tagValue = new TagValue();
-                            decodeField(tagValue->tag);
-                            decodeField(tagValue->value);
-                            order.algoParams.append( tagValue);
-                        }
-                    }
-                }
+    IB_POST(dispatchContractDetails( reqId, contract));
+    return true;
+}
+
+bool IBClient::decodeBondContractData()
+{
+    int version;
+    decodeField(version);
+
+    int reqId = -1;
+    if( version >= 3) {
+        decodeField(reqId);
+    }
+
+    ContractDetails contract;
+    decodeField(contract.summary.symbol);
+    decodeField(contract.summary.secType);
+    decodeField(contract.cusip);
+    decodeField(contract.coupon);
+    decodeField(contract.maturity);
+    decodeField(contract.issueDate);
+    decodeField(contract.ratings);
+    decodeField(contract.bondType);
+    decodeField(contract.couponType);
+    decodeField(contract.convertible);
+    decodeField(contract.callable);
+    decodeField(contract.putable);
+    decodeField(contract.descAppend);
+    decodeField(contract.summary.exchange);
+    decodeField(contract.summary.currency);
+    decodeField(contract.marketName);
+    decodeField(contract.summary.tradingClass);
+    decodeField(contract.summary.conId);
+    decodeField(contract.minTick);
+    decodeField(contract.orderTypes);
+    decodeField(contract.validExchanges);
+    decodeField(contract.nextOptionDate); // ver 2 field
+    decodeField(contract.nextOptionType); // ver 2 field
+    decodeField(contract.nextOptionPartial); // ver 2 field
+    decodeField(contract.notes); // ver 2 field
+    if( version >= 4) {
+        decodeField(contract.longName);
+    }
+    if( version >= 6) {
+        decodeField(contract.evRule);
+        decodeField(contract.evMultiplier);
+    }
+    if( version >= 5) {
+        int secIdListCount = 0;
+        decodeField(secIdListCount);
+        if( secIdListCount > 0) {
+            for( int i = 0; i < secIdListCount; ++i) {
+                TagValue* tagValue = new TagValue();
+                decodeField(tagValue->tag);
+                decodeField(tagValue->value);
+                contract.secIdList.append(tagValue);
             }
+        }
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(bondContractDetails( reqId, contract));
+    return true;
+}
+
+bool IBClient::decodeExecutionData()
+{
+    int version;
+    decodeField(version);
+
+    int reqId = -1;
+    if( version >= 7) {
+        decodeField(reqId);
+    }
 
-            OrderState orderState;
+    int orderId;
+    decodeField(orderId);
+
+    // decode contract fields
+    Contract contract;
+    decodeField(contract.conId); // ver 5 field
+    decodeField(contract.symbol);
+    decodeField(contract.secType);
+    decodeField(contract.expiry);
+    decodeField(contract.strike);
+    decodeField(contract.right);
+    if( version >= 9) {
+        decodeField(contract.multiplier);
+    }
+    decodeField(contract.exchange);
+    decodeField(contract.currency);
+    decodeField(contract.localSymbol);
+    if (version >= 10) {
+        decodeField(contract.tradingClass);
+    }
 
-            decodeField(order.whatIf); // ver 16 field
+    // decode execution fields
+    Execution exec;
+    exec.orderId = orderId;
+    decodeField(exec.execId);
+    decodeField(exec.time);
+    decodeField(exec.acctNumber);
+    decodeField(exec.exchange);
+    decodeField(exec.side);
+    decodeField(exec.shares);
+    decodeField(exec.price);
+    decodeField(exec.permId); // ver 2 field
+    decodeField(exec.clientId); // ver 3 field
+    decodeField(exec.liquidation); // ver 4 field
 
-            decodeField(orderState.status); // ver 16 field
-            decodeField(orderState.initMargin); // ver 16 field
-            decodeField(orderState.maintMargin); // ver 16 field
-            decodeField(orderState.equityWithLoan); // ver 16 field
-            decodeFieldMax( orderState.commission); // ver 16 field
-            decodeFieldMax( orderState.minCommission); // ver 16 field
-            decodeFieldMax( orderState.maxCommission); // ver 16 field
-            decodeField(orderState.commissionCurrency); // ver 16 field
-            decodeField(orderState.warningText); // ver 16 field
+    if( version >= 6) {
+        decodeField(exec.cumQty);
+        decodeField(exec.avgPrice);
+    }
+
+    if( version >= 8) {
+        decodeField(exec.orderRef);
+    }
+
+    if( version >= 9) {
+        decodeField(exec.evRule);
+        decodeField(exec.evMultiplier);
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(execDetails( reqId, contract, exec));
+    return true;
+}
+
+bool IBClient::decodeMarketDepth()
+{
+    int version;
+    int id;
+    int position;
+    int operation;
+    int side;
+    double price;
+    int size;
+
+    decodeField(version);
+    decodeField(id);
+    decodeField(position);
+    decodeField(operation);
+    decodeField(side);
+    decodeField(price);
+    decodeField(size);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_POST(dispatchMktDepth( id, position, operation, side, price, size));
+    return true;
+}
 
-            emit openOrder( (OrderId)order.orderId, contract, order, orderState);
-            break;
-        }
-        case ACCT_VALUE:
-        {
-            int version;
-            QByteArray key;
-            QByteArray val;
-            QByteArray cur;
-            QByteArray accountName;
-
-            decodeField(version);
-            decodeField(key);
-            decodeField(val);
-            decodeField(cur);
-            decodeField(accountName); // ver 2 field
-
-            emit updateAccountValue( key, val, cur, accountName);
-            break;
-        }
+void IBClient::dispatchMktDepth(TickerId id, int position, int operation, int side, double price, int size)
+{
+    MktDepthSubscription* sub = m_mktDepthSubscriptions.value(id);
+    if (sub)
+        sub->book.apply(position, operation, side, price, size);
+    emit updateMktDepth(id, position, operation, side, price, size);
+}
 
-        case PORTFOLIO_VALUE:
-        {
-            // decode version
-            int version;
-            decodeField(version);
-
-            // read contract fields
-            Contract contract;
-            decodeField(contract.conId); // ver 6 field
-            decodeField(contract.symbol);
-            decodeField(contract.secType);
-            decodeField(contract.expiry);
-            decodeField(contract.strike);
-            decodeField(contract.right);
-
-            if( version >= 7) {
-                decodeField(contract.multiplier);
-                decodeField(contract.primaryExchange);
-            }
+void IBClient::dispatchMktDepthL2(TickerId id, int position, const QByteArray &marketMaker, int operation, int side,
+                                  double price, int size)
+{
+    MktDepthSubscription* sub = m_mktDepthSubscriptions.value(id);
+    if (sub)
+        sub->book.apply(position, operation, side, price, size);
+    emit updateMktDepthL2(id, position, marketMaker, operation, side, price, size);
+}
 
-            decodeField(contract.currency);
-            decodeField(contract.localSymbol); // ver 2 field
-            if (version >= 8) {
-                decodeField(contract.tradingClass);
-            }
+bool IBClient::decodeMarketDepthL2()
+{
+    int version;
+    int id;
+    int position;
+    QByteArray marketMaker;
+    int operation;
+    int side;
+    double price;
+    int size;
+
+    decodeField(version);
+    decodeField(id);
+    decodeField(position);
+    decodeField(marketMaker);
+    decodeField(operation);
+    decodeField(side);
+    decodeField(price);
+    decodeField(size);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_POST(dispatchMktDepthL2( id, position, marketMaker, operation, side,
+                           price, size));
+
+    return true;
+}
 
-            int     position;
-            double  marketPrice;
-            double  marketValue;
-            double  averageCost;
-            double  unrealizedPNL;
-            double  realizedPNL;
-
-            decodeField(position);
-            decodeField(marketPrice);
-            decodeField(marketValue);
-            decodeField(averageCost); // ver 3 field
-            decodeField(unrealizedPNL); // ver 3 field
-            decodeField(realizedPNL); // ver 3 field
-
-            QByteArray accountName;
-            decodeField(accountName); // ver 4 field
-            if( version == 6 && m_serverVersion == 39) {
-                decodeField(contract.primaryExchange);
-            }
+bool IBClient::decodeNewsBulletins()
+{
+    int version;
+    int msgId;
+    int msgType;
+    QByteArray newsMessage;
+    QByteArray originatingExch;
+
+    decodeField(version);
+    decodeField(msgId);
+    decodeField(msgType);
+    decodeField(newsMessage);
+    decodeField(originatingExch);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(updateNewsBulletin( msgId, msgType, newsMessage, originatingExch));
+    return true;
+}
 
-            emit updatePortfolio( contract,
-                                  position, marketPrice, marketValue, averageCost,
-                                  unrealizedPNL, realizedPNL, accountName);
+bool IBClient::decodeManagedAccts()
+{
+    int version;
+    QByteArray accountsList;
 
-            break;
-        }
-        case ACCT_UPDATE_TIME:
-        {
-            int version;
-            QByteArray accountTime;
+    decodeField(version);
+    decodeField(accountsList);
 
-            decodeField(version);
-            decodeField(accountTime);
+    if (m_cursor.underflow())
+        return false;
 
-            emit updateAccountTime( accountTime);
-            break;
-        }
+    IB_EMIT(managedAccounts( accountsList));
+    return true;
+}
 
-        case NEXT_VALID_ID:
-        {
-            int version;
-            int orderId;
+bool IBClient::decodeReceiveFa()
+{
+    int version;
+    int faDataTypeInt;
+    QByteArray cxml;
 
-            decodeField(version);
-            decodeField(orderId);
+    decodeField(version);
+    decodeField(faDataTypeInt);
+    decodeField(cxml);
 
-            emit nextValidId(orderId);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case CONTRACT_DATA:
-        {
-            int version;
-            decodeField(version);
+    IB_EMIT(receiveFA( (FaDataType)faDataTypeInt, cxml));
+    return true;
+}
 
-            int reqId = -1;
-            if( version >= 3) {
-                decodeField(reqId);
-            }
+// value of n decimal digits at f, -1 if there is anything else
+static int parseDigits(const char* f, int n)
+{
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        if (f[i] < '0' || f[i] > '9')
+            return -1;
+        v = v * 10 + (f[i] - '0');
+    }
+    return v;
+}
 
-            ContractDetails contract;
-            decodeField(contract.summary.symbol);
-            decodeField(contract.summary.secType);
-            decodeField(contract.summary.expiry);
-            decodeField(contract.summary.strike);
-            decodeField(contract.summary.right);
-            decodeField(contract.summary.exchange);
-            decodeField(contract.summary.currency);
-            decodeField(contract.summary.localSymbol);
-            decodeField(contract.marketName);
-            decodeField(contract.summary.tradingClass);
-            decodeField(contract.summary.conId);
-            decodeField(contract.minTick);
-            decodeField(contract.summary.multiplier);
-            decodeField(contract.orderTypes);
-            decodeField(contract.validExchanges);
-            decodeField(contract.priceMagnifier); // ver 2 field
-            if( version >= 4) {
-                decodeField(contract.underConId);
-            }
-            if( version >= 5) {
-                decodeField(contract.longName);
-                decodeField(contract.summary.primaryExchange);
-            }
-            if( version >= 6) {
-                decodeField(contract.contractMonth);
-                decodeField(contract.industry);
-                decodeField(contract.category);
-                decodeField(contract.subcategory);
-                decodeField(contract.timeZoneId);
-                decodeField(contract.tradingHours);
-                decodeField(contract.liquidHours);
-            }
-            if( version >= 8) {
-                decodeField(contract.evRule);
-                decodeField(contract.evMultiplier);
-            }
-            if( version >= 7) {
-                int secIdListCount = 0;
-                decodeField(secIdListCount);
-                if( secIdListCount > 0) {
-                    for( int i = 0; i < secIdListCount; ++i) {
-                        TagValue* tagValue = new TagValue();
-                        decodeField(tagValue->tag);
-                        decodeField(tagValue->value);
-                        contract.secIdList.append( tagValue);
-                    }
-                }
-            }
+// the local hour the last bar date fell in, bars of a block share it
+struct BarHour
+{
+    BarHour() : key(-1), time(0) {}
 
-            emit contractDetails( reqId, contract);
-            break;
-        }
+    int     key;    // yyyyMMddHH
+    double  time;
+};
 
-        case BOND_CONTRACT_DATA:
-        {
-            int version;
-            decodeField(version);
+// Epoch seconds of a bar date: formatDate 2 sends them as is, daily bars and
+// formatDate 1 send local "yyyyMMdd" and "yyyyMMdd  HH:mm:ss". The digits
+// are read in place and the local time is only looked up once per hour.
+static double barTimeStamp(const char* f, int len, BarHour & hour)
+{
+    if (len != 8 && !(len > 8 && f[8] == ' '))
+        return IBFieldCursor::toDouble(f, len);
+
+    const char* t = f + 8;
+    const char* e = f + len;
+    while (t < e && *t == ' ')
+        ++t;
+
+    const int ymd = parseDigits(f, 8);
+    int h = 0, m = 0, sec = 0;
+    if (ymd < 0 || (t < e && (e - t != 8 || t[2] != ':' || t[5] != ':'
+                             || (h = parseDigits(t, 2)) < 0 || (m = parseDigits(t + 3, 2)) < 0
+                             || (sec = parseDigits(t + 6, 2)) < 0))) {
+        QTime time(0, 0);
+        if (len > 8)
+            time = QTime::fromString(QString::fromLatin1(f + 8, len - 8).trimmed(), "HH:mm:ss");
+        return (double)QDateTime(QDate(ymd / 10000, (ymd / 100) % 100, ymd % 100), time).toTime_t();
+    }
+
+    const int key = ymd * 100 + h;
+    if (key != hour.key) {
+        hour.key = key;
+        hour.time = (double)QDateTime(QDate(ymd / 10000, (ymd / 100) % 100, ymd % 100), QTime(h, 0)).toTime_t();
+    }
+    return hour.time + m * 60 + sec;
+}
 
-            int reqId = -1;
-            if( version >= 3) {
-                decodeField(reqId);
-            }
+bool IBClient::decodeHistoricalData()
+{
+    int version;
+    int reqId;
+
+    decodeField(version);
+    decodeField(reqId);
+
+    IBHistoricalBars bars;
+    decodeField(bars.startDate); // ver 2 field
+    decodeField(bars.endDate); // ver 2 field
+
+    int itemCount;
+    decodeField(itemCount);
+
+    // all bars or nothing, a block of them usually takes several reads
+    if (itemCount > 0 && !m_cursor.require(itemCount * 9))
+        return false;
+    if (itemCount > 0)
+        bars.reserve(itemCount);
+
+    BarHour hour;
+    for( int ctr = 0; ctr < itemCount; ++ctr) {
+        const char* f;
+        int len;
+        m_cursor.next(f, len);
+        bars.dates.append(f, len).append('\0');
+        bars.timeStamp.append(barTimeStamp(f, len, hour));
+
+        double open, high, low, close, wap;
+        int volume, barCount;
+        decodeField(open);
+        decodeField(high);
+        decodeField(low);
+        decodeField(close);
+        decodeField(volume);
+        decodeField(wap);
+        const bool hasGaps = m_cursor.readEquals("true");
+        decodeField(barCount); // ver 3 field
+
+        bars.open.append(open);
+        bars.high.append(high);
+        bars.low.append(low);
+        bars.close.append(close);
+        bars.volume.append((uint)volume);
+        bars.barCount.append((uint)barCount);
+        bars.wap.append(wap);
+        bars.hasGaps.append(hasGaps);
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_POST(dispatchHistoricalBars(reqId, bars));
+
+    return true;
+}
 
-            ContractDetails contract;
-            decodeField(contract.summary.symbol);
-            decodeField(contract.summary.secType);
-            decodeField(contract.cusip);
-            decodeField(contract.coupon);
-            decodeField(contract.maturity);
-            decodeField(contract.issueDate);
-            decodeField(contract.ratings);
-            decodeField(contract.bondType);
-            decodeField(contract.couponType);
-            decodeField(contract.convertible);
-            decodeField(contract.callable);
-            decodeField(contract.putable);
-            decodeField(contract.descAppend);
-            decodeField(contract.summary.exchange);
-            decodeField(contract.summary.currency);
-            decodeField(contract.marketName);
-            decodeField(contract.summary.tradingClass);
-            decodeField(contract.summary.conId);
-            decodeField(contract.minTick);
-            decodeField(contract.orderTypes);
-            decodeField(contract.validExchanges);
-            decodeField(contract.nextOptionDate); // ver 2 field
-            decodeField(contract.nextOptionType); // ver 2 field
-            decodeField(contract.nextOptionPartial); // ver 2 field
-            decodeField(contract.notes); // ver 2 field
-            if( version >= 4) {
-                decodeField(contract.longName);
-            }
-            if( version >= 6) {
-                decodeField(contract.evRule);
-                decodeField(contract.evMultiplier);
-            }
-            if( version >= 5) {
-                int secIdListCount = 0;
-                decodeField(secIdListCount);
-                if( secIdListCount > 0) {
-                    for( int i = 0; i < secIdListCount; ++i) {
-                        TagValue* tagValue = new TagValue();
-                        decodeField(tagValue->tag);
-                        decodeField(tagValue->value);
-                        contract.secIdList.append(tagValue);
-                    }
-                }
-            }
+// Hands the block to the handler passed to reqHistoricalData(), otherwise
+// falls back to one historicalData signal per bar and the "finished" marker.
+void IBClient::dispatchHistoricalBars(TickerId reqId, const IBHistoricalBars & bars)
+{
+    IBResponseHandler* handler = m_responseHandlers.take(reqId);
+    if (handler) {
+        handler->onHistoricalBars(reqId, bars);
+        return;
+    }
 
-            emit bondContractDetails( reqId, contract);
-            break;
-        }
+    IBFieldCursor dates(bars.dates.constData(), bars.dates.constData() + bars.dates.size());
+    for (int i = 0; i < bars.size(); ++i) {
+        emit historicalData(reqId, dates.readString(), bars.open.at(i), bars.high.at(i), bars.low.at(i),
+                            bars.close.at(i), bars.volume.at(i), bars.barCount.at(i), bars.wap.at(i),
+                            bars.hasGaps.at(i) ? 1 : 0);
+    }
 
-        case EXECUTION_DATA:
-        {
-            int version;
-            decodeField(version);
+    // send end of dataset marker
+    QByteArray finishedStr = QByteArray("finished-") + bars.startDate + "-" + bars.endDate;
+    emit historicalData(reqId, finishedStr, -1, -1, -1, -1, -1, -1, -1, 0);
+}
 
-            int reqId = -1;
-            if( version >= 7) {
-                decodeField(reqId);
-            }
+void IBClient::dispatchContractDetails(int reqId, const ContractDetails & details)
+{
+    IBResponseHandler* handler = m_responseHandlers.value(reqId);
+    if (handler)
+        handler->onContractDetails(reqId, details);
+    else
+        emit contractDetails(reqId, details);
+}
 
-            int orderId;
-            decodeField(orderId);
-
-            // decode contract fields
-            Contract contract;
-            decodeField(contract.conId); // ver 5 field
-            decodeField(contract.symbol);
-            decodeField(contract.secType);
-            decodeField(contract.expiry);
-            decodeField(contract.strike);
-            decodeField(contract.right);
-            if( version >= 9) {
-                decodeField(contract.multiplier);
-            }
-            decodeField(contract.exchange);
-            decodeField(contract.currency);
-            decodeField(contract.localSymbol);
-            if (version >= 10) {
-                decodeField(contract.tradingClass);
-            }
+void IBClient::dispatchContractDetailsEnd(int reqId)
+{
+    IBResponseHandler* handler = m_responseHandlers.take(reqId);
+    if (handler)
+        handler->onContractDetailsEnd(reqId);
+    else
+        emit contractDetailsEnd(reqId);
+}
 
-            // decode execution fields
-            Execution exec;
-            exec.orderId = orderId;
-            decodeField(exec.execId);
-            decodeField(exec.time);
-            decodeField(exec.acctNumber);
-            decodeField(exec.exchange);
-            decodeField(exec.side);
-            decodeField(exec.shares);
-            decodeField(exec.price);
-            decodeField(exec.permId); // ver 2 field
-            decodeField(exec.clientId); // ver 3 field
-            decodeField(exec.liquidation); // ver 4 field
-
-            if( version >= 6) {
-                decodeField(exec.cumQty);
-                decodeField(exec.avgPrice);
-            }
+bool IBClient::decodeScannerData()
+{
+    int version;
+    int tickerId;
 
-            if( version >= 8) {
-                decodeField(exec.orderRef);
-            }
+    decodeField(version);
+    decodeField(tickerId);
 
-            if( version >= 9) {
-                decodeField(exec.evRule);
-                decodeField(exec.evMultiplier);
-            }
+    int numberOfElements;
+    decodeField(numberOfElements);
 
-            emit execDetails( reqId, contract, exec);
-            break;
-        }
+    typedef std::vector<ScanData> ScanDataList;
+    ScanDataList scannerDataList;
 
-        case MARKET_DEPTH:
-        {
-            int version;
-            int id;
-            int position;
-            int operation;
-            int side;
-            double price;
-            int size;
-
-            decodeField(version);
-            decodeField(id);
-            decodeField(position);
-            decodeField(operation);
-            decodeField(side);
-            decodeField(price);
-            decodeField(size);
-
-            emit updateMktDepth( id, position, operation, side, price, size);
-            break;
-        }
+    scannerDataList.reserve( numberOfElements);
 
-        case MARKET_DEPTH_L2:
-        {
-            int version;
-            int id;
-            int position;
-            QByteArray marketMaker;
-            int operation;
-            int side;
-            double price;
-            int size;
-
-            decodeField(version);
-            decodeField(id);
-            decodeField(position);
-            decodeField(marketMaker);
-            decodeField(operation);
-            decodeField(side);
-            decodeField(price);
-            decodeField(size);
-
-            emit updateMktDepthL2( id, position, marketMaker, operation, side,
-                                   price, size);
+    for( int ctr=0; ctr < numberOfElements; ++ctr) {
 
-            break;
-        }
+        ScanData data;
 
-        case NEWS_BULLETINS:
-        {
-            int version;
-            int msgId;
-            int msgType;
-            QByteArray newsMessage;
-            QByteArray originatingExch;
-
-            decodeField(version);
-            decodeField(msgId);
-            decodeField(msgType);
-            decodeField(newsMessage);
-            decodeField(originatingExch);
-
-            emit updateNewsBulletin( msgId, msgType, newsMessage, originatingExch);
-            break;
-        }
+        decodeField(data.rank);
+        decodeField(data.contract.summary.conId); // ver 3 field
+        decodeField(data.contract.summary.symbol);
+        decodeField(data.contract.summary.secType);
+        decodeField(data.contract.summary.expiry);
+        decodeField(data.contract.summary.strike);
+        decodeField(data.contract.summary.right);
+        decodeField(data.contract.summary.exchange);
+        decodeField(data.contract.summary.currency);
+        decodeField(data.contract.summary.localSymbol);
+        decodeField(data.contract.marketName);
+        decodeField(data.contract.summary.tradingClass);
+        decodeField(data.distance);
+        decodeField(data.benchmark);
+        decodeField(data.projection);
+        decodeField(data.legsStr);
 
-        case MANAGED_ACCTS:
-        {
-            int version;
-            QByteArray accountsList;
+        scannerDataList.push_back( data);
+    }
 
-            decodeField(version);
-            decodeField(accountsList);
+    //            assert( (int)scannerDataList.size() == numberOfElements);
 
-            emit managedAccounts( accountsList);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case RECEIVE_FA:
-        {
-            int version;
-            int faDataTypeInt;
-            QByteArray cxml;
+    for( int ctr=0; ctr < numberOfElements; ++ctr) {
 
-            decodeField(version);
-            decodeField(faDataTypeInt);
-            decodeField(cxml);
+        const ScanData& data = scannerDataList[ctr];
+        IB_EMIT(scannerData( tickerId, data.rank, data.contract,
+                          data.distance, data.benchmark, data.projection, data.legsStr));
+    }
 
-            emit receiveFA( (FaDataType)faDataTypeInt, cxml);
-            break;
-        }
+    IB_EMIT(scannerDataEnd( tickerId));
+    return true;
+}
 
-        case HISTORICAL_DATA:
-        {
-            int version;
-            int reqId;
-            QByteArray startDateStr;
-            QByteArray endDateStr;
-
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(startDateStr); // ver 2 field
-            decodeField(endDateStr); // ver 2 field
-
-            int itemCount;
-            decodeField(itemCount);
-
-            QVector<BarData> bars;
-
-            for( int ctr = 0; ctr < itemCount; ++ctr) {
-                BarData bar;
-                decodeField(bar.date);
-                decodeField(bar.open);
-                decodeField(bar.high);
-                decodeField(bar.low);
-                decodeField(bar.close);
-                decodeField(bar.volume);
-                decodeField(bar.average);
-                decodeField(bar.hasGaps);
-                decodeField(bar.barCount); // ver 3 field
-
-                bars.push_back(bar);
-            }
+bool IBClient::decodeScannerParameters()
+{
+    int version;
+    QByteArray xml;
 
-            //            assert( (int)bars.size() == itemCount);
+    decodeField(version);
+    decodeField(xml);
 
-//qDebug() << "[DEBUG-HISTORICAL_DATA] bars.size():" << bars.size() << "itemCount:" << itemCount;
+    if (m_cursor.underflow())
+        return false;
 
-            for( int ctr = 0; ctr < bars.size(); ++ctr) {
+    IB_EMIT(scannerParameters( xml));
+    return true;
+}
 
-                const BarData& bar = bars[ctr];
-                emit historicalData( reqId, bar.date, bar.open, bar.high, bar.low,
-                                     bar.close, bar.volume, bar.barCount, bar.average,
-                                     (bar.hasGaps == "true" ? 1 : 0));
-            }
+bool IBClient::decodeCurrentTime()
+{
+    int version;
+    int time;
 
-            // send end of dataset marker
-            QByteArray finishedStr = QByteArray("finished-") + startDateStr + "-" + endDateStr;
-            emit historicalData( reqId, finishedStr, -1, -1, -1, -1, -1, -1, -1, 0);
+    decodeField(version);
+    decodeField(time);
 
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case SCANNER_DATA:
-        {
-            int version;
-            int tickerId;
-
-            decodeField(version);
-            decodeField(tickerId);
-
-            int numberOfElements;
-            decodeField(numberOfElements);
-
-            typedef std::vector<ScanData> ScanDataList;
-            ScanDataList scannerDataList;
-
-            scannerDataList.reserve( numberOfElements);
-
-            for( int ctr=0; ctr < numberOfElements; ++ctr) {
-
-                ScanData data;
-
-                decodeField(data.rank);
-                decodeField(data.contract.summary.conId); // ver 3 field
-                decodeField(data.contract.summary.symbol);
-                decodeField(data.contract.summary.secType);
-                decodeField(data.contract.summary.expiry);
-                decodeField(data.contract.summary.strike);
-                decodeField(data.contract.summary.right);
-                decodeField(data.contract.summary.exchange);
-                decodeField(data.contract.summary.currency);
-                decodeField(data.contract.summary.localSymbol);
-                decodeField(data.contract.marketName);
-                decodeField(data.contract.summary.tradingClass);
-                decodeField(data.distance);
-                decodeField(data.benchmark);
-                decodeField(data.projection);
-                decodeField(data.legsStr);
-
-                scannerDataList.push_back( data);
-            }
+    IB_EMIT(currentTime( time));
+    return true;
+}
 
-            //            assert( (int)scannerDataList.size() == numberOfElements);
+bool IBClient::decodeRealTimeBars()
+{
+    int version;
+    int reqId;
+    int time;
+    double open;
+    double high;
+    double low;
+    double close;
+    int volume;
+    double average;
+    int count;
+
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(time);
+    decodeField(open);
+    decodeField(high);
+    decodeField(low);
+    decodeField(close);
+    decodeField(volume);
+    decodeField(average);
+    decodeField(count);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_POST(dispatchRealtimeBar( reqId, time, open, high, low, close,
+                      volume, average, count));
+
+    return true;
+}
 
-            for( int ctr=0; ctr < numberOfElements; ++ctr) {
+// a realtime bar stream keeps its handler until cancelRealTimeBars()
+void IBClient::dispatchRealtimeBar(TickerId reqId, long time, double open, double high, double low, double close,
+                                   long volume, double wap, int count)
+{
+    IBResponseHandler* handler = m_responseHandlers.value(reqId);
+    if (handler)
+        handler->onRealtimeBar(reqId, time, open, high, low, close, volume, wap, count);
+    else
+        emit realtimeBar(reqId, time, open, high, low, close, volume, wap, count);
+}
 
-                const ScanData& data = scannerDataList[ctr];
-                emit scannerData( tickerId, data.rank, data.contract,
-                                  data.distance, data.benchmark, data.projection, data.legsStr);
-            }
+bool IBClient::decodeFundamentalData()
+{
+    int version;
+    int reqId;
+    QByteArray data;
 
-            emit scannerDataEnd( tickerId);
-            break;
-        }
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(data);
 
-        case SCANNER_PARAMETERS:
-        {
-            int version;
-            QByteArray xml;
+    if (m_cursor.underflow())
+        return false;
 
-            decodeField(version);
-            decodeField(xml);
+    IB_EMIT(fundamentalData( reqId, data));
+    return true;
+}
 
-            emit scannerParameters( xml);
-            break;
-        }
+bool IBClient::decodeContractDataEnd()
+{
+    int version;
+    int reqId;
 
-        case CURRENT_TIME:
-        {
-            int version;
-            int time;
+    decodeField(version);
+    decodeField(reqId);
 
-            decodeField(version);
-            decodeField(time);
+    if (m_cursor.underflow())
+        return false;
 
-            emit currentTime( time);
-            break;
-        }
+    IB_POST(dispatchContractDetailsEnd( reqId));
+    return true;
+}
 
-        case REAL_TIME_BARS:
-        {
-            int version;
-            int reqId;
-            int time;
-            double open;
-            double high;
-            double low;
-            double close;
-            int volume;
-            double average;
-            int count;
-
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(time);
-            decodeField(open);
-            decodeField(high);
-            decodeField(low);
-            decodeField(close);
-            decodeField(volume);
-            decodeField(average);
-            decodeField(count);
-
-            emit realtimeBar( reqId, time, open, high, low, close,
-                              volume, average, count);
+bool IBClient::decodeOpenOrderEnd()
+{
+    int version;
 
-            break;
-        }
+    decodeField(version);
 
-        case FUNDAMENTAL_DATA:
-        {
-            int version;
-            int reqId;
-            QByteArray data;
+    if (m_cursor.underflow())
+        return false;
 
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(data);
+    IB_EMIT(openOrderEnd());
+    return true;
+}
 
-            emit fundamentalData( reqId, data);
-            break;
-        }
+bool IBClient::decodeAcctDownloadEnd()
+{
+    int version;
+    QByteArray account;
 
-        case CONTRACT_DATA_END:
-        {
-            int version;
-            int reqId;
+    decodeField(version);
+    decodeField(account);
 
-            decodeField(version);
-            decodeField(reqId);
+    if (m_cursor.underflow())
+        return false;
 
-            emit contractDetailsEnd( reqId);
-            break;
-        }
+    IB_EMIT(accountDownloadEnd( account));
+    return true;
+}
 
-        case OPEN_ORDER_END:
-        {
-            int version;
+bool IBClient::decodeExecutionDataEnd()
+{
+    int version;
+    int reqId;
 
-            decodeField(version);
+    decodeField(version);
+    decodeField(reqId);
 
-            emit openOrderEnd();
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case ACCT_DOWNLOAD_END:
-        {
-            int version;
-            QByteArray account;
+    IB_EMIT(execDetailsEnd( reqId));
+    return true;
+}
 
-            decodeField(version);
-            decodeField(account);
+bool IBClient::decodeDeltaNeutralValidation()
+{
+    int version;
+    int reqId;
 
-            emit accountDownloadEnd( account);
-            break;
-        }
+    decodeField(version);
+    decodeField(reqId);
 
-        case EXECUTION_DATA_END:
-        {
-            int version;
-            int reqId;
+    UnderComp underComp;
 
-            decodeField(version);
-            decodeField(reqId);
+    decodeField(underComp.conId);
+    decodeField(underComp.delta);
+    decodeField(underComp.price);
 
-            emit execDetailsEnd( reqId);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case DELTA_NEUTRAL_VALIDATION:
-        {
-            int version;
-            int reqId;
+    IB_EMIT(deltaNeutralValidation( reqId, underComp));
+    return true;
+}
 
-            decodeField(version);
-            decodeField(reqId);
+bool IBClient::decodeTickSnapshotEnd()
+{
+    int version;
+    int reqId;
 
-            UnderComp underComp;
+    decodeField(version);
+    decodeField(reqId);
 
-            decodeField(underComp.conId);
-            decodeField(underComp.delta);
-            decodeField(underComp.price);
+    if (m_cursor.underflow())
+        return false;
 
-            emit deltaNeutralValidation( reqId, underComp);
-            break;
-        }
+    IB_EMIT(tickSnapshotEnd( reqId));
+    return true;
+}
 
-        case TICK_SNAPSHOT_END:
-        {
-            int version;
-            int reqId;
+bool IBClient::decodeMarketDataType()
+{
+    int version;
+    int reqId;
+    int marketDataTypeVal;
 
-            decodeField(version);
-            decodeField(reqId);
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(marketDataTypeVal);
 
-            emit tickSnapshotEnd( reqId);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case MARKET_DATA_TYPE:
-        {
-            int version;
-            int reqId;
-            int marketDataTypeVal;
+    IB_EMIT(marketDataType( reqId, marketDataTypeVal));
+    return true;
+}
 
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(marketDataTypeVal);
+bool IBClient::decodeCommissionReport()
+{
+    int version;
+    decodeField(version);
+
+    CommissionReport cr;
+    decodeField(cr.execId);
+    decodeField(cr.commission);
+    decodeField(cr.currency);
+    decodeField(cr.realizedPNL);
+    decodeField(cr.yield);
+    decodeField(cr.yieldRedemptionDate);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(commissionReport( cr));
+    return true;
+}
 
-            emit marketDataType( reqId, marketDataTypeVal);
-            break;
-        }
+bool IBClient::decodePositionData()
+{
+    int version;
+    QByteArray account;
+    int pos;
+    double avgCost = 0;
+
+    decodeField(version);
+    decodeField(account);
+
+    // decode contract fields
+    Contract contract;
+    decodeField(contract.conId);
+    decodeField(contract.symbol);
+    decodeField(contract.secType);
+    decodeField(contract.expiry);
+    decodeField(contract.strike);
+    decodeField(contract.right);
+    decodeField(contract.multiplier);
+    decodeField(contract.exchange);
+    decodeField(contract.currency);
+    decodeField(contract.localSymbol);
+    if (version >= 2) {
+        decodeField(contract.tradingClass);
+    }
+
+    decodeField(pos);
+    if (version >= 3) {
+        decodeField(avgCost);
+    }
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(position( account, contract, pos, avgCost));
+    return true;
+}
 
-        case COMMISSION_REPORT:
-        {
-            int version;
-            decodeField(version);
-
-            CommissionReport cr;
-            decodeField(cr.execId);
-            decodeField(cr.commission);
-            decodeField(cr.currency);
-            decodeField(cr.realizedPNL);
-            decodeField(cr.yield);
-            decodeField(cr.yieldRedemptionDate);
-
-            emit commissionReport( cr);
-            break;
-        }
+bool IBClient::decodePositionEnd()
+{
+    int version;
 
-        case POSITION_DATA:
-        {
-            int version;
-            QByteArray account;
-            int pos;
-            double avgCost = 0;
-
-            decodeField(version);
-            decodeField(account);
-
-            // decode contract fields
-            Contract contract;
-            decodeField(contract.conId);
-            decodeField(contract.symbol);
-            decodeField(contract.secType);
-            decodeField(contract.expiry);
-            decodeField(contract.strike);
-            decodeField(contract.right);
-            decodeField(contract.multiplier);
-            decodeField(contract.exchange);
-            decodeField(contract.currency);
-            decodeField(contract.localSymbol);
-            if (version >= 2) {
-                decodeField(contract.tradingClass);
-            }
+    decodeField(version);
 
-            decodeField(pos);
-            if (version >= 3) {
-                decodeField(avgCost);
-            }
+    if (m_cursor.underflow())
+        return false;
 
-            emit position( account, contract, pos, avgCost);
-            break;
-        }
+    IB_EMIT(positionEnd());
+    return true;
+}
 
-        case POSITION_END:
-        {
-            int version;
+bool IBClient::decodeAccountSummary()
+{
+    int version;
+    int reqId;
+    QByteArray account;
+    QByteArray tag;
+    QByteArray value;
+    QByteArray curency;
+
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(account);
+    decodeField(tag);
+    decodeField(value);
+    decodeField(curency);
+
+    if (m_cursor.underflow())
+        return false;
+
+    IB_EMIT(accountSummary( reqId, account, tag, value, curency));
+    return true;
+}
 
-            decodeField(version);
+bool IBClient::decodeAccountSummaryEnd()
+{
+    int version;
+    int reqId;
 
-            emit positionEnd();
-            break;
-        }
+    decodeField(version);
+    decodeField(reqId);
 
-        case ACCOUNT_SUMMARY:
-        {
-            int version;
-            int reqId;
-            QByteArray account;
-            QByteArray tag;
-            QByteArray value;
-            QByteArray curency;
-
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(account);
-            decodeField(tag);
-            decodeField(value);
-            decodeField(curency);
-
-            emit accountSummary( reqId, account, tag, value, curency);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case ACCOUNT_SUMMARY_END:
-        {
-            int version;
-            int reqId;
+    IB_EMIT(accountSummaryEnd( reqId));
+    return true;
+}
 
-            decodeField(version);
-            decodeField(reqId);
+bool IBClient::decodeVerifyMessageApi()
+{
+    int version;
+    QByteArray apiData;
 
-            emit accountSummaryEnd( reqId);
-            break;
-        }
+    decodeField(version);
+    decodeField(apiData);
 
-        case VERIFY_MESSAGE_API:
-        {
-            int version;
-            QByteArray apiData;
+    if (m_cursor.underflow())
+        return false;
 
-            decodeField(version);
-            decodeField(apiData);
+    IB_EMIT(verifyMessageAPI( apiData));
+    return true;
+}
 
-            emit verifyMessageAPI( apiData);
-            break;
-        }
+bool IBClient::decodeVerifyCompleted()
+{
+    int version;
+    QByteArray errorText;
 
-        case VERIFY_COMPLETED:
-        {
-            int version;
-            QByteArray isSuccessful;
-            QByteArray errorText;
-
-            decodeField(version);
-            decodeField(isSuccessful);
-            decodeField(errorText);
-
-            bool bRes = isSuccessful == "true";
-
-            if (bRes) {
-                const int VERSION = 1;
-                encodeField(START_API);
-                encodeField(VERSION);
-                encodeField(m_clientId);
-                send();
-            }
+    decodeField(version);
+    bool bRes = m_cursor.readEquals("true");
+    decodeField(errorText);
 
-            emit verifyCompleted( bRes, errorText);
-            break;
-        }
+    if (m_cursor.underflow())
+        return false;
 
-        case DISPLAY_GROUP_LIST:
-        {
-            int version;
-            int reqId;
-            QByteArray groups;
+    if (bRes)
+        IB_POST(startApi());
 
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(groups);
+    IB_EMIT(verifyCompleted( bRes, errorText));
+    return true;
+}
 
-            emit displayGroupList( reqId, groups);
-            break;
-        }
+bool IBClient::decodeDisplayGroupList()
+{
+    int version;
+    int reqId;
+    QByteArray groups;
 
-        case DISPLAY_GROUP_UPDATED:
-        {
-            int version;
-            int reqId;
-            QByteArray contractInfo;
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(groups);
 
-            decodeField(version);
-            decodeField(reqId);
-            decodeField(contractInfo);
+    if (m_cursor.underflow())
+        return false;
 
-            emit displayGroupUpdated( reqId, contractInfo);
-            break;
-        }
+    IB_EMIT(displayGroupList( reqId, groups));
+    return true;
+}
 
-        default:
-        {
-            QString errstr("[CRITICAL] UNKNOWN_ID: msgId:"
-                           + QString::number(msgId)
-                           + "buffer: "
-                           + m_inBuffer.mid(m_endIdx));
-            pDebug(errstr);
+bool IBClient::decodeDisplayGroupUpdated()
+{
+    int version;
+    int reqId;
+    QByteArray contractInfo;
 
-            emit error( msgId, UNKNOWN_ID.code(), UNKNOWN_ID.msg());
-            disconnectTWS();
-            emit connectionClosed();
-            break;
-        }
-        }
-    }
+    decodeField(version);
+    decodeField(reqId);
+    decodeField(contractInfo);
 
-    cleanInBuffer();
+    if (m_cursor.underflow())
+        return false;
 
-    }
+    IB_EMIT(displayGroupUpdated( reqId, contractInfo));
+    return true;
 }
 
 void IBClient::onSocketError(QAbstractSocket::SocketError socketError)
@@ -2495,9 +3359,9 @@ void IBClient::onSocketError(QAbstractSocket::SocketError socketError)
     switch (socketError)
     {
     case QAbstractSocket::ConnectionRefusedError:
-        emit ibSocketError("Connection Refused");
+        IB_EMIT(ibSocketError("Connection Refused"));
     default:
-        emit ibSocketError("Network Socket Error");
+        IB_EMIT(ibSocketError("Network Socket Error"));
     }
 }
 
@@ -2511,73 +3375,76 @@ QTcpSocket *IBClient::getSocket() const
 
 void IBClient::decodeField(int &value)
 {
-    value = decodeField().toInt();
+    value = m_cursor.readInt();
 }
 
 void IBClient::decodeField(bool &value)
 {
-    value = (decodeField().toInt() ? 1 : 0);
+    value = (m_cursor.readInt() ? 1 : 0);
 }
 
 void IBClient::decodeField(long &value)
 {
-    value = decodeField().toLong();
+    value = m_cursor.readLong();
 }
 
 void IBClient::decodeField(double &value)
 {
-    value = decodeField().toDouble();
+    value = m_cursor.readDouble();
 }
 
 void IBClient::decodeField(QByteArray & value)
 {
-    value = decodeField();
+    value = m_cursor.readString();
 }
 
-QByteArray IBClient::decodeField()
+void IBClient::skipField()
 {
-    QByteArray ret;
-    m_endIdx = m_inBuffer.indexOf('\0', m_begIdx);
-    ret = m_inBuffer.mid(m_begIdx, m_endIdx - m_begIdx);
-//    qDebug() << "[DEBUG-decodeField] field:" << ret << "m_inBuffer.size():" << m_inBuffer.size() << "m_endIdx:" << m_endIdx << "m_lastEndIdx:" << m_lastEndIdx;
-
-    m_lastEndIdx = m_endIdx;
-    m_begIdx = m_endIdx + 1;
-
-//    qDebug() << "[DEBUG-decodeField]" << ret;
-
-    return ret;
+    m_cursor.skip();
 }
 
 void IBClient::decodeFieldMax(int &value)
 {
-    QByteArray str;
-    decodeField(str);
-    value = (str.isEmpty() ? UNSET_INTEGER : str.toInt());
+    const char* f;
+    int len;
+    m_cursor.next(f, len);
+    value = (len == 0 ? UNSET_INTEGER : IBFieldCursor::toInt(f, len));
 }
 
 void IBClient::decodeFieldMax(long &value)
 {
-    QByteArray str;
-    decodeField(str);
-    value = (str.isEmpty() ? UNSET_INTEGER : str.toLong());
+    const char* f;
+    int len;
+    m_cursor.next(f, len);
+    value = (len == 0 ? UNSET_INTEGER : IBFieldCursor::toLong(f, len));
 }
 
 void IBClient::decodeFieldMax(double &value)
 {
-    QByteArray str;
-    decodeField(str);
-    value = (str.isEmpty() ? UNSET_DOUBLE : str.toDouble());
+    const char* f;
+    int len;
+    m_cursor.next(f, len);
+    value = (len == 0 ? UNSET_DOUBLE : IBFieldCursor::toDouble(f, len));
 }
 
 void IBClient::encodeField(const int &value)
 {
-    encodeField(QByteArray::number(value));
+    // digits are written backwards into buf, no temporary QByteArray
+    char buf[12];
+    char* p = buf + sizeof(buf);
+    unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        *--p = char('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0)
+        *--p = '-';
+    appendField(p, int(buf + sizeof(buf) - p));
 }
 
 void IBClient::encodeField(const bool &value)
 {
-    encodeField(QByteArray::number((value == true ? 1 : 0)));
+    appendField(value ? "1" : "0", 1);
 }
 
 void IBClient::encodeField(const long &value)
@@ -2592,19 +3459,54 @@ void IBClient::encodeField(const double &value)
 
 void IBClient::encodeField(const QByteArray &buf)
 {
-//    if (buf == "1")
-//        qDebug() << "[DEBUG-encodeField]";
-    m_debugBuffer.append(buf).append(" ");
+    appendField(buf.constData(), buf.size());
+}
+
+void IBClient::encodeField(const char* str)
+{
+    appendField(str, qstrlen(str));
+}
+
+void IBClient::appendField(const char* data, int len)
+{
+    if (m_traceMessages)
+        m_debugBuffer.append(data, len).append(" ");
 
-    m_outBuffer.append(buf);
+    m_outBuffer.append(data, len);
     m_outBuffer.append('\0');
 }
 
+void IBClient::reserveOut(int n)
+{
+    const int needed = m_outBuffer.size() + n;
+    if (needed > m_outBuffer.capacity())
+        m_outBuffer.reserve(qMax(needed, 2 * m_outBuffer.capacity()));
+}
+
+void IBClient::encodeTagValues(const QList<TagValue*> & tagValues)
+{
+    QByteArray str;
+    foreach (TagValue* tv, tagValues) {
+        str.append(tv->tag);
+        str.append("=");
+        str.append(tv->value);
+        str.append(";");
+    }
+    encodeField(str);
+}
+
+bool IBClient::checkServerVersion(int minVersion, bool used, long id, const char* what)
+{
+    if (!used || m_serverVersion >= minVersion)
+        return true;
+    emit error(id, UPDATE_TWS.code(), UPDATE_TWS.msg() + "  It does not support " + what);
+    return false;
+}
+
 void IBClient::encodeFieldMax(int value)
 {
     if (value == INT_MAX) {
-        QByteArray ba = "";
-        encodeField(ba);
+        appendField("", 0);
         return;
     }
     encodeField(value);
@@ -2613,33 +3515,9 @@ void IBClient::encodeFieldMax(int value)
 void IBClient::encodeFieldMax(double value)
 {
     if (value == DBL_MAX) {
-        QByteArray ba = "";
-        encodeField(ba);
+        appendField("", 0);
         return;
     }
     encodeField(value);
 }
 
-void IBClient::cleanInBuffer()
-{
-//    qDebug() << "[DEBUG-cleanInBuffer]";
-
-    // m_lastEndIdx is used to fix continued parsing after raw data has actually ended
-
-    if (m_endIdx == m_inBuffer.size() - 1 || m_endIdx < m_lastEndIdx) {
-        m_inBuffer.clear();
-        m_begIdx = m_endIdx = 0;
-//        qDebug() << "[DEBUG-cleanInBuffer] CLEAN BUFFER";
-
-    }
-    else {
-        m_inBuffer.remove(0, m_endIdx + 1);
-        m_begIdx = 0;        
-    }
-    if (!m_inBuffer.isEmpty()) {
-//        qDebug() << "[DEBUG-cleanInBuffer] remnants:" << m_inBuffer;
-//        qDebug() << "[DEBUG-cleanInBuffer] remnants.. m_begIdx:" << m_begIdx << "m_endIdx:" << m_endIdx << "m_inBuffer.size():" << m_inBuffer.size();
-
-    }
-}
-
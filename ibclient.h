@@ -3,8 +3,28 @@
 
 #include "ibticktype.h"
 #include "ibfadatatype.h"
+#include "ibfieldcursor.h"
+#include "ibringbuffer.h"
+#include "ibspscqueue.h"
+#include "ibmsgstats.h"
+#include "ibrequestpacer.h"
+#include "ibticksubscriber.h"
+#include "ibhistoricalbars.h"
+#include "ibresponsehandler.h"
+#include "iborderbook.h"
+#include "ibcapture.h"
 #include <QObject>
 #include <QTcpSocket>
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+
+class QThread;
+class QTimer;
+class IBClientWorker;
 
 struct ContractDetails;
 struct Contract;
@@ -23,29 +43,109 @@ class IBClient : public QObject
 {
     Q_OBJECT
 public:
-    explicit IBClient(QObject *parent = 0);
+    // with networkThread set the socket and the decoder run on their own
+    // thread and decoded signals are emitted from the GUI thread in batches
+    explicit IBClient(QObject *parent = 0, bool networkThread = false);
     ~IBClient();
 
+    bool isThreaded() const { return m_thread != NULL; }
+
+    // per incoming message type counters, see IBMsgStats
+    QList<IBMsgStats> msgStats() const;
+    void resetMsgStats();
+
     void connectToTWS(const QString & host, quint16 port, int clientId);
     void disconnectTWS();
+    bool isConnected() const { return m_connected; }
+    // connected and handed the next valid id, requests can be sent
+    bool isReady() const { return m_ready; }
     void send();
 
+    // messages sent between beginBatch() and endBatch() are written to the
+    // socket in one go when the outermost batch ends
+    void beginBatch() { ++m_batchDepth; }
+    void endBatch();
+
+    // keeps a readable copy of each outgoing message and logs it on send()
+    void setTraceMessages(bool trace) { m_traceMessages = trace; }
+
+    // outbound rate limits and lane statistics, for tuning
+    IBRequestPacer* pacer() { return &m_pacer; }
+
+    // Writes every inbound socket read to path, see IBCaptureWriter. Start
+    // and stop it while disconnected when running with a network thread.
+    bool startCapture(const QString & path);
+    void stopCapture();
+
+    // Replay: inbound bytes come from feedInbound() instead of the socket and
+    // outgoing messages are dropped. Needs a client without network thread.
+    void setReplayMode(bool replay) { m_replay = replay; }
+    bool isReplayMode() const { return m_replay; }
+    void feedInbound(const char* data, int len);
+
     TickerId getTickerId() { return m_tickerId++; }
     OrderId  getOrderId();
     void    setOrderId(long orderId) { m_orderId = orderId; }
 
-    void reqHistoricalData( TickerId tickerId, const Contract &contract, const QByteArray &endDateTime, const QByteArray &durationStr, const QByteArray & barSizeSetting, const QByteArray &whatToShow, int useRTH, int formatDate, const QList<TagValue*> & chartOptions);
+    // ticks for tickerId are delivered to the subscriber right after the
+    // tickPrice/tickSize signals, on the GUI thread
+    void subscribeTicks(TickerId tickerId, IBTickSubscriber* subscriber);
+    void unsubscribeTicks(TickerId tickerId, IBTickSubscriber* subscriber);
+    void unsubscribeTicks(IBTickSubscriber* subscriber);
+
+    // with a handler the response is delivered to it as one IBHistoricalBars
+    // block and no historicalData signals are emitted for it
+    void reqHistoricalData( TickerId tickerId, const Contract &contract, const QByteArray &endDateTime, const QByteArray &durationStr, const QByteArray & barSizeSetting, const QByteArray &whatToShow, int useRTH, int formatDate, const QList<TagValue*> & chartOptions, IBResponseHandler* handler = NULL);
     void reqCurrentTime();
     void reqMktData(TickerId tickerId, const Contract& contract, const QByteArray& genericTicks, bool snapshot, const QList<TagValue*>& mktDataOptions = QList<TagValue*>());
-    void reqRealTimeBars(const TickerId & tickerId, const Contract & contract, const int & barSize, const QByteArray & whatToShow, const bool & useRTH, const QList<TagValue*> & realTimeBarsOptions);
+    // with a handler the bars go to its onRealtimeBar() until cancelRealTimeBars()
+    void reqRealTimeBars(const TickerId & tickerId, const Contract & contract, const int & barSize, const QByteArray & whatToShow, const bool & useRTH, const QList<TagValue*> & realTimeBarsOptions, IBResponseHandler* handler = NULL);
+    void cancelRealTimeBars(TickerId tickerId);
+
+    // The depth updates are applied to an IBOrderBook of numRows levels per
+    // side before the updateMktDepth/updateMktDepthL2 signals go out, so the
+    // book is current in slots connected to them. It lives on the GUI thread
+    // until cancelMktDepth() and is empty while the connection is down;
+    // orderBook() gives NULL for unknown tickerIds.
+    void reqMktDepth(TickerId tickerId, const Contract & contract, int numRows, const QList<TagValue*> & mktDepthOptions = QList<TagValue*>());
+    void cancelMktDepth(TickerId tickerId);
+    const IBOrderBook* orderBook(TickerId tickerId) const;
     void placeOrder(OrderId id, const Contract & contract, const Order & order);
     void reqAccountUpdates(bool subscribe, const QByteArray & acctCode);
     void reqOpenOrders();
     void reqAllOpenOrders();
-    void reqContractDetails(int reqId, const Contract & contract);
+    void reqContractDetails(int reqId, const Contract & contract, IBResponseHandler* handler = NULL);
+
+    // drops every pending request of handler, e.g. when it is destroyed
+    void removeResponseHandler(IBResponseHandler* handler);
     void reqIds(int numIds);
     void cancelMktData(TickerId tickerId);
 
+    // Data connections: more IBClients, connected with their own clientIds,
+    // that take the market data, bar, depth, history and contract details
+    // requests made on this one, which keeps orders, executions and the
+    // account. Only data connections past their handshake take requests,
+    // with none of them ready this one does. Streams stay on the connection
+    // they were requested on until cancelled or, for realtime bars, ended
+    // by an error; tickerIds still come from getTickerId() here. The data
+    // signals and request errors of the data connections are emitted by this
+    // client, in the order the GUI thread gets them, so the application sees
+    // one event stream.
+    enum DataRouting
+    {
+        RouteRoundRobin,    // each request to the next connection
+        RouteLeastLoaded,   // to the one with the fewest streams and pending requests
+        RouteHistoryApart   // streams on the first, history and details on the others
+    };
+    void addDataConnection(IBClient* client);
+    QList<IBClient*> dataConnections() const { return m_dataConnections; }
+    void setDataRouting(DataRouting routing) { m_dataRouting = routing; }
+
+    // reqMktData(), reqRealTimeBars() and reqMktDepth() subscriptions stay
+    // registered until they are cancelled, also across a lost connection;
+    // this sends all of them again after a reconnect
+    void resubscribe();
+
     QTcpSocket *getSocket() const;
 
 signals:
@@ -67,6 +167,8 @@ signals:
     void openOrderEnd();
     void winError( const QByteArray &str, int lastError);
     void connectionClosed();
+    // the connection dropped without disconnectTWS(), see IBReconnectSupervisor
+    void connectionLost();
     void updateAccountValue(const QByteArray& key, const QByteArray& val,
     const QByteArray& currency, const QByteArray& accountName);
     void updatePortfolio( const Contract& contract, int position,
@@ -116,47 +218,223 @@ public slots:
 
 private slots:
     void onConnected();
+    void onDisconnected();
     void onReadyRead();
     void onSocketError(QAbstractSocket::SocketError socketError);
+    void drainEvents();
+    void pumpRequests();
 
 private:
+    friend class IBClientWorker;
+
     QTcpSocket* m_socket;
     int         m_clientId;
     QByteArray  m_outBuffer;
-    QByteArray  m_inBuffer;
-    bool        m_connected;
-    int         m_serverVersion;
+    IBRingBuffer m_inBuffer;
+    // a message that came short: the fields it needs, and the fields found
+    // in the first bytes of it scanned since
+    int         m_msgFieldsNeeded;
+    int         m_msgFieldsFound;
+    int         m_msgBytesScanned;
+    std::atomic<bool> m_connected;
+    std::atomic<int>  m_serverVersion;
     QByteArray  m_twsTime;
-    int         m_begIdx;
-    int         m_endIdx;
-    int         m_lastEndIdx;
+    IBFieldCursor m_cursor;
     bool        m_extraAuth;
+    bool        m_ready;
 
     QByteArray  m_debugBuffer;
+    bool        m_traceMessages;
+    std::atomic<bool> m_disconnecting;
+
+    struct MktDataSubscription;
+    QHash<TickerId, MktDataSubscription*> m_mktDataSubscriptions;
+    struct RealTimeBarsSubscription;
+    QHash<TickerId, RealTimeBarsSubscription*> m_realTimeBarsSubscriptions;
+    struct MktDepthSubscription;
+    QHash<TickerId, MktDepthSubscription*> m_mktDepthSubscriptions;
+
+    QList<IBClient*> m_dataConnections;
+    QHash<TickerId, IBClient*> m_streamConnection;     // by tickerId, while subscribed
+    DataRouting m_dataRouting;
+    int         m_nextDataConnection;
+
+    IBClient*   routeStream(TickerId tickerId);
+    IBClient*   routeRequest();
+    IBClient*   nextDataConnection(int first);
+    int         dataLoad() const;
+
+    void        resetSession();
 
     TickerId    m_tickerId;
     OrderId     m_orderId;
 
+    // worker-thread mode
+    QThread*        m_thread;
+    IBClientWorker* m_worker;
+    IBSpscQueue<std::function<void()> > m_events;
+    std::atomic<bool> m_drainPending;
+    QMutex          m_txMutex;
+    QByteArray      m_txBuffer;
+
+    int         m_batchDepth;
+    IBRequestPacer m_pacer;
+    QTimer*     m_pacerTimer;
+    QByteArray  m_wireBuffer;   // paced messages ready for the socket
+
+    IBCaptureWriter m_capture;
+    bool        m_replay;
+
+    // subscribers per tickerId; tickerIds are small and handed out in order
+    QVector<QVector<IBTickSubscriber*> > m_tickSubscribers;
+
+    void        dispatchTickPrice(TickerId tickerId, TickType field, double price, int canAutoExecute);
+    void        dispatchTickSize(TickerId tickerId, TickType field, int size);
+
+    // owners of the pending requests made with a handler, by reqId
+    QHash<TickerId, IBResponseHandler*> m_responseHandlers;
+
+    void        dispatchHistoricalBars(TickerId reqId, const IBHistoricalBars & bars);
+    void        dispatchContractDetails(int reqId, const ContractDetails & details);
+    void        dispatchContractDetailsEnd(int reqId);
+    void        dispatchRequestError(long reqId, int errorCode, const QByteArray & errorMsg);
+    void        dispatchRealtimeBar(TickerId reqId, long time, double open, double high, double low, double close,
+                                    long volume, double wap, int count);
+    void        dispatchMktDepth(TickerId id, int position, int operation, int side, double price, int size);
+    void        dispatchMktDepthL2(TickerId id, int position, const QByteArray & marketMaker, int operation, int side,
+                                   double price, int size);
+
+    void        writeOutBuffer();
+    void        postEvent(const std::function<void()> & event);
+    void        flushTx();
+
+    void        sendClientId();
+    void        startApi();
+
+    // incoming message dispatch table, indexed by msgId
+    typedef bool (IBClient::*MsgDecoder)();
+    struct MsgHandler
+    {
+        MsgHandler() : decode(NULL), name(NULL), count(0), bytes(0), nsecs(0) {}
+        MsgDecoder  decode;
+        const char* name;
+        std::atomic<quint64> count;
+        std::atomic<quint64> bytes;
+        std::atomic<qint64>  nsecs;
+    };
+    MsgHandler* m_msgHandlers;
+
+    void        registerHandler(int msgId, const char* name, MsgDecoder decode);
+
+    // one per incoming msgId; return false if the message is incomplete
+    bool        decodeTickPrice();
+    bool        decodeTickSize();
+    bool        decodeTickOptionComputation();
+    bool        decodeTickGeneric();
+    bool        decodeTickString();
+    bool        decodeTickEfp();
+    bool        decodeOrderStatus();
+    bool        decodeErrMsg();
+    bool        decodeOpenOrder();
+    bool        decodeAcctValue();
+    bool        decodePortfolioValue();
+    bool        decodeAcctUpdateTime();
+    bool        decodeNextValidId();
+    bool        decodeContractData();
+    bool        decodeBondContractData();
+    bool        decodeExecutionData();
+    bool        decodeMarketDepth();
+    bool        decodeMarketDepthL2();
+    bool        decodeNewsBulletins();
+    bool        decodeManagedAccts();
+    bool        decodeReceiveFa();
+    bool        decodeHistoricalData();
+    bool        decodeScannerData();
+    bool        decodeScannerParameters();
+    bool        decodeCurrentTime();
+    bool        decodeRealTimeBars();
+    bool        decodeFundamentalData();
+    bool        decodeContractDataEnd();
+    bool        decodeOpenOrderEnd();
+    bool        decodeAcctDownloadEnd();
+    bool        decodeExecutionDataEnd();
+    bool        decodeDeltaNeutralValidation();
+    bool        decodeTickSnapshotEnd();
+    bool        decodeMarketDataType();
+    bool        decodeCommissionReport();
+    bool        decodePositionData();
+    bool        decodePositionEnd();
+    bool        decodeAccountSummary();
+    bool        decodeAccountSummaryEnd();
+    bool        decodeVerifyMessageApi();
+    bool        decodeVerifyCompleted();
+    bool        decodeDisplayGroupList();
+    bool        decodeDisplayGroupUpdated();
+
     void        decodeField(int & value);
     void        decodeField(bool & value);
     void        decodeField(long & value);
     void        decodeField(double & value);
     void        decodeField(QByteArray & value);
-    QByteArray  decodeField();
+    void        skipField();
 
     void        decodeFieldMax(int & value);
     void        decodeFieldMax(long & value);
     void        decodeFieldMax(double & value);
 
+    // fields encoded with encodeFieldMax() inside an encodeFields() group
+    struct IntMax { int value; };
+    struct DoubleMax { double value; };
+    static IntMax    fieldMax(int value) { IntMax m = { value }; return m; }
+    static DoubleMax fieldMax(double value) { DoubleMax m = { value }; return m; }
+
     void        encodeField(const int & value);
     void        encodeField(const bool & value);
     void        encodeField(const long & value);
     void        encodeField(const double & value);
     void        encodeField(const QByteArray & buf);
+    void        encodeField(const char* str);
+    void        encodeField(const IntMax & m) { encodeFieldMax(m.value); }
+    void        encodeField(const DoubleMax & m) { encodeFieldMax(m.value); }
     void        encodeFieldMax(int value);
     void        encodeFieldMax(double value);
+    void        encodeTagValues(const QList<TagValue*> & tagValues);
+    void        appendField(const char* data, int len);
+    void        reserveOut(int n);
+
+    // Encodes a run of fields in order after growing m_outBuffer once for
+    // all of them, using the upper bound fieldSize() gives for each type.
+    template <typename... Fields>
+    void encodeFields(const Fields &... fields)
+    {
+        reserveOut(encodedSize(fields...));
+        int expand[] = { 0, (encodeField(fields), 0)... };
+        Q_UNUSED(expand);
+    }
+
+    static int encodedSize() { return 0; }
+    template <typename Field, typename... Fields>
+    static int encodedSize(const Field & field, const Fields &... fields)
+    {
+        return fieldSize(field) + encodedSize(fields...);
+    }
+
+    static int fieldSize(int) { return 12; }
+    static int fieldSize(bool) { return 2; }
+    static int fieldSize(long) { return 12; }
+    static int fieldSize(double) { return 32; }
+    static int fieldSize(const QByteArray & buf) { return buf.size() + 1; }
+    static int fieldSize(const char* str) { return qstrlen(str) + 1; }
+    static int fieldSize(const IntMax &) { return 12; }
+    static int fieldSize(const DoubleMax &) { return 32; }
+
+    // emits UPDATE_TWS and returns false if a feature that is used needs a
+    // newer server than the one connected
+    bool        checkServerVersion(int minVersion, bool used, long id, const char* what);
 
-    void        cleanInBuffer();
+    void        processInBuffer();
+    bool        havePendingFields();
+    bool        processMsg();
 
     bool        IsEmpty(const QByteArray & ba) { return ba.isEmpty(); }
     int         Compare(const QByteArray& a1, const QByteArray & a2) { return (a1==a2?0:1); }
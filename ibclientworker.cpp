@@ -0,0 +1,35 @@
+#include "ibclientworker.h"
+#include "ibclient.h"
+
+#include <QTcpSocket>
+
+IBClientWorker::IBClientWorker(IBClient* client)
+    : QObject(NULL)
+    , m_client(client)
+{
+}
+
+void IBClientWorker::connectToHost(const QString &host, int port)
+{
+    m_client->m_socket->connectToHost(host, port);
+}
+
+void IBClientWorker::disconnectFromHost()
+{
+    m_client->m_twsTime.clear();
+    m_client->m_inBuffer.clear();
+    m_client->m_cursor = IBFieldCursor();
+    m_client->m_socket->disconnectFromHost();
+}
+
+void IBClientWorker::flush()
+{
+    m_client->flushTx();
+}
+
+void IBClientWorker::shutdown()
+{
+    m_client->m_socket->abort();
+    delete m_client->m_socket;
+    m_client->m_socket = NULL;
+}
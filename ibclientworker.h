@@ -0,0 +1,27 @@
+#ifndef IBCLIENTWORKER_H
+#define IBCLIENTWORKER_H
+
+#include <QObject>
+
+class IBClient;
+
+// Lives on IBClient's network thread in worker-thread mode and runs the
+// socket operations that have to happen on that thread. IBClient reaches
+// it through queued invocations.
+class IBClientWorker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IBClientWorker(IBClient* client);
+
+public slots:
+    void connectToHost(const QString & host, int port);
+    void disconnectFromHost();
+    void flush();
+    void shutdown();
+
+private:
+    IBClient* m_client;
+};
+
+#endif // IBCLIENTWORKER_H
@@ -138,6 +138,7 @@ const int VERIFY_MESSAGE_API        = 65;
 const int VERIFY_COMPLETED          = 66;
 const int DISPLAY_GROUP_LIST        = 67;
 const int DISPLAY_GROUP_UPDATED     = 68;
+const int MAX_INCOMING_MSG_ID       = DISPLAY_GROUP_UPDATED;
 
 // TWS New Bulletins constants
 const int NEWS_MSG              = 1;    // standard IB news bulleting message
@@ -0,0 +1,305 @@
+#ifndef IBFIELDCURSOR_H
+#define IBFIELDCURSOR_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <cfloat>
+#include <climits>
+#include <cstring>
+
+// Non-owning cursor over the '\0' terminated fields of a TWS message.
+// Integers and doubles are parsed straight out of the receive buffer; only
+// string fields that are handed out are copied into a QByteArray.
+class IBFieldCursor
+{
+public:
+    IBFieldCursor()
+        : m_pos(NULL)
+        , m_end(NULL)
+        , m_underflow(false)
+        , m_fields(0)
+        , m_fieldsNeeded(0) {}
+
+    IBFieldCursor(const char* begin, const char* end)
+        : m_pos(begin)
+        , m_end(end)
+        , m_underflow(false)
+        , m_fields(0)
+        , m_fieldsNeeded(0) {}
+
+    const char* pos() const { return m_pos; }
+    const char* end() const { return m_end; }
+    bool atEnd() const { return m_pos >= m_end; }
+
+    // true once a field was requested that has no terminator in the buffer
+    bool underflow() const { return m_underflow; }
+
+    // once underflow() is set, how many fields from the start the message
+    // needs at least; there is no point in decoding it again before
+    int fieldsNeeded() const { return m_fieldsNeeded; }
+
+    bool next(const char*& field, int& len)
+    {
+        const char* nul = NULL;
+        if (m_pos < m_end)
+            nul = (const char*)memchr(m_pos, '\0', m_end - m_pos);
+        if (!nul) {
+            setUnderflow(1);
+            field = m_end;
+            len = 0;
+            return false;
+        }
+        field = m_pos;
+        len = (int)(nul - m_pos);
+        m_pos = nul + 1;
+        ++m_fields;
+        return true;
+    }
+
+    // true if n more fields are in the buffer, otherwise sets underflow()
+    // with all n of them needed; lets a decoder that knows the size of its
+    // message ask for it in one go
+    bool require(int n)
+    {
+        const char* p = m_pos;
+        for (int i = 0; i < n; ++i) {
+            const char* nul = NULL;
+            if (p < m_end)
+                nul = (const char*)memchr(p, '\0', m_end - p);
+            if (!nul) {
+                setUnderflow(n);
+                return false;
+            }
+            p = nul + 1;
+        }
+        return true;
+    }
+
+    void skip()
+    {
+        const char* f;
+        int len;
+        next(f, len);
+    }
+
+    int readInt()
+    {
+        const char* f;
+        int len;
+        next(f, len);
+        return toInt(f, len);
+    }
+
+    long readLong()
+    {
+        const char* f;
+        int len;
+        next(f, len);
+        return toLong(f, len);
+    }
+
+    double readDouble()
+    {
+        const char* f;
+        int len;
+        next(f, len);
+        return toDouble(f, len);
+    }
+
+    QByteArray readString()
+    {
+        const char* f;
+        int len;
+        next(f, len);
+        return QByteArray(f, len);
+    }
+
+    // compares the next field against str without copying it
+    bool readEquals(const char* str)
+    {
+        const char* f;
+        int len;
+        next(f, len);
+        return (int)qstrlen(str) == len && memcmp(f, str, len) == 0;
+    }
+
+    static int toInt(const char* f, int len)
+    {
+        qlonglong v = toLongLong(f, len);
+        return (v < INT_MIN || v > INT_MAX) ? 0 : (int)v;
+    }
+
+    static long toLong(const char* f, int len)
+    {
+        qlonglong v = toLongLong(f, len);
+        return (v < LONG_MIN || v > LONG_MAX) ? 0 : (long)v;
+    }
+
+    // Same result as QByteArray::toLongLong(): surrounding whitespace and a
+    // sign are accepted, anything else or an overflow gives 0.
+    static qlonglong toLongLong(const char* f, int len)
+    {
+        const char* p = f;
+        const char* e = f + len;
+        while (p < e && isSpace(*p))
+            ++p;
+
+        bool neg = false;
+        if (p < e && (*p == '-' || *p == '+')) {
+            neg = (*p == '-');
+            ++p;
+        }
+
+        const quint64 limit = neg ? Q_UINT64_C(9223372036854775808) : Q_UINT64_C(9223372036854775807);
+        const char* digitsBegin = p;
+        quint64 v = 0;
+        for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+            int d = *p - '0';
+            if (v > (limit - d) / 10)
+                return 0;
+            v = v * 10 + d;
+        }
+        if (p == digitsBegin)
+            return 0;
+
+        while (p < e && isSpace(*p))
+            ++p;
+        if (p != e)
+            return 0;
+
+        return neg ? (qlonglong)(0 - v) : (qlonglong)v;
+    }
+
+    // "[+-]digits[.digits][(e|E)[+-]digits]" with a mantissa of at most 2^53
+    // and a power of ten that is exact as a double is converted with a single
+    // correctly rounded multiplication or division, which gives the same bits
+    // as QByteArray::toDouble(). So does the DBL_MAX TWS sends for unset
+    // values. Anything else goes through QByteArray::toDouble() on a per
+    // thread scratch buffer, so no field allocates once that has grown.
+    static double toDouble(const char* f, int len)
+    {
+        static const double pow10[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+            1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+            1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        static const quint64 maxExact = Q_UINT64_C(9007199254740992);
+
+        if (len == 0)
+            return 0;
+
+        const char* p = f;
+        const char* e = f + len;
+        bool neg = false;
+        if (*p == '-' || *p == '+') {
+            neg = (*p == '-');
+            ++p;
+        }
+
+        quint64 mantissa = 0;
+        int digits = 0;
+        int exp10 = 0;
+        const char* intBegin = p;
+
+        for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa && ++digits > 19)
+                return slowToDouble(f, len);
+        }
+        if (p == intBegin)
+            return slowToDouble(f, len);
+
+        if (p < e && *p == '.') {
+            ++p;
+            for (; p < e && *p >= '0' && *p <= '9'; ++p) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa && ++digits > 19)
+                    return slowToDouble(f, len);
+                --exp10;
+            }
+        }
+
+        if (p < e && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool negExp = false;
+            if (p < e && (*p == '-' || *p == '+')) {
+                negExp = (*p == '-');
+                ++p;
+            }
+            const char* expBegin = p;
+            int exp = 0;
+            for (; p < e && *p >= '0' && *p <= '9' && p - expBegin < 4; ++p)
+                exp = exp * 10 + (*p - '0');
+            if (p == expBegin)
+                return slowToDouble(f, len);
+            exp10 += negExp ? -exp : exp;
+        }
+
+        if (p != e)
+            return slowToDouble(f, len);
+
+        if (mantissa == 0)
+            return neg ? -0.0 : 0.0;
+
+        if (mantissa > maxExact)
+            return isMaxDouble(f, len) ? DBL_MAX : slowToDouble(f, len);
+
+        double d;
+        if (exp10 < 0) {
+            if (exp10 < -22)
+                return slowToDouble(f, len);
+            d = (double)mantissa / pow10[-exp10];
+        }
+        else if (exp10 <= 22) {
+            d = (double)mantissa * pow10[exp10];
+        }
+        else {
+            // move the excess power into the mantissa while that stays exact
+            for (; exp10 > 22; --exp10) {
+                if (mantissa > maxExact / 10)
+                    return slowToDouble(f, len);
+                mantissa *= 10;
+            }
+            d = (double)mantissa * pow10[22];
+        }
+        return neg ? -d : d;
+    }
+
+private:
+    void setUnderflow(int fields)
+    {
+        if (!m_underflow)
+            m_fieldsNeeded = m_fields + fields;
+        m_underflow = true;
+    }
+
+    static bool isSpace(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static bool isMaxDouble(const char* f, int len)
+    {
+        static const char maxDouble[] = "1.7976931348623157E308";
+        return len == (int)sizeof(maxDouble) - 1 && memcmp(f, maxDouble, len) == 0;
+    }
+
+    static double slowToDouble(const char* f, int len)
+    {
+        static thread_local QByteArray scratch;
+        if (scratch.capacity() < len)
+            scratch.reserve(qMax(64, len));
+        scratch.resize(len);
+        memcpy(scratch.data(), f, len);
+        return scratch.toDouble();
+    }
+
+    const char* m_pos;
+    const char* m_end;
+    bool        m_underflow;
+    int         m_fields;       // read so far
+    int         m_fieldsNeeded;
+};
+
+#endif // IBFIELDCURSOR_H
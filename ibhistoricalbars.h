@@ -0,0 +1,41 @@
+#ifndef IBHISTORICALBARS_H
+#define IBHISTORICALBARS_H
+
+#include <QByteArray>
+#include <QVector>
+
+// All bars of one HISTORICAL_DATA response, one vector per column.
+// timeStamp holds epoch seconds whatever formatDate the request used;
+// dates keeps the bar dates as sent, '\0' terminated one after another.
+struct IBHistoricalBars
+{
+    QByteArray      startDate;
+    QByteArray      endDate;
+    QByteArray      dates;
+    QVector<double> timeStamp;
+    QVector<double> open;
+    QVector<double> high;
+    QVector<double> low;
+    QVector<double> close;
+    QVector<uint>   volume;
+    QVector<uint>   barCount;
+    QVector<double> wap;
+    QVector<bool>   hasGaps;
+
+    int size() const { return timeStamp.size(); }
+
+    void reserve(int n)
+    {
+        timeStamp.reserve(n);
+        open.reserve(n);
+        high.reserve(n);
+        low.reserve(n);
+        close.reserve(n);
+        volume.reserve(n);
+        barCount.reserve(n);
+        wap.reserve(n);
+        hasGaps.reserve(n);
+    }
+};
+
+#endif // IBHISTORICALBARS_H
@@ -0,0 +1,488 @@
+#include "ibhistorycache.h"
+#include "ibclient.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+
+static const quint32 CACHE_MAGIC = 0x4e4b4843; // "NKHC"
+static const qint32  CACHE_VERSION = 1;
+
+// TWS answers a tail over a closed market with this instead of no bars
+static const int HMDS_NO_DATA = 162;
+
+// start of each date in a '\0' terminated dates buffer, plus its end
+static QVector<int> dateOffsets(const QByteArray & dates)
+{
+    QVector<int> offsets;
+    offsets.append(0);
+    for (int i = 0; i < dates.size(); ++i) {
+        if (dates.at(i) == '\0')
+            offsets.append(i + 1);
+    }
+    return offsets;
+}
+
+// bars [i0, i1) of src to the end of dst
+static void appendRange(IBHistoricalBars & dst, QVector<int> & dstOffsets,
+                        const IBHistoricalBars & src, const QVector<int> & srcOffsets, int i0, int i1)
+{
+    if (i1 <= i0)
+        return;
+    const int n = i1 - i0;
+
+    dst.timeStamp += src.timeStamp.mid(i0, n);
+    dst.open += src.open.mid(i0, n);
+    dst.high += src.high.mid(i0, n);
+    dst.low += src.low.mid(i0, n);
+    dst.close += src.close.mid(i0, n);
+    dst.volume += src.volume.mid(i0, n);
+    dst.barCount += src.barCount.mid(i0, n);
+    dst.wap += src.wap.mid(i0, n);
+    dst.hasGaps += src.hasGaps.mid(i0, n);
+
+    const int base = dst.dates.size() - srcOffsets.at(i0);
+    dst.dates.append(src.dates.constData() + srcOffsets.at(i0), srcOffsets.at(i1) - srcOffsets.at(i0));
+    for (int i = i0 + 1; i <= i1; ++i)
+        dstOffsets.append(srcOffsets.at(i) + base);
+}
+
+static QByteArray twsDateTime(uint time)
+{
+    return QDateTime::fromTime_t(time).toString("yyyyMMdd  hh:mm:ss").toLatin1();
+}
+
+IBHistoryCache::IBHistoryCache(IBClient *client, QObject *parent)
+    : QObject(parent)
+    , m_client(client)
+    , m_hits(0)
+    , m_wireRequests(0)
+{
+    // errors of requests that never made it to TWS only come as a signal
+    connect(m_client, SIGNAL(error(int,int,QByteArray)),
+            this, SLOT(onClientError(int,int,QByteArray)));
+}
+
+IBHistoryCache::~IBHistoryCache()
+{
+    qDeleteAll(m_entries);
+}
+
+QByteArray IBHistoryCache::seriesKey(const Contract &contract, const QByteArray &barSize, const QByteArray &whatToShow,
+                                     int useRTH, int formatDate)
+{
+    QByteArray key = QByteArray::number((qlonglong)contract.conId);
+    key.append('\0').append(barSize)
+       .append('\0').append(whatToShow)
+       .append('\0').append(QByteArray::number(useRTH))
+       .append('\0').append(QByteArray::number(formatDate));
+    return key;
+}
+
+// "yyyyMMdd hh:mm:ss [tz]", local time unless GMT; empty is now
+uint IBHistoryCache::parseEndDateTime(const QByteArray &endDateTime)
+{
+    if (endDateTime.trimmed().isEmpty())
+        return QDateTime::currentDateTime().toTime_t();
+
+    QDateTime dt = QDateTime::fromString(QString::fromLatin1(endDateTime.left(17)), "yyyyMMdd hh:mm:ss");
+    if (endDateTime.endsWith("GMT"))
+        dt.setTimeSpec(Qt::UTC);
+    return dt.isValid() ? dt.toTime_t() : QDateTime::currentDateTime().toTime_t();
+}
+
+uint IBHistoryCache::durationSecs(const QByteArray &durationStr)
+{
+    const uint n = durationStr.left(durationStr.indexOf(' ')).toUInt();
+    switch (durationStr.isEmpty() ? 'S' : durationStr.at(durationStr.size() - 1)) {
+    case 'D':
+        return n * 86400;
+    case 'W':
+        return n * 7 * 86400;
+    case 'M':
+        return n * 31 * 86400;
+    case 'Y':
+        return n * 366 * 86400;
+    default:
+        return n;
+    }
+}
+
+uint IBHistoryCache::barSizeSecs(const QByteArray &barSize)
+{
+    const uint n = qMax(1u, barSize.left(barSize.indexOf(' ')).toUInt());
+    if (barSize.contains("sec"))
+        return n;
+    if (barSize.contains("min"))
+        return n * 60;
+    if (barSize.contains("hour"))
+        return n * 3600;
+    if (barSize.contains("week"))
+        return n * 7 * 86400;
+    if (barSize.contains("month"))
+        return n * 31 * 86400;
+    return n * 86400;
+}
+
+uint IBHistoryCache::startOfDay(uint time)
+{
+    return QDateTime(QDateTime::fromTime_t(time).date(), QTime(0, 0)).toTime_t();
+}
+
+void IBHistoryCache::reqHistoricalData(long reqId, const Contract &contract, const QByteArray &endDateTime, const QByteArray &durationStr,
+                                       const QByteArray &barSizeSetting, const QByteArray &whatToShow, int useRTH, int formatDate,
+                                       IBResponseHandler *handler)
+{
+    if (!handler || contract.conId <= 0) {
+        m_client->reqHistoricalData(reqId, contract, endDateTime, durationStr, barSizeSetting, whatToShow,
+                                    useRTH, formatDate, QList<TagValue*>(), handler);
+        return;
+    }
+
+    const QByteArray key = seriesKey(contract, barSizeSetting, whatToShow, useRTH, formatDate);
+    Entry* e = m_entries.value(key);
+    if (!e) {
+        e = new Entry;
+        e->barSize = barSizeSetting;
+        e->whatToShow = whatToShow;
+        e->useRTH = useRTH;
+        e->formatDate = formatDate;
+        e->barSecs = barSizeSecs(barSizeSetting);
+        e->dateOffsets.append(0);
+        e->coveredFrom = 0;
+        e->fetchedTo = 0;
+        e->wireReqId = 0;
+        e->wireEnd = 0;
+        e->wireIsTail = false;
+        m_entries.insert(key, e);
+    }
+
+    Request r;
+    r.reqId = reqId;
+    r.handler = handler;
+    r.contract = contract;
+    r.endDateTime = endDateTime;
+    r.durationStr = durationStr;
+    r.end = parseEndDateTime(endDateTime);
+    r.tailTried = false;
+    r.coalesced = e->wireReqId != 0;
+    e->requests.append(r);
+
+    if (!e->wireReqId)
+        process(e);
+}
+
+void IBHistoryCache::removeHandler(IBResponseHandler *handler)
+{
+    foreach (Entry* e, m_entries) {
+        for (int i = e->requests.size() - 1; i >= 0; --i) {
+            if (e->requests.at(i).handler == handler)
+                e->requests.removeAt(i);
+        }
+        if (e->wireFor.handler == handler)
+            e->wireFor.handler = NULL;
+    }
+    for (int i = m_served.size() - 1; i >= 0; --i) {
+        if (m_served.at(i).handler == handler)
+            m_served.removeAt(i);
+    }
+}
+
+// Start of the window durationStr reaches back from end: for days the
+// midnight of the Nth trading date among the cached bars, 0 if there are
+// fewer dates cached.
+uint IBHistoryCache::windowStart(const Entry *e, const QByteArray &durationStr, uint end) const
+{
+    if (!durationStr.endsWith('D'))
+        return end - qMin(end, durationSecs(durationStr));
+
+    const int days = durationStr.left(durationStr.indexOf(' ')).toInt();
+    const QVector<double> & ts = e->bars.timeStamp;
+    int i = (int)(std::upper_bound(ts.constBegin(), ts.constEnd(), (double)end) - ts.constBegin()) - 1;
+
+    QDate date;
+    int dates = 0;
+    for (; i >= 0; --i) {
+        QDate d = QDateTime::fromTime_t((uint)ts.at(i)).date();
+        if (d == date)
+            continue;
+        if (dates == days)
+            break;
+        date = d;
+        ++dates;
+    }
+    return dates == days ? QDateTime(date, QTime(0, 0)).toTime_t() : 0;
+}
+
+IBHistoryCache::Action IBHistoryCache::evaluate(const Entry *e, const Request &r, uint *start) const
+{
+    if (!e->fetchedTo)
+        return FETCH_FULL;
+
+    // a request that came while a fetch was out is answered by that fetch
+    uint end = r.end;
+    if (r.coalesced && end > e->fetchedTo && end <= e->fetchedTo + e->barSecs)
+        end = e->fetchedTo;
+
+    if (end > e->fetchedTo) {
+        const uint lastBar = e->bars.size() ? (uint)e->bars.timeStamp.last() : e->fetchedTo;
+        if (!r.tailTried && end - lastBar < durationSecs(r.durationStr))
+            return FETCH_TAIL;
+        return FETCH_FULL;
+    }
+
+    *start = windowStart(e, r.durationStr, end);
+    if (!*start || *start < e->coveredFrom)
+        return FETCH_FULL;
+    return SERVE;
+}
+
+// answers what the cache can and sends the first request it can't
+void IBHistoryCache::process(Entry *e)
+{
+    while (!e->requests.isEmpty() && !e->wireReqId) {
+        uint start = 0;
+        const Action action = evaluate(e, e->requests.first(), &start);
+        const Request r = e->requests.takeFirst();
+
+        if (action == SERVE) {
+            if (!r.tailTried)
+                ++m_hits;
+            serve(e, r, start);
+        }
+        else {
+            fetch(e, r, action == FETCH_TAIL);
+        }
+    }
+}
+
+void IBHistoryCache::fetch(Entry *e, const Request &r, bool tail)
+{
+    QByteArray duration = r.durationStr;
+    if (tail) {
+        // from the start of the last cached bar, it may have been incomplete
+        const uint lastBar = e->bars.size() ? (uint)e->bars.timeStamp.last() : e->fetchedTo;
+        const uint secs = r.end - lastBar + e->barSecs;
+        if (e->barSecs < 86400 && secs <= 86400)
+            duration = QByteArray::number(secs) + " S";
+        else
+            duration = QByteArray::number((secs + 86399) / 86400) + " D";
+    }
+
+    const long wireReqId = m_client->getTickerId();
+    e->wireReqId = wireReqId;
+    e->wireDuration = duration;
+    e->wireEnd = r.end;
+    e->wireIsTail = tail;
+    e->wireFor = r;
+    m_wire.insert(wireReqId, e);
+    ++m_wireRequests;
+
+    m_client->reqHistoricalData(wireReqId, r.contract, r.endDateTime, duration, e->barSize, e->whatToShow,
+                                e->useRTH, e->formatDate, QList<TagValue*>(), this);
+}
+
+void IBHistoryCache::serve(Entry *e, const Request &r, uint start)
+{
+    const QVector<double> & ts = e->bars.timeStamp;
+    const int i0 = (int)(std::lower_bound(ts.constBegin(), ts.constEnd(), (double)start) - ts.constBegin());
+    const int i1 = (int)(std::upper_bound(ts.constBegin(), ts.constEnd(), (double)r.end) - ts.constBegin());
+
+    IBHistoricalBars bars;
+    QVector<int> offsets;
+    offsets.append(0);
+    bars.reserve(qMax(0, i1 - i0));
+    appendRange(bars, offsets, e->bars, e->dateOffsets, i0, i1);
+    bars.startDate = twsDateTime(start);
+    bars.endDate = twsDateTime(qMin(r.end, e->fetchedTo));
+
+    Served served;
+    served.reqId = r.reqId;
+    served.handler = r.handler;
+    served.bars = bars;
+    m_served.append(served);
+    if (m_served.size() == 1)
+        QMetaObject::invokeMethod(this, "deliverServed", Qt::QueuedConnection);
+}
+
+void IBHistoryCache::deliverServed()
+{
+    // a handler may ask again or go away while answered
+    while (!m_served.isEmpty()) {
+        const Served served = m_served.takeFirst();
+        served.handler->onHistoricalBars(served.reqId, served.bars);
+    }
+}
+
+// The response replaces the cached bars over its own range. Ranges that
+// neither touch nor overlap aren't merged: a newer one replaces the cache,
+// an older one is only handed out.
+void IBHistoryCache::merge(Entry *e, const IBHistoricalBars &bars, uint from, uint to)
+{
+    const bool empty = !e->fetchedTo;
+    const bool touches = from <= e->fetchedTo + e->barSecs && to + e->barSecs >= e->coveredFrom;
+
+    if (!empty && !touches && from < e->fetchedTo)
+        return;
+
+    const QVector<int> offsets = dateOffsets(bars.dates);
+
+    if (empty || !touches) {
+        e->bars = bars;
+        e->dateOffsets = offsets;
+        e->coveredFrom = from;
+        e->fetchedTo = to;
+        return;
+    }
+
+    IBHistoricalBars merged;
+    QVector<int> mergedOffsets;
+    mergedOffsets.append(0);
+    merged.reserve(e->bars.size() + bars.size());
+
+    const QVector<double> & ts = e->bars.timeStamp;
+    const double first = bars.size() ? bars.timeStamp.first() : (double)to + 1;
+    const double last = bars.size() ? bars.timeStamp.last() : (double)to;
+    const int before = (int)(std::lower_bound(ts.constBegin(), ts.constEnd(), first) - ts.constBegin());
+    const int after = (int)(std::upper_bound(ts.constBegin(), ts.constEnd(), last) - ts.constBegin());
+
+    appendRange(merged, mergedOffsets, e->bars, e->dateOffsets, 0, before);
+    appendRange(merged, mergedOffsets, bars, offsets, 0, bars.size());
+    appendRange(merged, mergedOffsets, e->bars, e->dateOffsets, qMax(before, after), e->bars.size());
+
+    e->bars = merged;
+    e->dateOffsets = mergedOffsets;
+    e->coveredFrom = qMin(e->coveredFrom, from);
+    e->fetchedTo = qMax(e->fetchedTo, to);
+}
+
+void IBHistoryCache::onHistoricalBars(long reqId, const IBHistoricalBars &bars)
+{
+    Entry* e = m_wire.take(reqId);
+    if (!e)
+        return;
+    e->wireReqId = 0;
+
+    const uint to = e->wireEnd;
+    uint from;
+    if (e->wireDuration.endsWith('D'))
+        from = bars.size() ? startOfDay((uint)bars.timeStamp.first()) : to;
+    else
+        from = to - qMin(to, durationSecs(e->wireDuration));
+    merge(e, bars, from, to);
+
+    Request r = e->wireFor;
+    if (r.handler) {
+        if (e->wireIsTail) {
+            r.tailTried = true;
+            e->requests.prepend(r);
+        }
+        else {
+            r.handler->onHistoricalBars(r.reqId, bars);
+        }
+    }
+
+    process(e);
+}
+
+void IBHistoryCache::onClientError(int id, int errorCode, const QByteArray &errorString)
+{
+    if (id > 0)
+        onRequestError(id, errorCode, errorString);
+}
+
+// called for the errors TWS sends and for requests the client couldn't
+// send, whichever comes first
+void IBHistoryCache::onRequestError(long reqId, int errorCode, const QByteArray &errorMsg)
+{
+    Entry* e = m_wire.take(reqId);
+    if (!e)
+        return;
+    e->wireReqId = 0;
+
+    Request r = e->wireFor;
+    if (e->wireIsTail && errorCode == HMDS_NO_DATA) {
+        // nothing traded since, the cache is current
+        e->fetchedTo = qMax(e->fetchedTo, e->wireEnd);
+        if (r.handler) {
+            r.tailTried = true;
+            e->requests.prepend(r);
+        }
+    }
+    else if (e->wireIsTail && r.handler) {
+        r.tailTried = true;
+        e->requests.prepend(r);
+    }
+    else if (r.handler) {
+        r.handler->onRequestError(r.reqId, errorCode, errorMsg);
+    }
+
+    process(e);
+}
+
+bool IBHistoryCache::save(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out << CACHE_MAGIC << CACHE_VERSION << (qint32)m_entries.size();
+
+    foreach (const QByteArray & key, m_entries.keys()) {
+        const Entry* e = m_entries.value(key);
+        const IBHistoricalBars & b = e->bars;
+        out << key << e->barSize << e->whatToShow << (qint32)e->useRTH << (qint32)e->formatDate
+            << e->coveredFrom << e->fetchedTo
+            << b.dates << b.timeStamp << b.open << b.high << b.low << b.close
+            << b.volume << b.barCount << b.wap << b.hasGaps;
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+bool IBHistoryCache::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic;
+    qint32 version;
+    qint32 count;
+    in >> magic >> version >> count;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        qWarning() << "[HISTCACHE]" << path << "is not a history cache of this version";
+        return false;
+    }
+
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QByteArray key;
+        qint32 useRTH;
+        qint32 formatDate;
+        Entry* e = new Entry;
+        IBHistoricalBars & b = e->bars;
+        in >> key >> e->barSize >> e->whatToShow >> useRTH >> formatDate
+           >> e->coveredFrom >> e->fetchedTo
+           >> b.dates >> b.timeStamp >> b.open >> b.high >> b.low >> b.close
+           >> b.volume >> b.barCount >> b.wap >> b.hasGaps;
+
+        e->useRTH = useRTH;
+        e->formatDate = formatDate;
+        e->barSecs = barSizeSecs(e->barSize);
+        e->dateOffsets = dateOffsets(b.dates);
+        e->wireReqId = 0;
+        e->wireEnd = 0;
+        e->wireIsTail = false;
+
+        if (in.status() != QDataStream::Ok || e->dateOffsets.size() != b.size() + 1 || m_entries.contains(key)) {
+            delete e;
+            continue;
+        }
+        m_entries.insert(key, e);
+    }
+    return in.status() == QDataStream::Ok;
+}
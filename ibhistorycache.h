@@ -0,0 +1,131 @@
+#ifndef IBHISTORYCACHE_H
+#define IBHISTORYCACHE_H
+
+#include "ibcontract.h"
+#include "ibhistoricalbars.h"
+#include "ibresponsehandler.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+class IBClient;
+
+// Sits in front of IBClient::reqHistoricalData() for requests made with a
+// handler. Bars are kept per (conId, barSize, whatToShow, useRTH,
+// formatDate) as one merged range. A request the range covers is answered
+// from it; one that only lacks the newest bars asks TWS for the tail since
+// the last cached bar; anything else goes out as requested and is merged
+// in. While a request for a series is on the wire, further ones for it wait
+// and are answered from its result, so identical requests from several
+// pages cost one round trip. Answers from the cache are delivered from the
+// event loop, never from within reqHistoricalData(). The cache can be
+// saved and loaded so a new session starts with the bars of the last one.
+//
+// "N D" durations are counted in trading days, the others in calendar
+// seconds, weeks, months of 31 and years of 366 days.
+class IBHistoryCache : public QObject, public IBResponseHandler
+{
+    Q_OBJECT
+public:
+    explicit IBHistoryCache(IBClient* client, QObject *parent = 0);
+    ~IBHistoryCache();
+
+    // same as IBClient::reqHistoricalData(); contracts without conId and
+    // requests without handler go straight to the client
+    void reqHistoricalData(long reqId, const Contract & contract, const QByteArray & endDateTime, const QByteArray & durationStr,
+                           const QByteArray & barSizeSetting, const QByteArray & whatToShow, int useRTH, int formatDate,
+                           IBResponseHandler* handler);
+
+    // drops the waiting requests of handler, e.g. when it is destroyed
+    void removeHandler(IBResponseHandler* handler);
+
+    bool load(const QString & path);
+    bool save(const QString & path) const;
+
+    // seconds of a TWS duration string ("N S", "N D", ...), a day, month
+    // and year taken as 1, 31 and 366 calendar days
+    static uint durationSecs(const QByteArray & durationStr);
+
+    quint64 hits() const { return m_hits; }
+    quint64 wireRequests() const { return m_wireRequests; }
+
+    // IBResponseHandler, for the requests the cache sends
+    void onHistoricalBars(long reqId, const IBHistoricalBars & bars);
+    void onRequestError(long reqId, int errorCode, const QByteArray & errorMsg);
+
+private slots:
+    void onClientError(int id, int errorCode, const QByteArray & errorString);
+    void deliverServed();
+
+private:
+    struct Request
+    {
+        long                reqId;
+        IBResponseHandler*  handler;
+        Contract            contract;
+        QByteArray          endDateTime;
+        QByteArray          durationStr;
+        uint                end;
+        bool                tailTried;
+        bool                coalesced;  // arrived while a fetch was out
+    };
+
+    struct Entry
+    {
+        QByteArray      barSize;
+        QByteArray      whatToShow;
+        int             useRTH;
+        int             formatDate;
+        uint            barSecs;
+
+        // the bars, with the start of each date in bars.dates and its end
+        IBHistoricalBars bars;
+        QVector<int>    dateOffsets;
+        uint            coveredFrom;
+        uint            fetchedTo;
+
+        long            wireReqId;      // 0 when nothing is on the wire
+        QByteArray      wireDuration;
+        uint            wireEnd;
+        bool            wireIsTail;
+        Request         wireFor;        // handler cleared when it went away
+        QList<Request>  requests;       // waiting, in order of arrival
+    };
+
+    // an answer from the cache, waiting for the event loop
+    struct Served
+    {
+        long                reqId;
+        IBResponseHandler*  handler;
+        IBHistoricalBars    bars;
+    };
+
+    enum Action { SERVE, FETCH_TAIL, FETCH_FULL };
+
+    Action  evaluate(const Entry* e, const Request & r, uint* windowStart) const;
+    void    process(Entry* e);
+    void    fetch(Entry* e, const Request & r, bool tail);
+    void    serve(Entry* e, const Request & r, uint windowStart);
+    void    merge(Entry* e, const IBHistoricalBars & bars, uint from, uint to);
+
+    uint    windowStart(const Entry* e, const QByteArray & durationStr, uint end) const;
+
+    static QByteArray   seriesKey(const Contract & contract, const QByteArray & barSize, const QByteArray & whatToShow,
+                                  int useRTH, int formatDate);
+    static uint         parseEndDateTime(const QByteArray & endDateTime);
+    static uint         barSizeSecs(const QByteArray & barSize);
+    static uint         startOfDay(uint time);
+
+    IBClient*               m_client;
+    QHash<QByteArray, Entry*> m_entries;
+    QHash<long, Entry*>     m_wire;         // by wire reqId
+    QList<Served>           m_served;
+    quint64                 m_hits;
+    quint64                 m_wireRequests;
+};
+
+#endif // IBHISTORYCACHE_H
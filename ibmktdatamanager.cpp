@@ -0,0 +1,103 @@
+#include "ibmktdatamanager.h"
+#include "ibclient.h"
+
+#include <QDebug>
+
+IBMktDataManager::IBMktDataManager(IBClient *client, QObject *parent)
+    : QObject(parent)
+    , m_client(client)
+    , m_lineBudget(100)
+{
+}
+
+IBMktDataManager::~IBMktDataManager()
+{
+    qDeleteAll(m_lines);
+}
+
+QByteArray IBMktDataManager::lineKey(const Contract &contract)
+{
+    if (contract.conId > 0)
+        return QByteArray::number((qlonglong)contract.conId);
+
+    // before the contract details are in
+    QByteArray key;
+    key.append(contract.symbol).append('\0')
+       .append(contract.secType).append('\0')
+       .append(contract.expiry).append('\0')
+       .append(contract.exchange);
+    return key;
+}
+
+long IBMktDataManager::acquire(const Contract &contract, IBTickSubscriber *subscriber)
+{
+    const QByteArray key = lineKey(contract);
+    Line* line = m_linesByKey.value(key);
+
+    if (!line) {
+        line = new Line;
+        line->tickerId = m_client->getTickerId();
+        line->key = key;
+        line->contract = contract;
+        m_linesByKey.insert(key, line);
+        m_lines.insert(line->tickerId, line);
+
+        m_client->reqMktData(line->tickerId, contract, QByteArray(""), false);
+
+        if (linesUsed() > m_lineBudget)
+            qWarning() << "[MKTDATA]" << linesUsed() << "market data lines in use, budget is" << m_lineBudget;
+        emit linesUsedChanged(linesUsed(), m_lineBudget);
+    }
+
+    ++line->refs[subscriber];
+    m_client->subscribeTicks(line->tickerId, subscriber);
+    return line->tickerId;
+}
+
+void IBMktDataManager::release(long tickerId, IBTickSubscriber *subscriber)
+{
+    Line* line = m_lines.value(tickerId);
+    if (line && line->refs.contains(subscriber))
+        releaseRefs(line, subscriber, 1);
+}
+
+void IBMktDataManager::releaseAll(IBTickSubscriber *subscriber)
+{
+    foreach (long tickerId, m_lines.keys()) {
+        Line* line = m_lines.value(tickerId);
+        if (line->refs.contains(subscriber))
+            releaseRefs(line, subscriber, line->refs.value(subscriber));
+    }
+}
+
+void IBMktDataManager::releaseRefs(Line *line, IBTickSubscriber *subscriber, int refs)
+{
+    int & count = line->refs[subscriber];
+    count -= refs;
+    if (count > 0)
+        return;
+
+    line->refs.remove(subscriber);
+    m_client->unsubscribeTicks(line->tickerId, subscriber);
+    if (!line->refs.isEmpty())
+        return;
+
+    m_linesByKey.remove(line->key);
+    m_lines.remove(line->tickerId);
+    m_client->cancelMktData(line->tickerId);
+    delete line;
+
+    emit linesUsedChanged(linesUsed(), m_lineBudget);
+}
+
+const Contract *IBMktDataManager::contract(long tickerId) const
+{
+    const Line* line = m_lines.value(tickerId);
+    return line ? &line->contract : NULL;
+}
+
+void IBMktDataManager::setLineBudget(int lines)
+{
+    m_lineBudget = lines;
+    emit linesUsedChanged(linesUsed(), m_lineBudget);
+}
@@ -0,0 +1,63 @@
+#ifndef IBMKTDATAMANAGER_H
+#define IBMKTDATAMANAGER_H
+
+#include "ibcontract.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+
+class IBClient;
+class IBTickSubscriber;
+
+// Shares one reqMktData() line per contract between everyone who needs its
+// ticks. Lines are keyed by conId (symbol, type, expiry and exchange for
+// contracts without one), counted per subscriber and cancelled when the
+// last reference is released. The ticks are fanned out by IBClient to every
+// subscriber of the line's tickerId.
+//
+// TWS limits the number of simultaneous lines; linesUsedChanged() reports
+// the usage against the budget, which defaults to the 100 lines of a
+// standard account.
+class IBMktDataManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IBMktDataManager(IBClient* client, QObject *parent = 0);
+    ~IBMktDataManager();
+
+    // tickerId of the line for contract, requested on the first acquire
+    long acquire(const Contract & contract, IBTickSubscriber* subscriber);
+    void release(long tickerId, IBTickSubscriber* subscriber);
+    // drops every reference of subscriber, e.g. when it is destroyed
+    void releaseAll(IBTickSubscriber* subscriber);
+
+    // contract of an acquired line, NULL for other tickerIds
+    const Contract* contract(long tickerId) const;
+
+    int  linesUsed() const { return m_lines.size(); }
+    int  lineBudget() const { return m_lineBudget; }
+    void setLineBudget(int lines);
+
+signals:
+    void linesUsedChanged(int used, int budget);
+
+private:
+    struct Line
+    {
+        long                        tickerId;
+        QByteArray                  key;
+        Contract                    contract;
+        QHash<IBTickSubscriber*, int> refs;
+    };
+
+    static QByteArray lineKey(const Contract & contract);
+    void releaseRefs(Line* line, IBTickSubscriber* subscriber, int refs);
+
+    IBClient*               m_client;
+    QHash<QByteArray, Line*> m_linesByKey;
+    QHash<long, Line*>      m_lines;
+    int                     m_lineBudget;
+};
+
+#endif // IBMKTDATAMANAGER_H
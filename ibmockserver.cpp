@@ -0,0 +1,733 @@
+#include "ibmockserver.h"
+#include "ibdefines.h"
+#include "ibticktype.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QDateTime>
+#include <QDate>
+#include <QtAlgorithms>
+#include <QtDebug>
+
+#include <algorithm>
+#include <cmath>
+
+// the layouts walked below are the ones IBClient encodes for this version
+static const int MOCK_SERVER_VERSION = MIN_SERVER_VER_LINKING;
+
+static const char* MOCK_ACCOUNT = "DU000000";
+
+// background tickers are numbered from here so they never collide with the
+// ticker ids the client hands out
+static const long BACKGROUND_TICKER_BASE = 900000;
+
+static const int MAX_HISTORICAL_BARS = 5000;
+
+static quint64 mix(quint64 x)
+{
+    // splitmix64 finalizer
+    x += Q_UINT64_C(0x9e3779b97f4a7c15);
+    x = (x ^ (x >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+}
+
+static double unitNoise(quint64 x)
+{
+    return (double)(mix(x) >> 11) / 9007199254740992.0;
+}
+
+static double roundToCents(double price)
+{
+    return std::floor(price * 100 + 0.5) / 100;
+}
+
+static int barSizeInSeconds(const QByteArray & barSize)
+{
+    QList<QByteArray> parts = barSize.trimmed().toLower().split(' ');
+    int n = qMax(1, parts.first().toInt());
+    QByteArray unit = parts.size() > 1 ? parts.at(1) : QByteArray("min");
+
+    if (unit.startsWith("sec"))
+        return n;
+    if (unit.startsWith("min"))
+        return n * 60;
+    if (unit.startsWith("hour"))
+        return n * 3600;
+    if (unit.startsWith("day"))
+        return n * 86400;
+    if (unit.startsWith("week"))
+        return n * 604800;
+    if (unit.startsWith("month"))
+        return n * 2592000;
+    return 60;
+}
+
+static qint64 durationInSeconds(const QByteArray & duration)
+{
+    QList<QByteArray> parts = duration.trimmed().toUpper().split(' ');
+    qint64 n = qMax(1, parts.first().toInt());
+    char unit = parts.size() > 1 && !parts.at(1).isEmpty() ? parts.at(1).at(0) : 'S';
+
+    switch (unit) {
+    case 'D': return n * 86400;
+    case 'W': return n * 604800;
+    case 'M': return n * 2592000;
+    case 'Y': return n * 31536000;
+    default:  return n;
+    }
+}
+
+IBMockServer::IBMockServer(QObject *parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+    , m_tickers(100)
+    , m_tickRate(1000)
+    , m_nextOrderId(1)
+    , m_rng(1)
+    , m_ticksSent(0)
+    , m_bytesSent(0)
+    , m_orders(0)
+{
+    connect(m_server, SIGNAL(newConnection()),
+            this, SLOT(onNewConnection()));
+
+    m_tickTimer.setTimerType(Qt::PreciseTimer);
+    m_tickTimer.setInterval(1);
+    connect(&m_tickTimer, SIGNAL(timeout()),
+            this, SLOT(onTickTimeout()));
+
+    m_reportTimer.setInterval(10000);
+    connect(&m_reportTimer, SIGNAL(timeout()),
+            this, SLOT(report()));
+}
+
+IBMockServer::~IBMockServer()
+{
+    qDeleteAll(m_sessions);
+}
+
+bool IBMockServer::listen(quint16 port)
+{
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        qWarning() << "[mock-tws] cannot listen on port" << port << m_server->errorString();
+        return false;
+    }
+
+    qDebug() << "[mock-tws] listening on port" << port << "-"
+             << m_tickers << "background tickers," << m_tickRate << "ticks/s per client";
+
+    m_clock.start();
+    m_tickTimer.start();
+    m_reportTimer.start();
+    return true;
+}
+
+qint64 IBMockServer::latencyPercentile(double p) const
+{
+    if (m_latencies.isEmpty())
+        return -1;
+
+    QVector<qint64> sorted = m_latencies;
+    int i = qBound(0, (int)(p * sorted.size()), sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+    return sorted.at(i);
+}
+
+void IBMockServer::report()
+{
+    QByteArray latency = "no orders";
+    if (!m_latencies.isEmpty()) {
+        latency = QByteArray("tick-to-order usecs p50 ") + QByteArray::number(latencyPercentile(0.50) / 1000)
+                + " p90 " + QByteArray::number(latencyPercentile(0.90) / 1000)
+                + " p99 " + QByteArray::number(latencyPercentile(0.99) / 1000)
+                + " max " + QByteArray::number(latencyPercentile(1.0) / 1000);
+    }
+
+    qDebug() << "[mock-tws]" << m_sessions.size() << "clients,"
+             << m_ticksSent << "ticks," << m_bytesSent << "bytes,"
+             << m_orders << "orders," << latency.constData();
+}
+
+void IBMockServer::onNewConnection()
+{
+    while (QTcpSocket* socket = m_server->nextPendingConnection()) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        Session* s = new Session;
+        s->socket = socket;
+        s->clientVersion = 0;
+        s->started = false;
+        s->closing = false;
+        s->clientId = -1;
+        s->nextTicker = 0;
+        s->startNsecs = 0;
+        s->ticksSent = 0;
+        m_sessions.insert(socket, s);
+
+        connect(socket, SIGNAL(readyRead()),
+                this, SLOT(onReadyRead()));
+        connect(socket, SIGNAL(disconnected()),
+                this, SLOT(onDisconnected()));
+    }
+}
+
+void IBMockServer::onDisconnected()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    delete m_sessions.take(socket);
+    socket->deleteLater();
+
+    report();
+}
+
+void IBMockServer::onReadyRead()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    Session* s = m_sessions.value(socket);
+    if (!s)
+        return;
+
+    s->in.append(socket->readAll());
+
+    const char* begin = s->in.constData();
+    const char* end = begin + s->in.size();
+    int consumed = 0;
+
+    while (begin + consumed < end) {
+        IBFieldCursor c(begin + consumed, end);
+        if (!processMsg(s, c))
+            break;
+        consumed = c.pos() - begin;
+    }
+
+    s->in.remove(0, consumed);
+    flush(s);
+
+    if (s->closing) {
+        s->in.clear();
+        socket->disconnectFromHost();
+    }
+}
+
+// Walks one client message. Returns false if it is not complete yet, or if
+// the session has to be closed because the stream can't be framed any more.
+bool IBMockServer::processMsg(Session *s, IBFieldCursor &c)
+{
+    if (!s->clientVersion) {
+        int clientVersion = c.readInt();
+        if (c.underflow())
+            return false;
+
+        s->clientVersion = qMax(1, clientVersion);
+        encodeField(s->out, MOCK_SERVER_VERSION);
+        encodeField(s->out, QDateTime::currentDateTime().toString("yyyyMMdd hh:mm:ss").toLatin1() + " EST");
+        return true;
+    }
+
+    int msgId = c.readInt();
+
+    switch (msgId) {
+    case START_API:
+        c.skip();
+        s->clientId = c.readInt();
+        if (c.underflow())
+            return false;
+
+        s->started = true;
+        s->startNsecs = m_clock.nsecsElapsed();
+        s->ticksSent = 0;
+        addBackgroundTickers(s);
+
+        encodeField(s->out, NEXT_VALID_ID);
+        encodeField(s->out, 1);
+        encodeField(s->out, m_nextOrderId);
+
+        encodeField(s->out, MANAGED_ACCTS);
+        encodeField(s->out, 1);
+        encodeField(s->out, QByteArray(MOCK_ACCOUNT));
+        return true;
+
+    case REQ_MKT_DATA:
+        return reqMktData(s, c);
+
+    case CANCEL_MKT_DATA:
+        return cancelMktData(s, c);
+
+    case PLACE_ORDER:
+        return placeOrder(s, c);
+
+    case REQ_CONTRACT_DATA:
+        return reqContractDetails(s, c);
+
+    case REQ_HISTORICAL_DATA:
+        return reqHistoricalData(s, c);
+
+    case REQ_REAL_TIME_BARS:
+        return reqRealTimeBars(s, c);
+
+    case CANCEL_REAL_TIME_BARS:
+        skip(c, 2); // version, tickerId
+        return !c.underflow();
+
+    case REQ_MKT_DEPTH:
+        // accepted but not served
+        skip(c, 15); // version, tickerId, contract, numRows, options
+        return !c.underflow();
+
+    case CANCEL_MKT_DEPTH:
+        skip(c, 2); // version, tickerId
+        return !c.underflow();
+
+    case REQ_IDS:
+        skip(c, 2);
+        if (c.underflow())
+            return false;
+        encodeField(s->out, NEXT_VALID_ID);
+        encodeField(s->out, 1);
+        encodeField(s->out, m_nextOrderId);
+        return true;
+
+    case REQ_CURRENT_TIME:
+        c.skip();
+        if (c.underflow())
+            return false;
+        encodeField(s->out, CURRENT_TIME);
+        encodeField(s->out, 1);
+        encodeField(s->out, (int)QDateTime::currentDateTime().toTime_t());
+        return true;
+
+    case REQ_OPEN_ORDERS:
+    case REQ_ALL_OPEN_ORDERS:
+        c.skip();
+        if (c.underflow())
+            return false;
+        encodeField(s->out, OPEN_ORDER_END);
+        encodeField(s->out, 1);
+        return true;
+
+    case REQ_ACCT_DATA: {
+        c.skip();
+        int subscribe = c.readInt();
+        c.skip();
+        if (c.underflow())
+            return false;
+        if (subscribe) {
+            encodeField(s->out, ACCT_DOWNLOAD_END);
+            encodeField(s->out, 1);
+            encodeField(s->out, QByteArray(MOCK_ACCOUNT));
+        }
+        return true;
+    }
+
+    default:
+        if (c.underflow())
+            return false;
+        qWarning() << "[mock-tws] unsupported request" << msgId << "- closing the connection";
+        s->closing = true;
+        return false;
+    }
+}
+
+bool IBMockServer::reqMktData(Session *s, IBFieldCursor &c)
+{
+    c.skip(); // version
+    long tickerId = c.readLong();
+    c.skip(); // conId
+    QByteArray symbol = c.readString();
+    QByteArray secType = c.readString();
+    skip(c, 9); // expiry .. tradingClass
+    if (secType == "BAG")
+        skip(c, 4 * c.readInt());
+    if (c.readInt()) // underComp
+        skip(c, 3);
+    skip(c, 3); // genericTicks, snapshot, mktDataOptions
+
+    if (c.underflow())
+        return false;
+
+    Ticker t;
+    t.tickerId = tickerId;
+    t.symbol = symbol;
+    t.price = roundToCents(barPrice(symbol, QDateTime::currentDateTime().toTime_t()));
+    t.step = 0;
+    t.lastTickNsecs = 0;
+    s->tickers.append(t);
+    return true;
+}
+
+bool IBMockServer::cancelMktData(Session *s, IBFieldCursor &c)
+{
+    c.skip(); // version
+    long tickerId = c.readLong();
+
+    if (c.underflow())
+        return false;
+
+    for (int i = 0; i < s->tickers.size(); ++i) {
+        if (s->tickers.at(i).tickerId == tickerId) {
+            s->tickers.remove(i);
+            break;
+        }
+    }
+    if (s->nextTicker >= s->tickers.size())
+        s->nextTicker = 0;
+    return true;
+}
+
+bool IBMockServer::placeOrder(Session *s, IBFieldCursor &c)
+{
+    c.skip(); // version
+    int orderId = c.readInt();
+    c.skip(); // conId
+    QByteArray symbol = c.readString();
+    QByteArray secType = c.readString();
+    skip(c, 11); // expiry .. secId
+    c.skip(); // action
+    int quantity = c.readInt();
+    QByteArray orderType = c.readString();
+    double lmtPrice = c.readDouble();
+    c.skip(); // auxPrice
+    skip(c, 8); // tif .. parentId
+    skip(c, 6); // blockOrder .. hidden
+    if (secType == "BAG") {
+        skip(c, 8 * c.readInt()); // combo legs
+        skip(c, c.readInt()); // order combo leg prices
+        skip(c, 2 * c.readInt()); // smart combo routing params
+    }
+    skip(c, 4); // sharesAllocation .. goodTillDate
+    skip(c, 4); // fa fields
+    skip(c, 3); // shortSaleSlot, designatedLocation, exemptCode
+    skip(c, 15); // ocaType .. stockRangeUpper
+    c.skip(); // overridePercentageConstraints
+    skip(c, 2); // volatility, volatilityType
+    QByteArray deltaNeutralOrderType = c.readString();
+    c.skip(); // deltaNeutralAuxPrice
+    if (!deltaNeutralOrderType.isEmpty())
+        skip(c, 8);
+    skip(c, 4); // continuousUpdate .. trailingPercent
+    skip(c, 2); // scaleInitLevelSize, scaleSubsLevelSize
+    if (c.readDouble() > 0) // scalePriceIncrement
+        skip(c, 7);
+    skip(c, 3); // scaleTable, activeStartTime, activeStopTime
+    if (!c.readString().isEmpty()) // hedgeType
+        c.skip();
+    c.skip(); // optOutSmartRouting
+    skip(c, 2); // clearingAccount, clearingIntent
+    c.skip(); // notHeld
+    if (c.readInt()) // underComp
+        skip(c, 3);
+    if (!c.readString().isEmpty()) // algoStrategy
+        skip(c, 2 * c.readInt());
+    c.skip(); // whatIf
+    c.skip(); // miscOptions
+
+    if (c.underflow())
+        return false;
+
+    ++m_orders;
+    m_nextOrderId = qMax(m_nextOrderId, orderId + 1);
+
+    Ticker* t = findTicker(s, symbol);
+    if (t && t->lastTickNsecs)
+        m_latencies.append(m_clock.nsecsElapsed() - t->lastTickNsecs);
+
+    double fillPrice = (orderType == "LMT" || !t) ? lmtPrice : t->price;
+
+    encodeField(s->out, ORDER_STATUS);
+    encodeField(s->out, 6);
+    encodeField(s->out, orderId);
+    encodeField(s->out, QByteArray("Submitted"));
+    encodeField(s->out, 0);
+    encodeField(s->out, quantity);
+    encodeField(s->out, 0.0);
+    encodeField(s->out, 1000000 + orderId);
+    encodeField(s->out, 0);
+    encodeField(s->out, 0.0);
+    encodeField(s->out, s->clientId);
+    encodeField(s->out, QByteArray());
+
+    encodeField(s->out, ORDER_STATUS);
+    encodeField(s->out, 6);
+    encodeField(s->out, orderId);
+    encodeField(s->out, QByteArray("Filled"));
+    encodeField(s->out, quantity);
+    encodeField(s->out, 0);
+    encodeField(s->out, fillPrice);
+    encodeField(s->out, 1000000 + orderId);
+    encodeField(s->out, 0);
+    encodeField(s->out, fillPrice);
+    encodeField(s->out, s->clientId);
+    encodeField(s->out, QByteArray());
+    return true;
+}
+
+bool IBMockServer::reqContractDetails(Session *s, IBFieldCursor &c)
+{
+    c.skip(); // version
+    int reqId = c.readInt();
+    c.skip(); // conId
+    QByteArray symbol = c.readString();
+    QByteArray secType = c.readString();
+    skip(c, 4); // expiry, strike, right, multiplier
+    QByteArray exchange = c.readString();
+    QByteArray currency = c.readString();
+    skip(c, 5); // localSymbol .. secId
+
+    if (c.underflow())
+        return false;
+
+    // always open, so the pair pages start trading straight away
+    QByteArray hours = QDate::currentDate().toString("yyyyMMdd").toLatin1() + ":0000-2359";
+
+    encodeField(s->out, CONTRACT_DATA);
+    encodeField(s->out, 8);
+    encodeField(s->out, reqId);
+    encodeField(s->out, symbol);
+    encodeField(s->out, secType);
+    encodeField(s->out, QByteArray()); // expiry
+    encodeField(s->out, 0.0); // strike
+    encodeField(s->out, QByteArray()); // right
+    encodeField(s->out, exchange);
+    encodeField(s->out, currency);
+    encodeField(s->out, symbol); // localSymbol
+    encodeField(s->out, symbol); // marketName
+    encodeField(s->out, symbol); // tradingClass
+    encodeField(s->out, conIdFor(symbol));
+    encodeField(s->out, 0.01); // minTick
+    encodeField(s->out, QByteArray()); // multiplier
+    encodeField(s->out, QByteArray("LMT,MKT"));
+    encodeField(s->out, exchange); // validExchanges
+    encodeField(s->out, 1); // priceMagnifier
+    encodeField(s->out, 0); // underConId
+    encodeField(s->out, symbol); // longName
+    encodeField(s->out, QByteArray("NASDAQ")); // primaryExchange
+    encodeField(s->out, QByteArray()); // contractMonth
+    encodeField(s->out, QByteArray()); // industry
+    encodeField(s->out, QByteArray()); // category
+    encodeField(s->out, QByteArray()); // subcategory
+    encodeField(s->out, QByteArray("EST5EDT"));
+    encodeField(s->out, hours); // tradingHours
+    encodeField(s->out, hours); // liquidHours
+    encodeField(s->out, QByteArray()); // evRule
+    encodeField(s->out, 0.0); // evMultiplier
+    encodeField(s->out, 0); // secIdList
+
+    encodeField(s->out, CONTRACT_DATA_END);
+    encodeField(s->out, 1);
+    encodeField(s->out, reqId);
+    return true;
+}
+
+bool IBMockServer::reqHistoricalData(Session *s, IBFieldCursor &c)
+{
+    c.skip(); // version
+    int reqId = c.readInt();
+    c.skip(); // conId
+    QByteArray symbol = c.readString();
+    QByteArray secType = c.readString();
+    skip(c, 10); // expiry .. includeExpired
+    QByteArray endDateTime = c.readString();
+    QByteArray barSize = c.readString();
+    QByteArray duration = c.readString();
+    skip(c, 2); // useRTH, whatToShow
+    int formatDate = c.readInt();
+    if (secType == "BAG")
+        skip(c, 4 * c.readInt());
+    c.skip(); // chartOptions
+
+    if (c.underflow())
+        return false;
+
+    QDateTime endDT = QDateTime::currentDateTime();
+    if (endDateTime.size() >= 17) {
+        endDT = QDateTime::fromString(QString::fromLatin1(endDateTime.left(17)), "yyyyMMdd hh:mm:ss");
+        if (endDateTime.endsWith("GMT"))
+            endDT.setTimeSpec(Qt::UTC);
+    }
+
+    qint64 barSecs = barSizeInSeconds(barSize);
+    qint64 end = (endDT.toMSecsSinceEpoch() / 1000 / barSecs) * barSecs;
+    int count = (int)qBound((qint64)1, durationInSeconds(duration) / barSecs, (qint64)MAX_HISTORICAL_BARS);
+    qint64 start = end - count * barSecs;
+
+    encodeField(s->out, HISTORICAL_DATA);
+    encodeField(s->out, 3);
+    encodeField(s->out, reqId);
+    encodeField(s->out, QDateTime::fromMSecsSinceEpoch(start * 1000).toString("yyyyMMdd  hh:mm:ss").toLatin1());
+    encodeField(s->out, QDateTime::fromMSecsSinceEpoch(end * 1000).toString("yyyyMMdd  hh:mm:ss").toLatin1());
+    encodeField(s->out, count);
+
+    for (qint64 t = start; t < end; t += barSecs) {
+        double open = roundToCents(barPrice(symbol, t));
+        double close = roundToCents(barPrice(symbol, t + barSecs));
+        double wiggle = roundToCents(open * 0.001 * unitNoise(qHash(symbol) ^ (quint64)t));
+        double high = qMax(open, close) + wiggle;
+        double low = qMin(open, close) - wiggle;
+        int volume = 100 + (int)(mix((quint64)t) % 900);
+
+        QByteArray date;
+        if (barSecs >= 86400)
+            date = QDateTime::fromMSecsSinceEpoch(t * 1000).toString("yyyyMMdd").toLatin1();
+        else if (formatDate == 2)
+            date = QByteArray::number(t);
+        else
+            date = QDateTime::fromMSecsSinceEpoch(t * 1000).toString("yyyyMMdd  hh:mm:ss").toLatin1();
+
+        encodeField(s->out, date);
+        encodeField(s->out, open);
+        encodeField(s->out, high);
+        encodeField(s->out, low);
+        encodeField(s->out, close);
+        encodeField(s->out, volume);
+        encodeField(s->out, roundToCents((open + high + low + close) / 4));
+        encodeField(s->out, QByteArray("false"));
+        encodeField(s->out, volume / 10 + 1);
+    }
+    return true;
+}
+
+bool IBMockServer::reqRealTimeBars(Session *s, IBFieldCursor &c)
+{
+    Q_UNUSED(s);
+
+    // accepted but not served
+    skip(c, 18); // version, tickerId, contract, barSize, whatToShow, useRTH, options
+    return !c.underflow();
+}
+
+void IBMockServer::onTickTimeout()
+{
+    qint64 now = m_clock.nsecsElapsed();
+    quint64 maxBurst = qMax(1, m_tickRate / 10);
+
+    foreach (Session* s, m_sessions) {
+        if (!s->started || s->tickers.isEmpty())
+            continue;
+
+        quint64 due = (quint64)((now - s->startNsecs) / 1e9 * m_tickRate);
+
+        // don't try to catch up on more than 100 ms after a stall
+        if (due > s->ticksSent + maxBurst)
+            s->ticksSent = due - maxBurst;
+
+        while (s->ticksSent < due) {
+            sendTick(s, s->tickers[s->nextTicker]);
+            s->nextTicker = (s->nextTicker + 1) % s->tickers.size();
+            ++s->ticksSent;
+        }
+
+        flush(s);
+    }
+}
+
+// bid, ask, last and volume in turn; the price walks on every last
+void IBMockServer::sendTick(Session *s, Ticker &t)
+{
+    int step = t.step++ & 3;
+
+    if (step == 2) {
+        double move = (unitNoise(m_rng++) - 0.5) * t.price * 0.001;
+        t.price = qMax(0.01, roundToCents(t.price + move));
+    }
+
+    if (step < 3) {
+        static const int types[] = { BID, ASK, LAST };
+        double price = t.price + (step == 0 ? -0.01 : step == 1 ? 0.01 : 0);
+
+        encodeField(s->out, TICK_PRICE);
+        encodeField(s->out, 6);
+        encodeField(s->out, (int)t.tickerId);
+        encodeField(s->out, types[step]);
+        encodeField(s->out, price);
+        encodeField(s->out, 1 + (int)(mix(m_rng) % 10) * 100);
+        encodeField(s->out, 1);
+    }
+    else {
+        encodeField(s->out, TICK_SIZE);
+        encodeField(s->out, 6);
+        encodeField(s->out, (int)t.tickerId);
+        encodeField(s->out, (int)VOLUME);
+        encodeField(s->out, (int)(mix(m_rng) % 1000000));
+    }
+
+    t.lastTickNsecs = m_clock.nsecsElapsed();
+    ++m_ticksSent;
+}
+
+void IBMockServer::flush(Session *s)
+{
+    if (s->out.isEmpty())
+        return;
+
+    qint64 sent = s->socket->write(s->out);
+    if (sent > 0)
+        m_bytesSent += sent;
+    s->out.clear();
+}
+
+void IBMockServer::addBackgroundTickers(Session *s)
+{
+    uint now = QDateTime::currentDateTime().toTime_t();
+
+    for (int i = 0; i < m_tickers; ++i) {
+        Ticker t;
+        t.tickerId = BACKGROUND_TICKER_BASE + i;
+        t.symbol = "MOCK" + QByteArray::number(i);
+        t.price = roundToCents(barPrice(t.symbol, now));
+        t.step = 0;
+        t.lastTickNsecs = 0;
+        s->tickers.append(t);
+    }
+}
+
+IBMockServer::Ticker *IBMockServer::findTicker(Session *s, const QByteArray &symbol)
+{
+    for (int i = 0; i < s->tickers.size(); ++i) {
+        if (s->tickers.at(i).symbol == symbol)
+            return &s->tickers[i];
+    }
+    return NULL;
+}
+
+void IBMockServer::skip(IBFieldCursor &c, int fields)
+{
+    while (fields-- > 0)
+        c.skip();
+}
+
+void IBMockServer::encodeField(QByteArray &out, int value)
+{
+    encodeField(out, QByteArray::number(value));
+}
+
+void IBMockServer::encodeField(QByteArray &out, double value)
+{
+    encodeField(out, QByteArray::number(value));
+}
+
+void IBMockServer::encodeField(QByteArray &out, const QByteArray &value)
+{
+    out.append(value);
+    out.append('\0');
+}
+
+// A smooth daily and hourly swing plus noise, a pure function of the symbol
+// and the time so overlapping history requests agree with each other.
+double IBMockServer::barPrice(const QByteArray &symbol, qint64 epochSecs)
+{
+    uint h = qHash(symbol);
+    double base = 20 + (h % 18000) / 100.0;
+    double phase = (h % 628) / 100.0;
+
+    double swing = 0.02 * std::sin(2 * M_PI * epochSecs / 86400.0 + phase)
+                 + 0.005 * std::sin(2 * M_PI * epochSecs / 3700.0 + 2 * phase);
+    double noise = 0.001 * (unitNoise(h ^ (quint64)epochSecs) - 0.5);
+
+    return base * (1 + swing + noise);
+}
+
+int IBMockServer::conIdFor(const QByteArray &symbol)
+{
+    return 100000 + (int)(qHash(symbol) % 900000);
+}
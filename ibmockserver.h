@@ -0,0 +1,116 @@
+#ifndef IBMOCKSERVER_H
+#define IBMOCKSERVER_H
+
+#include "ibfieldcursor.h"
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+
+class QTcpServer;
+class QTcpSocket;
+
+// Stand-in for TWS used as a benchmark target. It speaks the handshake
+// IBClient expects (server version, START_API, nextValidId, managedAccounts),
+// streams synthetic TICK_PRICE/TICK_SIZE at a fixed total rate over the
+// tickers the client subscribed plus a number of background tickers,
+// answers reqHistoricalData and reqContractDetails with generated data and
+// fills every order immediately. The time from the last tick sent for a
+// symbol to the arrival of an order for it is recorded as the tick-to-order
+// latency.
+//
+// Client messages carry no length, so each request nkny sends is walked
+// field by field with the layout IBClient encodes for MOCK_SERVER_VERSION.
+class IBMockServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IBMockServer(QObject *parent = 0);
+    ~IBMockServer();
+
+    bool listen(quint16 port);
+
+    void setTickers(int tickers) { m_tickers = tickers; }
+    void setTickRate(int ticksPerSec) { m_tickRate = ticksPerSec; }
+
+    // latency percentile in nsecs over all orders so far, -1 without orders
+    qint64 latencyPercentile(double p) const;
+
+public slots:
+    void report();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+    void onTickTimeout();
+
+private:
+    struct Ticker
+    {
+        long        tickerId;
+        QByteArray  symbol;
+        double      price;
+        int         step;
+        qint64      lastTickNsecs;
+    };
+
+    struct Session
+    {
+        QTcpSocket*     socket;
+        QByteArray      in;
+        QByteArray      out;
+        int             clientVersion;
+        bool            started;
+        bool            closing;
+        int             clientId;
+        QVector<Ticker> tickers;
+        int             nextTicker;
+        qint64          startNsecs;
+        quint64         ticksSent;
+    };
+
+    bool processMsg(Session* s, IBFieldCursor & c);
+
+    bool reqMktData(Session* s, IBFieldCursor & c);
+    bool cancelMktData(Session* s, IBFieldCursor & c);
+    bool placeOrder(Session* s, IBFieldCursor & c);
+    bool reqContractDetails(Session* s, IBFieldCursor & c);
+    bool reqHistoricalData(Session* s, IBFieldCursor & c);
+    bool reqRealTimeBars(Session* s, IBFieldCursor & c);
+
+    void sendTick(Session* s, Ticker & t);
+    void flush(Session* s);
+
+    void addBackgroundTickers(Session* s);
+    Ticker* findTicker(Session* s, const QByteArray & symbol);
+
+    static void skip(IBFieldCursor & c, int fields);
+    static void encodeField(QByteArray & out, int value);
+    static void encodeField(QByteArray & out, double value);
+    static void encodeField(QByteArray & out, const QByteArray & value);
+
+    static double barPrice(const QByteArray & symbol, qint64 epochSecs);
+    static int    conIdFor(const QByteArray & symbol);
+
+    QTcpServer*                 m_server;
+    QHash<QTcpSocket*, Session*> m_sessions;
+    QTimer                      m_tickTimer;
+    QTimer                      m_reportTimer;
+    QElapsedTimer               m_clock;
+
+    int                         m_tickers;
+    int                         m_tickRate;
+    int                         m_nextOrderId;
+    quint64                     m_rng;
+
+    quint64                     m_ticksSent;
+    quint64                     m_bytesSent;
+    quint64                     m_orders;
+    QVector<qint64>             m_latencies;
+};
+
+#endif // IBMOCKSERVER_H
@@ -0,0 +1,16 @@
+#ifndef IBMSGSTATS_H
+#define IBMSGSTATS_H
+
+#include <QtGlobal>
+
+// Inbound traffic per message type, see IBClient::msgStats(). The decode
+// time includes directly connected slots unless IBClient runs threaded.
+struct IBMsgStats {
+    int msgId;
+    const char* name;
+    quint64 count;
+    quint64 bytes;
+    qint64 nsecs;
+};
+
+#endif // IBMSGSTATS_H
@@ -0,0 +1,116 @@
+#include "iborderbook.h"
+
+#include <cstring>
+
+IBOrderBook::IBOrderBook(int depth)
+{
+    setDepth(depth);
+}
+
+void IBOrderBook::setDepth(int depth)
+{
+    m_depth = qBound(1, depth, (int)MaxDepth);
+    clear();
+}
+
+void IBOrderBook::clear()
+{
+    m_count[ASK] = m_count[BID] = 0;
+    m_total[ASK] = m_total[BID] = 0;
+}
+
+bool IBOrderBook::apply(int position, int operation, int side, double price, int size)
+{
+    if ((side != ASK && side != BID) || position < 0 || position >= m_depth)
+        return false;
+
+    double* p = m_price[side];
+    int* s = m_size[side];
+    int & count = m_count[side];
+
+    switch (operation) {
+    case OP_INSERT: {
+        // TWS may insert past the end after deletes it didn't send
+        if (position > count)
+            position = count;
+        if (count == m_depth) {
+            m_total[side] -= s[count - 1];
+            --count;
+        }
+        const int move = count - position;
+        memmove(p + position + 1, p + position, move * sizeof(double));
+        memmove(s + position + 1, s + position, move * sizeof(int));
+        p[position] = price;
+        s[position] = size;
+        m_total[side] += size;
+        ++count;
+        return true;
+    }
+
+    case OP_UPDATE:
+        if (position >= count)
+            return false;
+        m_total[side] += size - s[position];
+        p[position] = price;
+        s[position] = size;
+        return true;
+
+    case OP_DELETE: {
+        if (position >= count)
+            return false;
+        m_total[side] -= s[position];
+        const int move = count - position - 1;
+        memmove(p + position, p + position + 1, move * sizeof(double));
+        memmove(s + position, s + position + 1, move * sizeof(int));
+        --count;
+        return true;
+    }
+    }
+    return false;
+}
+
+double IBOrderBook::mid() const
+{
+    if (!m_count[BID] || !m_count[ASK])
+        return 0;
+    return (m_price[BID][0] + m_price[ASK][0]) / 2;
+}
+
+double IBOrderBook::vwapToSize(Side side, long quantity, long *filled) const
+{
+    const double* p = m_price[side];
+    const int* s = m_size[side];
+
+    long left = quantity;
+    double notional = 0;
+    for (int i = 0; i < m_count[side] && left > 0; ++i) {
+        long take = qMin(left, (long)s[i]);
+        notional += take * p[i];
+        left -= take;
+    }
+
+    const long done = quantity - left;
+    if (filled)
+        *filled = done;
+    return done > 0 ? notional / done : 0;
+}
+
+double IBOrderBook::imbalance(int levels) const
+{
+    qint64 bid = 0;
+    qint64 ask = 0;
+    if (levels >= m_count[BID] && levels >= m_count[ASK]) {
+        bid = m_total[BID];
+        ask = m_total[ASK];
+    }
+    else {
+        for (int i = 0; i < qMin(levels, m_count[BID]); ++i)
+            bid += m_size[BID][i];
+        for (int i = 0; i < qMin(levels, m_count[ASK]); ++i)
+            ask += m_size[ASK][i];
+    }
+
+    if (bid + ask <= 0)
+        return 0;
+    return (double)(bid - ask) / (bid + ask);
+}
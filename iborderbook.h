@@ -0,0 +1,56 @@
+#ifndef IBORDERBOOK_H
+#define IBORDERBOOK_H
+
+#include <QtGlobal>
+
+// Limit order book of one reqMktDepth() ticker, kept the way TWS sends it:
+// each side is a fixed array of levels addressed by position, 0 being the
+// best. An insert or delete moves the levels behind it by one, which for
+// the at most MaxDepth levels is a single short memmove. Total size per side
+// is kept up to date so the full-book imbalance needs no pass over it.
+class IBOrderBook
+{
+public:
+    enum { MaxDepth = 32 };
+
+    // side and operation values of updateMktDepth
+    enum Side { ASK = 0, BID = 1 };
+    enum Operation { OP_INSERT = 0, OP_UPDATE = 1, OP_DELETE = 2 };
+
+    explicit IBOrderBook(int depth = 10);
+
+    int  depth() const { return m_depth; }
+    void setDepth(int depth);
+    void clear();
+
+    // returns false for updates that don't fit the book as it is
+    bool apply(int position, int operation, int side, double price, int size);
+
+    int    levels(Side side) const { return m_count[side]; }
+    double price(Side side, int position) const { return m_price[side][position]; }
+    int    size(Side side, int position) const { return m_size[side][position]; }
+    qint64 totalSize(Side side) const { return m_total[side]; }
+
+    bool   isEmpty() const { return !m_count[BID] && !m_count[ASK]; }
+    double bestBid() const { return m_count[BID] ? m_price[BID][0] : 0; }
+    double bestAsk() const { return m_count[ASK] ? m_price[ASK][0] : 0; }
+    double mid() const;
+
+    // Average price of taking quantity from side, level by level. filled
+    // gets how much of it the book could take; the price is over that part
+    // and 0 when the side is empty.
+    double vwapToSize(Side side, long quantity, long* filled = NULL) const;
+
+    // (bid size - ask size) / (bid size + ask size) over the best levels
+    // of each side, in [-1, 1]; 0 for an empty book
+    double imbalance(int levels = MaxDepth) const;
+
+private:
+    double  m_price[2][MaxDepth];
+    int     m_size[2][MaxDepth];
+    int     m_count[2];
+    qint64  m_total[2];
+    int     m_depth;
+};
+
+#endif // IBORDERBOOK_H
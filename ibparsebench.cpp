@@ -0,0 +1,106 @@
+#include "ibparsebench.h"
+#include "ibcapture.h"
+#include "ibfieldcursor.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QVector>
+#include <QtDebug>
+
+#include <cstring>
+
+struct Field
+{
+    const char* data;
+    int         len;
+};
+
+static double nsecsPerField(qint64 nsecs, int rounds, int fields)
+{
+    return fields ? (double)nsecs / rounds / fields : 0;
+}
+
+int runParseBenchmark(const QString &capturePath, int rounds)
+{
+    IBCaptureReader reader;
+    if (!reader.open(capturePath)) {
+        qWarning() << "[bench-parse] cannot read capture" << capturePath;
+        return 1;
+    }
+
+    // socket reads split fields anywhere, so glue the stream back together
+    QByteArray stream;
+    QByteArray chunk;
+    qint64 nsecs;
+    while (reader.next(nsecs, chunk))
+        stream.append(chunk);
+    reader.close();
+
+    QVector<Field> fields;
+    IBFieldCursor c(stream.constData(), stream.constData() + stream.size());
+    const char* f;
+    int len;
+    while (c.next(f, len)) {
+        Field field = { f, len };
+        fields.append(field);
+    }
+
+    // correctness first: every field, numeric or not, must give the same bits
+    int intMismatches = 0;
+    int doubleMismatches = 0;
+    for (int i = 0; i < fields.size(); ++i) {
+        const Field & field = fields.at(i);
+        QByteArray ba(field.data, field.len);
+
+        if (IBFieldCursor::toInt(field.data, field.len) != ba.toInt())
+            ++intMismatches;
+
+        double fast = IBFieldCursor::toDouble(field.data, field.len);
+        double slow = ba.toDouble();
+        if (memcmp(&fast, &slow, sizeof(double)) != 0) {
+            if (doubleMismatches < 10)
+                qWarning() << "[bench-parse] double mismatch:" << ba << fast << slow;
+            ++doubleMismatches;
+        }
+    }
+
+    // the sums keep the compiler from dropping the parsing
+    QElapsedTimer timer;
+    qint64 intSum = 0;
+    double doubleSum = 0;
+
+    timer.start();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < fields.size(); ++i)
+            intSum += QByteArray(fields.at(i).data, fields.at(i).len).toInt();
+    qint64 qtIntNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < fields.size(); ++i)
+            intSum -= IBFieldCursor::toInt(fields.at(i).data, fields.at(i).len);
+    qint64 cursorIntNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < fields.size(); ++i)
+            doubleSum += QByteArray(fields.at(i).data, fields.at(i).len).toDouble();
+    qint64 qtDoubleNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < fields.size(); ++i)
+            doubleSum -= IBFieldCursor::toDouble(fields.at(i).data, fields.at(i).len);
+    qint64 cursorDoubleNsecs = timer.nsecsElapsed();
+
+    qDebug() << "[bench-parse]" << stream.size() << "bytes," << fields.size() << "fields," << rounds << "rounds";
+    qDebug() << "[bench-parse] int    ns/field QByteArray" << nsecsPerField(qtIntNsecs, rounds, fields.size())
+             << "cursor" << nsecsPerField(cursorIntNsecs, rounds, fields.size())
+             << "mismatches" << intMismatches;
+    qDebug() << "[bench-parse] double ns/field QByteArray" << nsecsPerField(qtDoubleNsecs, rounds, fields.size())
+             << "cursor" << nsecsPerField(cursorDoubleNsecs, rounds, fields.size())
+             << "mismatches" << doubleMismatches;
+    qDebug() << "[bench-parse] checksums" << intSum << doubleSum;
+
+    return (intMismatches || doubleMismatches) ? 1 : 0;
+}
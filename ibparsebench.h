@@ -0,0 +1,12 @@
+#ifndef IBPARSEBENCH_H
+#define IBPARSEBENCH_H
+
+#include <QString>
+
+// Runs every field of a capture written by IBClient::startCapture() through
+// IBFieldCursor's number parsers and through QByteArray::toInt()/toDouble(),
+// checks that both give identical bits and prints the time per field of
+// each. Returns 0 if all fields match.
+int runParseBenchmark(const QString & capturePath, int rounds = 20);
+
+#endif // IBPARSEBENCH_H
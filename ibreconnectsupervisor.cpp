@@ -0,0 +1,138 @@
+#include "ibreconnectsupervisor.h"
+#include "ibclient.h"
+
+#include <QDateTime>
+#include <QDebug>
+
+static const int MIN_DELAY_MSECS = 1000;
+static const int MAX_DELAY_MSECS = 30000;
+
+// TWS error codes for its own connection to IB
+static const int IB_CONNECTIVITY_LOST = 1100;
+static const int IB_CONNECTIVITY_RESTORED_DATA_LOST = 1101;
+static const int IB_CONNECTIVITY_RESTORED_DATA_KEPT = 1102;
+
+IBReconnectSupervisor::IBReconnectSupervisor(IBClient *client, const QString &host, quint16 port, int clientId, QObject *parent)
+    : QObject(parent)
+    , m_client(client)
+    , m_host(host)
+    , m_port(port)
+    , m_clientId(clientId)
+    , m_hasConnected(false)
+    , m_reconnecting(false)
+    , m_handshaking(false)
+    , m_attempt(0)
+    , m_lostAt(0)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()),
+            this, SLOT(onTimeout()));
+
+    connect(m_client, SIGNAL(twsConnected()),
+            this, SLOT(onTwsConnected()));
+    connect(m_client, SIGNAL(connectionLost()),
+            this, SLOT(onConnectionLost()));
+    connect(m_client, SIGNAL(ibSocketError(QString)),
+            this, SLOT(onSocketError()));
+    connect(m_client, SIGNAL(nextValidId(long)),
+            this, SLOT(onNextValidId(long)));
+    connect(m_client, SIGNAL(error(int,int,QByteArray)),
+            this, SLOT(onIbError(int,int,QByteArray)));
+}
+
+void IBReconnectSupervisor::onTwsConnected()
+{
+    m_hasConnected = true;
+    if (m_reconnecting)
+        m_handshaking = true;
+}
+
+void IBReconnectSupervisor::onConnectionLost()
+{
+    if (m_reconnecting)
+        return;
+
+    qDebug() << "[RECONNECT] connection to TWS lost";
+    m_reconnecting = true;
+    m_handshaking = false;
+    m_attempt = 0;
+    // TWS may have lost its own connection to IB before the socket dropped
+    if (!m_lostAt)
+        m_lostAt = QDateTime::currentDateTime().toTime_t();
+    scheduleAttempt();
+}
+
+// a refused or failed attempt, the next one backs off further
+void IBReconnectSupervisor::onSocketError()
+{
+    if (!m_reconnecting || m_timer.isActive())
+        return;
+    m_handshaking = false;
+    scheduleAttempt();
+}
+
+void IBReconnectSupervisor::onNextValidId(long orderId)
+{
+    Q_UNUSED(orderId);
+
+    // nextValidId ends the handshake, TWS takes requests from here on
+    if (m_reconnecting && m_handshaking)
+        finishReconnect();
+}
+
+void IBReconnectSupervisor::onIbError(int id, int errorCode, const QByteArray &errorString)
+{
+    Q_UNUSED(id);
+    Q_UNUSED(errorString);
+
+    if (m_reconnecting)
+        return;
+
+    if (errorCode == IB_CONNECTIVITY_LOST) {
+        m_lostAt = QDateTime::currentDateTime().toTime_t();
+    }
+    else if (errorCode == IB_CONNECTIVITY_RESTORED_DATA_LOST) {
+        if (!m_lostAt)
+            m_lostAt = QDateTime::currentDateTime().toTime_t();
+        finishReconnect();
+    }
+    else if (errorCode == IB_CONNECTIVITY_RESTORED_DATA_KEPT) {
+        m_lostAt = 0;
+    }
+}
+
+void IBReconnectSupervisor::onTimeout()
+{
+    ++m_attempt;
+    qDebug() << "[RECONNECT] attempt" << m_attempt;
+
+    // start from a clean socket, a failed attempt may have left it half open
+    m_client->disconnectTWS();
+    m_client->connectToTWS(m_host, m_port, m_clientId);
+}
+
+void IBReconnectSupervisor::scheduleAttempt()
+{
+    int delay = MAX_DELAY_MSECS;
+    if (m_attempt < 5)
+        delay = qMin(MIN_DELAY_MSECS << m_attempt, MAX_DELAY_MSECS);
+
+    emit reconnecting(m_attempt + 1, delay);
+    m_timer.start(delay);
+}
+
+void IBReconnectSupervisor::finishReconnect()
+{
+    const uint lostAt = m_lostAt;
+
+    m_reconnecting = false;
+    m_handshaking = false;
+    m_attempt = 0;
+    m_lostAt = 0;
+    m_timer.stop();
+
+    qDebug() << "[RECONNECT] session restored, data lost since" << QDateTime::fromTime_t(lostAt).toString("yyyyMMdd/hh:mm:ss");
+
+    m_client->resubscribe();
+    emit reconnected(lostAt);
+}
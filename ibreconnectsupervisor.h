@@ -0,0 +1,57 @@
+#ifndef IBRECONNECTSUPERVISOR_H
+#define IBRECONNECTSUPERVISOR_H
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class IBClient;
+
+// Brings an IBClient session back after the socket dropped, e.g. when TWS
+// restarts at night. Connection attempts back off from MIN_DELAY_MSECS to
+// MAX_DELAY_MSECS. Once TWS answered the handshake with nextValidId the
+// subscriptions are sent again and reconnected() tells the application
+// since when it missed data, so it can backfill bars and reconcile orders.
+// A TWS that lost its own connection to IB and reports the market data as
+// lost (error 1101) is handled the same way.
+class IBReconnectSupervisor : public QObject
+{
+    Q_OBJECT
+public:
+    IBReconnectSupervisor(IBClient* client, const QString & host, quint16 port, int clientId, QObject *parent = 0);
+
+    // true once a session was up; from then on the supervisor owns reconnects
+    bool hasConnected() const { return m_hasConnected; }
+    bool isReconnecting() const { return m_reconnecting; }
+
+signals:
+    void reconnecting(int attempt, int delayMsecs);
+    // lostAt is the time_t of the moment the data stopped
+    void reconnected(uint lostAt);
+
+private slots:
+    void onTwsConnected();
+    void onConnectionLost();
+    void onSocketError();
+    void onNextValidId(long orderId);
+    void onIbError(int id, int errorCode, const QByteArray & errorString);
+    void onTimeout();
+
+private:
+    void scheduleAttempt();
+    void finishReconnect();
+
+    IBClient*   m_client;
+    QString     m_host;
+    quint16     m_port;
+    int         m_clientId;
+    QTimer      m_timer;
+
+    bool        m_hasConnected;
+    bool        m_reconnecting;
+    bool        m_handshaking;
+    int         m_attempt;
+    uint        m_lostAt;
+};
+
+#endif // IBRECONNECTSUPERVISOR_H
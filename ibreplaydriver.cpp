@@ -0,0 +1,68 @@
+#include "ibreplaydriver.h"
+#include "ibclient.h"
+
+// chunks fed per pass when replaying as fast as possible, so the GUI still
+// gets to paint in between
+static const int MAX_CHUNKS_PER_PASS = 256;
+
+IBReplayDriver::IBReplayDriver(IBClient *client, const QString &path, double speed, QObject *parent)
+    : QObject(parent)
+    , m_client(client)
+    , m_path(path)
+    , m_speed(speed)
+    , m_havePending(false)
+    , m_pendingNsecs(0)
+    , m_firstNsecs(0)
+    , m_chunks(0)
+    , m_bytes(0)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, SIGNAL(timeout()),
+            this, SLOT(onTimeout()));
+}
+
+bool IBReplayDriver::start()
+{
+    if (!m_reader.open(m_path))
+        return false;
+
+    m_chunks = 0;
+    m_bytes = 0;
+    m_havePending = m_reader.next(m_pendingNsecs, m_pending);
+    m_firstNsecs = m_pendingNsecs;
+
+    m_client->setReplayMode(true);
+    m_clock.start();
+    m_timer.start(0);
+    return true;
+}
+
+void IBReplayDriver::onTimeout()
+{
+    int budget = MAX_CHUNKS_PER_PASS;
+
+    while (m_havePending) {
+        if (m_speed > 0) {
+            qint64 due = (qint64)((m_pendingNsecs - m_firstNsecs) / m_speed);
+            qint64 now = m_clock.nsecsElapsed();
+            if (due > now) {
+                m_timer.start((int)((due - now) / 1000000));
+                return;
+            }
+        }
+        else if (budget-- == 0) {
+            m_timer.start(0);
+            return;
+        }
+
+        m_client->feedInbound(m_pending.constData(), m_pending.size());
+        ++m_chunks;
+        m_bytes += m_pending.size();
+
+        m_havePending = m_reader.next(m_pendingNsecs, m_pending);
+    }
+
+    m_reader.close();
+    emit finished(m_chunks, m_bytes, m_clock.nsecsElapsed());
+}
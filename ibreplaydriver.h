@@ -0,0 +1,46 @@
+#ifndef IBREPLAYDRIVER_H
+#define IBREPLAYDRIVER_H
+
+#include "ibcapture.h"
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class IBClient;
+
+// Feeds a capture written by IBClient::startCapture() back through the
+// client's decoder, without a socket. speed 1 replays at the recorded pace,
+// N replays N times faster and 0 as fast as possible.
+class IBReplayDriver : public QObject
+{
+    Q_OBJECT
+public:
+    IBReplayDriver(IBClient* client, const QString & path, double speed = 1, QObject *parent = 0);
+
+    bool start();
+
+signals:
+    void finished(quint64 chunks, quint64 bytes, qint64 nsecs);
+
+private slots:
+    void onTimeout();
+
+private:
+    IBClient*       m_client;
+    QString         m_path;
+    double          m_speed;
+    IBCaptureReader m_reader;
+    QTimer          m_timer;
+    QElapsedTimer   m_clock;
+
+    bool            m_havePending;
+    qint64          m_pendingNsecs;
+    QByteArray      m_pending;
+    qint64          m_firstNsecs;
+
+    quint64         m_chunks;
+    quint64         m_bytes;
+};
+
+#endif // IBREPLAYDRIVER_H
@@ -0,0 +1,208 @@
+#include "ibrequestpacer.h"
+#include "ibdefines.h"
+#include "ibfieldcursor.h"
+
+#include <cmath>
+
+// the request a cancel takes back, 0 if msgId is no such cancel
+static int requestCancelledBy(int msgId)
+{
+    switch (msgId) {
+    case CANCEL_MKT_DATA:               return REQ_MKT_DATA;
+    case CANCEL_MKT_DEPTH:              return REQ_MKT_DEPTH;
+    case CANCEL_HISTORICAL_DATA:        return REQ_HISTORICAL_DATA;
+    case CANCEL_REAL_TIME_BARS:         return REQ_REAL_TIME_BARS;
+    case CANCEL_SCANNER_SUBSCRIPTION:   return REQ_SCANNER_SUBSCRIPTION;
+    default:                            return 0;
+    }
+}
+
+// message id and ticker id field of msg, both kinds start with id,
+// version and ticker id
+static bool readIds(const QByteArray & msg, int & msgId, QByteArray & tickerId)
+{
+    const char* f;
+    int len;
+    IBFieldCursor c(msg.constData(), msg.constData() + msg.size());
+    if (!c.next(f, len))
+        return false;
+    msgId = IBFieldCursor::toInt(f, len);
+    if (!c.next(f, len) || !c.next(f, len))
+        return false;
+    tickerId = QByteArray::fromRawData(f, len);
+    return true;
+}
+
+IBRequestPacer::IBRequestPacer()
+    : m_rate(0)
+    , m_burst(0)
+    , m_tokens(0)
+    , m_lastRefill(0)
+    , m_histHead(0)
+    , m_histWindowNs(0)
+{
+    m_clock.start();
+    setRate(40, 10);
+    setHistoricalBudget(60, 600);
+    resetStats();
+}
+
+void IBRequestPacer::setRate(double msgsPerSec, int burst)
+{
+    m_rate = qMax(msgsPerSec, 0.1) / 1e9;
+    m_burst = qMax(burst, 1);
+    m_tokens = m_burst;
+    m_lastRefill = m_clock.nsecsElapsed();
+}
+
+void IBRequestPacer::setHistoricalBudget(int requests, int windowSecs)
+{
+    // times start out far enough in the past to not block anything
+    m_histTimes = QVector<qint64>(qMax(requests, 1), -(qint64)windowSecs * 1000000000LL);
+    m_histHead = 0;
+    m_histWindowNs = (qint64)windowSecs * 1000000000LL;
+}
+
+IBRequestPacer::Lane IBRequestPacer::laneFor(int msgId)
+{
+    switch (msgId) {
+    case PLACE_ORDER:
+    case CANCEL_ORDER:
+    case REQ_GLOBAL_CANCEL:
+    case START_API:
+        return OrderLane;
+    case REQ_HISTORICAL_DATA:
+        return HistoricalLane;
+    default:
+        return MarketLane;
+    }
+}
+
+void IBRequestPacer::enqueue(Lane lane, const QByteArray &msg)
+{
+    if (dropCancelled(msg))
+        return;
+
+    Pending p;
+    p.msg = msg;
+    p.queuedAt = m_clock.nsecsElapsed();
+    m_lanes[lane].enqueue(p);
+}
+
+bool IBRequestPacer::takeNext(QByteArray &msg)
+{
+    qint64 now = m_clock.nsecsElapsed();
+    refill(now);
+    if (m_tokens < 1)
+        return false;
+
+    for (int i = 0; i < NumLanes; ++i) {
+        if (m_lanes[i].isEmpty())
+            continue;
+        if (i == HistoricalLane && historicalReadyAt() > now)
+            continue;
+
+        Pending p = m_lanes[i].dequeue();
+        msg = p.msg;
+        m_tokens -= 1;
+
+        qint64 wait = now - p.queuedAt;
+        IBPacerStats & s = m_stats[i];
+        ++s.sent;
+        s.totalWaitNs += wait;
+        s.maxWaitNs = qMax(s.maxWaitNs, wait);
+
+        if (i == HistoricalLane) {
+            m_histTimes[m_histHead] = now;
+            m_histHead = (m_histHead + 1) % m_histTimes.size();
+        }
+        return true;
+    }
+    return false;
+}
+
+int IBRequestPacer::msecsUntilNext()
+{
+    if (isEmpty())
+        return -1;
+
+    qint64 now = m_clock.nsecsElapsed();
+    refill(now);
+
+    qint64 readyAt = now;
+    if (m_tokens < 1)
+        readyAt += (qint64)std::ceil((1 - m_tokens) / m_rate);
+
+    // only history left, it may be held back by its own budget
+    if (m_lanes[OrderLane].isEmpty() && m_lanes[MarketLane].isEmpty())
+        readyAt = qMax(readyAt, historicalReadyAt());
+
+    return (int)((readyAt - now + 999999) / 1000000);
+}
+
+bool IBRequestPacer::isEmpty() const
+{
+    for (int i = 0; i < NumLanes; ++i)
+        if (!m_lanes[i].isEmpty())
+            return false;
+    return true;
+}
+
+IBPacerStats IBRequestPacer::stats(Lane lane) const
+{
+    IBPacerStats s = m_stats[lane];
+    s.depth = m_lanes[lane].size();
+    return s;
+}
+
+void IBRequestPacer::resetStats()
+{
+    for (int i = 0; i < NumLanes; ++i) {
+        m_stats[i].depth = 0;
+        m_stats[i].sent = 0;
+        m_stats[i].totalWaitNs = 0;
+        m_stats[i].maxWaitNs = 0;
+    }
+}
+
+void IBRequestPacer::clear()
+{
+    for (int i = 0; i < NumLanes; ++i)
+        m_lanes[i].clear();
+}
+
+// takes out the last queued request cancel is for, false if it is no
+// cancel or its request went out already
+bool IBRequestPacer::dropCancelled(const QByteArray &cancel)
+{
+    int msgId;
+    QByteArray tickerId;
+    if (!readIds(cancel, msgId, tickerId))
+        return false;
+    const int reqMsgId = requestCancelledBy(msgId);
+    if (!reqMsgId)
+        return false;
+
+    QQueue<Pending> & queue = m_lanes[laneFor(reqMsgId)];
+    for (int i = queue.size() - 1; i >= 0; --i) {
+        int id;
+        QByteArray tid;
+        if (readIds(queue.at(i).msg, id, tid) && id == reqMsgId && tid == tickerId) {
+            queue.removeAt(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void IBRequestPacer::refill(qint64 now)
+{
+    m_tokens = qMin(m_burst, m_tokens + (now - m_lastRefill) * m_rate);
+    m_lastRefill = now;
+}
+
+qint64 IBRequestPacer::historicalReadyAt() const
+{
+    // the oldest of the last N requests has to leave the window first
+    return m_histTimes[m_histHead] + m_histWindowNs;
+}
@@ -0,0 +1,78 @@
+#ifndef IBREQUESTPACER_H
+#define IBREQUESTPACER_H
+
+#include <QByteArray>
+#include <QQueue>
+#include <QVector>
+#include <QElapsedTimer>
+
+// Per lane counters, see IBRequestPacer::stats()
+struct IBPacerStats {
+    int depth;          // messages waiting right now
+    quint64 sent;
+    qint64 totalWaitNs; // time spent queued, summed over sent messages
+    qint64 maxWaitNs;
+};
+
+// Outbound scheduler for IBClient. A token bucket caps the total message
+// rate TWS sees and a sliding window caps historical data requests. Queued
+// messages leave in lane order, so orders always go ahead of market data
+// and history requests. A cancel of a request still queued takes it out
+// of its lane, neither goes to TWS; other cancels wait with market data.
+class IBRequestPacer
+{
+public:
+    enum Lane {
+        OrderLane = 0,      // placeOrder, cancelOrder, START_API
+        MarketLane,         // everything else
+        HistoricalLane,     // reqHistoricalData, also subject to the history budget
+        NumLanes
+    };
+
+    IBRequestPacer();
+
+    // TWS allows 50 messages per second; rate * 1s + burst should stay below
+    void setRate(double msgsPerSec, int burst);
+    // historical data pacing: at most requests per window
+    void setHistoricalBudget(int requests, int windowSecs);
+
+    static Lane laneFor(int msgId);
+
+    void enqueue(Lane lane, const QByteArray & msg);
+    // pops the next message that may go out now, by lane priority
+    bool takeNext(QByteArray & msg);
+    // time until takeNext() can succeed again, -1 if nothing is queued
+    int  msecsUntilNext();
+
+    bool isEmpty() const;
+    int  queueDepth(Lane lane) const { return m_lanes[lane].size(); }
+    IBPacerStats stats(Lane lane) const;
+    void resetStats();
+    void clear();
+
+private:
+    struct Pending {
+        QByteArray msg;
+        qint64 queuedAt;
+    };
+
+    bool dropCancelled(const QByteArray & cancel);
+    void refill(qint64 now);
+    qint64 historicalReadyAt() const;
+
+    QQueue<Pending> m_lanes[NumLanes];
+    IBPacerStats    m_stats[NumLanes];
+    QElapsedTimer   m_clock;
+
+    double  m_rate;         // tokens per ns
+    double  m_burst;
+    double  m_tokens;
+    qint64  m_lastRefill;
+
+    // send times of the last historical requests, oldest at m_histHead
+    QVector<qint64> m_histTimes;
+    int     m_histHead;
+    qint64  m_histWindowNs;
+};
+
+#endif // IBREQUESTPACER_H
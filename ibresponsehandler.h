@@ -0,0 +1,58 @@
+#ifndef IBRESPONSEHANDLER_H
+#define IBRESPONSEHANDLER_H
+
+#include <QByteArray>
+
+struct ContractDetails;
+struct IBHistoricalBars;
+
+// Owner of a request made with a handler, see IBClient::reqHistoricalData(),
+// IBClient::reqContractDetails() and IBClient::reqRealTimeBars(). IBClient
+// routes the responses for the reqId to this handler only, instead of the
+// broadcast signals, and forgets the handler once the request ended with its
+// end marker, was cancelled or failed with an error.
+class IBResponseHandler
+{
+public:
+    virtual ~IBResponseHandler() {}
+
+    virtual void onHistoricalBars(long reqId, const IBHistoricalBars & bars)
+    {
+        Q_UNUSED(reqId);
+        Q_UNUSED(bars);
+    }
+
+    virtual void onContractDetails(int reqId, const ContractDetails & contractDetails)
+    {
+        Q_UNUSED(reqId);
+        Q_UNUSED(contractDetails);
+    }
+
+    virtual void onContractDetailsEnd(int reqId)
+    {
+        Q_UNUSED(reqId);
+    }
+
+    virtual void onRealtimeBar(long reqId, long time, double open, double high, double low, double close,
+                               long volume, double wap, int count)
+    {
+        Q_UNUSED(reqId);
+        Q_UNUSED(time);
+        Q_UNUSED(open);
+        Q_UNUSED(high);
+        Q_UNUSED(low);
+        Q_UNUSED(close);
+        Q_UNUSED(volume);
+        Q_UNUSED(wap);
+        Q_UNUSED(count);
+    }
+
+    virtual void onRequestError(long reqId, int errorCode, const QByteArray & errorMsg)
+    {
+        Q_UNUSED(reqId);
+        Q_UNUSED(errorCode);
+        Q_UNUSED(errorMsg);
+    }
+};
+
+#endif // IBRESPONSEHANDLER_H
@@ -0,0 +1,90 @@
+#include "ibringbuffer.h"
+
+#include <cstring>
+
+IBRingBuffer::IBRingBuffer(int capacity)
+    : m_data(NULL)
+    , m_capacity(1)
+    , m_head(0)
+    , m_size(0)
+{
+    while (m_capacity < capacity)
+        m_capacity <<= 1;
+    m_data = new char[m_capacity];
+}
+
+IBRingBuffer::~IBRingBuffer()
+{
+    delete [] m_data;
+}
+
+void IBRingBuffer::clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+int IBRingBuffer::contiguousSize() const
+{
+    return qMin(m_size, m_capacity - m_head);
+}
+
+void IBRingBuffer::consume(int n)
+{
+    n = qMin(n, m_size);
+    m_size -= n;
+    if (m_size == 0)
+        m_head = 0;
+    else
+        m_head = (m_head + n) & (m_capacity - 1);
+}
+
+void IBRingBuffer::linearize()
+{
+    if (isContiguous())
+        return;
+
+    // only happens when a message straddles the end of the ring, so at
+    // most once per lap
+    char* data = new char[m_capacity];
+    int first = contiguousSize();
+    memcpy(data, m_data + m_head, first);
+    memcpy(data + first, m_data, m_size - first);
+    delete [] m_data;
+    m_data = data;
+    m_head = 0;
+}
+
+char* IBRingBuffer::writePtr(int minSpace, int & space)
+{
+    if (m_capacity - m_size < minSpace)
+        grow(m_size + minSpace);
+
+    int tail = (m_head + m_size) & (m_capacity - 1);
+    if (m_size > 0 && tail <= m_head)
+        space = m_head - tail;
+    else
+        space = m_capacity - tail;
+    return m_data + tail;
+}
+
+void IBRingBuffer::commit(int n)
+{
+    m_size += qMin(n, m_capacity - m_size);
+}
+
+void IBRingBuffer::grow(int minCapacity)
+{
+    int capacity = m_capacity;
+    while (capacity < minCapacity)
+        capacity <<= 1;
+
+    char* data = new char[capacity];
+    int first = contiguousSize();
+    memcpy(data, m_data + m_head, first);
+    memcpy(data + first, m_data, m_size - first);
+    delete [] m_data;
+    m_data = data;
+    m_capacity = capacity;
+    m_head = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef IBRINGBUFFER_H
+#define IBRINGBUFFER_H
+
+#include <QtGlobal>
+
+// Growable byte ring for the socket receive path. The socket is read
+// straight into the free space and complete messages are consumed from the
+// front, so leftover bytes of a partial message never have to be shifted.
+class IBRingBuffer
+{
+public:
+    explicit IBRingBuffer(int capacity = 64 * 1024);
+    ~IBRingBuffer();
+
+    int  size() const { return m_size; }
+    int  capacity() const { return m_capacity; }
+    bool isEmpty() const { return m_size == 0; }
+    void clear();
+
+    // read side
+    const char* readPtr() const { return m_data + m_head; }
+    int  contiguousSize() const;
+    bool isContiguous() const { return contiguousSize() == m_size; }
+    void consume(int n);
+    void linearize();
+
+    // write side: makes room for at least minSpace bytes and returns the
+    // contiguous free block (which may be shorter if the free space wraps)
+    char* writePtr(int minSpace, int & space);
+    void  commit(int n);
+
+private:
+    Q_DISABLE_COPY(IBRingBuffer)
+
+    void grow(int minCapacity);
+
+    char* m_data;
+    int   m_capacity;  // always a power of two
+    int   m_head;
+    int   m_size;
+};
+
+#endif // IBRINGBUFFER_H
@@ -0,0 +1,66 @@
+#ifndef IBSPSCQUEUE_H
+#define IBSPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded lock-free single producer / single consumer queue. Used to hand
+// decoded events from IBClient's network thread to the GUI thread; push()
+// must only be called from one thread and pop() only from one other thread.
+template <typename T>
+class IBSpscQueue
+{
+public:
+    explicit IBSpscQueue(size_t capacity = 8192)
+        : m_head(0)
+        , m_tail(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    size_t capacity() const { return m_slots.size(); }
+
+    bool isEmpty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    // producer side, returns false if the queue is full
+    bool push(const T & value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+            return false;
+        m_slots[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, returns false if the queue is empty
+    bool pop(T & value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        value = m_slots[head & m_mask];
+        m_slots[head & m_mask] = T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    IBSpscQueue(const IBSpscQueue &);
+    IBSpscQueue & operator=(const IBSpscQueue &);
+
+    std::vector<T>      m_slots;
+    size_t              m_mask;
+    std::atomic<size_t> m_head;  // written by the consumer only
+    std::atomic<size_t> m_tail;  // written by the producer only
+};
+
+#endif // IBSPSCQUEUE_H
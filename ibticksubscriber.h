@@ -0,0 +1,25 @@
+#ifndef IBTICKSUBSCRIBER_H
+#define IBTICKSUBSCRIBER_H
+
+#include "ibticktype.h"
+
+#include <QtGlobal>
+
+// Receives market data ticks straight from IBClient for the tickerIds it
+// registered with IBClient::subscribeTicks(), without going through the
+// tickPrice/tickSize signals.
+class IBTickSubscriber
+{
+public:
+    virtual ~IBTickSubscriber() {}
+
+    virtual void onTickPrice(long tickerId, TickType field, double price, int canAutoExecute) = 0;
+    virtual void onTickSize(long tickerId, TickType field, int size)
+    {
+        Q_UNUSED(tickerId);
+        Q_UNUSED(field);
+        Q_UNUSED(size);
+    }
+};
+
+#endif // IBTICKSUBSCRIBER_H
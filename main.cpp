@@ -1,8 +1,11 @@
 #include "mainwindow.h"
+#include "ibmockserver.h"
+#include "ibparsebench.h"
 #include <QApplication>
 #include <QRect>
 #include <QMargins>
 #include <QDesktopWidget>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
@@ -12,8 +15,43 @@ int main(int argc, char *argv[])
     QCoreApplication::setOrganizationDomain("prodatalab.com");
     QCoreApplication::setApplicationName("nkny");
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption captureOption("capture", "Record the raw TWS stream to <file>.", "file");
+    QCommandLineOption replayOption("replay", "Replay a recorded TWS stream from <file> instead of connecting.", "file");
+    QCommandLineOption replaySpeedOption("replay-speed", "Replay speed factor, 0 for as fast as possible (default 1).", "factor", "1");
+    QCommandLineOption mockOption("mock-tws", "Run as a mock TWS server on <port> for benchmarking, without the GUI.", "port");
+    QCommandLineOption mockTickersOption("mock-tickers", "Background tickers streamed by the mock TWS (default 100).", "n", "100");
+    QCommandLineOption mockRateOption("mock-rate", "Ticks per second streamed to each mock TWS client (default 1000).", "ticks", "1000");
+    QCommandLineOption benchParseOption("bench-parse", "Compare the field parsers on the capture <file> and exit.", "file");
+    parser.addOption(captureOption);
+    parser.addOption(replayOption);
+    parser.addOption(replaySpeedOption);
+    parser.addOption(mockOption);
+    parser.addOption(mockTickersOption);
+    parser.addOption(mockRateOption);
+    parser.addOption(benchParseOption);
+    parser.process(a);
+
+    if (parser.isSet(benchParseOption))
+        return runParseBenchmark(parser.value(benchParseOption));
+
+    if (parser.isSet(mockOption)) {
+        IBMockServer server;
+        server.setTickers(parser.value(mockTickersOption).toInt());
+        server.setTickRate(parser.value(mockRateOption).toInt());
+        if (!server.listen(parser.value(mockOption).toUShort()))
+            return 1;
+        return a.exec();
+    }
+
     MainWindow w;
 
+    if (parser.isSet(captureOption))
+        w.setCaptureFile(parser.value(captureOption));
+    if (parser.isSet(replayOption))
+        w.setReplayFile(parser.value(replayOption), parser.value(replaySpeedOption).toDouble());
+
 //    QSettings s;
 //    s.clear();
 
@@ -1,6 +1,10 @@
 #include "mainwindow.h"
 #include "pairtabpage.h"
 #include "ibclient.h"
+#include "ibreplaydriver.h"
+#include "ibreconnectsupervisor.h"
+#include "ibmktdatamanager.h"
+#include "ibhistorycache.h"
 #include "ibcontract.h"
 #include "iborder.h"
 #include "iborderstate.h"
@@ -25,6 +29,9 @@
 #include <QtDebug>
 #include <QDateTime>
 #include <QPlainTextEdit>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QDir>
 
 #include <iostream>
 
@@ -35,7 +42,13 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , m_ibClient(NULL)
+    , m_reconnectSupervisor(NULL)
+    , m_mktDataManager(NULL)
+    , m_historyCache(NULL)
     , m_numConnectionAttempts(0)
+    , m_replaySpeed(1)
+    , m_startupRequestsSent(false)
+    , m_reconcilingOrders(false)
 {
     QTimer::singleShot(0, this, SLOT(onWelcome()));
 
@@ -186,8 +199,30 @@ void MainWindow::on_action_New_triggered()
 void MainWindow::on_actionConnect_To_TWS_triggered()
 {
 
-    m_ibClient = new IBClient(this);
+    QSettings settings;
+    settings.beginGroup("mainwindow");
+    bool networkThread = settings.value("ibNetworkThread", false).toBool();
+    int mktDataLines = settings.value("mktDataLines", 100).toInt();
+    int dataConnections = settings.value("dataConnections", 0).toInt();
+    QString dataRouting = settings.value("dataRouting", "historyApart").toString();
+    m_historyCacheFile = settings.value("historyCacheFile",
+            QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/history.cache").toString();
+    settings.endGroup();
+
+    // the replay feeds the decoder from this thread
+    if (!m_replayFile.isEmpty())
+        networkThread = false;
 
+    m_ibClient = new IBClient(this, networkThread);
+
+    m_mktDataManager = new IBMktDataManager(m_ibClient, this);
+    m_mktDataManager->setLineBudget(mktDataLines);
+    connect(m_mktDataManager, SIGNAL(linesUsedChanged(int,int)),
+            this, SLOT(onMktDataLinesUsed(int,int)));
+
+    m_historyCache = new IBHistoryCache(m_ibClient, this);
+    if (m_historyCache->load(m_historyCacheFile))
+        m_logDialog.getUi()->logPlainTextEdit->appendPlainText("[HISTCACHE] loaded " + m_historyCacheFile);
 
     connect(m_ibClient, SIGNAL(managedAccounts(QByteArray)),
             this, SLOT(onManagedAccounts(QByteArray)));
@@ -220,11 +255,51 @@ void MainWindow::on_actionConnect_To_TWS_triggered()
 //    connect(m_ibClient, SIGNAL(tickSize(long,TickType,int)),
 //            this, SLOT(onTickSize(long,TickType,int)));
 
+    if (!m_replayFile.isEmpty()) {
+        IBReplayDriver* replay = new IBReplayDriver(m_ibClient, m_replayFile, m_replaySpeed, this);
+        connect(replay, SIGNAL(finished(quint64,quint64,qint64)),
+                this, SLOT(onReplayFinished(quint64,quint64,qint64)));
+        if (!replay->start())
+            m_logDialog.getUi()->logPlainTextEdit->appendPlainText("[REPLAY] cannot read " + m_replayFile);
+        return;
+    }
+
+    if (!m_captureFile.isEmpty()
+            && !m_ibClient->startCapture(m_captureFile)) {
+        m_logDialog.getUi()->logPlainTextEdit->appendPlainText("[CAPTURE] cannot write " + m_captureFile);
+    }
+
 //    QSettings s;
 //    s.beginGroup("mainwindow");
 //    int clientId = s.value("clientId", 0).toInt() + 1;
     int clientId = 0;
+
+    m_reconnectSupervisor = new IBReconnectSupervisor(m_ibClient, "127.0.0.1", 7496, clientId, this);
+    connect(m_reconnectSupervisor, SIGNAL(reconnecting(int,int)),
+            this, SLOT(onTwsReconnecting(int,int)));
+    connect(m_reconnectSupervisor, SIGNAL(reconnected(uint)),
+            this, SLOT(onTwsReconnected(uint)));
+
     m_ibClient->connectToTWS("127.0.0.1", 7496, clientId);
+
+    // market data and history on their own sockets, orders stay on the first
+    if (dataRouting == "roundRobin")
+        m_ibClient->setDataRouting(IBClient::RouteRoundRobin);
+    else if (dataRouting == "leastLoaded")
+        m_ibClient->setDataRouting(IBClient::RouteLeastLoaded);
+    else
+        m_ibClient->setDataRouting(IBClient::RouteHistoryApart);
+
+    for (int i = 0; i < dataConnections; ++i) {
+        IBClient* data = new IBClient(this, networkThread);
+        m_ibClient->addDataConnection(data);
+
+        IBReconnectSupervisor* supervisor = new IBReconnectSupervisor(data, "127.0.0.1", 7496, clientId + 1 + i, this);
+        connect(supervisor, SIGNAL(reconnected(uint)),
+                this, SLOT(onDataConnectionReconnected(uint)));
+
+        data->connectToTWS("127.0.0.1", 7496, clientId + 1 + i);
+    }
 //    s.setValue("clientId", clientId);
 //    s.endGroup();
 
@@ -240,6 +315,22 @@ void MainWindow::on_actionConnect_To_TWS_triggered()
 
 }
 
+void MainWindow::onReplayFinished(quint64 chunks, quint64 bytes, qint64 nsecs)
+{
+    QPlainTextEdit* pte = m_logDialog.getUi()->logPlainTextEdit;
+    pte->appendPlainText(QString("[REPLAY] %1 chunks, %2 bytes in %3 ms")
+                         .arg(chunks).arg(bytes).arg(nsecs / 1000000));
+
+    QList<IBMsgStats> stats = m_ibClient->msgStats();
+    for (int i=0;i<stats.size();++i) {
+        const IBMsgStats & ms = stats.at(i);
+        if (ms.count == 0)
+            continue;
+        pte->appendPlainText(QString("[REPLAY]     %1: %2 msgs, %3 bytes, %4 us")
+                             .arg(ms.name).arg(ms.count).arg(ms.bytes).arg(ms.nsecs / 1000));
+    }
+}
+
 void MainWindow::onManagedAccounts(const QByteArray &msg)
 {
     m_managedAccounts = QString(msg).split(',', QString::SkipEmptyParts);
@@ -247,11 +338,22 @@ void MainWindow::onManagedAccounts(const QByteArray &msg)
     m_globalConfigDialog.setMangagedAccounts(m_managedAccounts);
     ui->actionGlobal_Config->setEnabled(true);
 
+    // TWS sends the accounts again on every reconnect, the pages exist already
+    if (m_startupRequestsSent)
+        return;
+    m_startupRequestsSent = true;
+
+    // the startup requests (contract details for every page) go out together
+    m_ibClient->beginBatch();
+
     m_ibClient->reqOpenOrders();
 
-    m_ibClient->reqAccountUpdates(true, "DU210791");
+    // the one chosen in the global config, the first managed one by default
+    m_ibClient->reqAccountUpdates(true, m_globalConfigDialog.getUi()->managedAccountsComboBox_2->currentText().toLocal8Bit());
 
     readPageSettings();
+
+    m_ibClient->endBatch();
 }
 
 void MainWindow::onIbError(const int id, const int errorCode, const QByteArray errorString)
@@ -283,6 +385,10 @@ void MainWindow::onIbSocketError(const QString &error)
 {
     static bool enacted = false;
 
+    // once a session was up the supervisor retries on its own
+    if (m_reconnectSupervisor && m_reconnectSupervisor->hasConnected())
+        return;
+
     ++m_numConnectionAttempts;
 
     if (!enacted) {
@@ -352,9 +458,68 @@ void MainWindow::onTwsConnected()
 
 void MainWindow::onTwsConnectionClosed()
 {
+    if (m_reconnectSupervisor && m_reconnectSupervisor->hasConnected()) {
+        ui->actionConnect_To_TWS->setText("TWS Reconnecting");
+        return;
+    }
     ui->actionConnect_To_TWS->setEnabled(true);
 }
 
+void MainWindow::onTwsReconnecting(int attempt, int delayMsecs)
+{
+    QString msg = QString("[RECONNECT] connection to TWS lost, attempt %1 in %2 s")
+            .arg(attempt).arg(delayMsecs / 1000);
+    m_logDialog.getUi()->logPlainTextEdit->appendPlainText(msg);
+    statusBar()->showMessage(QString("        Log: ") + msg);
+}
+
+void MainWindow::onMktDataLinesUsed(int used, int budget)
+{
+    QString msg = QString("[MKTDATA] %1 of %2 market data lines in use").arg(used).arg(budget);
+    m_logDialog.getUi()->logPlainTextEdit->appendPlainText(msg);
+    if (used > budget)
+        statusBar()->showMessage(QString("        Log: ") + msg);
+}
+
+// The market data subscriptions are live again. Each page fetches the bars
+// it missed since lostAt and the order maps are checked against what TWS
+// still has open.
+void MainWindow::onTwsReconnected(uint lostAt)
+{
+    m_logDialog.getUi()->logPlainTextEdit->appendPlainText(
+                "[RECONNECT] session restored, data lost since "
+                + QDateTime::fromTime_t(lostAt).toString("yyyyMMdd/hh:mm:ss"));
+
+    m_ibClient->beginBatch();
+
+    m_reconcilingOrders = true;
+    m_reportedOpenOrders.clear();
+    m_ibClient->reqOpenOrders();
+
+    // positions pick up fills that happened while disconnected
+    m_ibClient->reqAccountUpdates(true, m_globalConfigDialog.getUi()->managedAccountsComboBox_2->currentText().toLocal8Bit());
+
+    foreach (PairTabPage* p, m_pairTabPageMap) {
+        if (p)
+            p->backfillBars(lostAt);
+    }
+
+    m_ibClient->endBatch();
+}
+
+// the orders connection is fine, only bars from the data may be missing
+void MainWindow::onDataConnectionReconnected(uint lostAt)
+{
+    m_logDialog.getUi()->logPlainTextEdit->appendPlainText(
+                "[RECONNECT] data connection restored, data lost since "
+                + QDateTime::fromTime_t(lostAt).toString("yyyyMMdd/hh:mm:ss"));
+
+    foreach (PairTabPage* p, m_pairTabPageMap) {
+        if (p)
+            p->backfillBars(lostAt);
+    }
+}
+
 void MainWindow::onTabCloseRequested(int idx)
 {
 
@@ -721,6 +886,9 @@ void MainWindow::onOrderStatus(long orderId, const QByteArray &status, int fille
 void MainWindow::onOpenOrder(long orderId, const Contract &contract, const Order &order, const OrderState &orderState)
 {
     Q_UNUSED(contract);
+
+    if (m_reconcilingOrders)
+        m_reportedOpenOrders.insert(orderId);
 //qDebug() << "[DEBUG-onOpenOrder]"
 //             << orderId
 //             << contract.symbol
@@ -748,6 +916,60 @@ void MainWindow::onOpenOrder(long orderId, const Contract &contract, const Order
 void MainWindow::onOpenOrderEnd()
 {
 //qDebug() << "[DEBUG-onOpenOrderEnd]";
+    if (!m_reconcilingOrders)
+        return;
+    m_reconcilingOrders = false;
+
+    // Orders TWS still has open were refreshed by onOpenOrder/onOrderStatus.
+    // The others were filled or cancelled while the connection was down.
+    QPlainTextEdit* pte = m_logDialog.getUi()->logPlainTextEdit;
+    foreach (PairTabPage* p, m_pairTabPageMap) {
+        if (!p)
+            continue;
+        for (int leg=0;leg<p->getSecurities().count();++leg) {
+            Security* s = p->getSecurities().at(leg);
+            if (!s)
+                continue;
+            QStringList notOpen;
+            QMap<long, SecurityOrder*>* orderMap = s->getSecurityOrderMap();
+            for (QMap<long, SecurityOrder*>::const_iterator it = orderMap->constBegin(); it != orderMap->constEnd(); ++it) {
+                SecurityOrder* so = it.value();
+                if (m_reportedOpenOrders.contains(it.key())
+                        || so->status == "Filled" || so->status == "Cancelled")
+                    continue;
+                QString msg = QString("order %1 %2 %3 is no longer open at TWS, last status: %4 filled: %5")
+                        .arg(it.key())
+                        .arg(QString(so->order.action))
+                        .arg(QString(s->contract()->symbol))
+                        .arg(QString(so->status))
+                        .arg(so->filled);
+                pte->appendPlainText("[RECONNECT] " + msg);
+                notOpen << msg;
+            }
+            markOrdersNotOpen(p->getTabSymbol(), leg, notOpen);
+        }
+    }
+}
+
+// Highlights the symbol of leg in the row of the pair while orders of it
+// are missing at TWS, the tool tip tells which; an empty notOpen clears it.
+void MainWindow::markOrdersNotOpen(const QString &tabSymbol, int leg, const QStringList &notOpen)
+{
+    OrdersTableWidget* tab = ui->ordersTableWidget;
+    int pairCol = m_orderHeaderLabels.indexOf("Pair");
+    int symCol = m_orderHeaderLabels.indexOf(QString("Sym%1").arg(leg + 1));
+    if (pairCol < 0 || symCol < 0)
+        return;
+
+    for (int r=0;r<tab->rowCount();++r) {
+        QTableWidgetItem* pairItem = tab->item(r, pairCol);
+        QTableWidgetItem* symItem = tab->item(r, symCol);
+        if (!pairItem || !symItem || pairItem->text() != tabSymbol)
+            continue;
+        symItem->setBackground(notOpen.isEmpty() ? QBrush() : QBrush(Qt::yellow));
+        symItem->setToolTip(notOpen.join("\n"));
+        break;
+    }
 }
 
 void MainWindow::onUpdatePortfolio( const Contract& contract, int position,
@@ -978,6 +1200,11 @@ QStringList MainWindow::getHeaderLabels() const
 void MainWindow::closeEvent(QCloseEvent *event)
 {
     writeSettings();
+    if (m_historyCache) {
+        QDir().mkpath(QFileInfo(m_historyCacheFile).absolutePath());
+        if (!m_historyCache->save(m_historyCacheFile))
+            qWarning() << "[HISTCACHE] cannot write" << m_historyCacheFile;
+    }
     foreach (QWidget *widget, QApplication::topLevelWidgets()) {
         widget->close();
     }
@@ -1085,101 +1312,13 @@ void MainWindow::onTickPrice(const long &tickerId, const TickType &field, const
 
     Q_UNUSED(canAutoExecute);
 
-    QList<Security*> securities;
-
-    int cnt = 0;
-
-    switch (field)
-    {
-    case LAST:
-        // pDebug("1");
-        cnt = PairTabPage::RawDataMap.values().count();
-        for (int i=0;i<cnt;++i) {
-            Security* value = PairTabPage::RawDataMap.values().at(i);
-            if (tickerId == PairTabPage::RawDataMap.key(value)) {
-                securities.append(value);
-            }
-        }
-        // pDebug(securities);
-
-        // updateOrdersPage
-        if (!securities.isEmpty()) {
-            updateOrdersTable(securities.first()->contract()->symbol, price);
-        }
-
-        for (int i=0;i<securities.count();++i) {
-            // pDebug(2);
-            Security* ss = securities.at(i);
-            for (int j=0;j<m_pairTabPageMap.values().count();++j) {
-                // pDebug(3);
-                bool containsSecurity = false;
-                bool canCheckTradeExits = false;
-                Security* s = NULL;
-                PairTabPage* p = m_pairTabPageMap.values().at(j);
-                if (!p)
-                    continue;
-//                if (p->getSecurities().contains(s)
-//                        && p->isTrading(s))
-                for (int k=0;k<p->getSecurities().count();++k) {
-                    // pDebug(4);
-                    s = p->getSecurities().at(k);
-                    if (s->contract()->symbol == ss->contract()->symbol) {
-                        if (s->contract()->secType == QByteArray("FUT")) {
-                            if (s->contract()->expiry == ss->contract()->expiry)
-                            {
-                                containsSecurity = true;
-                                break;
-                            }
-                        }
-                        else {
-                            containsSecurity = true;
-                            break;
-                        }
-//                        if (containsSecurity && !s->getSecurityOrderMap()->isEmpty()) {
-//                            for (int i=0;i<s->getSecurityOrderMap()->count();++i) {
-//                                SecurityOrder* so = s->getSecurityOrderMap()->values().at(i);
-//                                if (so->triggerType != EXIT) {
-//                                    canCheckTradeExits = true;
-//                                }
-//                            }
-//                        }
-                    }
-                }
-                // pDebug(5);
-                if (containsSecurity && p->isTrading(s)) {
-                    // pDebug(s);
-                    // pDebug(price);
-                    s->appendRawPrice(price);
-                    p->appendPlotsAndTable(p->getSecurityMap().key(s));
-
-                    if (!p->getUi()->manualTradeEntryCheckBox->isChecked()
-                            && !p->getUi()->activateButton->isEnabled()
-                            && p->getUi()->deactivateButton->isEnabled())
-                    {
-                        p->checkTradeTriggers();
-                    }
-                    if (!p->getUi()->manualTradeExitCheckBox->isChecked()
-                            && !p->getUi()->activateButton->isEnabled()
-                            && p->getUi()->deactivateButton->isEnabled())
-                    {
-                        for (int i=0;i<s->getSecurityOrderMap()->count();++i) {
-                            SecurityOrder* so = s->getSecurityOrderMap()->values().at(i);
-                            if (so->triggerType != EXIT) {
-                                canCheckTradeExits = true;
-                                break;
-                            }
-                        }
-                        if (canCheckTradeExits) {
-                            p->checkTradeExits(price);
-                        }
-                    }
-                }
-                // pDebug(6);
-            }
+    // the pair pages get their ticks straight from IBClient, see
+    // PairTabPage::onTickPrice
+    if (field == LAST && m_mktDataManager) {
+        const Contract* c = m_mktDataManager->contract(tickerId);
+        if (c) {
+            updateOrdersTable(c->symbol, price);
         }
-        break;
-    default:
-        break;
     }
 
     if (ui->portfolioTableWidget->rowCount() == 1) {
@@ -11,6 +11,7 @@
 #include <QStringList>
 #include <QSettings>
 #include <QTimer>
+#include <QSet>
 
 #define TickerId long
 #define OrderId  long
@@ -18,6 +19,9 @@
 
 
 class IBClient;
+class IBReconnectSupervisor;
+class IBMktDataManager;
+class IBHistoryCache;
 class PairTabPage;
 struct Order;
 struct OrderState;
@@ -52,6 +56,16 @@ public:
 
     QStringList getOrderHeaderLabels() const;
 
+    // the market data lines the pages share, NULL before connecting
+    IBMktDataManager* getMktDataManager() const { return m_mktDataManager; }
+
+    // historical bars the pages share, NULL before connecting
+    IBHistoryCache* getHistoryCache() const { return m_historyCache; }
+
+    // set from the command line before connecting, see main.cpp
+    void setCaptureFile(const QString & path) { m_captureFile = path; }
+    void setReplayFile(const QString & path, double speed) { m_replayFile = path; m_replaySpeed = speed; }
+
 
 protected:
     void closeEvent(QCloseEvent *event);
@@ -71,6 +85,10 @@ private slots:
     void onCurrentTime(long time);
     void onTwsConnected();
     void onTwsConnectionClosed();
+    void onTwsReconnecting(int attempt, int delayMsecs);
+    void onTwsReconnected(uint lostAt);
+    void onDataConnectionReconnected(uint lostAt);
+    void onMktDataLinesUsed(int used, int budget);
     void onTabCloseRequested(int idx);
 
     void onOpenOrder(long orderId, const Contract& contract, const Order& order, const OrderState& orderState);
@@ -97,12 +115,17 @@ private slots:
     void onClearSettings();
     void onClickShowButtonsManually();
     void onWelcomeDialogStartButtonClicked();
+    void onReplayFinished(quint64 chunks, quint64 bytes, qint64 nsecs);
 
 
 private:
     Ui::MainWindow *ui;
     Ui::PairTabPage* ptpui;
     IBClient* m_ibClient;
+    IBReconnectSupervisor* m_reconnectSupervisor;
+    IBMktDataManager* m_mktDataManager;
+    IBHistoryCache* m_historyCache;
+    QString m_historyCacheFile;
     QMap<int,PairTabPage*> m_pairTabPageMap;
     QStringList m_managedAccounts;
     QStringList m_headerLabels;
@@ -116,11 +139,20 @@ private:
     WelcomeDialog* m_welcomeDialog;
     int             m_numConnectionAttempts;
     QTimer          m_welcomeTimer;
+    QString         m_captureFile;
+    QString         m_replayFile;
+    double          m_replaySpeed;
+    bool            m_startupRequestsSent;
+
+    // open orders TWS reported since the reqOpenOrders() after a reconnect
+    bool            m_reconcilingOrders;
+    QSet<long>      m_reportedOpenOrders;
 
     void writeSettings();
     void readSettings();
     void readPageSettings();
     void updateOrdersTable(const QString & symbol, const double & last);
+    void markOrdersNotOpen(const QString & tabSymbol, int leg, const QStringList & notOpen);
 };
 
 #endif // MAINWINDOW_H
@@ -8,6 +8,8 @@ QT       += core gui network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets printsupport
 
+CONFIG += c++11
+
 TARGET = nkny
 TEMPLATE = app
 
@@ -17,6 +19,20 @@ SOURCES += main.cpp\
         mainwindow.cpp \
     qcustomplot.cpp \
     ibclient.cpp \
+    ibringbuffer.cpp \
+    ibclientworker.cpp \
+    ibrequestpacer.cpp \
+    iborderbook.cpp \
+    ibcapture.cpp \
+    ibreplaydriver.cpp \
+    ibreconnectsupervisor.cpp \
+    ibmktdatamanager.cpp \
+    ibhistorycache.cpp \
+    barstore.cpp \
+    tickjournal.cpp \
+    pairjoin.cpp \
+    ibmockserver.cpp \
+    ibparsebench.cpp \
     security.cpp \
     helpers.cpp \
     pairtabpage.cpp \
@@ -33,6 +49,27 @@ SOURCES += main.cpp\
 HEADERS  += mainwindow.h \
     qcustomplot.h \
     ibclient.h \
+    ibfieldcursor.h \
+    ibringbuffer.h \
+    ibspscqueue.h \
+    ibmsgstats.h \
+    ibrequestpacer.h \
+    ibticksubscriber.h \
+    ibhistoricalbars.h \
+    ibresponsehandler.h \
+    iborderbook.h \
+    ibreconnectsupervisor.h \
+    ibmktdatamanager.h \
+    ibhistorycache.h \
+    barstore.h \
+    barring.h \
+    tickjournal.h \
+    pairjoin.h \
+    ibcapture.h \
+    ibreplaydriver.h \
+    ibmockserver.h \
+    ibparsebench.h \
+    ibclientworker.h \
     ibdefines.h \
     iborder.h \
     ibtagvalue.h \
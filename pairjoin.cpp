@@ -0,0 +1,205 @@
+#include "pairjoin.h"
+
+// close of leg at timeStamp, on the line between its bars before and after
+static double interpolate(const DataVecsHist* leg, int before, double timeStamp)
+{
+    const double t0 = leg->timeStamp.at(before);
+    const double t1 = leg->timeStamp.at(before + 1);
+    const double c0 = leg->close.at(before);
+    return c0 + (leg->close.at(before + 1) - c0) * (timeStamp - t0) / (t1 - t0);
+}
+
+PairJoin::PairJoin(FillPolicy policy)
+    : m_policy(policy)
+{
+    m_legs[0] = m_legs[1] = NULL;
+    m_joined[0] = m_joined[1] = NULL;
+    m_openFill[0] = m_openFill[1] = 0;
+}
+
+PairJoin::~PairJoin()
+{
+    reset();
+}
+
+void PairJoin::setPolicy(FillPolicy policy)
+{
+    m_policy = policy;
+    reset();
+}
+
+PairJoin::FillPolicy PairJoin::policyFromString(const QString &policy, FillPolicy defaultPolicy)
+{
+    if (policy == "previous")
+        return FILL_PREVIOUS;
+    if (policy == "drop")
+        return FILL_DROP;
+    if (policy == "interpolate")
+        return FILL_INTERPOLATE;
+    return defaultPolicy;
+}
+
+void PairJoin::reset()
+{
+    for (int i = 0; i < 2; ++i) {
+        delete m_joined[i];
+        m_joined[i] = NULL;
+        m_legs[i] = NULL;
+        m_openFill[i] = 0;
+    }
+}
+
+DataVecsHist *PairJoin::leg(int i) const
+{
+    return m_joined[i] && !m_joined[i]->timeStamp.isEmpty() ? m_joined[i] : NULL;
+}
+
+void PairJoin::update(const DataVecsHist *leg1, const DataVecsHist *leg2)
+{
+    if (leg1 != m_legs[0] || leg2 != m_legs[1]) {
+        reset();
+        m_legs[0] = leg1;
+        m_legs[1] = leg2;
+    }
+    if (!leg1 || !leg2 || leg1->timeStamp.isEmpty() || leg2->timeStamp.isEmpty())
+        return;
+
+    if (!m_joined[0]) {
+        const int capacity = qMax(leg1->capacity(), leg2->capacity());
+        m_joined[0] = new DataVecsHist(capacity);
+        m_joined[1] = new DataVecsHist(capacity);
+    }
+
+    refreshLast();
+    refreshFills();
+
+    const double joinedTo = m_joined[0]->timeStamp.isEmpty() ? -1 : m_joined[0]->timeStamp.last();
+    const double horizon = qMin(leg1->timeStamp.last(), leg2->timeStamp.last());
+
+    // the first bar of each leg after the joined ones
+    int next[2];
+    for (int i = 0; i < 2; ++i) {
+        const BarRing<double> & ts = m_legs[i]->timeStamp;
+        next[i] = ts.size();
+        while (next[i] > 0 && ts.at(next[i] - 1) > joinedTo)
+            --next[i];
+    }
+
+    // once a leg runs out the horizon is passed, it is at most its last bar
+    while (next[0] < leg1->size() && next[1] < leg2->size()) {
+        const double t0 = leg1->timeStamp.at(next[0]);
+        const double t1 = leg2->timeStamp.at(next[1]);
+        if (qMin(t0, t1) > horizon)
+            break;
+
+        if (t0 == t1) {
+            appendBar(0, next[0]++);
+            appendBar(1, next[1]++);
+        }
+        else if (t0 < t1) {
+            if (appendFill(1, next[1], t0))
+                appendBar(0, next[0]);
+            ++next[0];
+        }
+        else {
+            if (appendFill(0, next[0], t1))
+                appendBar(1, next[1]);
+            ++next[1];
+        }
+    }
+}
+
+// the legs' bar at the last joined time stamp, if they have one, as it is now
+void PairJoin::refreshLast()
+{
+    if (m_joined[0]->timeStamp.isEmpty())
+        return;
+
+    const double timeStamp = m_joined[0]->timeStamp.last();
+    for (int i = 0; i < 2; ++i) {
+        const DataVecsHist* leg = m_legs[i];
+        DataVecsHist* joined = m_joined[i];
+
+        int bar = leg->size() - 1;
+        while (bar >= 0 && leg->timeStamp.at(bar) > timeStamp)
+            --bar;
+        if (bar < 0 || leg->timeStamp.at(bar) != timeStamp)
+            continue;
+
+        const int last = joined->size() - 1;
+        joined->open.replace(last, leg->open.at(bar));
+        joined->high.replace(last, leg->high.at(bar));
+        joined->low.replace(last, leg->low.at(bar));
+        joined->close.replace(last, leg->close.at(bar));
+        joined->volume.replace(last, leg->volume.at(bar));
+        joined->barCount.replace(last, leg->barCount.at(bar));
+        joined->wap.replace(last, leg->wap.at(bar));
+        joined->hasGaps.replace(last, leg->hasGaps.at(bar));
+    }
+}
+
+// the fills interpolated towards a bar of the leg that was still being
+// built, with that bar as it is now; once the leg has a bar after it the
+// fills are final
+void PairJoin::refreshFills()
+{
+    for (int i = 0; i < 2; ++i) {
+        if (!m_openFill[i])
+            continue;
+
+        const DataVecsHist* leg = m_legs[i];
+        DataVecsHist* joined = m_joined[i];
+        const double from = m_openFill[i];
+        m_openFill[i] = 0;
+
+        int j = joined->size();
+        while (j > 0 && joined->timeStamp.at(j - 1) >= from)
+            --j;
+        for (; j < joined->size(); ++j) {
+            const double timeStamp = joined->timeStamp.at(j);
+            int before = leg->size() - 1;
+            while (before >= 0 && leg->timeStamp.at(before) > timeStamp)
+                --before;
+            if (before < 0 || before + 1 >= leg->size() || leg->timeStamp.at(before) == timeStamp)
+                continue;
+
+            const double price = interpolate(leg, before, timeStamp);
+            joined->open.replace(j, price);
+            joined->high.replace(j, price);
+            joined->low.replace(j, price);
+            joined->close.replace(j, price);
+            joined->wap.replace(j, price);
+            if (before + 1 == leg->size() - 1 && !m_openFill[i])
+                m_openFill[i] = timeStamp;
+        }
+    }
+}
+
+void PairJoin::appendBar(int i, int bar)
+{
+    const DataVecsHist* leg = m_legs[i];
+    m_joined[i]->append(leg->timeStamp.at(bar), leg->open.at(bar), leg->high.at(bar), leg->low.at(bar),
+                        leg->close.at(bar), leg->volume.at(bar), leg->barCount.at(bar), leg->wap.at(bar),
+                        leg->hasGaps.at(bar));
+}
+
+// a flat bar for leg i at timeStamp, which falls before its bar after;
+// false when the policy or a missing previous bar leaves it out
+bool PairJoin::appendFill(int i, int after, double timeStamp)
+{
+    const DataVecsHist* leg = m_legs[i];
+    const int before = after - 1;
+    if (m_policy == FILL_DROP || before < 0)
+        return false;
+
+    double price = leg->close.at(before);
+    if (m_policy == FILL_INTERPOLATE) {
+        price = interpolate(leg, before, timeStamp);
+        // the bar after may still change, see refreshFills()
+        if (after == leg->size() - 1 && !m_openFill[i])
+            m_openFill[i] = timeStamp;
+    }
+
+    m_joined[i]->append(timeStamp, price, price, price, price, 0, 0, price, true);
+    return true;
+}
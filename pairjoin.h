@@ -0,0 +1,54 @@
+#ifndef PAIRJOIN_H
+#define PAIRJOIN_H
+
+#include "security.h"
+
+#include <QString>
+
+// As-of merge join of the bars of the two legs of a pair on their time
+// stamps, so the ratio is taken of bars of the same time whatever halts,
+// gaps or session hours the legs have. At a time stamp only one leg has a
+// bar at, the other one gets its previous close, is dropped with it, or
+// gets the close interpolated between its bars around it. Time stamps are
+// joined up to the last one both legs reached, so a bar the other leg is
+// still to get isn't filled in; bars the legs get later are appended to
+// the joined ones, nothing joined is copied again. The last joined bar
+// follows its legs, it may be one still being built; so do the bars
+// interpolated towards a leg's bar still being built.
+class PairJoin
+{
+public:
+    enum FillPolicy { FILL_PREVIOUS, FILL_DROP, FILL_INTERPOLATE };
+
+    explicit PairJoin(FillPolicy policy = FILL_PREVIOUS);
+    ~PairJoin();
+
+    FillPolicy policy() const { return m_policy; }
+    void setPolicy(FillPolicy policy);
+
+    // "previous", "drop" or "interpolate"
+    static FillPolicy policyFromString(const QString & policy, FillPolicy defaultPolicy = FILL_PREVIOUS);
+
+    // joins what leg1 and leg2 got since the last call, starts over when
+    // they aren't the legs of the last call
+    void update(const DataVecsHist* leg1, const DataVecsHist* leg2);
+    void reset();
+
+    // the joined bars of leg 0 or 1, NULL while there are none
+    DataVecsHist* leg(int i) const;
+
+private:
+    Q_DISABLE_COPY(PairJoin)
+
+    void refreshLast();
+    void refreshFills();
+    void appendBar(int i, int bar);
+    bool appendFill(int i, int after, double timeStamp);
+
+    FillPolicy          m_policy;
+    const DataVecsHist* m_legs[2];
+    DataVecsHist*       m_joined[2];
+    double              m_openFill[2];  // first fill interpolated towards the last bar of the leg, 0 if none
+};
+
+#endif // PAIRJOIN_H
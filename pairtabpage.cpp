@@ -5,10 +5,13 @@
 #include "ui_contractdetailswidget.h"
 #include "ui_globalconfigdialog.h"
 #include "ui_datatoolboxwidget.h"
+#include "ui_logdialog.h"
 
 #include "contractdetailswidget.h"
 #include "globalconfigdialog.h"
 #include "ibclient.h"
+#include "ibmktdatamanager.h"
+#include "ibhistorycache.h"
 #include "ibcontract.h"
 #include "qcustomplot.h"
 #include "helpers.h"
@@ -21,6 +24,8 @@
 
 #include <QDateTime>
 #include <QTime>
+#include <QDir>
+#include <QStandardPaths>
 #include <QSpinBox>
 #include <QPair>
 #include <QPen>
@@ -36,7 +41,6 @@
 #include <QCursor>
 
 int PairTabPage::PairTabPageCount = 0;
-QMultiMap<long, Security*> PairTabPage::RawDataMap = QMultiMap<long, Security*>();
 bool PairTabPage::DontClickShowButtons = false;
 
 PairTabPage::PairTabPage(IBClient *ibClient, const QStringList & managedAccounts, QWidget *parent)
@@ -58,11 +62,23 @@ PairTabPage::PairTabPage(IBClient *ibClient, const QStringList & managedAccounts
     , m_pairTabPageId(++PairTabPageCount)
     , m_exitingOrder(false)
     , m_placingOrder(false)
+    , m_realTimeBarsFailed(false)
 {
 //    qDebug() << "[DEBUG-PairTabPage]";
 
     ui->setupUi(this);
 
+    QSettings settings;
+    settings.beginGroup("mainwindow");
+    m_realTimeBars = settings.value("realTimeBars", false).toBool();
+    m_mktDepthRows = settings.value("mktDepthRows", 0).toInt();
+    m_barStoreDir = settings.value("barStoreDir",
+            QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/bars").toString();
+    m_multiTimeFrame = settings.value("multiTimeFrame", true).toBool();
+    m_tickJournalDir = settings.value("tickJournalDir").toString();
+    m_pairJoin.setPolicy(PairJoin::policyFromString(settings.value("pairFillPolicy").toString()));
+    settings.endGroup();
+
     m_mainWindow = qobject_cast<MainWindow*>(parent);
     mwui = m_mainWindow->getUi();
 
@@ -168,16 +184,10 @@ PairTabPage::PairTabPage(IBClient *ibClient, const QStringList & managedAccounts
 //            this, SLOT(onOrderStatus(long,QByteArray,int,int,double,int,int,double,int,QByteArray)));
 //    connect(m_ibClient, SIGNAL(openOrder(long,Contract,Order,OrderState)),
 //            this, SLOT(onOpenOrder(long,Contract,Order,OrderState)));
-    connect(m_ibClient, SIGNAL(contractDetails(int,ContractDetails)),
-            this, SLOT(onContractDetails(int,ContractDetails)));
-    connect(m_ibClient, SIGNAL(historicalData(long,QByteArray,double,double,double,double,int,int,double,int)),
-            this, SLOT(onHistoricalData(long,QByteArray,double,double,double,double,int,int,double,int)));
     connect(ui->tradeEntryNumStdDevLayersSpinBox, SIGNAL(valueChanged(int)),
             this, SLOT(onTradeEntryNumStdDevLayersChanged(int)));
     connect(ui->waitCheckBox, SIGNAL(stateChanged(int)),
             this, SLOT(onWaitCheckBoxStateChanged(int)));
-    connect(m_ibClient, SIGNAL(contractDetailsEnd(int)),
-            this, SLOT(onContractDetailsEnd(int)));
     connect(ui->overrideUnitSizeCheckBox, SIGNAL(stateChanged(int)),
             this, SLOT(onOverrideCheckBoxStateChanged(int)));
 //    connect(ui->pair1ResetButton, SIGNAL(pressed()),
@@ -189,6 +199,20 @@ PairTabPage::PairTabPage(IBClient *ibClient, const QStringList & managedAccounts
 
 PairTabPage::~PairTabPage()
 {
+    if (m_mainWindow->getMktDataManager())
+        m_mainWindow->getMktDataManager()->releaseAll(this);
+    if (m_mainWindow->getHistoryCache())
+        m_mainWindow->getHistoryCache()->removeHandler(this);
+    if (m_ibClient) {
+        foreach (Security* s, m_securityMap.values()) {
+            if (s && s->getRealTimeBarsTickerId() && m_ibClient->isConnected())
+                m_ibClient->cancelRealTimeBars(s->getRealTimeBarsTickerId());
+            if (s && s->getMktDepthTickerId() && m_ibClient->isConnected())
+                m_ibClient->cancelMktDepth(s->getMktDepthTickerId());
+        }
+        m_ibClient->unsubscribeTicks(this);
+        m_ibClient->removeResponseHandler(this);
+    }
 //    if (!m_securityMap.keys().isEmpty()) {
 //        foreach(Security* s, m_securityMap.values()) {
 //            delete s;
@@ -196,10 +220,9 @@ PairTabPage::~PairTabPage()
 //    }
 }
 
-void PairTabPage::onHistoricalData(long reqId, const QByteArray& date, double open, double high,
-    double low, double close, int volume, int barCount, double WAP, int hasGaps)
+void PairTabPage::onHistoricalBars(long reqId, const IBHistoricalBars &bars)
 {
-//    qDebug() << "[DEBUG-onHistoricalData]";
+//    qDebug() << "[DEBUG-onHistoricalBars]";
 
 //    if (!(m_securityMap.keys().contains(reqId)
 //          || m_newBarMap.keys().contains(reqId)
@@ -210,7 +233,6 @@ void PairTabPage::onHistoricalData(long reqId, const QByteArray& date, double op
     long sid = 0;
 //    bool isS1 = false;
     bool isS2 = false;
-    double timeStamp = 0;
     bool isNewBarReq = false;
     bool isMoreDataReq = false;
 
@@ -221,31 +243,29 @@ void PairTabPage::onHistoricalData(long reqId, const QByteArray& date, double op
                 m_securityMap.remove(i);
         }
 
-    if (m_timeFrame == DAY_1)
-        timeStamp = (double)QDateTime::fromString(date, "yyyyMMdd").toTime_t();
-    else
-        timeStamp = date.toDouble();
-
+    // only requests made by this page get here, find out which kind it was
+    const long newBarSid = m_newBarMap.key(reqId, -1);
+    const long moreDataSid = m_moreDataMap.key(reqId, -1);
 
-    if (m_securityMap.keys().contains(reqId)) {
+    if (m_securityMap.contains(reqId)) {
         s = m_securityMap.value(reqId);
         sid = reqId;
-//        qDebug() << "[DEBUG-onHistoricalData] initial data request";
+//        qDebug() << "[DEBUG-onHistoricalBars] initial data request";
     }
-    else if (m_newBarMap.values().contains(reqId)) {
+    else if (newBarSid != -1) {
         isNewBarReq = true;
-        sid = m_newBarMap.key(reqId);
+        sid = newBarSid;
         s = m_securityMap.value(sid);
-//        qDebug() << "[DEBUG-onHistoricalData] new bar data request";
+//        qDebug() << "[DEBUG-onHistoricalBars] new bar data request";
     }
-    else if (m_moreDataMap.values().contains(reqId)) {
+    else if (moreDataSid != -1) {
         isMoreDataReq = true;
-        sid = m_moreDataMap.key(reqId);
+        sid = moreDataSid;
         s = m_securityMap.value(sid);
-//        qDebug() << "[DEBUG-onHistoricalData] more data request";
+//        qDebug() << "[DEBUG-onHistoricalBars] more data request";
     }
     else {
-//        qDebug() << "[ERROR-onHistoricalData] request Id UNKNOWN";
+//        qDebug() << "[ERROR-onHistoricalBars] request Id UNKNOWN";
 //        qDebug() << "    secMapKeys:" << m_securityMap.keys();
 //        qDebug() << "    secMapVals:" << m_securityMap.values();
 //        qDebug() << "    reqId:" << reqId;
@@ -255,44 +275,62 @@ void PairTabPage::onHistoricalData(long reqId, const QByteArray& date, double op
 //    if (m_securityMap.keys().indexOf(reqId) == 0) {
 //        isS1 = true;
 //    }
-    if (m_securityMap.keys().indexOf(reqId) == 1) {
+    if (m_securityMap.size() > 1 && (m_securityMap.constBegin() + 1).key() == reqId) {
         isS2 = true;
     }
 
     if (!isNewBarReq) {
-        if (date.startsWith("finished")) {
-            DataVecsHist* dvh = s->getHistData(m_timeFrame);
-            if (!isMoreDataReq) {
-                double lastBarsTimeStamp = dvh->timeStamp.last();
-                s->setLastBarsTimeStamp(lastBarsTimeStamp);
-
-                // realtime data request
+        if (isMoreDataReq)
+            s->appendMoreBarData(barTimeFrame(s), bars);
+        else
+            s->appendHistData(m_timeFrame, bars);
+
+        DataVecsHist* dvh = s->getHistData(m_timeFrame);
+        if (!isMoreDataReq) {
+            double lastBarsTimeStamp = dvh->timeStamp.last();
+            s->setLastBarsTimeStamp(lastBarsTimeStamp);
+
+            // the intraday frames above this one are built from its bars
+            if (m_multiTimeFrame && !s->hasTimeFrames()) {
+                QList<TimeFrame> derived;
+                for (int tf = m_timeFrame + 1; tf < DAY_1; ++tf)
+                    derived.append((TimeFrame)tf);
+                s->setTimeFrames(m_timeFrame, derived, ui->lookbackSpinBox->value());
+            }
 
-                // is this a duplicate?
-                long tid = 0;
+            // every tick on disk too when asked for
+            if (!m_tickJournalDir.isEmpty() && !s->getTicks()->isOpen() && s->contract()->conId > 0) {
+                QDir().mkpath(m_tickJournalDir);
+                const QString path = m_tickJournalDir + QString("/%1.ticks").arg((qint64)s->contract()->conId);
+                if (!s->openTickJournal(path))
+                    m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                                QString("[TICKJOURNAL] cannot use %1").arg(path));
+            }
 
-                QMap<long, Security*> tmpMap = PairTabPage::RawDataMap;
+            // realtime data request, shared with other pages on the contract
+            if (!s->getRealTimeTickerId()) {
+                long tid = m_mainWindow->getMktDataManager()->acquire(*(s->contract()), this);
+                s->setRealTimeTickerId(tid);
+                if (!useRealTimeBars())
+                    s->getTimer()->start(m_timeFrameInSeconds * 1000);
+            }
 
-                for (int i=0;i<tmpMap.values().count();++i) {
-                    Security* ss = tmpMap.values().at(i);
-                    if ((ss->contract()->symbol == s->contract()->symbol)
-                            && (ss->contract()->expiry == s->contract()->expiry)) {
-                        tid = tmpMap.key(ss);
-                        PairTabPage::RawDataMap.insert(tid, s);
-                    }
-                }
+            if (useRealTimeBars() && !s->getRealTimeBarsTickerId()) {
+                long rtbId = m_ibClient->getTickerId();
+                s->setRealTimeBarsTickerId(rtbId);
+                m_ibClient->reqRealTimeBars(rtbId, *(s->contract()), 5, "TRADES", true, QList<TagValue*>(), this);
+            }
 
-                if (tid == 0) {
-                    tid = m_ibClient->getTickerId();
-                    PairTabPage::RawDataMap.insert(tid, s);
-                    m_ibClient->reqMktData(tid, *(s->contract()), QByteArray(""), false);
-                    s->getTimer()->start(m_timeFrameInSeconds * 1000);
-                }
-                s->setRealTimeTickerId(tid);
+            // order book for sizing the orders of thin legs
+            if (m_mktDepthRows > 0 && !s->getMktDepthTickerId()) {
+                long depthId = m_ibClient->getTickerId();
+                s->setMktDepthTickerId(depthId);
+                m_ibClient->reqMktDepth(depthId, *(s->contract()), m_mktDepthRows);
+            }
 
 
-qDebug() << "[DEBUG-onHistoricalData] NUM BARS RECEIVED:" << dvh->timeStamp.size()
-                         << "Last timestamp:" << QDateTime::fromTime_t( (int)dvh->timeStamp.last()).toString("yyMMdd::hh:mm:ss");
+qDebug() << "[DEBUG-onHistoricalBars] NUM BARS RECEIVED:" << dvh->timeStamp.size()
+                     << "Last timestamp:" << QDateTime::fromTime_t( (int)dvh->timeStamp.last()).toString("yyMMdd::hh:mm:ss");
 
 //                if (dvh->timeStamp.size() < ui->lookbackSpinBox->value()) {
 ////                    // FIXME: I need more bars (1 HOUR BARS)
@@ -301,111 +339,210 @@ qDebug() << "[DEBUG-onHistoricalData] NUM BARS RECEIVED:" << dvh->timeStamp.size
 //                    onMoreHistoricalDataNeeded();
 //                    return;
 //                }
+        }
+        else {  // HANDLE THE LOOKBACK DATA
+            m_moreDataMap.remove(s->getHistoricalTickerId());
+            if (dvh->timeStamp.size() < ui->lookbackSpinBox->value()) {
+                m_moreDataMap[s->getHistoricalTickerId()] = m_ibClient->getTickerId();
+                onMoreHistoricalDataNeeded();
+                return;
             }
-            else {  // HANDLE THE LOOKBACK DATA
-                m_moreDataMap.remove(s->getHistoricalTickerId());
-                if (dvh->timeStamp.size() < ui->lookbackSpinBox->value()) {
-                    m_moreDataMap[s->getHistoricalTickerId()] = m_ibClient->getTickerId();
-                    onMoreHistoricalDataNeeded();
-                    return;
-                }
-            }
+        }
 
 //    qDebug() << "[DEBUG-" << __func__ << "]" << s->contract()->symbol << "lastBarsTimeStamp:" << (uint)s->getLastBarsTimeStamp();
 
-            showPlot(sid);
+        showPlot(sid);
 
-            if (isS2 && m_securityMap.values().at(0)->getHistData(m_timeFrame)) {
+        if (isS2 && m_securityMap.values().at(0)->getHistData(m_timeFrame)) {
+            plotPair();
+        }
+        else {
+            ui->mdiArea->subWindowList().at(0)->showMaximized();
+        }
+    }
+    else {
+        // into the base frame, the shown one may be built from it
+        s->appendNewBarData(barTimeFrame(s), bars);
+
+        pDebug("isNewDataRequest");
+        s->handleNewBarData(barTimeFrame(s));
+        if (!ui->manualTradeEntryCheckBox->isChecked()
+                && !ui->activateButton->isEnabled()
+                && ui->deactivateButton->isEnabled())
+        {
+            checkTradeTriggers();
+        }
+        appendPlotsAndTable(sid);
 
-                // handle different sized data sets.. TEMPORARY... FIX ME!!!
-                int s1 = m_securityMap.values().at(0)->getHistData(m_timeFrame)->timeStamp.size();
-                int s2 = m_securityMap.values().at(1)->getHistData(m_timeFrame)->timeStamp.size();
+        // with realtime bars this was a backfill, nothing to poll
+        if (useRealTimeBars())
+            return;
 
-                if (s1 > s2) {
-                    m_securityMap.values().at(0)->fixHistDataSize(m_timeFrame, s1-s2);
-                }
-                else
-                    m_securityMap.values().at(1)->fixHistDataSize(m_timeFrame, s2-s1);
+        // the ticks build bars of the base frame whichever one is shown
+        const uint barSecs = s->hasTimeFrames() ? Security::timeFrameSeconds(s->baseTimeFrame()) : m_timeFrameInSeconds;
+        uint diffSeconds = 0;
+        uint nowTimeStamp = QDateTime::currentDateTime().toTime_t();
 
+        for (;nowTimeStamp % barSecs != 0;--nowTimeStamp) {
+            diffSeconds++;
+        }
 
-                plotRatio();
+        if (diffSeconds) {
+            s->getTimer()->start((barSecs - diffSeconds) * 1000);
+        }
+    }
+//    qDebug() << "[DEBUG-onHistoricalBars] leaving";
+}
 
-//                plotRatioMA();
+// the ratio plots and the table row, from the bars of both legs
+void PairTabPage::plotPair()
+{
+    // the legs are joined on their time stamps from scratch
+    m_pairJoin.reset();
+    if (!pairData(0)) {
+        m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                    QString("[PAIRJOIN] %1: the legs have no bars in common time").arg(m_tabSymbol));
+        return;
+    }
 
-                plotRatioStdDev();
+    plotRatio();
 
-                plotRatioPercentFromMean();
+//    plotRatioMA();
 
-                plotCorrelation();
+    plotRatioStdDev();
 
-//                plotCointegration();
+    plotRatioPercentFromMean();
 
-                plotRatioVolatility();
+    plotCorrelation();
 
-                plotRatioRSI();
+//    plotCointegration();
 
-                plotRSISpread();
+    plotRatioVolatility();
 
-                removeTableRow();
-                addTableRow();
+    plotRatioRSI();
 
-                pDebug("done with plots");
+    plotRSISpread();
 
-                if (m_canSetTabWidgetCurrentIndex) {
-                    QSettings s;
-                    s.beginGroup(m_tabSymbol);
-//                    ui->tabWidget->setCurrentIndex(s.value("tabWidgetIndex").toInt());
-                    s.endGroup();
-                    m_canSetTabWidgetCurrentIndex = false;
-                }
-                ui->mdiArea->tileSubWindows();
-                ui->mdiArea->setSubWindowHeight(ui->mdiArea->subWindowList().first()->height());
-                ui->mdiArea->setSubWindowWidth( ui->mdiArea->subWindowList().first()->width());
-            }
-            else {
-                ui->mdiArea->subWindowList().at(0)->showMaximized();
-            }
-        }
-        else {
-            if (isMoreDataReq) {
-//                qDebug() << "[DEBUG-onHistoricalData]" << m_timeFrame << QDateTime::fromTime_t((int)timeStamp).toString("yyyyMMdd/hh:mm:ss") << open << high << low << close << volume << barCount << WAP << hasGaps;
-                s->appendMoreBarData(m_timeFrame, timeStamp, open, high, low, close, volume, barCount, WAP, hasGaps);
+    removeTableRow();
+    addTableRow();
 
-            }
-            else {
-//                qDebug() << "[DEBUG-onHistoricalData]" << m_timeFrame << QDateTime::fromTime_t((int)timeStamp).toString("yyyyMMdd/hh:mm:ss") << open << high << low << close << volume << barCount << WAP << hasGaps;
-                s->appendHistData(m_timeFrame, timeStamp, open, high, low, close, volume, barCount, WAP, hasGaps);
-            }
+    pDebug("done with plots");
+
+    if (m_canSetTabWidgetCurrentIndex) {
+        QSettings s;
+        s.beginGroup(m_tabSymbol);
+//        ui->tabWidget->setCurrentIndex(s.value("tabWidgetIndex").toInt());
+        s.endGroup();
+        m_canSetTabWidgetCurrentIndex = false;
+    }
+    ui->mdiArea->tileSubWindows();
+    ui->mdiArea->setSubWindowHeight(ui->mdiArea->subWindowList().first()->height());
+    ui->mdiArea->setSubWindowWidth( ui->mdiArea->subWindowList().first()->width());
+}
+
+// bars of leg 0 or 1 on the time stamps of both, see PairJoin
+DataVecsHist* PairTabPage::pairData(int leg)
+{
+    m_pairJoin.update(m_securityMap.values().at(0)->getHistData(m_timeFrame),
+                      m_securityMap.values().at(1)->getHistData(m_timeFrame));
+    return m_pairJoin.leg(leg);
+}
+
+void PairTabPage::onRealtimeBar(long reqId, long time, double open, double high, double low, double close,
+                                long volume, double wap, int count)
+{
+    long sid = -1;
+    Security* s = NULL;
+    foreach (long key, m_securityMap.keys()) {
+        Security* ss = m_securityMap.value(key);
+        if (ss && ss->getRealTimeBarsTickerId() == reqId) {
+            sid = key;
+            s = ss;
+            break;
         }
     }
-    else {
-        if (date.startsWith("finished")) {
-            pDebug("isNewDataRequest");
-            s->handleNewBarData(m_timeFrame);
-            if (!ui->manualTradeEntryCheckBox->isChecked()
-                    && !ui->activateButton->isEnabled()
-                    && ui->deactivateButton->isEnabled())
-            {
-                checkTradeTriggers();
-            }
-            appendPlotsAndTable(sid);
+    if (!s || !isTrading(s))
+        return;
 
-            uint diffSeconds = 0;
-            uint nowTimeStamp = QDateTime::currentDateTime().toTime_t();
+    // into the bars the other time frames are built from
+    const TimeFrame timeFrame = barTimeFrame(s);
+    if (!s->appendRealTimeBar(timeFrame, Security::timeFrameSeconds(timeFrame), time, open, high, low, close,
+                              volume, wap, count))
+        return;
 
-            for (;nowTimeStamp % m_timeFrameInSeconds != 0;--nowTimeStamp) {
-                diffSeconds++;
-            }
+    if (!ui->manualTradeEntryCheckBox->isChecked()
+            && !ui->activateButton->isEnabled()
+            && ui->deactivateButton->isEnabled())
+    {
+        checkTradeTriggers();
+    }
+    appendPlotsAndTable(sid);
+}
 
-            if (diffSeconds) {
-                s->getTimer()->start((m_timeFrameInSeconds - diffSeconds) * 1000);
-            }
+// a gap request that fails leaves the page with the stored bars, a
+// realtime bar stream that fails with ticks and polling
+void PairTabPage::onRequestError(long reqId, int errorCode, const QByteArray &errorMsg)
+{
+    foreach (long key, m_securityMap.keys()) {
+        Security* rtb = m_securityMap.value(key);
+        if (rtb && rtb->getRealTimeBarsTickerId() == reqId) {
+            m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                        QString("[REALTIMEBARS] %1: %2 %3, polling the bars instead")
+                        .arg(QString(rtb->contract()->symbol)).arg(errorCode).arg(QString(errorMsg)));
+            // the client dropped the failed stream already
+            rtb->setRealTimeBarsTickerId(0);
+            fallBackFromRealTimeBars();
+            return;
         }
-        else {
-            s->appendNewBarData(m_timeFrame, timeStamp, open, high, low, close, volume, barCount, WAP, hasGaps);
+    }
+
+    Security* s = m_securityMap.value(reqId);
+    if (!s || !s->getHistData(m_timeFrame) || !s->getLastBarsTimeStamp())
+        return;
+
+    m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                QString("[BARSTORE] %1: %2 %3, going on with the stored bars")
+                .arg(QString(s->contract()->symbol)).arg(errorCode).arg(QString(errorMsg)));
+    onHistoricalBars(reqId, IBHistoricalBars());
+}
+
+TimeFrame PairTabPage::barTimeFrame(Security *s) const
+{
+    return s->hasTimeFrames() ? s->baseTimeFrame() : m_timeFrame;
+}
+
+bool PairTabPage::useRealTimeBars() const
+{
+    return m_realTimeBars
+            && !m_realTimeBarsFailed
+            && m_timeFrame != DAY_1
+            && m_timeFrameInSeconds >= 5
+            && m_timeFrameInSeconds % 5 == 0;
+}
+
+// the bars of both legs from ticks and new bar requests from now on, as
+// without realtime bars
+void PairTabPage::fallBackFromRealTimeBars()
+{
+    m_realTimeBarsFailed = true;
+
+    foreach (long sid, m_securityMap.keys()) {
+        Security* s = m_securityMap.value(sid);
+        if (!s || !s->getHistData(m_timeFrame))
+            continue;
+
+        if (s->getRealTimeBarsTickerId()) {
+            m_ibClient->cancelRealTimeBars(s->getRealTimeBarsTickerId());
+            s->setRealTimeBarsTickerId(0);
         }
+
+        // the response brings the bars since the last one and aligns the timer
+        if (!s->getTimer()->isActive())
+            s->getTimer()->start(m_timeFrameInSeconds * 1000);
+        long tid = m_ibClient->getTickerId();
+        m_newBarMap[sid] = tid;
+        reqHistoricalData(tid);
     }
-//    qDebug() << "[DEBUG-onHistoricalData] leaving";
 }
 
 //void PairTabPage::on_pair1SymbolLineEdit_textEdited(const QString &arg1)
@@ -482,7 +619,7 @@ void PairTabPage::on_pair1ShowButton_clicked()
 
     long reqId = m_ibClient->getTickerId();
     m_contractDetailsMap[tickerId] = reqId;
-    m_ibClient->reqContractDetails(reqId, *c);
+    m_ibClient->reqContractDetails(reqId, *c, this);
 
 //    ui->pair2ShowButton->setEnabled(true);
 //    ui->pair1ShowButton->setEnabled(false);
@@ -552,7 +689,7 @@ void PairTabPage::on_pair2ShowButton_clicked()
 
     long reqId = m_ibClient->getTickerId();
     m_contractDetailsMap[tickerId] = reqId;
-    m_ibClient->reqContractDetails(reqId, *contract);
+    m_ibClient->reqContractDetails(reqId, *contract, this);
 
     m_pair2ShowButtonClickedAlready = true;
 
@@ -910,8 +1047,6 @@ bool PairTabPage::reqClosePair()
 
     QSettings s;
 
-    int numOfSameSecurity = 0;
-
     // IF S2 NOT SET YET
     if (s1 != NULL && s2 == NULL) {
         s.remove(m_tabSymbol);
@@ -919,27 +1054,7 @@ bool PairTabPage::reqClosePair()
             s1->getTimer()->stop();
         }
 
-        for (int i=0;i<PairTabPage::RawDataMap.values().count();++i) {
-            Security* ss = PairTabPage::RawDataMap.values().at(i);
-//            if (ss->contract()->symbol == s1->contract()->symbol
-//                    && ss->contract()->expiry == s1->contract()->expiry)
-//            {
-//                long key = PairTabPage::RawDataMap.key(ss);
-//                if (PairTabPage::RawDataMap.contains(key, ss))
-//                    PairTabPage::RawDataMap.remove(key, ss);
-//                ++numOfSameSecurity;
-//            }
-            if (ss == s1) {
-                long key = PairTabPage::RawDataMap.key(ss);
-                if (PairTabPage::RawDataMap.contains(key, ss))
-                    PairTabPage::RawDataMap.remove(key, ss);
-                ++numOfSameSecurity;
-            }
-        }
-
-        if (numOfSameSecurity == 1) {
-            m_ibClient->cancelMktData(s1->getRealTimeTickerId());
-        }
+        releaseSubscriptions(s1);
         return true;
     }
     if (s1->getSecurityOrderMap()->isEmpty()
@@ -959,35 +1074,11 @@ bool PairTabPage::reqClosePair()
         if (s1->getTimer()->isActive()) {
             s1->getTimer()->stop();
         }
-        for (int i=0;i<PairTabPage::RawDataMap.values().count();++i) {
-            Security* ss = PairTabPage::RawDataMap.values().at(i);
-            if (ss == s1) {
-                long key = PairTabPage::RawDataMap.key(ss);
-                if (PairTabPage::RawDataMap.contains(key, ss))
-                    PairTabPage::RawDataMap.remove(key, ss);
-                ++numOfSameSecurity;
-            }
-        }
-        if (numOfSameSecurity == 1) {
-            m_ibClient->cancelMktData(s1->getRealTimeTickerId());
-        }
+        releaseSubscriptions(s1);
         if (s2->getTimer()->isActive()) {
             s2->getTimer()->stop();
         }
-        numOfSameSecurity = 0;
-        for (int i=0;i<PairTabPage::RawDataMap.values().count();++i) {
-            Security* ss = PairTabPage::RawDataMap.values().at(i);
-            if (ss == s2)
-            {
-                long key = PairTabPage::RawDataMap.key(ss);
-                if (PairTabPage::RawDataMap.contains(key, ss))
-                    PairTabPage::RawDataMap.remove(key, ss);
-                ++numOfSameSecurity;
-            }
-        }
-        if (numOfSameSecurity == 1) {
-            m_ibClient->cancelMktData(s2->getRealTimeTickerId());
-        }
+        releaseSubscriptions(s2);
         m_securityMap.remove(m_securityMap.key(s1));
         m_securityMap.remove(m_securityMap.key(s2));
         return true;
@@ -1011,7 +1102,75 @@ ContractDetailsWidget *PairTabPage::getPair1ContractDetailsWidget() const
 }
 
 
-void PairTabPage::reqHistoricalData(long tickerId, QDateTime dt)
+// gives back the market data line and cancels the bar and depth streams
+void PairTabPage::releaseSubscriptions(Security *s)
+{
+    if (s->getRealTimeTickerId()) {
+        m_mainWindow->getMktDataManager()->release(s->getRealTimeTickerId(), this);
+        s->setRealTimeTickerId(0);
+    }
+    if (s->getRealTimeBarsTickerId()) {
+        m_ibClient->cancelRealTimeBars(s->getRealTimeBarsTickerId());
+        s->setRealTimeBarsTickerId(0);
+    }
+    if (s->getMktDepthTickerId()) {
+        m_ibClient->cancelMktDepth(s->getMktDepthTickerId());
+        s->setMktDepthTickerId(0);
+    }
+}
+
+void PairTabPage::backfillBars(uint lostAt)
+{
+    const uint now = QDateTime::currentDateTime().toTime_t();
+
+    foreach (long sid, m_securityMap.keys()) {
+        Security* s = m_securityMap.value(sid);
+        if (!s || !s->getHistData(m_timeFrame) || !s->getLastBarsTimeStamp())
+            continue;
+
+        // from the last complete bar or the drop, whichever is earlier
+        uint from = qMin(lostAt, (uint)s->getLastBarsTimeStamp());
+        if (from >= now)
+            continue;
+
+        long tid = m_ibClient->getTickerId();
+        m_newBarMap[sid] = tid;
+        reqHistoricalData(tid, QDateTime::currentDateTime(), now - from + m_timeFrameInSeconds);
+    }
+}
+
+// twice the lookback so the indicators have bars before it, and at least
+// what the first request of any time frame brings
+int PairTabPage::barCapacity() const
+{
+    return qMax(2 * ui->lookbackSpinBox->value(), (int)DataVecsHist::DefaultCapacity);
+}
+
+// Loads the stored bars of s and returns the seconds since the last of them
+// to ask TWS for; 0 to make the full request when nothing was stored or the
+// gap is longer than it.
+uint PairTabPage::loadStoredBars(Security *s, const QByteArray &durationStr)
+{
+    if (m_barStoreDir.isEmpty() || s->contract()->conId <= 0)
+        return 0;
+
+    QDir().mkpath(m_barStoreDir);
+    const QString path = m_barStoreDir + QString("/%1_%2.bars").arg((qint64)s->contract()->conId).arg((int)m_timeFrameInSeconds);
+    const int loaded = s->openBarStore(m_timeFrame, path, m_timeFrameInSeconds, barCapacity());
+    if (loaded <= 0)
+        return 0;
+
+    const uint now = QDateTime::currentDateTime().toTime_t();
+    const uint gap = now - qMin(now, (uint)s->getLastBarsTimeStamp()) + m_timeFrameInSeconds;
+
+    const uint fullSecs = IBHistoryCache::durationSecs(durationStr);
+
+    m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                QString("[BARSTORE] %1 bars of %2 from disk").arg(loaded).arg(QString(s->contract()->symbol)));
+    return gap < fullSecs ? gap : 0;
+}
+
+void PairTabPage::reqHistoricalData(long tickerId, QDateTime dt, uint backfillSecs)
 {
 //    qDebug() << "[DEBUG-reqHistoricalData]";
 
@@ -1021,20 +1180,34 @@ void PairTabPage::reqHistoricalData(long tickerId, QDateTime dt)
     bool isNewBarReq = false;
     Security* security;
 
-    if (m_newBarMap.values().contains(tickerId)) {
-        security = m_securityMap.value(m_newBarMap.key(tickerId));
+    const long newBarSid = m_newBarMap.key(tickerId, -1);
+    const long moreDataSid = m_moreDataMap.key(tickerId, -1);
+
+    if (newBarSid != -1) {
+        security = m_securityMap.value(newBarSid);
         isNewBarReq = true;
     }
-    else if (m_securityMap.keys().contains(tickerId)) {
+    else if (m_securityMap.contains(tickerId)) {
         security = m_securityMap.value(tickerId);
     }
-    else if (m_moreDataMap.values().contains(tickerId)) {
-        security = m_securityMap.value(m_moreDataMap.key(tickerId));
+    else if (moreDataSid != -1) {
+        security = m_securityMap.value(moreDataSid);
     }
     else {
         qFatal("Security* security.. was not established!!");
     }
 
+    // new and more bars of a pair shown in a derived frame are asked for in
+    // the base frame, the page stays in the shown one
+    const bool inBaseFrame = !m_securityMap.contains(tickerId) && security->hasTimeFrames();
+    const TimeFrame shownTimeFrame = m_timeFrame;
+    const uint shownTimeFrameInSeconds = m_timeFrameInSeconds;
+    const QString shownTimeFrameString = m_timeFrameString;
+    if (inBaseFrame) {
+        tf = security->baseTimeFrame();
+        barSize = ui->timeFrameComboBox->itemText(tf).toLocal8Bit();
+    }
+
     /*
      *  390 mins in a trading day
      */
@@ -1166,6 +1339,27 @@ void PairTabPage::reqHistoricalData(long tickerId, QDateTime dt)
         // handle 1 week time frame specially
         break;
     }
+
+    if (inBaseFrame) {
+        m_timeFrame = shownTimeFrame;
+        m_timeFrameInSeconds = shownTimeFrameInSeconds;
+        m_timeFrameString = shownTimeFrameString;
+    }
+
+    // with bars on disk only the gap since the last of them is needed
+    if (!isNewBarReq && moreDataSid == -1 && !security->getHistData(m_timeFrame)) {
+        security->setBarCapacity(barCapacity());
+        backfillSecs = loadStoredBars(security, durationStr);
+    }
+
+    // TWS takes at most 86400 S, longer gaps are asked for in days; daily
+    // bars keep their 5 D
+    if (backfillSecs && m_timeFrame != DAY_1) {
+        if (backfillSecs <= 86400)
+            durationStr = QByteArray::number(backfillSecs) + " S";
+        else
+            durationStr = QByteArray::number((backfillSecs + 86399) / 86400) + " D";
+    }
 //    qDebug() << "[DEBUG-reqHistoricalData] -secs:" << m_timeFrameInSeconds;
 
 
@@ -1184,15 +1378,23 @@ void PairTabPage::reqHistoricalData(long tickerId, QDateTime dt)
 
 //    qDebug() << "[DEBUG-reqHistoricalData] dt2:" << dt.toString("yyyyMMdd/hh:mm:ss");
 
+    const QByteArray endDateTime = dt.toUTC().toString("yyyyMMdd hh:mm:ss 'GMT'").toLocal8Bit();
+    if (m_mainWindow->getHistoryCache()) {
+        m_mainWindow->getHistoryCache()->reqHistoricalData(tickerId, *(security->contract()), endDateTime,
+                                                           durationStr, barSize, "TRADES", 1, 2, this);
+        return;
+    }
+
     m_ibClient->reqHistoricalData(tickerId
                                   , *(security->contract())
-                                  , dt.toUTC().toString("yyyyMMdd hh:mm:ss 'GMT'").toLocal8Bit()
+                                  , endDateTime
                                   , durationStr
                                   , barSize
                                   , "TRADES"
                                   , 1
                                   , 2
-                                  , QList<TagValue*>());
+                                  , QList<TagValue*>()
+                                  , this);
 }
 
 void PairTabPage::onMoreHistoricalDataNeeded()
@@ -1743,6 +1945,24 @@ QString PairTabPage::getTabSymbol() const
 }
 
 
+// Quantity that amount buys at the price the order is expected to fill at
+// when the leg has an order book with levels, else at last; an empty book,
+// e.g. after the connection dropped, says nothing about size. Quantity
+// beyond the levels in the book is assumed to fill at the worst of them.
+static long sizeFromBook(const IBOrderBook* book, IBOrderBook::Side side, double amount, double last)
+{
+    long quantity = (long)floor(amount/last);
+    if (!book || book->isEmpty() || !book->levels(side) || quantity <= 0)
+        return quantity;
+
+    long filled = 0;
+    double vwap = book->vwapToSize(side, quantity, &filled);
+    double worst = book->price(side, book->levels(side) - 1);
+    double fillPrice = (vwap * filled + worst * (quantity - filled)) / quantity;
+
+    return fillPrice > 0 ? (long)floor(amount/fillPrice) : quantity;
+}
+
 void PairTabPage::placeOrder(TriggerType triggerType, bool reverse)
 {
     m_placingOrder = true;
@@ -1802,8 +2022,11 @@ void PairTabPage::placeOrder(TriggerType triggerType, bool reverse)
 
     if ( !ui->overrideUnitSizeCheckBox->isChecked()) {
 
-        so1->order.totalQuantity = (long)floor(amount/2/last1);
-        so2->order.totalQuantity = (long)floor(amount/2/last2);
+        // leg 1 sells into the bids and leg 2 buys from the asks
+        so1->order.totalQuantity = sizeFromBook(m_ibClient->orderBook(s1->getMktDepthTickerId()),
+                                                reverse ? IBOrderBook::ASK : IBOrderBook::BID, amount/2, last1);
+        so2->order.totalQuantity = sizeFromBook(m_ibClient->orderBook(s2->getMktDepthTickerId()),
+                                                reverse ? IBOrderBook::BID : IBOrderBook::ASK, amount/2, last2);
     }
     else {
         so1->order.totalQuantity = ui->pair1UnitOverrideSpinBox->value();
@@ -1832,8 +2055,11 @@ void PairTabPage::placeOrder(TriggerType triggerType, bool reverse)
     so2->order.transmit = true;
     so2->order.account = ui->managedAccountsComboBox->currentText().toLocal8Bit();
 
+    // both legs go out in one write
+    m_ibClient->beginBatch();
     m_ibClient->placeOrder(orderId1, *c1, so1->order);
     m_ibClient->placeOrder(orderId2, *c2, so2->order);
+    m_ibClient->endBatch();
 
 //qDebug() << "[DEBUG-placeOrder] orderId1:" << orderId1 << "orderId2:" << orderId2;
 
@@ -1855,6 +2081,7 @@ void PairTabPage::exitOrder()
 
     m_exitingOrder = true;
 
+    m_ibClient->beginBatch();
     for (int i=0;i<2;++i) {
         Security* s = m_securityMap.values().at(i);
         for (int j=0;j<s->getSecurityOrderMap()->count();++j) {
@@ -1903,6 +2130,7 @@ void PairTabPage::exitOrder()
             }
         }
     }
+    m_ibClient->endBatch();
 }
 
 void PairTabPage::showPlot(long tickerId)
@@ -1911,7 +2139,7 @@ void PairTabPage::showPlot(long tickerId)
     DataVecsHist* dvh = s->getHistData(m_timeFrame);
 
     QCustomPlot* cp = createPlot();
-    addGraph(cp, dvh->timeStamp, dvh->close);
+    addGraph(cp, dvh->timeStamp.toVector(), dvh->close.toVector());
 
     QMdiArea* ma = ui->mdiArea;
     QMdiSubWindow* sw =  ma->addSubWindow(cp);
@@ -1921,6 +2149,54 @@ void PairTabPage::showPlot(long tickerId)
 }
 
 
+void PairTabPage::onTickPrice(long tickerId, TickType field, double price, int canAutoExecute)
+{
+    Q_UNUSED(canAutoExecute);
+
+    if (field != LAST)
+        return;
+
+    Security* s = NULL;
+    long sid = 0;
+    QMap<long, Security*>::const_iterator it = m_securityMap.constBegin();
+    for (; it != m_securityMap.constEnd(); ++it) {
+        if (it.value()->getRealTimeTickerId() == tickerId) {
+            s = it.value();
+            sid = it.key();
+            break;
+        }
+    }
+
+    if (!s || !isTrading(s))
+        return;
+
+    s->appendRawPrice(price);
+    appendPlotsAndTable(sid);
+
+    if (!ui->manualTradeEntryCheckBox->isChecked()
+            && !ui->activateButton->isEnabled()
+            && ui->deactivateButton->isEnabled())
+    {
+        checkTradeTriggers();
+    }
+    if (!ui->manualTradeExitCheckBox->isChecked()
+            && !ui->activateButton->isEnabled()
+            && ui->deactivateButton->isEnabled())
+    {
+        bool canCheckTradeExits = false;
+        for (int i=0;i<s->getSecurityOrderMap()->count();++i) {
+            SecurityOrder* so = s->getSecurityOrderMap()->values().at(i);
+            if (so->triggerType != EXIT) {
+                canCheckTradeExits = true;
+                break;
+            }
+        }
+        if (canCheckTradeExits) {
+            checkTradeExits(price);
+        }
+    }
+}
+
 void PairTabPage::appendPlotsAndTable(long sid)
 {
 //    QString sidString("sid: " + QString::number(sid));
@@ -1943,9 +2219,9 @@ void PairTabPage::appendPlotsAndTable(long sid)
 //    bool isS2 = m_securityMap.keys().indexOf(sid) == 1;
 
     DataVecsHist* dvh = s->getHistData(m_timeFrame);
-    DataVecsRaw*  dvr = s->getRawData();
-    DataVecsRaw*  dvr1 = NULL;
-    DataVecsRaw*  dvr2 = NULL;
+    TickJournal*  dvr = s->getTicks();
+    TickJournal*  dvr1 = NULL;
+    TickJournal*  dvr2 = NULL;
 
     if (!dvh || dvh->timeStamp.isEmpty()) {
         // pDebug("return");
@@ -1964,7 +2240,7 @@ void PairTabPage::appendPlotsAndTable(long sid)
 
     if (dvr) {
         // pDebug("2");
-        dvrTimeStampIsEmpty = dvr->timeStamp.isEmpty();
+        dvrTimeStampIsEmpty = dvr->isEmpty();
     }
 
     if (!dvr || dvrTimeStampIsEmpty) {
@@ -1975,7 +2251,7 @@ void PairTabPage::appendPlotsAndTable(long sid)
     if (dvr && !dvrTimeStampIsEmpty) {
 //         pDebug("4");
         timeStampLast = dvh->timeStamp.last() + m_timeFrameInSeconds;
-        closeLast = dvr->price.last();
+        closeLast = dvr->last().price;
     }
 
     QCPDataMap* dataMap = cp->graph()->data();
@@ -2022,8 +2298,8 @@ void PairTabPage::appendPlotsAndTable(long sid)
     Security* s1 = m_securityMap.values().at(0);
     Security* s2 = m_securityMap.values().at(1);
 
-    DataVecsHist* dvh1 = s1->getHistData(m_timeFrame);
-    DataVecsHist* dvh2 = s2->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
+    DataVecsHist* dvh2 = pairData(1);
 
     // pDebug(9);
 
@@ -2032,32 +2308,32 @@ void PairTabPage::appendPlotsAndTable(long sid)
 
     // pDebug(10);
 
-    dvr1 = s1->getRawData();
-    dvr2 = s2->getRawData();
+    dvr1 = s1->getTicks();
+    dvr2 = s2->getTicks();
 
-    QVector<double> timeStampVec = dvh1->timeStamp;
-    QVector<double> closeVec1 = dvh1->close;
-    QVector<double> closeVec2 = dvh2->close;
-    QVector<double> highVec1  = dvh1->high;
-    QVector<double> highVec2  = dvh2->high;
-    QVector<double> lowVec1   = dvh1->low;
-    QVector<double> lowVec2   = dvh2->low;
+    QVector<double> timeStampVec = dvh1->timeStamp.toVector();
+    QVector<double> closeVec1 = dvh1->close.toVector();
+    QVector<double> closeVec2 = dvh2->close.toVector();
+    QVector<double> highVec1  = dvh1->high.toVector();
+    QVector<double> highVec2  = dvh2->high.toVector();
+    QVector<double> lowVec1   = dvh1->low.toVector();
+    QVector<double> lowVec2   = dvh2->low.toVector();
 
     // pDebug(11);
 
-    if (dvr1 && !dvr1->price.isEmpty()) {
+    if (dvr1 && !dvr1->isEmpty()) {
         // pDebug("");
         timeStampVec.append(dvh1->timeStamp.last() + m_timeFrameInSeconds);
-        closeVec1.append(dvr1->price.last());
+        closeVec1.append(dvr1->last().price);
         highVec1.append(s1->getRawPriceHigh());
         lowVec1.append(s1->getRawPriceLow());
     }
 
     // pDebug(12);
 
-    if (dvr2 && !dvr2->price.isEmpty()) {
+    if (dvr2 && !dvr2->isEmpty()) {
         timeStampVec.append(dvh1->timeStamp.last() + m_timeFrameInSeconds);
-        closeVec2.append(dvr2->price.last());
+        closeVec2.append(dvr2->last().price);
         highVec2.append(s2->getRawPriceHigh());
         lowVec2.append(s2->getRawPriceLow());
     }
@@ -2069,7 +2345,8 @@ void PairTabPage::appendPlotsAndTable(long sid)
     m_ratioMA = getMA(m_ratio, ui->maPeriodSpinBox->value());
     m_ratioStdDev = getStdDevVector(m_ratio, ui->stdDevPeriodSpinBox->value());
     m_ratioPercentFromMA = getPercentFromMA(m_ratio, ui->maPeriodSpinBox->value());
-    m_correlation = getCorrelation(dvh1->close, dvh2->close);
+    m_correlation = getCorrelation(dvh1->close.constData(), dvh1->close.size(),
+                                   dvh2->close.constData(), dvh2->close.size());
 //    m_ratioVolatility = getRatioVolatility(getRatio(dvh1->high,dvh2->high), getRatio(dvh1->low,dvh2->low), ui->volatilityPeriodSpinBox->value());
     m_ratioVolatility = getRatioVolatility(
                 getRatio(getDiff(highVec1, lowVec1), getDiff(highVec2, lowVec2)),
@@ -2093,7 +2370,8 @@ void PairTabPage::appendPlotsAndTable(long sid)
 
     // pDebug("");
 
-    double ts = dvh->timeStamp.last();
+    // the pair plots go by the joined time stamps, not by those of sid
+    double ts = timeStampVec.last();
 
 //    pDebug(QDateTime::fromTime_t((uint)ts));
 
@@ -2277,29 +2555,23 @@ void PairTabPage::appendPlotsAndTable(long sid)
 
 void PairTabPage::plotRatio()
 {
-    Security* s1 = NULL;
-    Security* s2 = NULL;
-    DataVecsHist* dvh1 = NULL;
-    DataVecsHist* dvh2 = NULL;
-
-    s1 = m_securityMap.values().at(0);
-    s2 = m_securityMap.values().at(1);
-
-    dvh1 = s1->getHistData(m_timeFrame);
-    dvh2 = s2->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
+    DataVecsHist* dvh2 = pairData(1);
 
     QCustomPlot* cp = createPlot();
     QVector<double> ts;
 
     if (dvh1->timeStamp.size() < dvh2->timeStamp.size()) {
         int mid = dvh2->timeStamp.size() - dvh1->timeStamp.size();
-        m_ratio = getRatio(dvh1->close, dvh2->close.mid(mid));
-        ts = dvh1->timeStamp;
+        m_ratio = getRatio(dvh1->close.constData(), dvh1->close.size(),
+                           dvh2->close.constData() + mid, dvh2->close.size() - mid);
+        ts = dvh1->timeStamp.toVector();
     }
     else {
         int mid = dvh1->timeStamp.size() - dvh2->timeStamp.size();
-        m_ratio = getRatio(dvh1->close.mid(mid), dvh2->close);
-        ts = dvh2->timeStamp;
+        m_ratio = getRatio(dvh1->close.constData() + mid, dvh1->close.size() - mid,
+                           dvh2->close.constData(), dvh2->close.size());
+        ts = dvh2->timeStamp.toVector();
     }
 
 //qDebug() << m_ratio;
@@ -2337,7 +2609,7 @@ void PairTabPage::plotRatio()
 
 void PairTabPage::plotRatioMA()
 {
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
 
     m_ratioMA = getMA(m_ratio, ui->maPeriodSpinBox->value());
 
@@ -2356,7 +2628,7 @@ void PairTabPage::plotRatioMA()
 
 void PairTabPage::plotRatioStdDev()
 {
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
 
     int period = qMin(ui->stdDevPeriodSpinBox->value(), m_ratio.size());
 
@@ -2377,7 +2649,7 @@ void PairTabPage::plotRatioStdDev()
 
 void PairTabPage::plotRatioPercentFromMean()
 {
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
 
     m_ratioPercentFromMA = getPercentFromMA(m_ratio, ui->maPeriodSpinBox->value());
 
@@ -2397,10 +2669,11 @@ void PairTabPage::plotRatioPercentFromMean()
 void PairTabPage::plotCorrelation()
 {
 //    P_DEBUG;
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
-    DataVecsHist* dvh2 = m_securityMap.values().at(1)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
+    DataVecsHist* dvh2 = pairData(1);
 
-    m_correlation = getCorrelation(dvh1->close, dvh2->close);
+    m_correlation = getCorrelation(dvh1->close.constData(), dvh1->close.size(),
+                                   dvh2->close.constData(), dvh2->close.size());
 
     int diff = dvh1->timeStamp.size() - m_correlation.size();
 
@@ -2428,14 +2701,14 @@ void PairTabPage::plotRatioVolatility()
 {
     pDebug("");
 
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
-    DataVecsHist* dvh2 = m_securityMap.values().at(1)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
+    DataVecsHist* dvh2 = pairData(1);
 
     int period = qMin(ui->volatilityPeriodSpinBox->value(), m_ratio.size());
 
 //    m_ratioVolatility = getRatioVolatility(getRatio(dvh1->high,dvh2->high), getRatio(dvh1->low,dvh2->low), period);
-    QVector<double> d1 = getDiff(dvh1->high,dvh1->low);
-    QVector<double> d2  = getDiff(dvh2->high,dvh2->low);
+    QVector<double> d1 = getDiff(dvh1->high.constData(), dvh1->high.size(), dvh1->low.constData(), dvh1->low.size());
+    QVector<double> d2  = getDiff(dvh2->high.constData(), dvh2->high.size(), dvh2->low.constData(), dvh2->low.size());
     QVector<double> r   = getRatio(d1,d2);
     m_ratioVolatility = getRatioVolatility(r, period);
 
@@ -2455,7 +2728,7 @@ void PairTabPage::plotRatioVolatility()
 
 void PairTabPage::plotRatioRSI()
 {
-    DataVecsHist* dvh1 = m_securityMap.values().at(0)->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
 
     int period = qMin(ui->volatilityPeriodSpinBox->value(), m_ratio.size());
 
@@ -2478,11 +2751,6 @@ void PairTabPage::plotRatioRSI()
 
 void PairTabPage::plotRSISpread()
 {
-    Security* s1 = NULL;
-    Security* s2 = NULL;
-    DataVecsHist* dvh1 = NULL;
-    DataVecsHist* dvh2 = NULL;
-
     for (int i=0;i<m_securityMap.count();++i) {
         long key = m_securityMap.keys().at(i);
         Security* s = m_securityMap.values().at(i);
@@ -2490,16 +2758,13 @@ void PairTabPage::plotRSISpread()
             m_securityMap.remove(key);
     }
 
-    s1 = m_securityMap.values().at(0);
-    s2 = m_securityMap.values().at(1);
-
-    dvh1 = s1->getHistData(m_timeFrame);
-    dvh2 = s2->getHistData(m_timeFrame);
+    DataVecsHist* dvh1 = pairData(0);
+    DataVecsHist* dvh2 = pairData(1);
 
     int period = ui->rsiSpreadSpinBox->value();
 
-    m_pair1RSI = getRSI(dvh1->close, period);
-    m_pair2RSI = getRSI(dvh2->close, period);
+    m_pair1RSI = getRSI(dvh1->close.constData(), dvh1->close.size(), period);
+    m_pair2RSI = getRSI(dvh2->close.constData(), dvh2->close.size(), period);
     m_rsiSpread = getDiff(m_pair1RSI, m_pair2RSI);
 
     int diff = 0;
@@ -2537,11 +2802,8 @@ void PairTabPage::addTableRow()
             tab->removeRow(r);
     }
 
-    Security* s1 = m_securityMap.values().at(0);
-    Security* s2 = m_securityMap.values().at(1);
-
-    DataVecsHist* d1 = s1->getHistData(m_timeFrame);
-    DataVecsHist* d2 = s2->getHistData(m_timeFrame);
+    DataVecsHist* d1 = pairData(0);
+    DataVecsHist* d2 = pairData(1);
 
 //    m_headerLabels << "Pair"
 //            << "Price2"
@@ -3140,6 +3402,21 @@ bool PairTabPage::reqDeletePlotsAndTableRow()
         return false;
     }
 
+    deletePlots();
+
+
+//    QString dStr("subwindowList.size():" + mdi->subWindowList().size());
+//    pDebug(mdi->subWindowList().size());
+
+    m_pair1ShowButtonClickedAlready = false;
+    m_pair2ShowButtonClickedAlready = false;
+
+    return true;
+}
+
+
+void PairTabPage::deletePlots()
+{
     QMdiArea* mdi = ui->mdiArea;
     while (mdi->subWindowList().size()) {
         for (int i=0;i<mdi->subWindowList().size();++i) {
@@ -3153,21 +3430,55 @@ bool PairTabPage::reqDeletePlotsAndTableRow()
                 delete sw;
         }
     }
+    m_customPlotMap.clear();
+}
 
+// Shows the pair in timeFrame if both legs built enough of its bars along
+// with the requested ones; nothing is asked of TWS then. While the pair is
+// shown and they didn't, the combo box goes back to the shown frame.
+bool PairTabPage::switchTimeFrame(TimeFrame timeFrame)
+{
+    if (timeFrame == m_timeFrame || m_securityMap.size() < 2)
+        return false;
+    // not shown yet, the frame is the one of the first request
+    foreach (Security* s, m_securityMap.values()) {
+        if (!s || !s->getHistData(m_timeFrame))
+            return false;
+    }
+
+    foreach (Security* s, m_securityMap.values()) {
+        DataVecsHist* dvh = s->getHistData(timeFrame);
+        const int bars = dvh ? dvh->timeStamp.size() : 0;
+        if (bars < ui->lookbackSpinBox->value()) {
+            m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                        QString("[TIMEFRAME] %1 stays in %2: %3 has %4 %5 bars built locally, the lookback is %6")
+                        .arg(m_tabSymbol).arg(ui->timeFrameComboBox->itemText(m_timeFrame))
+                        .arg(QString(s->contract()->symbol)).arg(bars)
+                        .arg(ui->timeFrameComboBox->itemText(timeFrame)).arg(ui->lookbackSpinBox->value()));
+            // back to the shown frame, m_timeFrameString with it
+            ui->timeFrameComboBox->setCurrentIndex(m_timeFrame);
+            return false;
+        }
+    }
 
-//    QString dStr("subwindowList.size():" + mdi->subWindowList().size());
-//    pDebug(mdi->subWindowList().size());
+    deletePlots();
+    m_timeFrame = timeFrame;
+    m_timeFrameInSeconds = Security::timeFrameSeconds(timeFrame);
 
-    m_pair1ShowButtonClickedAlready = false;
-    m_pair2ShowButtonClickedAlready = false;
+    foreach (long sid, m_securityMap.keys())
+        showPlot(sid);
+    plotPair();
 
+    m_mainWindow->getLogDialog()->getUi()->logPlainTextEdit->appendPlainText(
+                QString("[TIMEFRAME] %1 now in %2 bars built locally").arg(m_tabSymbol).arg(m_timeFrameString));
     return true;
 }
 
-
 void PairTabPage::on_timeFrameComboBox_currentIndexChanged(const QString &arg1)
 {
     m_timeFrameString = arg1;
+    if (!m_readingSettings)
+        switchTimeFrame((TimeFrame)ui->timeFrameComboBox->currentIndex());
 }
 
 void PairTabPage::onCustomPlotDoubleClick(QCPAbstractPlottable* plotable, QMouseEvent* event)
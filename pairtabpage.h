@@ -2,14 +2,16 @@
 #define PAIRTABPAGE_H
 
 #include "ibticktype.h"
+#include "ibticksubscriber.h"
+#include "ibresponsehandler.h"
 #include "security.h"
+#include "pairjoin.h"
 #include "iborder.h"
 #include "iborderstate.h"
 
 #include <QWidget>
 #include <QVector>
 #include <QMap>
-#include <QMultiMap>
 #include <QList>
 #include <QPair>
 #include <QSettings>
@@ -25,13 +27,12 @@ class PairTabPage;
 class MainWindow;
 }
 
-class PairTabPage : public QWidget
+class PairTabPage : public QWidget, public IBTickSubscriber, public IBResponseHandler
 {
     Q_OBJECT
 
 public:
     static int PairTabPageCount;
-    static QMultiMap<long, Security*> RawDataMap;
     static bool DontClickShowButtons;
 
 public:
@@ -72,6 +73,21 @@ public:
 
     void appendPlotsAndTable(long sid);
 
+    // requests the bars missed since lostAt as new bar data after a reconnect
+    void backfillBars(uint lostAt);
+
+    // IBTickSubscriber, registered for the realtime tickerIds of both legs
+    void onTickPrice(long tickerId, TickType field, double price, int canAutoExecute);
+
+    // IBResponseHandler, passed with every reqHistoricalData(),
+    // reqContractDetails() and reqRealTimeBars() this page makes
+    void onHistoricalBars(long reqId, const IBHistoricalBars & bars);
+    void onContractDetails(int reqId, const ContractDetails & contractDetails);
+    void onContractDetailsEnd(int reqId);
+    void onRealtimeBar(long reqId, long time, double open, double high, double low, double close,
+                       long volume, double wap, int count);
+    void onRequestError(long reqId, int errorCode, const QByteArray & errorMsg);
+
 
     QMap<long, Security *> getSecurityMap() const;
 
@@ -79,6 +95,15 @@ public:
     void setPairTabPageId(int pairTabPageId);
 
     bool isTrading(Security *s);
+    void fallBackFromRealTimeBars();
+
+    // bars of the time frame are aggregated from 5 sec realtime bars instead
+    // of being built from ticks and polled with reqHistoricalData(), until a
+    // realtime bar stream of the page fails
+    bool useRealTimeBars() const;
+    // the time frame TWS sends the new bars of s in, the base one once the
+    // others are built from it
+    TimeFrame barTimeFrame(Security* s) const;
 
 
     void setDontClickShowButtons(bool dontClickShowButtons);
@@ -92,10 +117,6 @@ public:
 
     int getNumStdDevLayerTriggersActivated() const;
 
-public slots:
-    void onHistoricalData(long reqId, const QByteArray& date, double open, double high,
-        double low, double close, int volume, int barCount, double WAP, int hasGaps);
-
 private slots:
 //    void on_pair1SymbolLineEdit_textEdited(const QString &arg1);
 //    void on_pair2SymbolLineEdit_textEdited(const QString &arg1);
@@ -115,8 +136,6 @@ private slots:
 
 
     void onSingleShotTimer();
-    void onContractDetails(int reqId, const ContractDetails & contractDetails);
-    void onContractDetailsEnd(int reqId);
     void onTradeEntryNumStdDevLayersChanged(int num);
     void onWaitCheckBoxStateChanged(int state);
     void onTrailCheckBoxStateChanged(int state);
@@ -216,6 +235,13 @@ private:
     int                                     m_pairTabPageId;
     bool                                    m_exitingOrder;
     bool                                    m_placingOrder;
+    bool                                    m_realTimeBars;
+    bool                                    m_realTimeBarsFailed;
+    int                                     m_mktDepthRows;
+    QString                                 m_barStoreDir;
+    bool                                    m_multiTimeFrame;
+    QString                                 m_tickJournalDir;
+    PairJoin                                m_pairJoin;
 
     struct GraphInfo
     {
@@ -245,7 +271,7 @@ private:
         SCATTER
     };
 
-    void reqHistoricalData(long tickerId, QDateTime dt=QDateTime::currentDateTime());
+    void reqHistoricalData(long tickerId, QDateTime dt=QDateTime::currentDateTime(), uint backfillSecs=0);
     void placeOrder(TriggerType triggerType, bool reverse=false);
     void showPlot(long tickerId);
     void plotRatio();
@@ -265,6 +291,13 @@ private:
     QCustomPlot* createPlot();
     QCPGraph* addGraph(QCustomPlot* cp, QVector<double> x, QVector<double> y, QColor penColor=QColor(Qt::blue), bool useBrush=true);
     bool reqDeletePlotsAndTableRow();
+    void deletePlots();
+    void plotPair();
+    DataVecsHist* pairData(int leg);
+    bool switchTimeFrame(TimeFrame timeFrame);
+    void releaseSubscriptions(Security* s);
+    int  barCapacity() const;
+    uint loadStoredBars(Security* s, const QByteArray & durationStr);
     void removeTableRow();
 };
 
@@ -1,13 +1,27 @@
 #include "security.h"
 #include "helpers.h"
 #include "pairtabpage.h"
+#include "barstore.h"
 #include <QCoreApplication>
 
+#include <algorithm>
+#include <cstring>
+
 Security::Security(const long &tickerId, QObject *parent)
     : QObject(parent)
     , m_historicalTickerId(tickerId)
+    , m_realTimeTickerId(0)
+    , m_realTimeBarsTickerId(0)
+    , m_mktDepthTickerId(0)
+    , m_hasPendingBar(false)
+    , m_hasTickBar(false)
+    , m_tickBuiltFrom(0)
     , m_histDataRequested(false)
     , m_lastBarsTimeStamp(0)
+    , m_barCapacity(DataVecsHist::DefaultCapacity)
+    , m_baseTimeFrame(RAW)
+    , m_baseSecs(0)
+    , m_frameMinBars(0)
     , m_pairTabPage(qobject_cast<PairTabPage*>(parent))
     , m_rawPriceHigh(0)
     , m_rawPriceLow(9999999)
@@ -15,12 +29,15 @@ Security::Security(const long &tickerId, QObject *parent)
 //    , m_fillDataHandled(false)
 {
 //    qDebug() << "[DEBUG-Security] tickerId:" << tickerId;
-    m_rawDataMap[RAW] = new DataVecsRaw;
 }
 
 Security::~Security()
 {
     qDeleteAll(m_dataMap);
+    qDeleteAll(m_newBarDataMap);
+    qDeleteAll(m_moreBarsDataMap);
+    foreach (BarStore* store, m_barStoreMap)
+        BarStore::release(store);
 }
 
 void Security::appendHistData(TimeFrame timeFrame, double timeStamp, double open, double high, double low, double close, int volume, int barCount, double wap, int hasGaps)
@@ -29,21 +46,13 @@ void Security::appendHistData(TimeFrame timeFrame, double timeStamp, double open
 
     DataVecsHist* dvh;
     if (!m_dataMap.contains(timeFrame)) {
-        dvh = new DataVecsHist;
+        dvh = new DataVecsHist(m_barCapacity);
         m_dataMap[timeFrame] = dvh;
     }
     else
         dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
 
-    dvh->timeStamp.append(timeStamp);
-    dvh->open.append(open);
-    dvh->high.append(high);
-    dvh->low.append(low);
-    dvh->close.append(close);
-    dvh->volume.append((uint)volume);
-    dvh->barCount.append((uint)barCount);
-    dvh->wap.append(wap);
-    dvh->hasGaps.append((bool)hasGaps);
+    dvh->append(timeStamp, open, high, low, close, (uint)volume, (uint)barCount, wap, (bool)hasGaps);
 
     m_lastBarsTimeStamp = timeStamp;
 }
@@ -52,77 +61,504 @@ void Security::appendNewBarData(TimeFrame timeFrame, double timeStamp, double op
 {
     DataVecsNewBar* dvn;
     if (!m_newBarDataMap.contains(timeFrame)) {
-        dvn = new DataVecsNewBar;
+        dvn = new DataVecsNewBar(m_barCapacity);
         m_newBarDataMap[timeFrame] = dvn;
     }
     else
         dvn = m_newBarDataMap.value(timeFrame);
 
-    dvn->timeStamp.append(timeStamp);
-    dvn->open.append(open);
-    dvn->high.append(high);
-    dvn->low.append(low);
-    dvn->close.append(close);
-    dvn->volume.append((uint)volume);
-    dvn->barCount.append((uint)barCount);
-    dvn->wap.append(wap);
-    dvn->hasGaps.append((bool)hasGaps);
-
-    m_lastBarsTimeStamp = timeStamp;
+    dvn->append(timeStamp, open, high, low, close, (uint)volume, (uint)barCount, wap, (bool)hasGaps);
 }
 
 void Security::appendMoreBarData(TimeFrame timeFrame, double timeStamp, double open, double high, double low, double close, int volume, int barCount, double wap, int hasGaps)
 {
     DataVecsMoreHist* dvmh;
     if (!m_moreBarsDataMap.contains(timeFrame)) {
-        dvmh = new DataVecsMoreHist;
+        dvmh = new DataVecsMoreHist(m_barCapacity);
         m_moreBarsDataMap[timeFrame] = dvmh;
     }
     else
         dvmh = m_moreBarsDataMap.value(timeFrame);
-    dvmh->timeStamp += timeStamp;
-    dvmh->open += open;
-    dvmh->high += high;
-    dvmh->low += low;
-    dvmh->close += close;
-    dvmh->volume += (uint)volume;
-    dvmh->barCount += (uint)barCount;
-    dvmh->wap += wap;
-    dvmh->hasGaps += (bool)hasGaps;
+
+    dvmh->append(timeStamp, open, high, low, close, (uint)volume, (uint)barCount, wap, (bool)hasGaps);
 
 }
 
-void Security::appendRawPrice(const double &price)
+void DataVecsHist::append(double timeStamp, double open, double high, double low, double close,
+                          uint volume, uint barCount, double wap, bool hasGaps)
+{
+    this->timeStamp.append(timeStamp);
+    this->open.append(open);
+    this->high.append(high);
+    this->low.append(low);
+    this->close.append(close);
+    this->volume.append(volume);
+    this->barCount.append(barCount);
+    this->wap.append(wap);
+    this->hasGaps.append(hasGaps);
+}
+
+// whole columns of a historical data response at once
+void DataVecsHist::append(const IBHistoricalBars &bars, int from)
+{
+    const int n = bars.size() - from;
+    if (n <= 0)
+        return;
+    timeStamp.append(bars.timeStamp.constData() + from, n);
+    open.append(bars.open.constData() + from, n);
+    high.append(bars.high.constData() + from, n);
+    low.append(bars.low.constData() + from, n);
+    close.append(bars.close.constData() + from, n);
+    volume.append(bars.volume.constData() + from, n);
+    barCount.append(bars.barCount.constData() + from, n);
+    wap.append(bars.wap.constData() + from, n);
+    hasGaps.append(bars.hasGaps.constData() + from, n);
+}
+
+void DataVecsHist::append(const DataVecsHist &bars, int i)
+{
+    append(bars.timeStamp.at(i), bars.open.at(i), bars.high.at(i), bars.low.at(i), bars.close.at(i),
+           bars.volume.at(i), bars.barCount.at(i), bars.wap.at(i), bars.hasGaps.at(i));
+}
+
+void DataVecsHist::merge(const DataVecsHist &bars, int n)
+{
+    if (n <= 0)
+        return;
+
+    // the bars from the first one of bars on go in again behind it
+    int from = size();
+    while (from > 0 && timeStamp.at(from - 1) >= bars.timeStamp.at(0))
+        --from;
+    DataVecsHist tail(size() - from);
+    for (int j = from; j < size(); ++j)
+        tail.append(*this, j);
+    removeLast(size() - from);
+
+    int i = 0;
+    int j = 0;
+    while (i < n || j < tail.size()) {
+        if (j == tail.size() || (i < n && bars.timeStamp.at(i) <= tail.timeStamp.at(j))) {
+            if (j < tail.size() && tail.timeStamp.at(j) == bars.timeStamp.at(i))
+                ++j;
+            append(bars, i++);
+        }
+        else
+            append(tail, j++);
+    }
+}
+
+void DataVecsHist::removeFirst(int n)
+{
+    timeStamp.removeFirst(n);
+    open.removeFirst(n);
+    high.removeFirst(n);
+    low.removeFirst(n);
+    close.removeFirst(n);
+    volume.removeFirst(n);
+    barCount.removeFirst(n);
+    wap.removeFirst(n);
+    hasGaps.removeFirst(n);
+}
+
+void DataVecsHist::removeLast(int n)
+{
+    timeStamp.removeLast(n);
+    open.removeLast(n);
+    high.removeLast(n);
+    low.removeLast(n);
+    close.removeLast(n);
+    volume.removeLast(n);
+    barCount.removeLast(n);
+    wap.removeLast(n);
+    hasGaps.removeLast(n);
+}
+
+void DataVecsHist::clear()
+{
+    removeFirst(size());
+}
+
+void Security::appendHistData(TimeFrame timeFrame, const IBHistoricalBars &bars)
+{
+    DataVecsHist* dvh;
+    if (!m_dataMap.contains(timeFrame)) {
+        dvh = new DataVecsHist(m_barCapacity);
+        m_dataMap[timeFrame] = dvh;
+    }
+    else
+        dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+
+    // bars loaded from the store may overlap the response
+    int from = 0;
+    if (!dvh->timeStamp.isEmpty()) {
+        while (from < bars.size() && bars.timeStamp.at(from) <= dvh->timeStamp.last())
+            ++from;
+    }
+    dvh->append(bars, from);
+
+    if (!dvh->timeStamp.isEmpty())
+        m_lastBarsTimeStamp = dvh->timeStamp.last();
+    barsAppended(timeFrame);
+}
+
+void Security::appendNewBarData(TimeFrame timeFrame, const IBHistoricalBars &bars)
+{
+    DataVecsNewBar* dvn;
+    if (!m_newBarDataMap.contains(timeFrame)) {
+        dvn = new DataVecsNewBar(m_barCapacity);
+        m_newBarDataMap[timeFrame] = dvn;
+    }
+    else
+        dvn = m_newBarDataMap.value(timeFrame);
+
+    dvn->append(bars);
+}
+
+void Security::appendMoreBarData(TimeFrame timeFrame, const IBHistoricalBars &bars)
 {
-    DataVecsRaw* dvr = m_rawDataMap.value(RAW);
-    dvr->price.append(price);
-//    QString tsString(QDateTime::currentDateTime().toString("yyMMdd/hh:mm:ss"));
+    DataVecsMoreHist* dvmh;
+    if (!m_moreBarsDataMap.contains(timeFrame)) {
+        dvmh = new DataVecsMoreHist(m_barCapacity);
+        m_moreBarsDataMap[timeFrame] = dvmh;
+    }
+    else
+        dvmh = m_moreBarsDataMap.value(timeFrame);
 
-//    qDebug() << "[DEBUG" << __func__ << "] tsString" << tsString;
+    dvmh->append(bars);
+}
 
-    dvr->timeStamp.append((double)QDateTime::currentDateTime().toTime_t());
-    dvr->size.append(-1);
+void Security::appendRawPrice(const double &price)
+{
+    const TickRecord & tick = m_ticks.append(price, LAST);
+    const uint now = (uint)(tick.wallNsecs / 1000000000);
 
     if (price > m_rawPriceHigh)
         m_rawPriceHigh = price;
     if (price < m_rawPriceLow)
         m_rawPriceLow = price;
+
+    const uint tfSecs = m_baseSecs ? m_baseSecs : (m_pairTabPage ? m_pairTabPage->getTimeFrameInSeconds() : 0);
+    if (!tfSecs)
+        return;
+    const double bucket = (double)(now - now % tfSecs);
+
+    if (m_hasTickBar && bucket > m_tickBar.timeStamp) {
+        // the boundary passed before the timer did, the bar waits for it
+        m_closedTickBars.append(m_tickBar);
+        m_hasTickBar = false;
+    }
+
+    if (!m_hasTickBar) {
+        m_tickBar.timeStamp = bucket;
+        m_tickBar.open = m_tickBar.high = m_tickBar.low = price;
+        m_tickBar.volume = 0;
+        m_tickBar.tickCount = 0;
+        m_tickBar.priceVolume = 0;
+        m_hasTickBar = true;
+    }
+    else if (price > m_tickBar.high)
+        m_tickBar.high = price;
+    else if (price < m_tickBar.low)
+        m_tickBar.low = price;
+
+    m_tickBar.close = price;
+    ++m_tickBar.tickCount;
 }
 
-void Security::appendRawSize(const int &size)
+bool Security::appendRealTimeBar(TimeFrame timeFrame, uint tfSecs, long time, double open, double high, double low, double close,
+                                 long volume, double wap, int count)
 {
-    DataVecsRaw* dvr = m_rawDataMap.value(RAW);
-    if (dvr->size.size() > 0) {
-        if (dvr->size.last() == -1) {
-            dvr->size[dvr->size.size()-1] = size;
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (!dvh || !tfSecs)
+        return false;
+
+    const double bucket = (double)(time - time % tfSecs);
+    bool completed = false;
+
+    if (m_hasPendingBar && bucket > m_pendingBar.timeStamp)
+        completed = flushPendingBar(timeFrame);
+
+    if (!m_hasPendingBar) {
+        if (bucket < m_lastBarsTimeStamp)
+            return completed;
+
+        if (bucket == m_lastBarsTimeStamp && !dvh->timeStamp.isEmpty()) {
+            // the last history bar is the one still being built, go on from it
+            m_pendingBar.timeStamp = dvh->timeStamp.takeLast();
+            m_pendingBar.open = dvh->open.takeLast();
+            m_pendingBar.high = dvh->high.takeLast();
+            m_pendingBar.low = dvh->low.takeLast();
+            m_pendingBar.close = dvh->close.takeLast();
+            m_pendingBar.volume = dvh->volume.takeLast();
+            m_pendingBar.barCount = dvh->barCount.takeLast();
+            m_pendingBar.wapVolume = dvh->wap.takeLast() * m_pendingBar.volume;
+            m_pendingBar.hasGaps = dvh->hasGaps.takeLast();
+            m_lastBarsTimeStamp = dvh->timeStamp.isEmpty() ? 0 : dvh->timeStamp.last();
         }
         else {
-//qDebug() << "[DEBUG-appendRawSize] duplicate size data for a single price datum";
+            m_pendingBar.timeStamp = bucket;
+            m_pendingBar.open = open;
+            m_pendingBar.high = high;
+            m_pendingBar.low = low;
+            m_pendingBar.close = close;
+            m_pendingBar.volume = 0;
+            m_pendingBar.barCount = 0;
+            m_pendingBar.wapVolume = 0;
+            m_pendingBar.hasGaps = false;
         }
+        m_hasPendingBar = true;
+    }
+
+    if (high > m_pendingBar.high)
+        m_pendingBar.high = high;
+    if (low < m_pendingBar.low)
+        m_pendingBar.low = low;
+    m_pendingBar.close = close;
+    m_pendingBar.volume += (uint)volume;
+    m_pendingBar.barCount += (uint)count;
+    m_pendingBar.wapVolume += wap * volume;
+
+    // time is the start of the 5 sec bar
+    if (time + 5 >= bucket + tfSecs)
+        completed = flushPendingBar(timeFrame) || completed;
+
+    return completed;
+}
+
+bool Security::flushPendingBar(TimeFrame timeFrame)
+{
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    const PendingBar & b = m_pendingBar;
+    m_hasPendingBar = false;
+
+    // a backfill may have brought this bar in already
+    if (b.timeStamp <= m_lastBarsTimeStamp && !dvh->timeStamp.isEmpty())
+        return false;
+
+    dvh->append(b.timeStamp, b.open, b.high, b.low, b.close, b.volume, b.barCount,
+                b.volume ? b.wapVolume / b.volume : b.close, b.hasGaps);
+
+    m_lastBarsTimeStamp = b.timeStamp;
+    barsAppended(timeFrame);
+    return true;
+}
+
+void Security::barsAppended(TimeFrame timeFrame)
+{
+    // the ticks of a closed bar are on disk with it
+    m_ticks.flush();
+    storeBars(timeFrame);
+    rollUp(timeFrame);
+}
+
+// the hist bars that closed since the last stored one
+void Security::storeBars(TimeFrame timeFrame)
+{
+    BarStore* store = m_barStoreMap.value(timeFrame);
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (!store || !dvh)
+        return;
+
+    const double last = store->lastTimeStamp();
+    const double closedBefore = (double)QDateTime::currentDateTime().toTime_t() - store->barSecs();
+
+    int i = dvh->timeStamp.size();
+    while (i > 0 && dvh->timeStamp.at(i - 1) > last)
+        --i;
+    for (; i < dvh->timeStamp.size() && dvh->timeStamp.at(i) <= closedBefore; ++i) {
+        store->append(dvh->timeStamp.at(i), dvh->open.at(i), dvh->high.at(i), dvh->low.at(i), dvh->close.at(i),
+                      dvh->volume.at(i), dvh->barCount.at(i), dvh->wap.at(i), dvh->hasGaps.at(i));
+    }
+}
+
+uint Security::timeFrameSeconds(TimeFrame timeFrame)
+{
+    static const uint SECONDS[] = { 1, 5, 15, 30, 60, 120, 180, 300, 900, 1800, 3600, 86400, 0 };
+    return SECONDS[timeFrame];
+}
+
+void Security::setTimeFrames(TimeFrame base, const QList<TimeFrame> &derived, int minBars)
+{
+    m_baseTimeFrame = base;
+    m_baseSecs = timeFrameSeconds(base);
+    m_frameMinBars = minBars;
+    m_frameMap.clear();
+    if (!m_baseSecs || base == DAY_1)
+        return;
+
+    // smallest first, the candidates for a parent are in the map before it
+    QList<TimeFrame> timeFrames = derived;
+    std::sort(timeFrames.begin(), timeFrames.end());
+
+    foreach (TimeFrame timeFrame, timeFrames) {
+        const uint secs = timeFrameSeconds(timeFrame);
+        if (timeFrame >= DAY_1 || secs <= m_baseSecs || secs % m_baseSecs || m_frameMap.contains(timeFrame))
+            continue;
+
+        FrameNode node;
+        node.parent = base;
+        node.secs = secs;
+        node.folded = 0;
+        node.hasBar = false;
+        node.partial = false;
+        for (QMap<TimeFrame, FrameNode>::const_iterator it = m_frameMap.constBegin(); it != m_frameMap.constEnd(); ++it) {
+            if (secs % it.value().secs == 0)
+                node.parent = it.key();
+        }
+        m_frameMap[timeFrame] = node;
+    }
+
+    // from the bars base has already
+    rollUp(base);
+}
+
+// folds the closed bars of timeFrame into the frames built from it, and
+// theirs into the next ones
+void Security::rollUp(TimeFrame timeFrame)
+{
+    const DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (m_frameMap.isEmpty() || !dvh || dvh->timeStamp.isEmpty())
+        return;
+
+    const uint secs = timeFrameSeconds(timeFrame);
+    const double closedBefore = (double)QDateTime::currentDateTime().toTime_t() - secs;
+
+    QList<TimeFrame> grown;
+    for (QMap<TimeFrame, FrameNode>::iterator it = m_frameMap.begin(); it != m_frameMap.end(); ++it) {
+        FrameNode & node = it.value();
+        if (node.parent != timeFrame)
+            continue;
+
+        int i = dvh->timeStamp.size();
+        while (i > 0 && dvh->timeStamp.at(i - 1) > node.folded)
+            --i;
+        bool published = false;
+        for (; i < dvh->timeStamp.size() && dvh->timeStamp.at(i) <= closedBefore; ++i)
+            published = foldBar(it.key(), node, secs, dvh, i) || published;
+        if (published)
+            grown.append(it.key());
+    }
+
+    foreach (TimeFrame derived, grown)
+        rollUp(derived);
+}
+
+bool Security::foldBar(TimeFrame timeFrame, FrameNode &node, uint parentSecs, const DataVecsHist *parent, int i)
+{
+    const double timeStamp = parent->timeStamp.at(i);
+    const uint t = (uint)timeStamp;
+    const double bucket = (double)(t - t % node.secs);
+    bool published = false;
+
+    if (node.hasBar && bucket > node.bar.timeStamp)
+        published = publishFrameBar(timeFrame, node);
+
+    if (!node.hasBar) {
+        node.partial = node.folded == 0 && timeStamp > bucket;
+        node.bar.timeStamp = bucket;
+        node.bar.open = parent->open.at(i);
+        node.bar.high = parent->high.at(i);
+        node.bar.low = parent->low.at(i);
+        node.bar.volume = 0;
+        node.bar.tickCount = 0;
+        node.bar.priceVolume = 0;
+        node.hasBar = true;
     }
     else {
-//qDebug() << "[ERROR-appendRawSize] size is coming in before price";
+        node.bar.high = qMax(node.bar.high, parent->high.at(i));
+        node.bar.low = qMin(node.bar.low, parent->low.at(i));
     }
+    node.bar.close = parent->close.at(i);
+    node.bar.volume += parent->volume.at(i);
+    node.bar.tickCount += parent->barCount.at(i);
+    node.bar.priceVolume += parent->wap.at(i) * parent->volume.at(i);
+    node.folded = timeStamp;
+
+    // the last parent bar of the bucket
+    if (timeStamp + parentSecs >= bucket + node.secs)
+        published = publishFrameBar(timeFrame, node) || published;
+
+    return published;
+}
+
+bool Security::publishFrameBar(TimeFrame timeFrame, FrameNode &node)
+{
+    node.hasBar = false;
+    if (node.partial)
+        return false;
+
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (!dvh) {
+        // the base bars kept never fill more than their span of it
+        const DataVecsHist* base = (DataVecsHist*)m_dataMap.value(m_baseTimeFrame);
+        const int baseBars = base ? base->capacity() : m_barCapacity;
+        dvh = new DataVecsHist(qMax(baseBars / (int)(node.secs / m_baseSecs), m_frameMinBars));
+        m_dataMap[timeFrame] = dvh;
+    }
+
+    const TickBar & b = node.bar;
+    if (!dvh->timeStamp.isEmpty() && b.timeStamp <= dvh->timeStamp.last())
+        return false;
+
+    dvh->append(b.timeStamp, b.open, b.high, b.low, b.close, b.volume, b.tickCount,
+                b.volume ? b.priceVolume / b.volume : b.close, false);
+    storeBars(timeFrame);
+    return true;
+}
+
+int Security::openBarStore(TimeFrame timeFrame, const QString &path, uint tfSecs, int maxBars)
+{
+    BarStore* store = m_barStoreMap.value(timeFrame);
+    if (!store) {
+        store = BarStore::acquire(path, tfSecs);
+        if (!store) {
+            qWarning() << "[BARSTORE] cannot use" << path;
+            return -1;
+        }
+        m_barStoreMap[timeFrame] = store;
+    }
+
+    // no empty hist data, the pages take that for a response
+    const int n = qMin(store->size(), qMax(0, maxBars));
+    if (!n || m_dataMap.contains(timeFrame))
+        return 0;
+
+    DataVecsHist* dvh = new DataVecsHist(m_barCapacity);
+    m_dataMap[timeFrame] = dvh;
+
+    // straight out of the mapping, a column at a time
+    const int first = store->size() - n;
+    dvh->timeStamp.append(store->timeStamps() + first, n);
+    dvh->open.append(store->opens() + first, n);
+    dvh->high.append(store->highs() + first, n);
+    dvh->low.append(store->lows() + first, n);
+    dvh->close.append(store->closes() + first, n);
+    dvh->volume.append(store->volumes() + first, n);
+    dvh->barCount.append(store->barCounts() + first, n);
+    dvh->wap.append(store->waps() + first, n);
+    for (int i = 0; i < n; ++i)
+        dvh->hasGaps.append(store->hasGaps()[first + i]);
+
+    m_lastBarsTimeStamp = dvh->timeStamp.last();
+    return n;
+}
+
+void Security::appendRawSize(const int &size)
+{
+    // a size before any price, or a second one for a price, is dropped
+    if (!m_ticks.setLastSize(size))
+        return;
+
+    if (m_hasTickBar && size > 0) {
+        m_tickBar.volume += size;
+        m_tickBar.priceVolume += size * m_ticks.last().price;
+    }
+}
+
+bool Security::openTickJournal(const QString &path)
+{
+    return m_ticks.open(path, m_contractDetails.summary.conId);
 }
 
 //void Security::handleFillData(TimeFrame timeFrame)
@@ -240,84 +676,46 @@ void Security::appendRawSize(const int &size)
 
 void Security::handleNewBarData(TimeFrame timeFrame)
 {
-    static bool isFirstTime = true;
-
     DataVecsNewBar* dvn = m_newBarDataMap.value(timeFrame);
 
 //    qDebug() << "[DEBUG-handleNewBarData] numNewBars:" << dvn->timeStamp.size();
 
     DataVecsHist*   dvh =(DataVecsHist*) m_dataMap.value(timeFrame);
+    if (!dvn || !dvh)
+        return;
+
+    // missing bars go in, the ones there are replaced, whether TWS or the
+    // ticks built them
+    const double closedBefore = (double)QDateTime::currentDateTime().toTime_t() - timeFrameSeconds(timeFrame);
+    int n = dvn->size();
+    while (n > 0 && dvn->timeStamp.at(n - 1) > closedBefore)
+        --n;
+    dvh->merge(*dvn, n);
+
+    if (n) {
+        const double merged = dvn->timeStamp.at(n - 1);
+
+        // the bars after the last one of TWS are still the ticks' own
+        if (m_tickBuiltFrom && merged >= m_tickBuiltFrom) {
+            int j = dvh->timeStamp.size();
+            while (j > 0 && dvh->timeStamp.at(j - 1) > merged)
+                --j;
+            m_tickBuiltFrom = j < dvh->timeStamp.size() ? dvh->timeStamp.at(j) : 0;
+        }
 
-    if (isFirstTime) {
-        dvh->timeStamp.removeLast();
-        m_lastBarsTimeStamp = dvh->timeStamp.last();
-        dvh->open.removeLast();
-        dvh->high.removeLast();
-        dvh->low.removeLast();
-        dvh->close.removeLast();
-        dvh->volume.removeLast();
-        dvh->barCount.removeLast();
-        dvh->wap.removeLast();
-        dvh->hasGaps.removeLast();
+        m_lastBarsTimeStamp = qMax(m_lastBarsTimeStamp, dvh->timeStamp.last());
     }
 
-    QDateTime lbdt = QDateTime::fromTime_t(m_lastBarsTimeStamp);
-
-    for (int i=0;i<dvn->timeStamp.size();++i) {
-
-        QDateTime dt = QDateTime::fromTime_t(dvn->timeStamp.at(i));
+    // kept for the next response
+    dvn->clear();
 
-        if (dt > lbdt) {
-
-//qDebug() << "[DEBUG-Security::handleNewBarData] appending timeStamp:" << (uint)dvn->timeStamp.at(i);
-
-            dvh->timeStamp.append(dt.toTime_t());
-            dvh->open.append(dvn->open.at(i));
-            dvh->high.append(dvn->high.at(i));
-            dvh->low.append(dvn->low.at(i));
-            dvh->close.append(dvn->close.at(i));
-            dvh->volume.append(dvn->volume.at(i));
-            dvh->barCount.append(dvn->barCount.at(i));
-            dvh->wap.append(dvn->wap.at(i));
-            dvh->hasGaps.append(dvn->hasGaps.at(i));
-
-            m_lastBarsTimeStamp = (double)dt.toTime_t();
-
-//    qDebug() << "[DEBUG-" << __func__ << "] m_lastBarsTimeStamp:" << (uint)m_lastBarsTimeStamp;
-        }
-    }
-
-    m_newBarDataMap.remove(timeFrame);
-    isFirstTime = false;
+    barsAppended(timeFrame);
 
 //qDebug() << "[DEBUG-handleNewBarData] leaving";
 }
 
 
 
-void Security::fixHistDataSize(TimeFrame timeFrame, int size)
-{
-    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
-
-//    qDebug() << "[DEBUG-fixHistDataSize] dvh.size:" << dvh->timeStamp.size();
-//    qDebug() << "[DEBUG-fixHistDataSize] size - 250:" << n;
-
-    for (int i = 0;i<size;++i) {
-//        qDebug() << "[DEBUG-fixHistDataSize] i:" << i;
-        dvh->timeStamp.removeFirst();
-        dvh->open.removeFirst();
-        dvh->high.removeFirst();
-        dvh->low.removeFirst();
-        dvh->close.removeFirst();
-        dvh->volume.removeFirst();
-        dvh->barCount.removeFirst();
-        dvh->wap.removeFirst();
-        dvh->hasGaps.removeFirst();
-    }
-
-//    qDebug() << "[DEBUG-fixHistDataSize] size:" << dvh->timeStamp.size();
-}
-
 ContractDetails *Security::getContractDetails()
 {
     return &m_contractDetails;
@@ -361,138 +759,95 @@ void Security::setRealTimeTickerId(long realTimeTickerId)
 }
 
 void Security::handleRawBarData()
-{        
-//    pDebug("");
-//    static bool isFirstRun = true;
-//    static bool isSecondRun = false;
-
-    DataVecsRaw* dvr = m_rawDataMap.values().at(0);
-    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.values().at(0);
-
-    uint firstBarsTimeStamp = (uint)m_lastBarsTimeStamp;
-    uint newBarsTimeStamp = QDateTime::currentDateTime().toTime_t();
-    uint timeFrameInSeconds = m_pairTabPage->getTimeFrameInSeconds();
-    uint diffSeconds = 0;
+{
+    if (m_dataMap.isEmpty())
+        return;
+    const TimeFrame timeFrame = m_baseSecs ? m_baseTimeFrame : m_dataMap.firstKey();
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (!dvh)
+        return;
 
-    for (;newBarsTimeStamp % timeFrameInSeconds != 0;--newBarsTimeStamp) {
-        diffSeconds++;
-    }
+    // the timer may fire a little early, round to the nearest second
+    const uint now = (uint)((QDateTime::currentMSecsSinceEpoch() + 500) / 1000);
+    const uint timeFrameInSeconds = m_baseSecs ? m_baseSecs : m_pairTabPage->getTimeFrameInSeconds();
+    const uint diffSeconds = now % timeFrameInSeconds;
+    const uint newBarsTimeStamp = now - diffSeconds;
 
     if (diffSeconds) {
         m_timer.start((timeFrameInSeconds - diffSeconds) * 1000);
     }
 
-
-
-//    if (isFirstRun) {
-//        QDateTime lastBarsDateTime(QDateTime::fromTime_t((uint)m_lastBarsTimeStamp));
-//        int cnt = 0;
-//        while (lastBarsDateTime < now) {
-//            if (lastBarsDateTime.addSecs(m_pairTabPage->getTimeFrameInSeconds()) < now)
-//                lastBarsDateTime = now.addSecs(m_pairTabPage->getTimeFrameInSeconds());
-//            ++cnt;
-//        }
-
-//        firstTimeStamp = (double)lastBarsDateTime.addSecs(-(m_pairTabPage->getTimeFrameInSeconds() * cnt)).toTime_t();
-//        newBarsTimeStamp = (double)lastBarsDateTime.toTime_t();
-
-//        isFirstRun = false;
-//        isSecondRun = true;
-//    }
-//    else {
-//        if (isSecondRun) {
-//            while (now.toTime_t() % m_pairTabPage->getTimeFrameInSeconds() != 0) {
-//                delay(100);
-//            }
-//            newBarsTimeStamp = now.toTime_t();
-//            firstTimeStamp = newBarsTimeStamp - m_pairTabPage->getTimeFrameInSeconds();
-//        } else {
-//            firstTimeStamp = m_lastBarsTimeStamp;
-//            newBarsTimeStamp = m_lastBarsTimeStamp + m_pairTabPage->getTimeFrameInSeconds();
-//        }
-//    }
-
-// pDebug(QDateTime::fromTime_t((uint)newBarsTimeStamp).toString("hh:mm:ss"));
-
-    if (dvr->timeStamp.isEmpty()) {
-        dvh->close.append(dvh->close.last());
-        dvh->high.append(dvh->high.last());
-        dvh->low.append(dvh->low.last());
-        dvh->open.append(dvh->open.last());
+    // every bar that closed since the last time, flat ones between them
+    foreach (const TickBar & bar, m_closedTickBars) {
+        publishFlatBars(timeFrame, timeFrameInSeconds, bar.timeStamp);
+        publishTickBar(timeFrame, bar);
     }
-    else {
-        double dvrTimeStamp = 0;
-        double open = 0;
-        double high = 0;
-        double low = 999999;
-        double close = 0;
-
-        double price = 0;
-
-        for (int i=0;i<dvr->timeStamp.size();++i) {
-            dvrTimeStamp = dvr->timeStamp.at(i);
-
-//            qDebug() << "[DEBUG-" << __func__ << "] price:" << dvr->price.at(i);
-            if (dvrTimeStamp < firstBarsTimeStamp) {
-                dvr->timeStamp.remove(i);
-                dvr->price.remove(i);
-                continue;
-            }
-            if (dvrTimeStamp < newBarsTimeStamp) {
-                price = dvr->price.at(i);
-                close = price;
-
-                if (open == 0)
-                    open = price;
-
-                if (price > high)
-                    high = price;
-
-                if (price < low)
-                    low = price;
-
-                dvr->price.remove(i);
-                dvr->timeStamp.remove(i);
-            }
-        }
-        if (close != 0) {
-            dvh->open.append(open);
-            dvh->high.append(high);
-            dvh->low.append(low);
-            dvh->close.append(close);
-//            qDebug() << "open:" << open <<  "high:" << high << "low:" << low << "close:" << close;
-        }
-        else {
-            dvh->open.append(dvh->open.last());
-            dvh->high.append(dvh->high.last());
-            dvh->low.append(dvh->low.last());
-            dvh->close.append(dvh->close.last());
-        }
+    m_closedTickBars.clear();
+    if (m_hasTickBar && m_tickBar.timeStamp < newBarsTimeStamp) {
+        publishFlatBars(timeFrame, timeFrameInSeconds, m_tickBar.timeStamp);
+        publishTickBar(timeFrame, m_tickBar);
+        m_hasTickBar = false;
     }
 
-//    qDebug() << "[DEBUG-" << __func__ << "]" << QDateTime::fromTime_t((uint)m_lastBarsTimeStamp);
-//    qDebug() << "[DEBUG-" << __func__ << "] lastBarsTimeStamp:" << QString::number((uint)m_lastBarsTimeStamp) << "newBarsTimeStamp:" << QString::number((uint)newBarsTimeStamp);
-//qDebug() << "[DEBUG-" << __func__ << "] new close:" << dvh->close.last();
+    // no ticks in the bars up to the one that just ended
+    publishFlatBars(timeFrame, timeFrameInSeconds, newBarsTimeStamp);
+    const double lastBucket = (double)(newBarsTimeStamp - timeFrameInSeconds);
+    if (lastBucket > m_lastBarsTimeStamp)
+        publishFlatBar(timeFrame, lastBucket);
+}
 
-    dvh->timeStamp.append(newBarsTimeStamp);
-    m_lastBarsTimeStamp = newBarsTimeStamp;
+// Flat bars for the buckets from the last bar on up to before. They stop
+// at the end of the last bar's day: the night between two sessions is no
+// gap to fill.
+void Security::publishFlatBars(TimeFrame timeFrame, uint secs, double before)
+{
+    if (!m_lastBarsTimeStamp)
+        return;
 
+    const QDate date = QDateTime::fromTime_t((uint)m_lastBarsTimeStamp).date();
+    const double end = qMin(before, (double)QDateTime(date.addDays(1), QTime(0, 0)).toTime_t());
+    for (double t = m_lastBarsTimeStamp + secs; t < end; t += secs)
+        publishFlatBar(timeFrame, t);
+}
 
-//    dvr->price.clear();
-//    dvr->timeStamp.clear();
-    dvr->size.clear();
+void Security::publishFlatBar(TimeFrame timeFrame, double timeStamp)
+{
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    if (!dvh || dvh->close.isEmpty())
+        return;
+
+    TickBar flat;
+    flat.timeStamp = timeStamp;
+    flat.open = flat.high = flat.low = flat.close = dvh->close.last();
+    flat.volume = 0;
+    flat.tickCount = 0;
+    flat.priceVolume = 0;
+    publishTickBar(timeFrame, flat);
+}
 
-//    qApp->exit();
+void Security::publishTickBar(TimeFrame timeFrame, const TickBar &bar)
+{
+    // TWS bars already there win
+    if (bar.timeStamp <= m_lastBarsTimeStamp)
+        return;
+
+    DataVecsHist* dvh = (DataVecsHist*)m_dataMap.value(timeFrame);
+    dvh->append(bar.timeStamp, bar.open, bar.high, bar.low, bar.close, bar.volume, bar.tickCount,
+                bar.volume ? bar.priceVolume / bar.volume : bar.close, false);
+    m_lastBarsTimeStamp = bar.timeStamp;
+    if (!m_tickBuiltFrom)
+        m_tickBuiltFrom = bar.timeStamp;
+    barsAppended(timeFrame);
 }
 
 double Security::getRawPriceHigh() const
 {
-    return m_rawPriceHigh;
+    return m_hasTickBar ? m_tickBar.high : m_rawPriceHigh;
 }
 
 double Security::getRawPriceLow() const
 {
-    return m_rawPriceLow;
+    return m_hasTickBar ? m_tickBar.low : m_rawPriceLow;
 }
 
 
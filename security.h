@@ -5,8 +5,12 @@
 #include "ibcontract.h"
 #include "iborder.h"
 #include "iborderstate.h"
+#include "ibhistoricalbars.h"
+#include "barring.h"
+#include "tickjournal.h"
 #include <QObject>
 #include <QMap>
+#include <QList>
 #include <QByteArray>
 #include <QVector>
 #include <QDateTime>
@@ -30,44 +34,53 @@ enum TimeFrame
 };
 
 
-struct DataVecs {};
-
-struct DataVecsHist : public DataVecs
-{
-    QVector<double> timeStamp;
-    QVector<double> open;
-    QVector<double> high;
-    QVector<double> low;
-    QVector<double> close;
-    QVector<uint>   volume;
-    QVector<uint>   barCount;
-    QVector<double> wap;
-    QVector<bool>   hasGaps;
-};
-\
-struct DataVecsNewBar : public DataVecs
+struct DataVecs
 {
-    QVector<double> timeStamp;
-    QVector<double> open;
-    QVector<double> high;
-    QVector<double> low;
-    QVector<double> close;
-    QVector<uint>   volume;
-    QVector<uint>   barCount;
-    QVector<double> wap;
-    QVector<bool>   hasGaps;
+    virtual ~DataVecs() {}
 };
 
-struct DataVecsMoreHist : public DataVecsHist {};
+// Bars of one time frame, a ring per column; the oldest bars make room
+// once capacity is reached
+struct DataVecsHist : public DataVecs
+{
+    enum { DefaultCapacity = 1024 };
 
+    explicit DataVecsHist(int capacity = DefaultCapacity)
+        : timeStamp(capacity), open(capacity), high(capacity), low(capacity), close(capacity)
+        , volume(capacity), barCount(capacity), wap(capacity), hasGaps(capacity)
+    {
+    }
 
-struct DataVecsRaw : public DataVecs
-{
-    QVector<double> timeStamp;
-    QVector<double> price;
-    QVector<int>    size;
+    BarRing<double> timeStamp;
+    BarRing<double> open;
+    BarRing<double> high;
+    BarRing<double> low;
+    BarRing<double> close;
+    BarRing<uint>   volume;
+    BarRing<uint>   barCount;
+    BarRing<double> wap;
+    BarRing<bool>   hasGaps;
+
+    int  size() const { return timeStamp.size(); }
+    int  capacity() const { return timeStamp.capacity(); }
+
+    void append(double timeStamp, double open, double high, double low, double close,
+                uint volume, uint barCount, double wap, bool hasGaps);
+    // bars of a response, from bar from on
+    void append(const IBHistoricalBars & bars, int from = 0);
+    // bar i of bars
+    void append(const DataVecsHist & bars, int i);
+    // the first n bars of bars in time stamp order, each one replacing a
+    // bar of the same time stamp
+    void merge(const DataVecsHist & bars, int n);
+    void removeFirst(int n);
+    void removeLast(int n = 1);
+    void clear();
 };
 
+typedef DataVecsHist DataVecsNewBar;
+typedef DataVecsHist DataVecsMoreHist;
+
 //#define DataVecsFill DataVecsHist
 
 enum TriggerType
@@ -103,6 +116,7 @@ struct SecurityOrder
 
 
 class PairTabPage;
+class BarStore;
 
 
 
@@ -123,17 +137,25 @@ public:
 
     void appendNewBarData(TimeFrame timeFrame, double timeStamp, double open, double high, double low, double close, int volume, int barCount, double wap, int hasGaps);
     void appendMoreBarData(TimeFrame timeFrame, double timeStamp, double open, double high, double low, double close, int volume, int barCount, double wap, int hasGaps);
+    void appendHistData(TimeFrame timeFrame, const IBHistoricalBars & bars);
+    void appendNewBarData(TimeFrame timeFrame, const IBHistoricalBars & bars);
+    void appendMoreBarData(TimeFrame timeFrame, const IBHistoricalBars & bars);
+    // Ticks of the realtime data, into the tick journal. Each one also goes
+    // into the bar of the time frame it falls in, so closing that bar needs
+    // no pass over them.
     void appendRawPrice(const double & price);
     void appendRawSize(const int & size);
 
-    DataVecsRaw* getRawData()
-    {
-        return m_rawDataMap.value(RAW);
-//        if (m_dataMap.contains(RAW))
-//            return (DataVecsRaw*)m_dataMap.value(RAW);
-//        else
-//            return NULL;
-    }
+    // journals the ticks at path as well, see TickJournal
+    bool openTickJournal(const QString & path);
+
+    // Folds a 5 second realtime bar into the timeFrame bar of tfSecs it
+    // falls in. The bar goes to the hist data once its last 5 seconds or a
+    // bar of a later one came in; returns true when that happened.
+    bool appendRealTimeBar(TimeFrame timeFrame, uint tfSecs, long time, double open, double high, double low, double close,
+                           long volume, double wap, int count);
+
+    TickJournal* getTicks() { return &m_ticks; }
     DataVecsHist* getHistData(TimeFrame timeFrame) { return (DataVecsHist*)m_dataMap.value(timeFrame); }
     DataVecsNewBar* getNewBarData(TimeFrame timeFrame) { return (DataVecsNewBar*)m_dataMap.value(timeFrame); }
 
@@ -143,10 +165,31 @@ public:
 //    void handleFillData(TimeFrame timeFrame);
 //    bool fillDataHandled() const { return m_fillDataHandled; }
 //    void handleRawData(TimeFrame timeFrame);
+    // merges the closed bars of a new bar request, a poll or a backfill,
+    // into the hist data; the bar still being built is the live feed's
     void handleNewBarData(TimeFrame timeFrame);
     QTimer* getTimer() { return &m_timer; }
 
-    void fixHistDataSize(TimeFrame timeFrame, int size);
+    // bars kept per time frame, for the series created from then on
+    int  barCapacity() const { return m_barCapacity; }
+    void setBarCapacity(int capacity) { m_barCapacity = capacity; }
+
+    // Maps the bar store at path for timeFrame and loads its last maxBars
+    // bars as the hist data. Returns how many it loaded, -1 if the store
+    // can't be used. Closed bars are appended to it from then on.
+    int  openBarStore(TimeFrame timeFrame, const QString & path, uint tfSecs, int maxBars);
+
+    // length of a bar of timeFrame, 0 for RAW
+    static uint timeFrameSeconds(TimeFrame timeFrame);
+
+    // Builds the bars of each of derived out of the closed bars of base,
+    // every frame from the largest one below it that divides it, so their
+    // hist data is there without asking TWS. Ticks go into base from then
+    // on. DAY_1 and frames base doesn't divide are left out. A derived
+    // frame keeps the span of the base bars, at least minBars of its own.
+    void setTimeFrames(TimeFrame base, const QList<TimeFrame> & derived, int minBars);
+    bool hasTimeFrames() const { return m_baseSecs != 0; }
+    TimeFrame baseTimeFrame() const { return m_baseTimeFrame; }
 
     ContractDetails* getContractDetails();
     void setContractDetails(const ContractDetails &contractDetails);
@@ -161,8 +204,17 @@ public:
     long getRealTimeTickerId() const;
     void setRealTimeTickerId(long realTimeTickerId);
 
+    long getRealTimeBarsTickerId() const { return m_realTimeBarsTickerId; }
+    void setRealTimeBarsTickerId(long tickerId) { m_realTimeBarsTickerId = tickerId; }
+
+    long getMktDepthTickerId() const { return m_mktDepthTickerId; }
+    void setMktDepthTickerId(long tickerId) { m_mktDepthTickerId = tickerId; }
+
+    // called on the bar boundary, appends the bars the ticks built and flat
+    // ones at the last close for the buckets without ticks
     void handleRawBarData();
 
+    // of the bar being built, or of all ticks before the first one
     double getRawPriceHigh() const;
 
     double getRawPriceLow() const;
@@ -172,16 +224,76 @@ signals:
 public slots:
 
 private:
+    struct PendingBar
+    {
+        double  timeStamp;
+        double  open;
+        double  high;
+        double  low;
+        double  close;
+        uint    volume;
+        uint    barCount;
+        double  wapVolume;      // sum of wap * volume of the 5 sec bars
+        bool    hasGaps;
+    };
+
+    struct TickBar
+    {
+        double  timeStamp;      // start of the bar
+        double  open;
+        double  high;
+        double  low;
+        double  close;
+        uint    volume;
+        uint    tickCount;
+        double  priceVolume;    // sum of price * size
+    };
+
+    // a derived time frame, built from the bars of parent
+    struct FrameNode
+    {
+        TimeFrame   parent;
+        uint        secs;
+        double      folded;     // time stamp of the last parent bar in it
+        TickBar     bar;
+        bool        hasBar;
+        bool        partial;    // the first one, missing its start
+    };
+
+    bool flushPendingBar(TimeFrame timeFrame);
+    void publishTickBar(TimeFrame timeFrame, const TickBar & bar);
+    void publishFlatBar(TimeFrame timeFrame, double timeStamp);
+    void publishFlatBars(TimeFrame timeFrame, uint secs, double before);
+    void barsAppended(TimeFrame timeFrame);
+    void storeBars(TimeFrame timeFrame);
+    void rollUp(TimeFrame timeFrame);
+    bool foldBar(TimeFrame timeFrame, FrameNode & node, uint parentSecs, const DataVecsHist* parent, int i);
+    bool publishFrameBar(TimeFrame timeFrame, FrameNode & node);
+
     long                                m_historicalTickerId;
     long                                m_realTimeTickerId;
+    long                                m_realTimeBarsTickerId;
+    long                                m_mktDepthTickerId;
+    PendingBar                          m_pendingBar;
+    bool                                m_hasPendingBar;
+    TickBar                             m_tickBar;          // being built
+    QList<TickBar>                      m_closedTickBars;   // ended before the timer came
+    bool                                m_hasTickBar;
+    double                              m_tickBuiltFrom;    // first bar built from ticks since the last TWS one, 0 if none
     ContractDetails                     m_contractDetails;
     QMap<TimeFrame, DataVecs*>          m_dataMap;
 //    QMap<TimeFrame, DataVecsFill*>      m_dataFillMap;
     QMap<TimeFrame, DataVecsMoreHist*>  m_moreBarsDataMap;
     QMap<TimeFrame, DataVecsNewBar*>    m_newBarDataMap;
-    QMap<TimeFrame, DataVecsRaw*>       m_rawDataMap;
+    TickJournal                         m_ticks;
+    QMap<TimeFrame, BarStore*>          m_barStoreMap;
     bool                                m_histDataRequested;
     double                              m_lastBarsTimeStamp;
+    int                                 m_barCapacity;
+    TimeFrame                           m_baseTimeFrame;
+    uint                                m_baseSecs;         // 0 until setTimeFrames()
+    int                                 m_frameMinBars;
+    QMap<TimeFrame, FrameNode>          m_frameMap;
 //    bool                                m_gettingRealTimeData;
 //    bool                                m_fillDataHandled;
     QTimer                              m_timer;
@@ -0,0 +1,168 @@
+#include "tickjournal.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QtEndian>
+
+#include <chrono>
+#include <cstring>
+
+static const char    JOURNAL_MAGIC[4] = { 'N', 'K', 'T', 'J' };
+static const quint32 JOURNAL_VERSION = 1;
+static const int     HEADER_SIZE = 16;
+static const int     RECORD_SIZE = 32;
+
+static QElapsedTimer & tickClock()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return clock;
+}
+
+// journals open in this process, each contract's ticks go to one file
+static QSet<QString> & openPaths()
+{
+    static QSet<QString> paths;
+    return paths;
+}
+
+TickJournal::TickJournal(int capacity)
+    : m_ticks(capacity)
+    , m_lastUnwritten(false)
+{
+}
+
+TickJournal::~TickJournal()
+{
+    close();
+}
+
+qint64 TickJournal::monotonicNsecs()
+{
+    return tickClock().nsecsElapsed();
+}
+
+qint64 TickJournal::wallNsecs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool TickJournal::open(const QString &path, long conId)
+{
+    close();
+
+    if (openPaths().contains(path))
+        return false;
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    uchar header[HEADER_SIZE];
+    if (m_file.size() == 0) {
+        memcpy(header, JOURNAL_MAGIC, 4);
+        qToLittleEndian<quint32>(JOURNAL_VERSION, header + 4);
+        qToLittleEndian<qint64>(conId, header + 8);
+        if (m_file.write((const char*)header, HEADER_SIZE) != HEADER_SIZE) {
+            m_file.close();
+            return false;
+        }
+    }
+    else if (m_file.read((char*)header, HEADER_SIZE) != HEADER_SIZE
+             || memcmp(header, JOURNAL_MAGIC, 4) != 0
+             || qFromLittleEndian<quint32>(header + 4) != JOURNAL_VERSION
+             || qFromLittleEndian<qint64>(header + 8) != conId) {
+        m_file.close();
+        return false;
+    }
+
+    // a record cut short by a crash is dropped
+    const qint64 records = (m_file.size() - HEADER_SIZE) / RECORD_SIZE;
+    const qint64 end = HEADER_SIZE + records * RECORD_SIZE;
+    if ((m_file.size() != end && !m_file.resize(end)) || !m_file.seek(end)) {
+        m_file.close();
+        return false;
+    }
+
+    openPaths().insert(path);
+    return true;
+}
+
+void TickJournal::close()
+{
+    if (!m_file.isOpen())
+        return;
+
+    if (m_lastUnwritten)
+        writeLast();
+    openPaths().remove(m_file.fileName());
+    m_file.close();
+}
+
+void TickJournal::flush()
+{
+    if (m_file.isOpen() && !m_file.flush())
+        fail();
+}
+
+// the ticks go on in memory only
+void TickJournal::fail()
+{
+    qWarning() << "[TICKJOURNAL] cannot write" << m_file.fileName() << m_file.errorString();
+    m_lastUnwritten = false;
+    openPaths().remove(m_file.fileName());
+    m_file.close();
+}
+
+const TickRecord &TickJournal::append(double price, TickType tickType)
+{
+    if (m_lastUnwritten)
+        writeLast();
+
+    TickRecord tick;
+    tick.monoNsecs = monotonicNsecs();
+    tick.wallNsecs = wallNsecs();
+    tick.price = price;
+    tick.size = -1;
+    tick.tickType = (quint8)tickType;
+    memset(tick.reserved, 0, sizeof(tick.reserved));
+
+    m_ticks.append(tick);
+    m_lastUnwritten = m_file.isOpen();
+    return m_ticks.last();
+}
+
+bool TickJournal::setLastSize(int size)
+{
+    if (m_ticks.isEmpty() || m_ticks.last().size != -1)
+        return false;
+
+    TickRecord tick = m_ticks.last();
+    tick.size = size;
+    m_ticks.replace(m_ticks.size() - 1, tick);
+
+    if (m_lastUnwritten)
+        writeLast();
+    return true;
+}
+
+void TickJournal::writeLast()
+{
+    const TickRecord & tick = m_ticks.last();
+    m_lastUnwritten = false;
+
+    uchar rec[RECORD_SIZE];
+    qToLittleEndian<qint64>(tick.monoNsecs, rec);
+    qToLittleEndian<qint64>(tick.wallNsecs, rec + 8);
+    quint64 price;
+    memcpy(&price, &tick.price, sizeof(price));
+    qToLittleEndian<quint64>(price, rec + 16);
+    qToLittleEndian<qint32>(tick.size, rec + 24);
+    rec[28] = tick.tickType;
+    memset(rec + 29, 0, 3);
+    if (m_file.write((const char*)rec, RECORD_SIZE) != RECORD_SIZE)
+        fail();
+}
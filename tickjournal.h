@@ -0,0 +1,69 @@
+#ifndef TICKJOURNAL_H
+#define TICKJOURNAL_H
+
+#include "barring.h"
+#include "ibticktype.h"
+
+#include <QFile>
+#include <QString>
+#include <QtGlobal>
+
+// One tick, packed. The monotonic time, from a clock started once per
+// process, orders the ticks; the wall time is read from the system clock
+// per tick, so it follows clock adjustments and suspends but may step.
+struct TickRecord
+{
+    qint64  monoNsecs;      // since the clock started
+    qint64  wallNsecs;      // since the epoch
+    double  price;
+    qint32  size;           // -1 until the size of the tick came
+    quint8  tickType;
+    quint8  reserved[3];
+};
+
+// The latest ticks of a contract in a fixed arena, and optionally all of
+// them in an append-only journal file: a 16 byte header (magic "NKTJ",
+// version, conId) followed by 32 byte records as above, little endian. A
+// tick goes to the file once its size came or the next tick did, so
+// nothing in the file is ever rewritten. A write that fails closes the
+// file, the ticks are only kept in memory from then on.
+class TickJournal
+{
+public:
+    enum { DefaultCapacity = 4096 };
+
+    explicit TickJournal(int capacity = DefaultCapacity);
+    ~TickJournal();
+
+    // appends to path, creating it; fails for a journal of another
+    // contract or one already open in this process
+    bool open(const QString & path, long conId);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+    // hands the records written so far to the system
+    void flush();
+
+    const TickRecord & append(double price, TickType tickType);
+    // sets the size of the last tick, false if it has one already
+    bool setLastSize(int size);
+
+    int  size() const { return m_ticks.size(); }
+    bool isEmpty() const { return m_ticks.isEmpty(); }
+    const TickRecord & at(int i) const { return m_ticks.at(i); }
+    const TickRecord & last() const { return m_ticks.last(); }
+
+    static qint64 monotonicNsecs();
+    static qint64 wallNsecs();
+
+private:
+    Q_DISABLE_COPY(TickJournal)
+
+    void writeLast();
+    void fail();
+
+    BarRing<TickRecord> m_ticks;
+    QFile               m_file;
+    bool                m_lastUnwritten;
+};
+
+#endif // TICKJOURNAL_H